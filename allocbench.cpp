@@ -0,0 +1,131 @@
+/*
+ *	This file is a part of ConfigurableAssemblyIntepreter.
+ *
+ *	ConfigurableAssemblyIntepreter is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ConfigurableAssemblyIntepreter is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+
+#include "bench.h"
+#include "mainLib.h"
+
+#ifndef ALLOCBENCH_CPP
+#define ALLOCBENCH_CPP
+
+// Counts every heap allocation that happens in this program. This is its own binary so
+// main doesn't have to replace operator new to check this
+static std::atomic<long long> heapAllocs{0};
+
+void* operator new(std::size_t size) {
+	heapAllocs.fetch_add(1, std::memory_order_relaxed);
+	if (void *p = malloc(size ? size : 1)) {
+		return p;
+	}
+	throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept {
+	free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept {
+	free(p);
+}
+
+// Every instruction there is, over and over
+static const char *allocsBlockSource = R"ASM(ENVDEF
+size=64
+init=[0,10,7,3,56,0,0,40]
+ENDENVDEF
+inp
+cpt 0
+loop:
+	cpf 0
+	jiz done
+	fill 20 1 2
+	bcp 20 *7 1
+	badd 40 1 3
+	bsum 40 1
+	vadd 20 40 1
+	bfind 8 4 6
+	mov 5 6
+	fadd 6
+	ldacq 0
+	strel 9
+	cas 9 10
+	fence
+	nop
+	dec 0
+	jmp loop
+done:
+out
+end
+)ASM";
+
+// Counts the heap allocations a whole run makes once the Env is set up, which should be none.
+// Each program gets run with both engines and with stats, and the closure engine gets a short run
+// first so compiling the program isn't counted. Returns 1 if anything allocated
+int main(int argc, char *argv[]) {
+	int count = 100000;
+	if (argc > 1) {
+		char *end = nullptr;
+		count = (int)strtol(argv[1], &end, 10);
+		if (*argv[1] == '\0' || *end != '\0' || count <= 0) {
+			fprintf(stderr, "Usage: %s [count]\n", argv[0]);
+			return 1;
+		}
+	}
+	std::string modesEnvdef = "ENVDEF\nsize=272\ninit=[0,0,0,1,16,272]\nENDENVDEF\n";
+	const char *names[4] = { "branches", "loop", "indexed", "block" };
+	std::string sources[4] = { lockstepBenchSource, loopBenchSource, modesEnvdef + modesIndexedSource, allocsBlockSource };
+	const char *modes[3] = { "interp", "closure", "stats" };
+	int result = 0;
+	for (int s = 0; s < 4; s++) {
+		ProgramRef prog;
+		try {
+			prog = loadProgramBuffer(sources[s]);
+		} catch (const CaiError &e) {
+			fprintf(stderr, "Error: %s\n", e.what());
+			return 1;
+		}
+		for (int m = 0; m < 3; m++) {
+			RunStats stats;
+			Env envs[2] = { createInstance(prog), createInstance(prog) };
+			for (Env &env : envs) {
+				env.engine = (m == 1) ? Engine::CLOSURE : Engine::INTERPRETER;
+				env.stats = (m == 2) ? &stats : nullptr;
+				env.input.push_back(s == 2 ? count / 256 + 1 : count);
+				env.input.push_back(count / 3);
+			}
+			long long allocs = 0;
+			try {
+				runSteps(envs[0], 100);
+				allocs = heapAllocs.load();
+				runEnvironment(envs[1]);
+				allocs = heapAllocs.load() - allocs;
+			} catch (const CaiError &e) {
+				fprintf(stderr, "Error: %s\n", e.what());
+				return 1;
+			}
+			printf("  %-8s %-8s %11lld steps %6lld allocations\n", names[s], modes[m], envs[1].steps, allocs);
+			result = (allocs != 0) ? 1 : result;
+		}
+	}
+	return result;
+}
+
+#endif
@@ -0,0 +1,849 @@
+/*
+ *	This file is a part of ConfigurableAssemblyIntepreter.
+ *
+ *	ConfigurableAssemblyIntepreter is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ConfigurableAssemblyIntepreter is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+#include <unistd.h>
+
+#include "bench.h"
+#include "breakpoints.h"
+#include "envpool.h"
+#include "instructions.h"
+#include "lexscan.h"
+#include "linker.h"
+#include "lockstep.h"
+#include "mainLib.h"
+
+#ifndef BENCH_CPP
+#define BENCH_CPP
+
+using BenchClock = std::chrono::steady_clock;
+
+static double secondsSince(BenchClock::time_point start) {
+	return std::chrono::duration<double>(BenchClock::now() - start).count();
+}
+
+// A big made up program, about size bytes of it, with an ENVDEF that has a long init array.
+// It has labels, comments, derefs and blank lines so it looks like a real one
+static std::string makeBenchSource(size_t size) {
+	std::string src = "ENVDEF\nsize=4096\ninit=[";
+	for (int i = 0; i < 4096; i++) {
+		src += std::to_string(i * 7 % 1000);
+		src += (i + 1 < 4096) ? ", " : "]\n";
+	}
+	src += "ENDENVDEF\n";
+	int n = 0;
+	while (src.size() < size) {
+		std::string num = std::to_string(n);
+		src += "loop" + num + ":   // top of block " + num + "\n";
+		src += "\tmov 10 *" + std::to_string(n % 100) + "\n";
+		src += "\tadd 10 " + std::to_string(n % 4000) + "\n";
+		src += "\n";
+		src += "\tout 10 // print it\n";
+		src += "\tjiz loop" + num + "\n";
+		n++;
+	}
+	src += "end\n";
+	return src;
+}
+
+// Lexes src over and over for about a quarter second with one kernel, and prints how fast it went
+static void benchLexKernel(const std::string &src, LexKernel kernel) {
+	LexIndex index;
+	lexSource(src.data(), src.size(), index, kernel);  // Warm up, and so the vectors are already big enough
+	int reps = 0;
+	BenchClock::time_point start = BenchClock::now();
+	double elapsed;
+	do {
+		lexSource(src.data(), src.size(), index, kernel);
+		reps++;
+		elapsed = secondsSince(start);
+	} while (elapsed < 0.25);
+	double gbs = (double)src.size() * reps / elapsed / 1e9;
+	printf("  %-7s %8.3f GB/s  (%zu lines, %zu tokens)\n", lexKernelName(kernel), gbs,
+		index.lines.size(), index.tokens.size());
+}
+
+static int benchLex(const std::vector<std::string> &args) {
+	std::string src;
+	if (!args.empty()) {
+		std::ifstream ifs(args[0], std::ifstream::in | std::ifstream::binary);
+		if (!ifs.is_open()) {
+			fprintf(stderr, "Error: Couldn't open file '%s'\n", args[0].c_str());
+			return 1;
+		}
+		src.assign((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+	} else {
+		src = makeBenchSource(16 << 20);
+	}
+	printf("Lexing %zu bytes (best kernel here is %s)\n", src.size(), lexKernelName(bestLexKernel()));
+	benchLexKernel(src, LexKernel::SCALAR);
+#if defined(__x86_64__) || defined(__i386__)
+	if (__builtin_cpu_supports("sse2")) {
+		benchLexKernel(src, LexKernel::SSE2);
+	}
+	if (__builtin_cpu_supports("avx2")) {
+		benchLexKernel(src, LexKernel::AVX2);
+	}
+#endif
+	
+	// And the whole loader, lexing plus making the Lines
+	BenchClock::time_point start = BenchClock::now();
+	try {
+		ProgramRef prog = loadProgramBuffer(src);
+		double elapsed = secondsSince(start);
+		printf("  load    %8.3f GB/s  (%zu program lines in %.1f ms)\n",
+			(double)src.size() / elapsed / 1e9, prog->lines.size(), elapsed * 1e3);
+	} catch (const CaiError &e) {
+		fprintf(stderr, "Error: %s\n", e.what());
+		return 1;
+	}
+	return 0;
+}
+
+// Counts down from the first input, and adds 1 or 2 to cell 4 each time depending on whether
+// the counter is under the second input. So each lane goes a different way through the branch
+// and loops a different number of times
+const char *const lockstepBenchSource = R"ASM(ENVDEF
+size=8
+init=[0,1,0,0,0,2,0,0]
+ENDENVDEF
+inp
+cpt 2
+inp
+cpt 3
+loop:
+	cpf 2
+	jiz done
+	sub 3
+	jlz small
+	cpf 4
+	add 5
+	cpt 4
+	jmp next
+small:
+	inc 4
+next:
+	dec 2
+	jmp loop
+done:
+cpf 4
+out
+end
+)ASM";
+
+static bool sameResult(const Env &a, const Env &b) {
+	return a.reg == b.reg && a.line == b.line && a.steps == b.steps && a.memory == b.memory &&
+		a.output == b.output && a.input == b.input && a.status == b.status &&
+		a.endProgram == b.endProgram && a.states == b.states;
+}
+
+// Runs the same batch of Envs with runEnvironment one at a time, and then with runLockstep,
+// checks they come out the same and prints how fast each one was
+static int benchLockstep(const std::vector<std::string> &args) {
+	ProgramRef prog;
+	try {
+		prog = (args.size() < 2) ? loadProgramBuffer(lockstepBenchSource) : loadProgramFile(args[1]);
+	} catch (const CaiError &e) {
+		fprintf(stderr, "Error: %s\n", e.what());
+		return 1;
+	}
+	int lanes = args.empty() ? 8 : std::stoi(args[0]);
+	const int count = 1024;
+	std::vector<Env> scalar;
+	scalar.reserve(count);
+	for (int i = 0; i < count; i++) {
+		Env env = createInstance(prog);
+		if (args.size() < 2) {
+			env.input = std::deque<int>{};
+			env.input.push_back(1000 + (i * 37) % 500);
+			env.input.push_back((i * 13) % 700);
+		}
+		scalar.push_back(std::move(env));
+	}
+	std::vector<Env> grouped = scalar;
+
+	BenchClock::time_point start = BenchClock::now();
+	long long totalSteps = 0;
+	try {
+		for (Env &env : scalar) {
+			runEnvironment(env);
+			totalSteps += env.steps;
+		}
+	} catch (const CaiError &e) {
+		fprintf(stderr, "Error: %s\n", e.what());
+		return 1;
+	}
+	double scalarTime = secondsSince(start);
+
+	start = BenchClock::now();
+	runLockstep(grouped, lanes);
+	double lockstepTime = secondsSince(start);
+
+	int mismatches = 0;
+	for (int i = 0; i < count; i++) {
+		if (!sameResult(scalar[i], grouped[i])) {
+			mismatches++;
+		}
+	}
+	printf("%i runs, %lli steps in total\n", count, totalSteps);
+	printf("  runEnvironment    %8.2f ms  %6.2f ns/step\n", scalarTime * 1e3, scalarTime * 1e9 / totalSteps);
+	printf("  runLockstep(%2i)   %8.2f ms  %6.2f ns/step  (%.2fx)\n", lanes, lockstepTime * 1e3,
+		lockstepTime * 1e9 / totalSteps, scalarTime / lockstepTime);
+	if (mismatches != 0) {
+		printf("  %i runs came out different!\n", mismatches);
+		return 1;
+	}
+	return 0;
+}
+
+// Adds up 1..n and 3 * (1..n) the long way, so the loop has two counters and two series in it
+const char *const loopBenchSource = R"ASM(ENVDEF
+size=8
+init=[0,0,0,0,0,3,0,0]
+ENDENVDEF
+inp
+cpt 0
+loop:
+	cpf 0
+	jiz done
+	cpf 1
+	add 0
+	cpt 1
+	mov 0 6
+	cpf 2
+	add 5
+	cpt 2
+	cpf 3
+	add 2
+	cpt 3
+	dec 0
+	jmp loop
+done:
+cpf 1
+out
+cpf 3
+out
+end
+)ASM";
+
+// Runs a program with and without the loop acceleration in loopopt.cpp and checks they match
+static int benchLoop(const std::vector<std::string> &args) {
+	ProgramRef prog;
+	try {
+		prog = (args.size() < 2) ? loadProgramBuffer(loopBenchSource) : loadProgramFile(args[1]);
+	} catch (const CaiError &e) {
+		fprintf(stderr, "Error: %s\n", e.what());
+		return 1;
+	}
+	int trips = args.empty() ? 200000 : std::stoi(args[0]);
+	// The same program with every LOOP_JUMP turned back into a plain jmp
+	std::shared_ptr<Program> plain = std::make_shared<Program>(*prog);
+	for (Line &line : plain->lines) {
+		if (line.operation == Op::LOOP_JUMP) {
+			line.operation = Op::JUMP;
+			line.func = optofunc.at(Op::JUMP);
+			line.arguments.resize(1);
+			line.numArgs = 1;
+		}
+	}
+	plain->loops.clear();
+
+	Env fast = createInstance(prog);
+	Env slow = createInstance(plain);
+	if (args.size() < 2) {
+		fast.input = slow.input = std::deque<int>{};
+		fast.input.push_back(trips);
+		slow.input.push_back(trips);
+	}
+	double times[2];
+	Env *envs[2] = { &slow, &fast };
+	for (int i = 0; i < 2; i++) {
+		BenchClock::time_point start = BenchClock::now();
+		try {
+			runEnvironment(*envs[i]);
+		} catch (const CaiError &e) {
+			fprintf(stderr, "Error: %s\n", e.what());
+			return 1;
+		}
+		times[i] = secondsSince(start);
+	}
+	printf("%zu loop(s) found, %lld steps\n", prog->loops.size(), slow.steps);
+	printf("  plain        %10.3f ms\n", times[0] * 1e3);
+	printf("  accelerated  %10.3f ms  (%.0fx)\n", times[1] * 1e3, times[0] / times[1]);
+	if (!sameResult(fast, slow)) {
+		printf("  The results came out different!\n");
+		return 1;
+	}
+	return 0;
+}
+
+// Runs a program once with each engine and checks they come out the same. With no file it's
+// the lockstep benchmark's program, counting down from "count" so it doesn't need much input
+static int benchEngines(const std::vector<std::string> &args) {
+	ProgramRef prog;
+	try {
+		prog = (args.size() < 2) ? loadProgramBuffer(lockstepBenchSource) : loadProgramFile(args[1]);
+	} catch (const CaiError &e) {
+		fprintf(stderr, "Error: %s\n", e.what());
+		return 1;
+	}
+	int count = args.empty() ? 200000 : std::stoi(args[0]);
+	const Engine engines[2] = { Engine::INTERPRETER, Engine::CLOSURE };
+	Env envs[2];
+	double times[2];
+	for (int i = 0; i < 2; i++) {
+		envs[i] = createInstance(prog);
+		envs[i].engine = engines[i];
+		if (args.size() < 2) {
+			envs[i].input = std::deque<int>{};
+			envs[i].input.push_back(count);
+			envs[i].input.push_back(count / 3);
+		}
+		BenchClock::time_point start = BenchClock::now();
+		try {
+			runEnvironment(envs[i]);
+		} catch (const CaiError &e) {
+			fprintf(stderr, "Error: %s\n", e.what());
+			return 1;
+		}
+		times[i] = secondsSince(start);
+	}
+	printf("%lld steps\n", envs[0].steps);
+	for (int i = 0; i < 2; i++) {
+		printf("  %-8s %10.2f ms  %7.2f ns/step  (%.2fx)\n", engineName(engines[i]), times[i] * 1e3,
+			times[i] * 1e9 / envs[i].steps, times[0] / times[i]);
+	}
+	if (!sameResult(envs[0], envs[1])) {
+		printf("  The results came out different!\n");
+		return 1;
+	}
+	return 0;
+}
+
+// Times the counters being off against them not being there at all(see stats.h). A hand written
+// loop of iterateOnce is the interpreter with no counting in it at all, which runSteps without stats
+// should take as long as. Each one is run 5 times and the fastest time is kept, and all three have to
+// end up with the same state and step count. That the stats off loop has no counting in it is
+// checked when mainLib.cpp compiles, not here
+static int benchStats(const std::vector<std::string> &args) {
+	ProgramRef prog;
+	try {
+		prog = (args.size() < 2) ? loadProgramBuffer(lockstepBenchSource) : loadProgramFile(args[1]);
+	} catch (const CaiError &e) {
+		fprintf(stderr, "Error: %s\n", e.what());
+		return 1;
+	}
+	int count = args.empty() ? 200000 : std::stoi(args[0]);
+	const char *names[3] = { "no counters", "stats off", "stats on" };
+	Env envs[3];
+	double times[3] = { 1e30, 1e30, 1e30 };
+	RunStats stats;
+	for (int rep = 0; rep < 5; rep++) {
+		for (int i = 0; i < 3; i++) {
+			envs[i] = createInstance(prog);
+			envs[i].engine = Engine::INTERPRETER;
+			envs[i].limits = RunLimits();
+			if (args.size() < 2) {
+				envs[i].input = std::deque<int>{};
+				envs[i].input.push_back(count);
+				envs[i].input.push_back(count / 3);
+			}
+			stats = RunStats();
+			envs[i].stats = (i == 2) ? &stats : nullptr;
+			BenchClock::time_point start = BenchClock::now();
+			try {
+				if (i == 0) {
+					Env &env = envs[i];
+					while (!env.endProgram && !env.states[IS_END] && env.status == RunStatus::RUNNING) {
+						iterateOnce(env);
+					}
+					env.status = RunStatus::ENDED;
+				} else {
+					runEnvironment(envs[i]);
+				}
+			} catch (const CaiError &e) {
+				fprintf(stderr, "Error: %s\n", e.what());
+				return 1;
+			}
+			times[i] = std::min(times[i], secondsSince(start));
+		}
+	}
+	envs[2].stats = nullptr;
+	printf("%lld steps\n", envs[0].steps);
+	for (int i = 0; i < 3; i++) {
+		printf("  %-12s %10.2f ms  %7.2f ns/step  (%.3fx)\n", names[i], times[i] * 1e3,
+			times[i] * 1e9 / envs[i].steps, times[i] / times[0]);
+	}
+	if (!sameResult(envs[0], envs[1]) || !sameResult(envs[0], envs[2])) {
+		printf("  The results came out different!\n");
+		return 1;
+	}
+	printf("%s", statsJson(&stats, &prog->loadTimes).c_str());
+	return 0;
+}
+
+// Checks breakpoints cost nothing on the lines they aren't on(see breakpoints.h). With each
+// engine it runs the lockstep benchmark's program with none, with a breakpoint after the loop
+// and a watchpoint on a cell nothing writes, and with a breakpoint in the loop that never stops
+static int benchBreakpoints(const std::vector<std::string> &args) {
+	ProgramRef prog;
+	try {
+		prog = loadProgramBuffer(lockstepBenchSource);
+	} catch (const CaiError &e) {
+		fprintf(stderr, "Error: %s\n", e.what());
+		return 1;
+	}
+	int count = args.empty() ? 200000 : std::stoi(args[0]);
+	const Engine engines[2] = { Engine::INTERPRETER, Engine::CLOSURE };
+	const char *names[3] = { "none", "outside loop", "in loop" };
+	Env first;
+	for (int e = 0; e < 2; e++) {
+		printf("%s\n", engineName(engines[e]));
+		double times[3] = { 1e30, 1e30, 1e30 };
+		Env envs[3];
+		for (int rep = 0; rep < 5; rep++) {
+			for (int i = 0; i < 3; i++) {
+				Breakpoints bp;
+				envs[i] = createInstance(prog);
+				envs[i].engine = engines[e];
+				envs[i].input = std::deque<int>{};
+				envs[i].input.push_back(count);
+				envs[i].input.push_back(count / 3);
+				try {
+					if (i == 1) {
+						addBreakpoint(bp, breakpointLine(*prog, "done"));
+						addWatchpoint(bp, 7);
+					} else if (i == 2) {
+						addBreakpoint(bp, breakpointLine(*prog, "loop"), parseBreakCondition("reg < #-1"));
+					}
+					armBreakpoints(envs[i], bp);
+					BenchClock::time_point start = BenchClock::now();
+					// The one after the loop stops once
+					while (runSteps(envs[i], -1) == RunStatus::BREAKPOINT) {}
+					times[i] = std::min(times[i], secondsSince(start));
+				} catch (const CaiError &e) {
+					fprintf(stderr, "Error: %s\n", e.what());
+					return 1;
+				}
+				disarmBreakpoints(envs[i]);
+			}
+		}
+		for (int i = 0; i < 3; i++) {
+			printf("  %-12s %10.2f ms  %7.2f ns/step  (%.3fx)\n", names[i], times[i] * 1e3,
+				times[i] * 1e9 / envs[i].steps, times[i] / times[0]);
+			if (e == 0 && i == 0) {
+				first = envs[0];
+			} else if (!sameResult(first, envs[i])) {
+				printf("  The results came out different!\n");
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+// Summing an array of 256 cells, "reps" times over. The plain way walks a pointer in cell 1
+// up to the end address in cell 5
+static const char *modesPlainSource = R"ASM(inp
+cpt 0
+outer:
+	cpf 0
+	jiz done
+	cpf 4
+	cpt 1
+inner:
+	cpf 1
+	sub 5
+	jiz next
+	cpf 2
+	add *1
+	cpt 2
+	inc 1
+	jmp inner
+next:
+	dec 0
+	jmp outer
+done:
+cpf 2
+out
+end
+)ASM";
+
+// And with an indexed argument, counting cell 1 up from -256 to 0 so the array is at [272+*1]
+const char *const modesIndexedSource = R"ASM(inp
+cpt 0
+outer:
+	cpf 0
+	jiz done
+	cpf #-256
+	cpt 1
+inner:
+	cpf 2
+	add [272+*1]
+	cpt 2
+	inc 1
+	cpf 1
+	jlz inner
+	dec 0
+	jmp outer
+done:
+cpf 2
+out
+end
+)ASM";
+
+// And with the sum and the number of reps left in registers, so the acc only has the index
+static const char *modesRegisterSource = R"ASM(inp
+cpt r0
+outer:
+	jiz r0 done
+	mov #-256 1
+inner:
+	add [272+*1] r2
+	inc 1
+	cpf 1
+	jlz inner
+	dec r0
+	jmp outer
+done:
+cpf r2
+out
+end
+)ASM";
+
+// Runs the array sum written each way with both engines, to see what the addressing modes and registers save
+static int benchModes(const std::vector<std::string> &args) {
+	int reps = args.empty() ? 2000 : std::stoi(args[0]);
+	std::string envdef = "ENVDEF\nsize=272\nregisters=3\ninit=[0,0,0,1,16,272";
+	for (int i = 6; i < 272; i++) {
+		envdef += "," + std::to_string(i < 16 ? 0 : i % 7);
+	}
+	envdef += "]\nENDENVDEF\n";
+	const char *names[3] = { "plain", "indexed", "register" };
+	const char *sources[3] = { modesPlainSource, modesIndexedSource, modesRegisterSource };
+	const Engine engines[2] = { Engine::INTERPRETER, Engine::CLOSURE };
+	Env first;
+	for (int s = 0; s < 3; s++) {
+		ProgramRef prog;
+		try {
+			prog = loadProgramBuffer(envdef + sources[s]);
+		} catch (const CaiError &e) {
+			fprintf(stderr, "Error: %s\n", e.what());
+			return 1;
+		}
+		for (int i = 0; i < 2; i++) {
+			Env env = createInstance(prog);
+			env.engine = engines[i];
+			env.input.push_back(reps);
+			BenchClock::time_point start = BenchClock::now();
+			try {
+				runEnvironment(env);
+			} catch (const CaiError &e) {
+				fprintf(stderr, "Error: %s\n", e.what());
+				return 1;
+			}
+			double time = secondsSince(start);
+			printf("  %-8s %-8s %11lld steps %10.2f ms\n", names[s], engineName(engines[i]), env.steps, time * 1e3);
+			if (s == 0 && i == 0) {
+				first = env;
+			} else if (env.output != first.output) {
+				printf("  The results came out different!\n");
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+// Writes a memory image as a .bin and as text, and times loading each of them with init_file=
+// against just copying that much memory
+static int benchInitFile(const std::vector<std::string> &args) {
+	const size_t cells = args.empty() ? 100000000 : std::stoull(args[0]);
+	std::vector<int> image(cells);
+	for (size_t i = 0; i < cells; i++) {
+		image[i] = (int)(i * 2654435761u);
+	}
+	const std::string base = "/tmp/cai-bench-init-" + std::to_string(getpid());
+	const std::string paths[2] = { base + ".bin", base + ".txt" };
+	{
+		std::ofstream bin(paths[0], std::ofstream::binary);
+		bin.write((const char*)image.data(), (std::streamsize)(cells * sizeof(int)));
+		std::ofstream txt(paths[1]);
+		std::string text;
+		for (size_t i = 0; i < cells; i++) {
+			text += std::to_string(image[i]);
+			text += '\n';
+			if (text.size() > (1 << 20)) {
+				txt << text;
+				text.clear();
+			}
+		}
+		txt << text;
+	}
+
+	BenchClock::time_point start = BenchClock::now();
+	std::vector<int> copy(cells);
+	memcpy(copy.data(), image.data(), cells * sizeof(int));
+	double copyTime = secondsSince(start);
+	printf("%zu cells(%.1f MB)\n", cells, cells * sizeof(int) / 1e6);
+	printf("  memcpy       %8.1f ms\n", copyTime * 1e3);
+
+	int result = 0;
+	for (int i = 0; i < 2; i++) {
+		std::string src = "ENVDEF\ninit_file=" + paths[i] + "\nENDENVDEF\nend\n";
+		start = BenchClock::now();
+		try {
+			ProgramRef prog = loadProgramBuffer(src, "");
+			double elapsed = secondsSince(start);
+			printf("  %s  %8.1f ms  (%.2fx memcpy)\n", i == 0 ? "init_file .bin" : "init_file text",
+				elapsed * 1e3, elapsed / copyTime);
+			if (prog->config.initialMemory != image) {
+				printf("  It didn't load the same numbers!\n");
+				result = 1;
+			}
+		} catch (const CaiError &e) {
+			fprintf(stderr, "Error: %s\n", e.what());
+			result = 1;
+		}
+		remove(paths[i].c_str());
+	}
+	return result;
+}
+
+// Writes a module for benchLink. Module k is "lines" lines of incrementing cell 1 with a label
+// every few lines, and then it jumps on to module k + 1(or back to the main program)
+static void writeBenchModule(const std::string &path, int k, int count, int lines, bool edited) {
+	std::string src = "EXPORT entry" + std::to_string(k) + "\n";
+	std::string next = (k + 1 < count) ? "entry" + std::to_string(k + 1) : "back";
+	src += "IMPORT " + next + "\nentry" + std::to_string(k) + ":\n";
+	for (int i = 0; i < lines; i++) {
+		src += (i % 8 == 0) ? "l" + std::to_string(i) + ": // a label\n" : "\tinc 1\n";
+	}
+	if (edited) {
+		src += "\tinc 1\n";
+	}
+	src += "\tjmp " + next + "\n";
+	std::ofstream(path) << src;
+}
+
+// Times loading a program made of lots of modules: from nothing, from the .caio files, from
+// what's already in memory, and after one module changes
+static int benchLink(const std::vector<std::string> &args) {
+	const int count = args.empty() ? 64 : std::stoi(args[0]);
+	const int lines = args.size() < 2 ? 20000 : std::stoi(args[1]);
+	const std::string dir = "/tmp/cai-bench-link-" + std::to_string(getpid());
+	std::filesystem::create_directories(dir);
+	std::string main = "ENVDEF\nsize=4\nENDENVDEF\nEXPORT back\nIMPORT entry0\n";
+	for (int k = 0; k < count; k++) {
+		writeBenchModule(dir + "/mod" + std::to_string(k) + ".asm", k, count, lines, false);
+		main += "MODULE mod" + std::to_string(k) + ".asm\n";
+	}
+	main += "jmp entry0\nback:\ncpf 1\nout\n";
+	std::ofstream(dir + "/main.asm") << main;
+	printf("%i modules of %i lines\n", count, lines);
+
+	const char *names[4] = { "no .caio", "from .caio", "in memory", "one edited" };
+	int result = 0;
+	std::deque<int> firstOutput;
+	for (int i = 0; i < 4; i++) {
+		if (i == 3) {
+			writeBenchModule(dir + "/mod0.asm", 0, count, lines, true);
+		}
+		if (i != 2) {
+			forgetLoadedModules();
+		}
+		ModuleCacheStats before = moduleCacheStats();
+		BenchClock::time_point start = BenchClock::now();
+		try {
+			ProgramRef prog = loadProgramFile(dir + "/main.asm");
+			double elapsed = secondsSince(start);
+			ModuleCacheStats after = moduleCacheStats();
+			printf("  %-10s %9.2f ms  %3lli parsed, %3lli from .caio, %3lli in memory\n", names[i], elapsed * 1e3,
+				after.parsed - before.parsed, after.fromObject - before.fromObject, after.fromMemory - before.fromMemory);
+			Env env = createInstance(prog);
+			runEnvironment(env);
+			if (i == 0) {
+				firstOutput = env.output;
+			} else if (env.output.front() != firstOutput.front() + (i == 3 ? 1 : 0)) {
+				printf("  The results came out different!\n");
+				result = 1;
+			}
+		} catch (const CaiError &e) {
+			fprintf(stderr, "Error: %s\n", e.what());
+			result = 1;
+			break;
+		}
+	}
+	std::error_code ec;
+	std::filesystem::remove_all(dir, ec);
+	return result;
+}
+
+// A program of about "lines" lines where only the first few and the last few ever run, like a
+// big generated one where most of it is for inputs this run doesn't get
+static std::string makeLazySource(int lines, bool lazy) {
+	std::string src = "ENVDEF\nsize=4096\n";
+	src += lazy ? "lazy=yes\n" : "";
+	src += "ENDENVDEF\ninp\ncpt 1\njmp done\n";
+	for (int i = 0; i < lines; i++) {
+		std::string num = std::to_string(i);
+		src += (i % 16 == 0) ? "case" + num + ":\n" : "";
+		src += "\tadd [16+*" + std::to_string(i % 8) + "] // case " + num + "\n";
+		src += "\tjiz case" + std::to_string(i / 16 * 16) + "\n";
+	}
+	src += "done:\n\tcpf 1\n\tadd #1\n\tout\n";
+	return src;
+}
+
+// Times how long it takes from having the source to the first instruction running, and to the
+// end of a run that only uses a few lines, with every line decoded up front and with lazy=yes
+static int benchLazy(const std::vector<std::string> &args) {
+	const int most = args.empty() ? 1000000 : std::stoi(args[0]);
+	int result = 0;
+	for (int lines = std::max(1, most / 100); lines <= most; lines *= 10) {
+		int outputs[2] = { 0, 0 };
+		for (int lazy = 0; lazy < 2; lazy++) {
+			std::string src = makeLazySource(lines, lazy == 1);
+			try {
+				BenchClock::time_point start = BenchClock::now();
+				ProgramRef prog = loadProgramBuffer(std::move(src));
+				const double load = secondsSince(start);
+				Env env = createInstance(prog);
+				pushInput(env, 41);
+				runSteps(env, 1);
+				const double first = secondsSince(start);
+				runEnvironment(env);
+				const double done = secondsSince(start);
+				outputs[lazy] = env.output.empty() ? 0 : env.output.front();
+				printf("  %8i lines %-6s load %9.2f ms  first step %9.2f ms  done %9.2f ms\n", lines * 2,
+					lazy ? "lazy" : "eager", load * 1e3, first * 1e3, done * 1e3);
+			} catch (const CaiError &e) {
+				fprintf(stderr, "Error: %s\n", e.what());
+				return 1;
+			}
+		}
+		if (outputs[0] != 42 || outputs[1] != 42) {
+			printf("  The results came out different!\n");
+			result = 1;
+		}
+	}
+	return result;
+}
+
+// A short run over a big memory that only touches a few cells of it: the input, a counting loop,
+// a cell half way through and a fill near the end
+static std::string poolBenchSource(int cells) {
+	const std::string half = std::to_string(cells / 2);
+	const std::string late = std::to_string(cells - 8);
+	return "ENVDEF\nsize=" + std::to_string(cells) + "\ninit=[5, 7]\nENDENVDEF\n"
+		"inp\ncpt 2\nadd 1\ncpt 3\ninc " + half + "\ncpf " + half + "\nadd 3\nout\n"
+		"cpf #20\ncpt 9\nloop:\ncpf 9\njiz done\nadd #-1\ncpt 9\ninc 8\njmp loop\ndone:\ncpf 8\nout\n"
+		"fill " + late + " #4 #9\nbsum " + late + " #4\nadd " + late + "\nout\n";
+}
+
+// Times runs that each get a new Env against runs that reuse one from an EnvPool, with both engines
+static int benchPool(const std::vector<std::string> &args) {
+	const int cells = args.empty() ? 4000000 : std::stoi(args[0]);
+	const int runs = args.size() < 2 ? 1000 : std::stoi(args[1]);
+	ProgramRef prog;
+	try {
+		prog = loadProgramBuffer(poolBenchSource(cells));
+	} catch (const CaiError &e) {
+		fprintf(stderr, "Error: %s\n", e.what());
+		return 1;
+	}
+	printf("%i runs over %i cells(%.1f MB)\n", runs, cells, cells * sizeof(int) / 1e6);
+	const Engine engines[2] = { Engine::INTERPRETER, Engine::CLOSURE };
+	std::deque<int> expected;
+	int result = 0;
+	for (int e = 0; e < 2; e++) {
+		for (int pooled = 0; pooled < 2; pooled++) {
+			EnvPool pool;
+			initEnvPool(pool, prog);
+			bool same = true;
+			BenchClock::time_point start = BenchClock::now();
+			try {
+				for (int i = 0; i < runs; i++) {
+					PooledEnv *p = pooled ? &acquireEnv(pool) : nullptr;
+					Env fresh = pooled ? Env() : createInstance(prog);
+					Env &env = pooled ? p->env : fresh;
+					env.engine = engines[e];
+					pushInput(env, i);
+					runEnvironment(env);
+					if (e == 0 && pooled == 0 && i == 0) {
+						expected = env.output;
+						expected.front() -= i;
+					}
+					same = same && env.output.size() == expected.size() && env.output.front() == expected.front() + i &&
+						std::equal(env.output.begin() + 1, env.output.end(), expected.begin() + 1);
+					if (pooled) {
+						releaseEnv(pool, *p);
+					}
+				}
+			} catch (const CaiError &err) {
+				fprintf(stderr, "Error: %s\n", err.what());
+				return 1;
+			}
+			const double time = secondsSince(start);
+			printf("  %-8s %-7s %9.2f us a run", engineName(engines[e]), pooled ? "pool" : "new", time * 1e6 / runs);
+			if (pooled) {
+				printf("  (%lli made, %.1f pages put back a run)", pool.made, (double)pool.pagesRestored / runs);
+			}
+			printf("\n");
+			if (!same) {
+				printf("  The results came out different!\n");
+				result = 1;
+			}
+		}
+	}
+	return result;
+}
+
+int runBench(const std::string &name, const std::vector<std::string> &args) {
+	if (name == "lex") {
+		return benchLex(args);
+	} else if (name == "lockstep") {
+		return benchLockstep(args);
+	} else if (name == "loop") {
+		return benchLoop(args);
+	} else if (name == "engines") {
+		return benchEngines(args);
+	} else if (name == "initfile") {
+		return benchInitFile(args);
+	} else if (name == "modes") {
+		return benchModes(args);
+	} else if (name == "link") {
+		return benchLink(args);
+	} else if (name == "stats") {
+		return benchStats(args);
+	} else if (name == "breakpoints") {
+		return benchBreakpoints(args);
+	} else if (name == "lazy") {
+		return benchLazy(args);
+	} else if (name == "pool") {
+		return benchPool(args);
+	}
+	fprintf(stderr, "Error: Unknown benchmark '%s', the benchmarks are: lex, lockstep, loop, engines, initfile, modes, link, stats, breakpoints, lazy, pool\n", name.c_str());
+	return 1;
+}
+
+#endif
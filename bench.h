@@ -0,0 +1,33 @@
+// -*- grammar-ext: .cpp -*-
+/*
+ *	This file is a part of ConfigurableAssemblyIntepreter.
+ *
+ *	ConfigurableAssemblyIntepreter is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ConfigurableAssemblyIntepreter is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <string>
+#include <vector>
+
+#ifndef BENCH_H
+#define BENCH_H
+
+// Benchmarks for "main --bench <name> [args]". These only get linked into main(and allocbench), not libcai.
+// Returns what main should return
+int runBench(const std::string &name, const std::vector<std::string> &args);
+
+// Some of the programs the benchmarks run, which allocbench runs too
+extern const char *const lockstepBenchSource;
+extern const char *const loopBenchSource;
+extern const char *const modesIndexedSource;
+
+#endif
@@ -0,0 +1,316 @@
+/*
+ *	This file is a part of ConfigurableAssemblyIntepreter.
+ *
+ *	ConfigurableAssemblyIntepreter is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ConfigurableAssemblyIntepreter is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+
+#include "breakpoints.h"
+#include "stringops.h"
+
+#ifndef BREAKPOINTS_CPP
+#define BREAKPOINTS_CPP
+
+static BreakValue parseBreakValue(const std::string &text, const std::string &whole) {
+	if (text.empty()) {
+		throw CaiError(CaiErrc::BAD_ARGUMENT, "Condition '" + whole + "' is missing a value");
+	}
+	if (text == "reg" || text == "acc") {
+		return BreakValue{ true, Arg{ 0, 0 } };
+	}
+	return BreakValue{ false, interpretArg(text) };
+}
+
+BreakCondition parseBreakCondition(const std::string &text) {
+	BreakCondition cond;
+	cond.text = trim(text);
+	if (cond.text.empty()) {
+		return cond;
+	}
+	size_t start = 0;
+	while (start <= cond.text.size()) {
+		size_t end = cond.text.find("&&", start);
+		if (end == std::string::npos) {
+			end = cond.text.size();
+		}
+		std::string term = cond.text.substr(start, end - start);
+		// Nothing in an argument is one of these, so the first one is the comparison
+		size_t at = term.find_first_of("=!<>");
+		if (at == std::string::npos) {
+			throw CaiError(CaiErrc::BAD_ARGUMENT, "Condition '" + trim(term) + "' doesn't compare anything");
+		}
+		size_t len = (at + 1 < term.size() && term[at + 1] == '=') ? 2 : 1;
+		std::string op = term.substr(at, len);
+		BreakCompare cmp;
+		if (op == "==")      { cmp = BreakCompare::EQ; }
+		else if (op == "!=") { cmp = BreakCompare::NE; }
+		else if (op == "<")  { cmp = BreakCompare::LT; }
+		else if (op == "<=") { cmp = BreakCompare::LE; }
+		else if (op == ">")  { cmp = BreakCompare::GT; }
+		else if (op == ">=") { cmp = BreakCompare::GE; }
+		else {
+			throw CaiError(CaiErrc::BAD_ARGUMENT, "Condition '" + trim(term) + "' has an unknown comparison '" + op + "'");
+		}
+		cond.terms.push_back(BreakTerm{
+			parseBreakValue(trim(term.substr(0, at)), cond.text),
+			cmp,
+			parseBreakValue(trim(term.substr(at + len)), cond.text)
+		});
+		start = end + 2;
+	}
+	return cond;
+}
+
+int breakpointLine(const Program &prog, const std::string &where) {
+	int line = -1;
+	const int label = findLabel(prog, where);
+	if (label >= 0) {
+		line = label;
+	} else {
+		size_t pos = 0;
+		try {
+			line = std::stoi(where, &pos);
+		} catch (const std::logic_error &e) {
+			pos = 0;
+		}
+		if (pos == 0 || pos != where.size()) {
+			throw CaiError(CaiErrc::UNKNOWN_LABEL, "'" + where + "' isn't a line or a label");
+		}
+	}
+	// Blank lines and labels don't do anything, so stop at whatever comes after them
+	while (line >= 0 && hasLine(prog, line) &&
+		(fetchLine(prog, line).operation == Op::NO_INSTRUCTION || fetchLine(prog, line).operation == Op::LABEL)) {
+		line++;
+	}
+	if (line < 0 || !hasLine(prog, line)) {
+		throw CaiError(CaiErrc::BAD_ARGUMENT, "There's no instruction at or after '" + where + "' to stop at");
+	}
+	return line;
+}
+
+int addBreakpoint(Breakpoints &bp, int line, const BreakCondition &cond) {
+	bp.breaks.push_back(Breakpoint{ bp.nextId, line, cond });
+	return bp.nextId++;
+}
+
+int addWatchpoint(Breakpoints &bp, int addr, const BreakCondition &cond) {
+	bp.watches.push_back(Watchpoint{ bp.nextId, addr, cond });
+	return bp.nextId++;
+}
+
+bool removeBreakpoint(Breakpoints &bp, int id) {
+	size_t before = bp.breaks.size() + bp.watches.size();
+	bp.breaks.erase(std::remove_if(bp.breaks.begin(), bp.breaks.end(),
+		[id](const Breakpoint &b) { return b.id == id; }), bp.breaks.end());
+	bp.watches.erase(std::remove_if(bp.watches.begin(), bp.watches.end(),
+		[id](const Watchpoint &w) { return w.id == id; }), bp.watches.end());
+	return bp.breaks.size() + bp.watches.size() != before;
+}
+
+static int breakValue(const Env &env, const BreakValue &v) {
+	return v.reg ? env.reg : peekArg(env, v.arg);
+}
+
+static bool holds(const Env &env, const BreakCondition &cond) {
+	for (const BreakTerm &t : cond.terms) {
+		int a = breakValue(env, t.left);
+		int b = breakValue(env, t.right);
+		bool ok = false;
+		switch (t.cmp) {
+			case BreakCompare::EQ: ok = a == b; break;
+			case BreakCompare::NE: ok = a != b; break;
+			case BreakCompare::LT: ok = a <  b; break;
+			case BreakCompare::LE: ok = a <= b; break;
+			case BreakCompare::GT: ok = a >  b; break;
+			case BreakCompare::GE: ok = a >= b; break;
+		}
+		if (!ok) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Hands a hit to onHit. True if the run has to stop
+static bool reportHit(Env &env, Breakpoints &bp, const BreakHit &hit) {
+	bp.lastHit = hit;
+	BreakAction action = bp.onHit ? bp.onHit(env, hit) : BreakAction::STOP;
+	if (action == BreakAction::STOP && env.status == RunStatus::RUNNING) {
+		env.status = RunStatus::BREAKPOINT;
+		return true;
+	}
+	return false;
+}
+
+// The func every line with a breakpoint or a watchpoint on it gets
+static void breakLine(Env &env, const std::vector<Arg> &args) {
+	Breakpoints &bp = *env.breakpoints;
+	const int line = env.line;
+	const long long stepsBefore = env.steps;
+	if (bp.breakAt[line] && !(line == bp.skipLine && env.steps == bp.skipSteps)) {
+		bp.skipLine = -1;
+		for (Breakpoint &b : bp.breaks) {
+			if (b.line != line || !holds(env, b.cond)) {
+				continue;
+			}
+			b.hits++;
+			if (reportHit(env, bp, BreakHit{ false, b.id, line, -1, env.reg, env.reg })) {
+				bp.skipLine = line;
+				bp.skipSteps = env.steps;
+				return;
+			}
+		}
+		if (env.line != line) {
+			return;  // onHit moved it somewhere else, so that's where it carries on from
+		}
+	}
+	const bool watching = bp.watchAt[line];
+	if (watching) {
+		for (size_t i = 0; i < bp.watches.size(); i++) {
+			bp.before[i] = env.memory[bp.watches[i].addr];
+		}
+	}
+	bp.funcs[line](env, args);
+	// A line that blocked(an inp with no input) runs again once it's resumed, and it mustn't stop
+	// again then. Anything else means it's been gotten past
+	const bool blocked = env.line == line && env.steps == stepsBefore &&
+		(env.status == RunStatus::BLOCKED_INPUT || env.status == RunStatus::BLOCKED_OUTPUT);
+	if (!blocked) {
+		bp.skipLine = -1;
+	}
+	if (!watching) {
+		return;
+	}
+	for (size_t i = 0; i < bp.watches.size(); i++) {
+		Watchpoint &w = bp.watches[i];
+		const int now = env.memory[w.addr];
+		if (now == bp.before[i] || !holds(env, w.cond)) {
+			continue;
+		}
+		w.hits++;
+		if (reportHit(env, bp, BreakHit{ true, w.id, line, w.addr, bp.before[i], now })) {
+			return;
+		}
+	}
+}
+
+// Whether the argument a line writes to could be one of the watched cells
+static bool mayWriteCell(const std::vector<Arg> &args, int i, const std::vector<Watchpoint> &watches) {
+	if (i >= (int)args.size() || args[i].mode == ArgMode::IMMEDIATE) {
+		return false;  // It'll throw instead
+	}
+	if (args[i].mode == ArgMode::REGISTER) {
+		return false;
+	}
+	if (args[i].mode == ArgMode::INDEXED || args[i].derefLevel > 0) {
+		return true;
+	}
+	for (const Watchpoint &w : watches) {
+		if (w.addr == args[i].value) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool mayWrite(const Line &line, const std::vector<Watchpoint> &watches) {
+	if (watches.empty()) {
+		return false;
+	}
+	switch (line.operation) {
+		case Op::MOV:
+			return mayWriteCell(line.arguments, 1, watches);
+		case Op::COPY_TO: case Op::INC: case Op::DEC:
+		case Op::FETCH_ADD: case Op::COMPARE_SWAP: case Op::STORE_RELEASE:
+			return mayWriteCell(line.arguments, 0, watches);
+		case Op::NOP: case Op::NO_INSTRUCTION: case Op::LABEL: case Op::COPY_FROM: case Op::ADD:
+		case Op::SUB: case Op::JUMP: case Op::JUMP_IF_ZERO: case Op::JUMP_IF_NEGATIVE:
+		case Op::INP: case Op::OUT: case Op::END: case Op::BLOCK_SUM: case Op::BLOCK_FIND:
+		case Op::LOOP_JUMP: case Op::LOAD_ACQUIRE: case Op::FENCE: case Op::BARRIER:
+			return false;  // A sped up loop only writes what the lines in it do
+		default:
+			return true;   // The block instructions and anything custom
+	}
+}
+
+void armBreakpoints(Env &env, Breakpoints &bp) {
+	disarmBreakpoints(env);
+	if (env.group != nullptr) {
+		throw CaiError(CaiErrc::BAD_CONFIG, "Programs with threads can't have breakpoints");
+	}
+	if (bp.breaks.empty() && bp.watches.empty()) {
+		return;
+	}
+	ProgramRef before = env.program;
+	env.program = decodedProgram(env.program);  // A lazy program gets copied with every line in it
+	const Program &prog = *env.program;
+	const int size = (int)prog.lines.size();
+	for (const Breakpoint &b : bp.breaks) {
+		if (b.line < 0 || b.line >= size) {
+			throw CaiError(CaiErrc::BAD_ARGUMENT, "Breakpoint " + std::to_string(b.id) + " is on line " +
+				std::to_string(b.line) + ", which isn't in the program");
+		}
+	}
+	for (const Watchpoint &w : bp.watches) {
+		if (w.addr < 0 || w.addr >= (int)env.memory.size()) {
+			throw CaiError(CaiErrc::BAD_ARGUMENT, "Watchpoint " + std::to_string(w.id) + " is on cell " +
+				std::to_string(w.addr) + ", which is outside of memory");
+		}
+	}
+	bp.breakAt.assign(size, 0);
+	bp.watchAt.assign(size, 0);
+	bp.funcs.resize(size);
+	bp.before.resize(bp.watches.size());
+	bp.skipLine = -1;
+	for (const Breakpoint &b : bp.breaks) {
+		bp.breakAt[b.line] = 1;
+	}
+	std::shared_ptr<Program> copy = std::make_shared<Program>(prog);
+	for (int i = 0; i < size; i++) {
+		bp.funcs[i] = prog.lines[i].func;
+		bp.watchAt[i] = mayWrite(prog.lines[i], bp.watches);
+	}
+	// A sped up loop doesn't run its lines one at a time, so any with something on them
+	// have to go back to being a normal loop
+	for (const CountedLoop &loop : prog.loops) {
+		for (int i = loop.head; i <= loop.back; i++) {
+			if (bp.breakAt[i] || bp.watchAt[i]) {
+				copy->lines[loop.back].func = jmp;
+				bp.funcs[loop.back] = jmp;
+				break;
+			}
+		}
+	}
+	for (int i = 0; i < size; i++) {
+		if (bp.breakAt[i] || bp.watchAt[i]) {
+			copy->lines[i].func = breakLine;
+		}
+	}
+	bp.original = before;
+	env.program = copy;
+	env.breakpoints = &bp;
+}
+
+void disarmBreakpoints(Env &env) {
+	if (env.breakpoints == nullptr) {
+		return;
+	}
+	if (env.breakpoints->original != nullptr) {
+		env.program = env.breakpoints->original;
+		env.breakpoints->original.reset();
+	}
+	env.breakpoints = nullptr;
+}
+
+#endif
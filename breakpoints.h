@@ -0,0 +1,130 @@
+// -*- grammar-ext: .cpp -*-
+/*
+ *	This file is a part of ConfigurableAssemblyIntepreter.
+ *
+ *	ConfigurableAssemblyIntepreter is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ConfigurableAssemblyIntepreter is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "instructions.h"
+#include "mainLib.h"
+
+#ifndef BREAKPOINTS_H
+#define BREAKPOINTS_H
+
+// Breakpoints on lines and watchpoints on memory cells, for normal runs through runSteps with
+// either engine. Nothing in runSteps or the engines knows about them. armBreakpoints gives the
+// Env its own copy of the program where only the lines that need it have their func swapped for
+// one that checks first(a breakpoint) or compares the watched cells after(a watchpoint), and
+// the closure engine sends any line with a func it doesn't know to that func. So every other
+// line runs exactly like it would without them, and a run without any doesn't do anything extra.
+//
+// A watchpoint only goes on lines that could change its cell: "cpt 5" can only write cell 5, but
+// "cpt *5", the block instructions and custom instructions could write anywhere. A sped up loop
+// (see loopopt.h) with any of those lines in it goes back to being a plain loop.
+//
+// A breakpoint stops before its line runs, and a watchpoint after the line that changed its cell.
+// Either way the hit goes to Breakpoints::onHit, which can look at and change the Env and then
+// say whether to keep going. If it stops(or there isn't an onHit) runSteps returns
+// RunStatus::BREAKPOINT and the Env can be resumed with runSteps like any other status. Resuming
+// from a breakpoint runs its line without stopping there again.
+//
+// A breakpoint on a blank line or a label goes on the next line that's an instruction.
+// Programs with threads= can't have them.
+
+// One side of a comparison. Either the acc, or an argument written the same as an
+// instruction's("5" is memory[5], "*5" follows it, "#5" is just 5, "[5+*4]" is indexed, "r2" is a register)
+struct BreakValue {
+	bool reg;
+	Arg arg;
+};
+
+enum class BreakCompare { EQ, NE, LT, LE, GT, GE };
+
+struct BreakTerm {
+	BreakValue left;
+	BreakCompare cmp;
+	BreakValue right;
+};
+
+// All of the terms have to be true. No terms is always true
+struct BreakCondition {
+	std::vector<BreakTerm> terms;
+	std::string text;  // What it was parsed from
+};
+
+struct Breakpoint {
+	int id;
+	int line;             // The line it stops at
+	BreakCondition cond;
+	long long hits{0};
+};
+
+struct Watchpoint {
+	int id;
+	int addr;
+	BreakCondition cond;  // Checked after the write, so "5 > #10" sees the new value
+	long long hits{0};
+};
+
+struct BreakHit {
+	bool watch;      // A watchpoint, not a breakpoint
+	int id;
+	int line;        // Where it stopped. For a watchpoint, the line that did the write
+	int addr;        // Only for a watchpoint
+	int oldValue;
+	int newValue;
+};
+
+enum class BreakAction { CONTINUE, STOP };
+
+using BreakCallback = std::function<BreakAction(Env &env, const BreakHit &hit)>;
+
+struct Breakpoints {
+	std::vector<Breakpoint> breaks;
+	std::vector<Watchpoint> watches;
+	BreakCallback onHit;        // If it isn't set every hit stops
+	BreakHit lastHit{};
+	int nextId{1};
+	// Set by armBreakpoints
+	ProgramRef original;        // The program the Env had before it was armed
+	std::vector<OpFunc> funcs;  // The original func of each line
+	std::vector<char> breakAt;  // Whether each line has a breakpoint
+	std::vector<char> watchAt;  // Whether each line could change a watched cell
+	std::vector<int> before;    // The watched cells before the line that's running
+	int skipLine{-1};           // The breakpoint to not stop at when resuming, and the step it was at
+	long long skipSteps{-1};
+};
+
+// Parses things like "reg == 3", "5 >= #10 && *2 != reg". Throws a CaiError(BAD_ARGUMENT) if it can't
+BreakCondition parseBreakCondition(const std::string &text);
+// The line a breakpoint given as a line number or a label would be on. Throws a CaiError if there isn't one
+int breakpointLine(const Program &prog, const std::string &where);
+
+// Add one and return its id. They only take effect the next time armBreakpoints is called
+int addBreakpoint(Breakpoints &bp, int line, const BreakCondition &cond = BreakCondition());
+int addWatchpoint(Breakpoints &bp, int addr, const BreakCondition &cond = BreakCondition());
+// False if there isn't one with that id
+bool removeBreakpoint(Breakpoints &bp, int id);
+
+// Switches env over to a copy of its program with bp's breakpoints and watchpoints in it(or
+// back to the original if it has none). bp has to outlive env's runs or be disarmed first.
+// Throws a CaiError if env has threads or one of them is outside the program or the memory
+void armBreakpoints(Env &env, Breakpoints &bp);
+// Puts env back on the program it had before
+void disarmBreakpoints(Env &env);
+
+#endif
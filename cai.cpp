@@ -0,0 +1,85 @@
+/*
+ *	This file is a part of ConfigurableAssemblyIntepreter.
+ *
+ *	ConfigurableAssemblyIntepreter is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ConfigurableAssemblyIntepreter is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <string>
+#include <stdexcept>
+
+#include "cai.h"
+
+#ifndef CAI_CPP
+#define CAI_CPP
+
+const char* caiErrcName(CaiErrc code) {
+	switch (code) {
+		case CaiErrc::OK:                  return "ok";
+		case CaiErrc::FILE_ERROR:          return "file error";
+		case CaiErrc::BAD_CONFIG:          return "bad config";
+		case CaiErrc::UNKNOWN_INSTRUCTION: return "unknown instruction";
+		case CaiErrc::UNKNOWN_LABEL:       return "unknown label";
+		case CaiErrc::BAD_ARGUMENT:        return "bad argument";
+		case CaiErrc::BAD_ADDRESS:         return "bad address";
+		case CaiErrc::INTERNAL:            return "internal error";
+	}
+	return "unknown error";
+}
+
+// Turns whatever was thrown into an error code. Anything that isn't a CaiError
+// is a bug somewhere, so it gets reported as INTERNAL
+static CaiErrc errorToCode(std::exception_ptr e, std::string *message) {
+	try {
+		std::rethrow_exception(e);
+	} catch (const CaiError &err) {
+		if (message != nullptr) {
+			*message = err.what();
+		}
+		return err.code;
+	} catch (const std::exception &err) {
+		if (message != nullptr) {
+			*message = err.what();
+		}
+		return CaiErrc::INTERNAL;
+	}
+}
+
+CaiErrc caiLoadFile(const std::string &filename, ProgramRef &out, std::string *message) {
+	try {
+		out = loadProgramFile(filename);
+		return CaiErrc::OK;
+	} catch (...) {
+		return errorToCode(std::current_exception(), message);
+	}
+}
+
+CaiErrc caiLoadBuffer(const std::string &source, ProgramRef &out, std::string *message) {
+	try {
+		out = loadProgramBuffer(source);
+		return CaiErrc::OK;
+	} catch (...) {
+		return errorToCode(std::current_exception(), message);
+	}
+}
+
+CaiErrc caiRunSteps(Env &env, long long steps, RunStatus &status, std::string *message) {
+	try {
+		status = runSteps(env, steps);
+		return CaiErrc::OK;
+	} catch (...) {
+		status = env.status;
+		return errorToCode(std::current_exception(), message);
+	}
+}
+
+#endif
@@ -0,0 +1,55 @@
+// -*- grammar-ext: .cpp -*-
+/*
+ *	This file is a part of ConfigurableAssemblyIntepreter.
+ *
+ *	ConfigurableAssemblyIntepreter is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ConfigurableAssemblyIntepreter is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <string>
+
+#include "caiError.h"
+#include "mainLib.h"
+#include "instructions.h"
+#include "closures.h"
+#include "debugger.h"
+#include "breakpoints.h"
+#include "linker.h"
+#include "lockstep.h"
+#include "threads.h"
+#include "outputsink.h"
+#include "stats.h"
+#include "statedump.h"
+#include "resultcache.h"
+#include "envpool.h"
+#include "session.h"
+#include "server.h"
+
+#ifndef CAI_H
+#define CAI_H
+
+// This is the header to include when using libcai from another program.
+//
+// A program is loaded once into a ProgramRef, which is immutable and reference counted,
+// so it can be shared between threads. Each run gets its own Env from createInstance,
+// which points at the program instead of copying it.
+//
+// Everything in mainLib.h throws a CaiError when something goes wrong. The functions
+// below do the same things but return a CaiErrc instead, and put the message in
+// *message if it isn't null. Nothing in the library prints anything, except for the
+// functions that are meant to(printState and printLabelMap).
+
+CaiErrc caiLoadFile(const std::string &filename, ProgramRef &out, std::string *message = nullptr);
+CaiErrc caiLoadBuffer(const std::string &source, ProgramRef &out, std::string *message = nullptr);
+CaiErrc caiRunSteps(Env &env, long long steps, RunStatus &status, std::string *message = nullptr);
+
+#endif
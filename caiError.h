@@ -0,0 +1,49 @@
+// -*- grammar-ext: .cpp -*-
+/*
+ *	This file is a part of ConfigurableAssemblyIntepreter.
+ *
+ *	ConfigurableAssemblyIntepreter is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ConfigurableAssemblyIntepreter is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdexcept>
+#include <string>
+
+#ifndef CAIERROR_H
+#define CAIERROR_H
+
+// Error codes for everything that can go wrong while loading or running a program.
+// The same codes are used by the exceptions and by the return code functions in cai.h
+enum class CaiErrc {
+	OK = 0,
+	FILE_ERROR,           // Couldn't open or read a file
+	BAD_CONFIG,           // Something in the ENVDEF didn't make sense
+	UNKNOWN_INSTRUCTION,  // No such operation in strtoop
+	UNKNOWN_LABEL,        // A jump went to a label that doesn't exist
+	BAD_ARGUMENT,         // An argument couldn't be turned into an Arg
+	BAD_ADDRESS,          // A memory access went outside of the memory
+	INTERNAL              // Shouldn't happen, but is a bug in the interpreter if it does
+};
+
+// What gets thrown instead of the single chars that used to be thrown.
+// lineNum is the line of the source file(starting at 1) if the error is about one, otherwise -1.
+// For BAD_ADDRESS it's the program line that was running instead.
+struct CaiError : public std::runtime_error {
+	CaiErrc code;
+	int lineNum;
+	CaiError(CaiErrc code, const std::string &message, int lineNum = -1)
+		: std::runtime_error(message), code(code), lineNum(lineNum) {}
+};
+
+const char* caiErrcName(CaiErrc code);
+
+#endif
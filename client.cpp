@@ -0,0 +1,124 @@
+/*
+ *	This file is a part of ConfigurableAssemblyIntepreter.
+ *
+ *	ConfigurableAssemblyIntepreter is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ConfigurableAssemblyIntepreter is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+// caiclient, the thin client for "./main --serve". It takes the same arguments as main
+// and prints the same thing, but the server does the parsing and running.
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+#include <unistd.h>
+
+#include "server.h"
+#include "stringops.h"
+
+// Same format as printState and printOutput in mainLib.cpp, so scripts can't tell the difference
+static void printResponse(const RunResponse &response) {
+	printf("memorySize is %i\n", (int)response.memory.size());
+	printf("ISEND: %s ACC: %i  LINE: %i - MEM: [", (response.endProgram ? "true" : "false"), response.reg, response.line);
+	for (size_t i = 0; i < response.memory.size(); ++i) {
+		printf((i + 1 == response.memory.size()) ? "%i]\n" : "%i, ", response.memory[i]);
+	}
+	if (!response.output.empty()) {
+		printf("OUTPUT: [");
+		for (size_t i = 0; i < response.output.size(); ++i) {
+			printf((i + 1 == response.output.size()) ? "%i]\n" : "%i, ", response.output[i]);
+		}
+	}
+}
+
+int main(int argc, char const *argv[]) {
+	RunRequest request;
+	std::string filename;
+	const char *envSocket = getenv("CAI_SOCKET");
+	std::string socketPath = (envSocket != nullptr) ? envSocket : CAI_DEFAULT_SOCKET;
+	bool sendSource = false;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+			socketPath = argv[++i];
+		} else if (strcmp(argv[i], "--send-source") == 0) {
+			// Send the file's contents instead of its path, for when the server can't see the file
+			sendSource = true;
+		} else if (strcmp(argv[i], "--input") == 0 && i + 1 < argc) {
+			request.hasInput = true;
+			request.input = processArrayString(argv[++i]);
+		} else if (strcmp(argv[i], "--max-steps") == 0 && i + 1 < argc) {
+			if (!parseWholeNumber(argv[i + 1], -1, LLONG_MAX, request.maxSteps)) {
+				fprintf(stderr, "Error: %s needs a whole number that's at least -1, not '%s'\n", argv[i], argv[i + 1]);
+				return 1;
+			}
+			i++;
+		} else if (strcmp(argv[i], "--max-time") == 0 && i + 1 < argc) {
+			if (!parseWholeNumber(argv[i + 1], -1, LLONG_MAX, request.maxMillis)) {
+				fprintf(stderr, "Error: %s needs a whole number that's at least -1, not '%s'\n", argv[i], argv[i + 1]);
+				return 1;
+			}
+			i++;
+		} else if (strcmp(argv[i], "--max-output") == 0 && i + 1 < argc) {
+			if (!parseWholeNumber(argv[i + 1], -1, LLONG_MAX, request.maxOutput)) {
+				fprintf(stderr, "Error: %s needs a whole number that's at least -1, not '%s'\n", argv[i], argv[i + 1]);
+				return 1;
+			}
+			i++;
+		} else {
+			filename = argv[i];
+		}
+	}
+	if (filename.empty()) {
+		printf("Please input a file name\n");
+		return 0;
+	}
+
+	if (sendSource) {
+		std::ifstream ifs(filename, std::ifstream::in | std::ifstream::binary);
+		if (!ifs.is_open()) {
+			fprintf(stderr, "Error: Couldn't open file '%s'\n", filename.c_str());
+			return 1;
+		}
+		request.source.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+	} else if (filename[0] == '/') {
+		request.path = filename;
+	} else {
+		// The server has its own working directory, so send an absolute path
+		char cwd[4096];
+		if (getcwd(cwd, sizeof(cwd)) == nullptr) {
+			fprintf(stderr, "Error: Couldn't get the current directory\n");
+			return 1;
+		}
+		request.path = std::string(cwd) + "/" + filename;
+	}
+
+	RunResponse response;
+	CaiErrc err = requestRun(socketPath, request, response);
+	if (err != CaiErrc::OK) {
+		fprintf(stderr, "Error: %s\n", response.message.c_str());
+		if (response.memory.empty()) {
+			return 1;  // Never got as far as running
+		}
+		printResponse(response);
+		return 1;
+	}
+	printResponse(response);
+	if (response.status != RunStatus::ENDED) {
+		printf("Program stopped early: %s after %lld steps\n", runStatusName(response.status), response.steps);
+		return 2;
+	}
+	return 0;
+}
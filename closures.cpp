@@ -0,0 +1,602 @@
+/*
+ *	This file is a part of ConfigurableAssemblyIntepreter.
+ *
+ *	ConfigurableAssemblyIntepreter is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ConfigurableAssemblyIntepreter is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <map>
+#include <mutex>
+
+#include "closures.h"
+#include "instructions.h"
+
+#ifndef CLOSURES_CPP
+#define CLOSURES_CPP
+
+// The handlers. The "D" ones are for direct arguments that were checked when compiling, and the
+// "X" ones are for dereferenced ones, which go through getDeref like the instructions do. Those
+// set env.line first, since that's what goes in the error if an address is bad.
+
+static const Closure* cSkip(Env &, const Closure *c) {
+	return c->next;
+}
+
+static const Closure* cNop(Env &env, const Closure *c) {
+	env.steps++;
+	return c->next;
+}
+
+static const Closure* cMovD(Env &env, const Closure *c) {
+	env.memory[c->b.value] = env.memory[c->a.value];
+	env.memory.touch(c->b.value);
+	env.steps++;
+	return c->next;
+}
+
+static const Closure* cMovX(Env &env, const Closure *c) {
+	env.line = c->line;
+	int val = getDeref(env, c->a);
+	*getDerefp(env, c->b) = val;
+	env.steps++;
+	return c->next;
+}
+
+static const Closure* cCpfD(Env &env, const Closure *c) {
+	env.reg = env.memory[c->a.value];
+	env.steps++;
+	return c->next;
+}
+
+static const Closure* cCpfX(Env &env, const Closure *c) {
+	env.line = c->line;
+	env.reg = getDeref(env, c->a);
+	env.steps++;
+	return c->next;
+}
+
+static const Closure* cCptD(Env &env, const Closure *c) {
+	env.memory[c->a.value] = env.reg;
+	env.memory.touch(c->a.value);
+	env.steps++;
+	return c->next;
+}
+
+static const Closure* cCptX(Env &env, const Closure *c) {
+	env.line = c->line;
+	*getDerefp(env, c->a) = env.reg;
+	env.steps++;
+	return c->next;
+}
+
+static const Closure* cAddD(Env &env, const Closure *c) {
+	env.reg += env.memory[c->a.value];
+	env.steps++;
+	return c->next;
+}
+
+static const Closure* cAddX(Env &env, const Closure *c) {
+	env.line = c->line;
+	env.reg += getDeref(env, c->a);
+	env.steps++;
+	return c->next;
+}
+
+static const Closure* cSubD(Env &env, const Closure *c) {
+	env.reg -= env.memory[c->a.value];
+	env.steps++;
+	return c->next;
+}
+
+static const Closure* cSubX(Env &env, const Closure *c) {
+	env.line = c->line;
+	env.reg -= getDeref(env, c->a);
+	env.steps++;
+	return c->next;
+}
+
+static const Closure* cIncD(Env &env, const Closure *c) {
+	env.memory[c->a.value]++;
+	env.memory.touch(c->a.value);
+	env.steps++;
+	return c->next;
+}
+
+static const Closure* cIncX(Env &env, const Closure *c) {
+	env.line = c->line;
+	(*getDerefp(env, c->a))++;
+	env.steps++;
+	return c->next;
+}
+
+static const Closure* cDecD(Env &env, const Closure *c) {
+	env.memory[c->a.value]--;
+	env.memory.touch(c->a.value);
+	env.steps++;
+	return c->next;
+}
+
+static const Closure* cDecX(Env &env, const Closure *c) {
+	env.line = c->line;
+	(*getDerefp(env, c->a))--;
+	env.steps++;
+	return c->next;
+}
+
+// Immediates("#5"). Reading one can't fail. Writing to one is an error, which the X handlers give
+static const Closure* cMovI(Env &env, const Closure *c) {
+	env.memory[c->b.value] = c->a.value;
+	env.memory.touch(c->b.value);
+	env.steps++;
+	return c->next;
+}
+
+static const Closure* cCpfI(Env &env, const Closure *c) {
+	env.reg = c->a.value;
+	env.steps++;
+	return c->next;
+}
+
+static const Closure* cAddI(Env &env, const Closure *c) {
+	env.reg += c->a.value;
+	env.steps++;
+	return c->next;
+}
+
+static const Closure* cSubI(Env &env, const Closure *c) {
+	env.reg -= c->a.value;
+	env.steps++;
+	return c->next;
+}
+
+// Indexed arguments like "[10+*4]", where the base is a constant and the index is a cell that
+// was checked when compiling. If the address they add up to is outside of memory, the X
+// handler does it over so the error is exactly the same
+static inline int* indexedCell(Env &env, const Arg &arg) {
+	unsigned addr = (unsigned)arg.value + (unsigned)env.memory[arg.index];
+	return addr < env.memory.size() ? &env.memory[addr] : nullptr;
+}
+
+static const Closure* cCpfN(Env &env, const Closure *c) {
+	int *cell = indexedCell(env, c->a);
+	if (cell == nullptr) {
+		return cCpfX(env, c);
+	}
+	env.reg = *cell;
+	env.steps++;
+	return c->next;
+}
+
+static const Closure* cCptN(Env &env, const Closure *c) {
+	int *cell = indexedCell(env, c->a);
+	if (cell == nullptr) {
+		return cCptX(env, c);
+	}
+	*cell = env.reg;
+	env.memory.touch(cell - env.memory.data());
+	env.steps++;
+	return c->next;
+}
+
+static const Closure* cAddN(Env &env, const Closure *c) {
+	int *cell = indexedCell(env, c->a);
+	if (cell == nullptr) {
+		return cAddX(env, c);
+	}
+	env.reg += *cell;
+	env.steps++;
+	return c->next;
+}
+
+static const Closure* cSubN(Env &env, const Closure *c) {
+	int *cell = indexedCell(env, c->a);
+	if (cell == nullptr) {
+		return cSubX(env, c);
+	}
+	env.reg -= *cell;
+	env.steps++;
+	return c->next;
+}
+
+// Registers("r3"). The loader already checked they're ones the program has, so these can't fail
+static const Closure* cMovRR(Env &env, const Closure *c) {
+	env.regs[c->b.value] = env.regs[c->a.value];
+	env.steps++;
+	return c->next;
+}
+
+static const Closure* cMovDR(Env &env, const Closure *c) {
+	env.regs[c->b.value] = env.memory[c->a.value];
+	env.steps++;
+	return c->next;
+}
+
+static const Closure* cMovRD(Env &env, const Closure *c) {
+	env.memory[c->b.value] = env.regs[c->a.value];
+	env.memory.touch(c->b.value);
+	env.steps++;
+	return c->next;
+}
+
+static const Closure* cMovIR(Env &env, const Closure *c) {
+	env.regs[c->b.value] = c->a.value;
+	env.steps++;
+	return c->next;
+}
+
+static const Closure* cCpfR(Env &env, const Closure *c) {
+	env.reg = env.regs[c->a.value];
+	env.steps++;
+	return c->next;
+}
+
+static const Closure* cCptR(Env &env, const Closure *c) {
+	env.regs[c->a.value] = env.reg;
+	env.steps++;
+	return c->next;
+}
+
+static const Closure* cAddR(Env &env, const Closure *c) {
+	env.reg += env.regs[c->a.value];
+	env.steps++;
+	return c->next;
+}
+
+static const Closure* cSubR(Env &env, const Closure *c) {
+	env.reg -= env.regs[c->a.value];
+	env.steps++;
+	return c->next;
+}
+
+static const Closure* cIncR(Env &env, const Closure *c) {
+	env.regs[c->a.value]++;
+	env.steps++;
+	return c->next;
+}
+
+static const Closure* cDecR(Env &env, const Closure *c) {
+	env.regs[c->a.value]--;
+	env.steps++;
+	return c->next;
+}
+
+// "add a r1" and "sub a r1", which add to or take from r1 instead of the acc
+static const Closure* cAddRegD(Env &env, const Closure *c) {
+	env.regs[c->b.value] += env.memory[c->a.value];
+	env.steps++;
+	return c->next;
+}
+
+static const Closure* cAddRegR(Env &env, const Closure *c) {
+	env.regs[c->b.value] += env.regs[c->a.value];
+	env.steps++;
+	return c->next;
+}
+
+static const Closure* cAddRegI(Env &env, const Closure *c) {
+	env.regs[c->b.value] += c->a.value;
+	env.steps++;
+	return c->next;
+}
+
+static const Closure* cAddRegX(Env &env, const Closure *c) {
+	env.line = c->line;
+	env.regs[c->b.value] += getDeref(env, c->a);
+	env.steps++;
+	return c->next;
+}
+
+static const Closure* cAddRegN(Env &env, const Closure *c) {
+	int *cell = indexedCell(env, c->a);
+	if (cell == nullptr) {
+		return cAddRegX(env, c);
+	}
+	env.regs[c->b.value] += *cell;
+	env.steps++;
+	return c->next;
+}
+
+static const Closure* cSubRegD(Env &env, const Closure *c) {
+	env.regs[c->b.value] -= env.memory[c->a.value];
+	env.steps++;
+	return c->next;
+}
+
+static const Closure* cSubRegR(Env &env, const Closure *c) {
+	env.regs[c->b.value] -= env.regs[c->a.value];
+	env.steps++;
+	return c->next;
+}
+
+static const Closure* cSubRegI(Env &env, const Closure *c) {
+	env.regs[c->b.value] -= c->a.value;
+	env.steps++;
+	return c->next;
+}
+
+static const Closure* cSubRegX(Env &env, const Closure *c) {
+	env.line = c->line;
+	env.regs[c->b.value] -= getDeref(env, c->a);
+	env.steps++;
+	return c->next;
+}
+
+static const Closure* cSubRegN(Env &env, const Closure *c) {
+	int *cell = indexedCell(env, c->a);
+	if (cell == nullptr) {
+		return cSubRegX(env, c);
+	}
+	env.regs[c->b.value] -= *cell;
+	env.steps++;
+	return c->next;
+}
+
+static const Closure* cJmp(Env &env, const Closure *c) {
+	env.steps++;
+	return c->target;
+}
+
+static const Closure* cJiz(Env &env, const Closure *c) {
+	env.steps++;
+	return env.reg == 0 ? c->target : c->next;
+}
+
+static const Closure* cJlz(Env &env, const Closure *c) {
+	env.steps++;
+	return env.reg < 0 ? c->target : c->next;
+}
+
+// "jiz r1 done" and "jlz r1 done". b is the register
+static const Closure* cJizR(Env &env, const Closure *c) {
+	env.steps++;
+	return env.regs[c->b.value] == 0 ? c->target : c->next;
+}
+
+static const Closure* cJlzR(Env &env, const Closure *c) {
+	env.steps++;
+	return env.regs[c->b.value] < 0 ? c->target : c->next;
+}
+
+// A loop loopopt.cpp can speed up. b is which one of the program's loops it is
+static const Closure* cLoopJmp(Env &env, const Closure *c) {
+	env.steps++;
+	env.line = c->a.value;
+	accelerateLoop(env, env.program->loops[c->b.value]);
+	return c->target;
+}
+
+static const Closure* cInp(Env &env, const Closure *c) {
+	if (env.input.empty()) {
+		env.line = c->line;
+		env.status = RunStatus::BLOCKED_INPUT;
+		return nullptr;
+	}
+	setReg(env, env.input.front());
+	env.input.pop_front();
+	env.steps++;
+	return c->next;
+}
+
+static const Closure* cOut(Env &env, const Closure *c) {
+	if (env.outputSink != nullptr) {
+		if (!sinkPut(*env.outputSink, env.reg)) {
+			env.line = c->line;
+			env.status = RunStatus::BLOCKED_OUTPUT;
+			return nullptr;
+		}
+		getReg(env, true);
+		env.steps++;
+		return c->next;
+	}
+	env.output.push_back(getReg(env, true));
+	env.steps++;
+	return c->next;
+}
+
+static const Closure* cEnd(Env &env, const Closure *c) {
+	env.line = c->line;
+	env.states[IS_END] = true;
+	env.endProgram = true;
+	return nullptr;
+}
+
+// The extra one past the last line
+static const Closure* cOffEnd(Env &env, const Closure *c) {
+	env.line = c->line;
+	env.endProgram = true;
+	return nullptr;
+}
+
+// Everything else gets run the normal way, and then the next Closure is looked up from env.line
+static const Closure* cLine(Env &env, const Closure *c) {
+	env.line = c->line;
+	const Line &line = env.program->lines[c->line];
+	line.func(env, line.arguments);
+	if (env.status != RunStatus::RUNNING || env.endProgram || env.states[IS_END]) {
+		return nullptr;
+	}
+	const Closure *base = c - c->line;
+	int size = (int)env.program->lines.size();
+	if (env.line < 0 || env.line > size) {
+		return nullptr;  // A jump to nowhere, runClosureBatch hands it back to iterateOnce
+	}
+	return base + env.line;
+}
+
+static void compileLine(const Program &prog, ClosureProgram &cp, int i) {
+	const Line &line = prog.lines[i];
+	Closure &c = cp.code[i];
+	const int size = (int)prog.lines.size();
+	c.func = cLine;
+	c.line = i;
+	c.next = &cp.code[i + 1];
+	c.target = nullptr;
+	c.a = c.b = Arg{ 0, 0 };
+	if (line.arguments.size() >= 1) {
+		c.a = line.arguments[0];
+	}
+	if (line.arguments.size() >= 2) {
+		c.b = line.arguments[1];
+	}
+	auto direct = [&](const Arg &arg) {
+		return arg.mode == ArgMode::ADDRESS && arg.derefLevel == 0 && arg.value >= 0 && arg.value < cp.memSize;
+	};
+	// A constant base plus a cell that's in range
+	auto indexed = [&](const Arg &arg) {
+		return arg.mode == ArgMode::INDEXED && arg.derefLevel == 0 && arg.indexDeref == 1 &&
+			arg.index >= 0 && arg.index < cp.memSize;
+	};
+	auto immediate = [&](const Arg &arg) {
+		return arg.mode == ArgMode::IMMEDIATE;
+	};
+	auto reg = [&](const Arg &arg) {
+		return arg.mode == ArgMode::REGISTER;
+	};
+	// Picks the direct handler if the argument is direct, and the general one if not.
+	// n, im and r are for indexed arguments, immediates and registers, if the instruction has handlers for them
+	auto pick = [&](ClosureFunc d, ClosureFunc x, ClosureFunc n = nullptr, ClosureFunc im = nullptr, ClosureFunc r = nullptr) {
+		if (direct(c.a)) {
+			c.func = d;
+		} else if (n != nullptr && indexed(c.a)) {
+			c.func = n;
+		} else if (im != nullptr && immediate(c.a)) {
+			c.func = im;
+		} else if (r != nullptr && reg(c.a)) {
+			c.func = r;
+		} else {
+			c.func = x;
+		}
+	};
+	const OpFunc f = line.func;
+	const int args = (int)line.arguments.size();
+	if (f == label) {
+		c.func = cSkip;
+	} else if (f == nop) {
+		c.func = cNop;
+	} else if (f == endprog) {
+		c.func = cEnd;
+	} else if (f == inp) {
+		c.func = cInp;
+	} else if (f == out) {
+		c.func = cOut;
+	} else if (args >= 1 && f == cpf) {
+		pick(cCpfD, cCpfX, cCpfN, cCpfI, cCpfR);
+	} else if (args >= 1 && f == cpt) {
+		pick(cCptD, cCptX, cCptN, nullptr, cCptR);
+	} else if (args >= 1 && f == add) {
+		pick(cAddD, cAddX, cAddN, cAddI, cAddR);
+	} else if (args >= 1 && f == sub) {
+		pick(cSubD, cSubX, cSubN, cSubI, cSubR);
+	} else if (args >= 1 && f == inc) {
+		pick(cIncD, cIncX, nullptr, nullptr, cIncR);
+	} else if (args >= 1 && f == dec) {
+		pick(cDecD, cDecX, nullptr, nullptr, cDecR);
+	} else if (args >= 2 && f == addreg) {
+		pick(cAddRegD, cAddRegX, cAddRegN, cAddRegI, cAddRegR);
+	} else if (args >= 2 && f == subreg) {
+		pick(cSubRegD, cSubRegX, cSubRegN, cSubRegI, cSubRegR);
+	} else if (args >= 2 && f == mov) {
+		if (reg(c.b)) {
+			c.func = direct(c.a) ? cMovDR : reg(c.a) ? cMovRR : immediate(c.a) ? cMovIR : cMovX;
+		} else if (direct(c.b) && immediate(c.a)) {
+			c.func = cMovI;
+		} else if (direct(c.b) && reg(c.a)) {
+			c.func = cMovRD;
+		} else {
+			c.func = (direct(c.a) && direct(c.b)) ? cMovD : cMovX;
+		}
+	} else if (args >= 1 && c.a.value >= 0 && c.a.value <= size) {
+		// Jumps. A target of size is running off the end, which is fine
+		if (f == jmp) {
+			c.func = cJmp;
+		} else if (f == jiz) {
+			c.func = cJiz;
+		} else if (f == jlz) {
+			c.func = cJlz;
+		} else if (f == jizreg && args >= 2) {
+			c.func = cJizR;
+		} else if (f == jlzreg && args >= 2) {
+			c.func = cJlzR;
+		} else if (f == jmploop && args >= 2) {
+			c.func = cLoopJmp;
+		}
+		c.target = &cp.code[c.a.value];
+	}
+}
+
+static std::shared_ptr<const ClosureProgram> compileProgram(const Program &prog) {
+	std::shared_ptr<ClosureProgram> cp = std::make_shared<ClosureProgram>();
+	const int size = (int)prog.lines.size();
+	cp->program = &prog;
+	cp->memSize = prog.config.memSize;
+	cp->code.resize(size + 1);
+	for (int i = 0; i < size; i++) {
+		compileLine(prog, *cp, i);
+	}
+	Closure &end = cp->code[size];
+	end.func = cOffEnd;
+	end.a = end.b = Arg{ 0, 0 };
+	end.next = end.target = nullptr;
+	end.line = size;
+	return cp;
+}
+
+// Compiled programs, the same way resultcache.cpp remembers digests. The weak_ptr is to tell
+// if the Program at that address is still the same one
+struct CompiledEntry {
+	std::weak_ptr<const Program> program;
+	std::shared_ptr<const ClosureProgram> code;
+};
+
+std::shared_ptr<const ClosureProgram> compileClosures(const ProgramRef &prog) {
+	static std::mutex mtx;
+	static std::map<const Program*, CompiledEntry> compiled;
+	std::lock_guard<std::mutex> lock(mtx);
+	std::map<const Program*, CompiledEntry>::iterator it = compiled.find(prog.get());
+	if (it != compiled.end() && it->second.program.lock() == prog) {
+		return it->second.code;
+	}
+	// Forget about any programs that are gone while we're here
+	for (it = compiled.begin(); it != compiled.end(); ) {
+		it = it->second.program.expired() ? compiled.erase(it) : std::next(it);
+	}
+	std::shared_ptr<const ClosureProgram> code = compileProgram(*prog);
+	compiled[prog.get()] = CompiledEntry{ prog, code };
+	return code;
+}
+
+bool runClosureBatch(Env &env, const ClosureProgram &code, long long batchEnd) {
+	const int size = (int)code.code.size() - 1;
+	if (env.memProfile != nullptr || env.program.get() != code.program ||
+		(int)env.memory.size() != code.memSize || env.line < 0 || env.line > size) {
+		return false;
+	}
+	const Closure *base = code.code.data();
+	const Closure *c = base + env.line;
+	while (env.steps < batchEnd) {
+		const Closure *next = c->func(env, c);
+		if (next == nullptr) {
+			if (env.status == RunStatus::RUNNING && !env.endProgram && !env.states[IS_END]) {
+				iterateOnce(env);  // Let the interpreter deal with the jump to nowhere
+			}
+			if (env.endProgram || env.states[IS_END]) {
+				env.status = RunStatus::ENDED;
+			}
+			return true;
+		}
+		c = next;
+	}
+	env.line = (int)(c - base);
+	return true;
+}
+
+#endif
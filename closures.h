@@ -0,0 +1,63 @@
+// -*- grammar-ext: .cpp -*-
+/*
+ *	This file is a part of ConfigurableAssemblyIntepreter.
+ *
+ *	ConfigurableAssemblyIntepreter is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ConfigurableAssemblyIntepreter is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <memory>
+#include <vector>
+
+#include "mainLib.h"
+
+#ifndef CLOSURES_H
+#define CLOSURES_H
+
+// The closure engine(Engine::CLOSURE). Every Line gets turned into a Closure once, with a
+// handler picked for exactly what it does: "add 3" gets a handler that adds memory[3] to the
+// acc and nothing else, since the address was already checked against the memory size. Each
+// Closure points straight at the one that runs after it(and at its jump target), so running
+// a program is just calling one handler after another. No Op, no std::vector<Arg>, no Env
+// copies. It's plain C++, so it works anywhere the interpreter does.
+//
+// Anything without its own handler(the block instructions, custom instructions, jumps to
+// nowhere) gets a handler that just calls the Line's func like iterateOnce does, so both
+// engines always end up with exactly the same Env.
+
+struct Closure;
+using ClosureFunc = const Closure* (*)(Env &env, const Closure *c);
+
+struct Closure {
+	ClosureFunc func;        // Returns the next Closure to run, or nullptr if the run has to stop
+	Arg a;                   // The arguments, already checked if they're direct
+	Arg b;
+	const Closure *next;     // The line after this one
+	const Closure *target;   // Where a jump goes
+	int line;                // Which line this is, so env.line can be put back
+};
+
+struct ClosureProgram {
+	std::vector<Closure> code;  // One for every line, plus one at the end for running off it
+	const Program *program;     // What it was made from
+	int memSize;                // Direct addresses were only checked against this
+};
+
+// The compiled version of prog. Each Program only gets compiled once, however many Envs run it
+std::shared_ptr<const ClosureProgram> compileClosures(const ProgramRef &prog);
+
+// Runs env until its steps get to batchEnd or something stops it, like runSteps' inner loop.
+// Returns false without doing anything if this Env can't use the compiled code(like if its
+// memory isn't the size the program asked for), and then the interpreter has to do it
+bool runClosureBatch(Env &env, const ClosureProgram &code, long long batchEnd);
+
+#endif
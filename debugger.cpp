@@ -0,0 +1,288 @@
+/*
+ *	This file is a part of ConfigurableAssemblyIntepreter.
+ *
+ *	ConfigurableAssemblyIntepreter is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ConfigurableAssemblyIntepreter is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+
+#include "debugger.h"
+#include "instructions.h"
+
+#ifndef DEBUGGER_CPP
+#define DEBUGGER_CPP
+
+static size_t checkpointBytes(const Env &env) {
+	return sizeof(DebugCheckpoint) + env.memory.size() * sizeof(int) + env.states.size() / 8;
+}
+
+// Saves the old value of n cells starting where args[i] points. A register is saved as -1 - which one it is
+static void saveCells(Debugger &dbg, const std::vector<Arg> &args, int i, long long n) {
+	int addr;
+	if (i < (int)args.size() && args[i].mode == ArgMode::REGISTER) {
+		dbg.writes.push_back(DebugWrite{ -1 - args[i].value, dbg.env.regs[args[i].value] });
+		return;
+	}
+	if (i >= (int)args.size() || !peekAddress(dbg.env, args[i], addr)) {
+		return;  // It's going to throw instead of writing anything
+	}
+	n = std::min(n, (long long)dbg.env.memory.size() - addr);
+	for (long long k = 0; k < n; k++) {
+		dbg.writes.push_back(DebugWrite{ addr + (int)k, dbg.env.memory[addr + k] });
+	}
+}
+
+static long long rangeLength(const Env &env, const std::vector<Arg> &args, int i) {
+	return i < (int)args.size() ? std::max(0, peekArg(env, args[i])) : 0;
+}
+
+// Saves every cell line is about to write, by looking at its arguments before it runs
+static void saveWrites(Debugger &dbg, const Line &line) {
+	const std::vector<Arg> &args = line.arguments;
+	switch (line.operation) {
+		case Op::MOV:
+			saveCells(dbg, args, 1, 1);
+			break;
+		case Op::ADD: case Op::SUB:
+			saveCells(dbg, args, 1, 1);  // "add 5 r1" writes r1, and plain "add 5" doesn't have an args[1]
+			break;
+		case Op::COPY_TO: case Op::INC: case Op::DEC:
+		case Op::FETCH_ADD: case Op::COMPARE_SWAP: case Op::STORE_RELEASE:
+			saveCells(dbg, args, 0, 1);
+			break;
+		case Op::FILL: case Op::BLOCK_ADD:
+			saveCells(dbg, args, 0, rangeLength(dbg.env, args, 1));
+			break;
+		case Op::BLOCK_COPY: case Op::VECTOR_ADD:
+			saveCells(dbg, args, 1, rangeLength(dbg.env, args, 2));
+			break;
+		case Op::NOP: case Op::NO_INSTRUCTION: case Op::LABEL: case Op::COPY_FROM: case Op::JUMP: case Op::JUMP_IF_ZERO: case Op::JUMP_IF_NEGATIVE:
+		case Op::INP: case Op::OUT: case Op::END: case Op::BLOCK_SUM: case Op::BLOCK_FIND:
+		case Op::LOOP_JUMP: case Op::LOAD_ACQUIRE: case Op::FENCE: case Op::BARRIER:
+			break;
+		default:
+			// Something it doesn't know about(a custom instruction) could write anywhere
+			for (int addr = 0; addr < (int)dbg.env.memory.size(); addr++) {
+				dbg.writes.push_back(DebugWrite{ addr, dbg.env.memory[addr] });
+			}
+			break;
+	}
+}
+
+// Puts back everything the last step changed
+static void undoLast(Debugger &dbg) {
+	const DebugUndo u = dbg.undo.back();
+	dbg.undo.pop_back();
+	Env &env = dbg.env;
+	for (size_t i = dbg.writes.size(); i > u.firstWrite; i--) {
+		const DebugWrite &w = dbg.writes[i - 1];
+		if (w.addr < 0) {
+			env.regs[-1 - w.addr] = w.old;
+		} else {
+			env.memory[w.addr] = w.old;
+		}
+	}
+	dbg.writes.resize(u.firstWrite);
+	env.reg = u.reg;
+	env.line = u.line;
+	env.steps = u.steps;
+	env.states[NULL_REGISTER] = u.nullReg;
+	env.states[IS_END] = u.isEnd;
+	env.endProgram = u.endProgram;
+	env.status = RunStatus::RUNNING;
+	while (env.input.size() < u.inputLeft) {
+		env.input.push_front(dbg.input[dbg.input.size() - env.input.size() - 1]);
+	}
+	env.output.resize(u.outputSize);
+	dbg.step--;
+}
+
+static void addCheckpoint(Debugger &dbg) {
+	Env &env = dbg.env;
+	DebugCheckpoint cp{ dbg.step, Env(), dbg.input.size() - env.input.size(), env.output.size() };
+	// Only the Env's own state goes in it, the input and output are in dbg already
+	std::deque<int> input = std::move(env.input);
+	std::deque<int> output = std::move(env.output);
+	env.input.clear();
+	env.output.clear();
+	cp.env = env;
+	env.input = std::move(input);
+	env.output = std::move(output);
+	std::vector<DebugCheckpoint>::iterator it = std::upper_bound(dbg.checkpoints.begin(), dbg.checkpoints.end(), cp.step,
+		[](long long step, const DebugCheckpoint &c) { return step < c.step; });
+	dbg.checkpoints.insert(it, std::move(cp));
+	
+	// Too many, so keep every other one and take them twice as far apart from now on
+	while (dbg.checkpoints.size() > 2 && dbg.checkpoints.size() * checkpointBytes(env) > dbg.budgetBytes) {
+		dbg.interval *= 2;
+		const long long interval = dbg.interval;
+		dbg.checkpoints.erase(std::remove_if(dbg.checkpoints.begin() + 1, dbg.checkpoints.end(),
+			[interval](const DebugCheckpoint &c) { return c.step % interval != 0; }), dbg.checkpoints.end());
+	}
+}
+
+// Called at the start of every step. Every interval steps there's a checkpoint(unless there
+// already is one from last time it was here) and the undo log starts over
+static void atStepStart(Debugger &dbg) {
+	if (dbg.step % dbg.interval != 0 || dbg.step == dbg.segmentStart) {
+		return;
+	}
+	std::vector<DebugCheckpoint>::iterator it = std::lower_bound(dbg.checkpoints.begin(), dbg.checkpoints.end(), dbg.step,
+		[](const DebugCheckpoint &c, long long step) { return c.step < step; });
+	if (it == dbg.checkpoints.end() || it->step != dbg.step) {
+		addCheckpoint(dbg);
+	}
+	dbg.segmentStart = dbg.step;
+	dbg.undo.clear();
+	dbg.writes.clear();
+}
+
+// Makes env what it was at the last checkpoint at or before step n
+static void restoreCheckpoint(Debugger &dbg, long long n) {
+	std::vector<DebugCheckpoint>::iterator it = std::upper_bound(dbg.checkpoints.begin(), dbg.checkpoints.end(), n,
+		[](long long step, const DebugCheckpoint &c) { return step < c.step; });
+	const DebugCheckpoint &cp = *(it - 1);  // There's always one at 0
+	dbg.env = cp.env;
+	dbg.env.input.assign(dbg.input.begin() + cp.inputUsed, dbg.input.end());
+	dbg.env.output.assign(dbg.output.begin(), dbg.output.begin() + cp.outputSize);
+	dbg.step = cp.step;
+	dbg.segmentStart = cp.step;
+	dbg.undo.clear();
+	dbg.writes.clear();
+}
+
+void setupDebugger(Debugger &dbg, Env env, size_t budgetBytes) {
+	if (env.group != nullptr || env.memory.isShared()) {
+		throw CaiError(CaiErrc::BAD_CONFIG, "Programs with threads or a memfile can't be debugged");
+	}
+	dbg = Debugger();
+	dbg.env = std::move(env);
+	dbg.budgetBytes = budgetBytes;
+	dbg.input.assign(dbg.env.input.begin(), dbg.env.input.end());
+	dbg.output = dbg.env.output;
+	addCheckpoint(dbg);
+}
+
+RunStatus debugStep(Debugger &dbg) {
+	Env &env = dbg.env;
+	if (env.endProgram || env.states[IS_END]) {
+		env.status = RunStatus::ENDED;
+		return env.status;
+	}
+	atStepStart(dbg);
+	dbg.undo.push_back(DebugUndo{ env.reg, env.line, env.steps, env.states[NULL_REGISTER], env.states[IS_END],
+		env.endProgram, env.input.size(), env.output.size(), dbg.writes.size() });
+	dbg.step++;
+	env.status = RunStatus::RUNNING;
+	const Program &program = *env.program;
+	try {
+		Op op;
+		do {
+			if (env.line < 0) {
+				iterateOnce(env);  // Which throws for a line before the start
+			}
+			if (!hasLine(program, env.line)) {
+				env.endProgram = true;  // Like iterateOnce
+				break;
+			}
+			const Line &line = fetchLine(program, env.line);
+			op = line.operation;
+			saveWrites(dbg, line);
+			if (op == Op::LOOP_JUMP) {
+				jmp(env, line.arguments);  // One trip at a time
+			} else {
+				iterateOnce(env);
+			}
+		} while (op == Op::NO_INSTRUCTION && env.status == RunStatus::RUNNING);
+	} catch (...) {
+		undoLast(dbg);
+		throw;
+	}
+	if (env.status != RunStatus::RUNNING) {
+		// Blocked on input, so the step didn't happen
+		RunStatus status = env.status;
+		undoLast(dbg);
+		env.status = status;
+		return status;
+	}
+	if (env.output.size() > dbg.output.size()) {
+		dbg.output.push_back(env.output.back());
+	}
+	return RunStatus::RUNNING;
+}
+
+RunStatus debugContinue(Debugger &dbg, long long maxSteps) {
+	RunStatus status = RunStatus::RUNNING;
+	for (long long i = 0; (maxSteps < 0 || i < maxSteps) && status == RunStatus::RUNNING; i++) {
+		status = debugStep(dbg);
+	}
+	return status;
+}
+
+bool debugStepBack(Debugger &dbg) {
+	if (dbg.step == 0) {
+		return false;
+	}
+	if (dbg.undo.empty()) {
+		// The undo log doesn't go back that far, so run forward to here again from the
+		// checkpoint before, which leaves the log full of the steps in between
+		const long long here = dbg.step;
+		restoreCheckpoint(dbg, here - 1);
+		debugContinue(dbg, here - dbg.step);
+	}
+	undoLast(dbg);
+	return true;
+}
+
+bool debugReverseToWrite(Debugger &dbg, int addr) {
+	while (dbg.step > 0) {
+		if (dbg.undo.empty()) {
+			const long long here = dbg.step;
+			restoreCheckpoint(dbg, here - 1);
+			debugContinue(dbg, here - dbg.step);
+		}
+		bool wrote = false;
+		for (size_t i = dbg.undo.back().firstWrite; i < dbg.writes.size(); i++) {
+			wrote = wrote || dbg.writes[i].addr == addr;
+		}
+		undoLast(dbg);
+		if (wrote) {
+			return true;
+		}
+	}
+	return false;
+}
+
+RunStatus debugGoTo(Debugger &dbg, long long n) {
+	n = std::max(0LL, n);
+	if (n < dbg.segmentStart || (n > dbg.step && n - dbg.step > dbg.interval)) {
+		// Further than the undo log goes back or than a checkpoint is away, so start from the
+		// closest checkpoint instead(if it's further along than this)
+		std::vector<DebugCheckpoint>::iterator it = std::upper_bound(dbg.checkpoints.begin(), dbg.checkpoints.end(), n,
+			[](long long step, const DebugCheckpoint &c) { return step < c.step; });
+		if (n < dbg.step || (it - 1)->step > dbg.step) {
+			restoreCheckpoint(dbg, n);
+		}
+	}
+	while (dbg.step > n) {
+		undoLast(dbg);
+	}
+	return debugContinue(dbg, n - dbg.step);
+}
+
+void debugPushInput(Debugger &dbg, int value) {
+	dbg.input.push_back(value);
+	pushInput(dbg.env, value);
+}
+
+#endif
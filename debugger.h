@@ -0,0 +1,101 @@
+// -*- grammar-ext: .cpp -*-
+/*
+ *	This file is a part of ConfigurableAssemblyIntepreter.
+ *
+ *	ConfigurableAssemblyIntepreter is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ConfigurableAssemblyIntepreter is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <deque>
+#include <vector>
+
+#include "mainLib.h"
+
+#ifndef DEBUGGER_H
+#define DEBUGGER_H
+
+// Time travel debugging. A Debugger runs an Env one step at a time and can go backwards too.
+// A step is one line, except that blank lines and comments go along with the line after them.
+//
+// Every step leaves a DebugUndo with the acc, line and flags from before it and the old value of
+// every cell(or register) it was about to write, so going back one step is just putting those
+// back. That log only goes back to the last checkpoint, which is a copy of the Env(without its
+// input and output, which are kept once for the whole run) taken every "interval" steps. To go
+// back further, or to jump to any step, the closest checkpoint before it gets restored and run
+// forward from, so it takes time proportional to how far that is from a checkpoint. Programs
+// always do the same thing given the same input, so running forward again always ends up in the
+// same place.
+//
+// The checkpoints have to fit in budgetBytes. When they don't, every other one gets dropped and
+// the interval doubles, so a run of billions of steps still only keeps a few dozen of them, just
+// further apart.
+//
+// Sped up loops(see loopopt.h) are run one trip at a time, limits are ignored, and programs
+// with threads= or a memfile= can't be debugged, since the other threads(or the file)
+// wouldn't go back with it.
+
+struct DebugWrite {
+	int addr;   // -1 - which register it is for r0 to r15
+	int old;
+};
+
+struct DebugUndo {
+	int reg;
+	int line;
+	long long steps;
+	bool nullReg;
+	bool isEnd;
+	bool endProgram;
+	size_t inputLeft;    // env.input.size() before the step
+	size_t outputSize;   // env.output.size() before the step
+	size_t firstWrite;   // Its writes are Debugger::writes from here to the next one's
+};
+
+struct DebugCheckpoint {
+	long long step;
+	Env env;             // With input and output empty
+	size_t inputUsed;    // How much of Debugger::input had been read
+	size_t outputSize;
+};
+
+struct Debugger {
+	Env env;
+	long long step{0};                 // How many steps have been run
+	std::vector<int> input;            // All the input it's been given, read or not
+	std::deque<int> output;            // The output of the furthest it's been
+	std::vector<DebugCheckpoint> checkpoints;  // In order of step, and there's always one at 0
+	long long interval{1024};
+	size_t budgetBytes{64u << 20};
+	long long segmentStart{0};         // undo goes back to this step
+	std::vector<DebugUndo> undo;
+	std::vector<DebugWrite> writes;
+};
+
+// Starts debugging env from where it is. Throws a CaiError if it has threads
+void setupDebugger(Debugger &dbg, Env env, size_t budgetBytes = 64u << 20);
+
+// Runs one step. Returns RUNNING if it did, and otherwise why it couldn't(ENDED, or BLOCKED_INPUT
+// until debugPushInput gives it something), without changing anything. If the step throws, the
+// Env is put back to how it was before it and the error is rethrown
+RunStatus debugStep(Debugger &dbg);
+// Runs until the program stops or maxSteps more steps have been run(if maxSteps >= 0)
+RunStatus debugContinue(Debugger &dbg, long long maxSteps = -1);
+// Goes back one step. False if it's already at step 0
+bool debugStepBack(Debugger &dbg);
+// Goes back to just before the last step that wrote to the cell at addr, so stepping forward
+// once shows the write. False if no step did, and then it's left at step 0
+bool debugReverseToWrite(Debugger &dbg, int addr);
+// Goes to step n, or as close to it as it can get if the program stops before then
+RunStatus debugGoTo(Debugger &dbg, long long n);
+void debugPushInput(Debugger &dbg, int value);
+
+#endif
@@ -0,0 +1,115 @@
+/*
+ *	This file is a part of ConfigurableAssemblyIntepreter.
+ *
+ *	ConfigurableAssemblyIntepreter is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ConfigurableAssemblyIntepreter is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+
+#include "envpool.h"
+
+#ifndef ENVPOOL_CPP
+#define ENVPOOL_CPP
+
+void initEnvPool(EnvPool &pool, ProgramRef prog) {
+	const EnvConfig &config = prog->config;
+	if (!config.memFile.empty()) {
+		throw CaiError(CaiErrc::BAD_CONFIG, "Programs with a memfile can't be pooled");
+	}
+	std::lock_guard<std::mutex> guard(pool.lock);
+	// Whoever has one still has a reference to it, so they can't be thrown away yet
+	for (const std::unique_ptr<PooledEnv> &p : pool.envs) {
+		if (p->inUse) {
+			throw CaiError(CaiErrc::BAD_CONFIG, "An EnvPool can't be set up again while any of its Envs are acquired");
+		}
+	}
+	pool.envs.clear();
+	pool.idle.clear();
+	pool.pristine.assign(config.memSize, 0);
+	std::copy(config.initialMemory.begin(), config.initialMemory.end(), pool.pristine.begin());
+	pool.program = std::move(prog);
+}
+
+// A new Env for the pool, with its memory marking its own pages
+static std::unique_ptr<PooledEnv> makePooledEnv(const EnvPool &pool) {
+	std::unique_ptr<PooledEnv> p = std::make_unique<PooledEnv>();
+	const size_t pages = (pool.pristine.size() + (1 << DIRTY_PAGE_SHIFT) - 1) >> DIRTY_PAGE_SHIFT;
+	p->dirty.flags.assign(pages, 0);
+	p->dirty.pages.reserve(pages);
+	Memory mem(std::vector<int>(pool.pristine));
+	mem.dirty = &p->dirty;
+	p->env = setupEnvironment(pool.program->config, pool.program, std::move(mem));
+	return p;
+}
+
+PooledEnv& acquireEnv(EnvPool &pool) {
+	{
+		std::lock_guard<std::mutex> guard(pool.lock);
+		if (!pool.idle.empty()) {
+			PooledEnv *p = pool.idle.back();
+			pool.idle.pop_back();
+			p->inUse = true;
+			pool.reused++;
+			return *p;
+		}
+	}
+	// Copying the memory can take a while, so it's done without holding the lock
+	std::unique_ptr<PooledEnv> made = makePooledEnv(pool);
+	made->inUse = true;
+	std::lock_guard<std::mutex> guard(pool.lock);
+	pool.envs.push_back(std::move(made));
+	pool.made++;
+	return *pool.envs.back();
+}
+
+void releaseEnv(EnvPool &pool, PooledEnv &p) {
+	Env &env = p.env;
+	Memory mem = std::move(env.memory);
+	long long restored = 0;
+	bool full = false;
+	if (mem.dirty != &p.dirty || mem.size() != pool.pristine.size()) {
+		// It isn't the memory it was given anymore, so nothing about it can be trusted
+		for (int page : p.dirty.pages) {
+			p.dirty.flags[page] = 0;
+		}
+		p.dirty.pages.clear();
+		mem = std::vector<int>(pool.pristine);
+		mem.dirty = &p.dirty;
+		full = true;
+	} else {
+		const size_t pageCells = (size_t)1 << DIRTY_PAGE_SHIFT;
+		for (int page : p.dirty.pages) {
+			const size_t first = (size_t)page << DIRTY_PAGE_SHIFT;
+			const size_t n = std::min(pageCells, mem.size() - first);
+			std::copy(pool.pristine.begin() + first, pool.pristine.begin() + first + n, mem.data() + first);
+			p.dirty.flags[page] = 0;
+		}
+		restored = (long long)p.dirty.pages.size();
+		p.dirty.pages.clear();
+	}
+	// Everything else goes back to how a new one would be, besides the closure engine's code,
+	// which is still for the same program
+	std::shared_ptr<const ClosureProgram> closures = std::move(env.closures);
+	ProgramRef closuresFor = std::move(env.closuresFor);
+	env = setupEnvironment(pool.program->config, pool.program, std::move(mem));
+	env.closures = std::move(closures);
+	env.closuresFor = std::move(closuresFor);
+
+	std::lock_guard<std::mutex> guard(pool.lock);
+	pool.pagesRestored += restored;
+	pool.fullRestores += full ? 1 : 0;
+	p.inUse = false;
+	pool.idle.push_back(&p);
+}
+
+#endif
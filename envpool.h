@@ -0,0 +1,76 @@
+// -*- grammar-ext: .cpp -*-
+/*
+ *	This file is a part of ConfigurableAssemblyIntepreter.
+ *
+ *	ConfigurableAssemblyIntepreter is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ConfigurableAssemblyIntepreter is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "mainLib.h"
+
+#ifndef ENVPOOL_H
+#define ENVPOOL_H
+
+// Envs that get used over and over for runs of the same program, for batches of lots of short
+// runs where making a new Env every time(allocating the memory, zeroing it and copying the
+// initial memory in) would cost more than the run does.
+//
+//   EnvPool pool;
+//   initEnvPool(pool, prog);
+//   PooledEnv &p = acquireEnv(pool);  // The same as createInstance(prog) would give
+//   pushInput(p.env, 5);
+//   runEnvironment(p.env);
+//   releaseEnv(pool, p);              // Puts it back how it started
+//
+// Every write to a pooled Env's memory marks its page(see DirtyPages in mainLib.h), so releasing
+// one only copies the pages the run wrote back from the pool's copy of the starting memory, and
+// the time it takes is down to what the run touched and not how big the memory is. Everything
+// else in the Env goes back to how setupEnvironment makes it, so anything like a memory profiler
+// or a sink has to be set again after each acquireEnv. If something swaps the memory out for a
+// new one(like a result cache hit) the whole memory gets put back instead.
+//
+// Custom instructions that write to env.memory directly instead of through getDerefp, getRangep
+// or setDeref have to call env.memory.touch, or the cells they wrote won't get put back.
+// Programs with a memfile= can't be pooled, since their memory is the file's.
+
+struct PooledEnv {
+	Env env;
+	DirtyPages dirty;
+	bool inUse{false};
+};
+
+struct EnvPool {
+	ProgramRef program;
+	std::vector<int> pristine;  // The memory every run starts with
+	std::vector<std::unique_ptr<PooledEnv>> envs;
+	std::vector<PooledEnv*> idle;
+	std::mutex lock;            // acquireEnv and releaseEnv can be called from any thread
+	// How it's been going
+	long long made{0};          // Envs made because there wasn't an idle one
+	long long reused{0};
+	long long pagesRestored{0};
+	long long fullRestores{0};  // Resets that had to put the whole memory back
+};
+
+// Sets the pool up for prog, throwing away any Envs it had for another one. Throws a
+// CaiError(BAD_CONFIG) if prog has a memfile=, or if any of its Envs are still acquired
+void initEnvPool(EnvPool &pool, ProgramRef prog);
+// An Env for a new run, made if there isn't an idle one
+PooledEnv& acquireEnv(EnvPool &pool);
+// Resets p and lets it be acquired again. p has to be one of pool's and not be used after this
+void releaseEnv(EnvPool &pool, PooledEnv &p);
+
+#endif
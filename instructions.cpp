@@ -16,12 +16,17 @@
  */
 //#include "environment.h"
 //#include "instructions.h"
+#include <atomic>
 #include <functional>
 #include <map>
 #include <vector>
+#include <cstring>
 #include "instructions.h"
 #include "instructionsEnum.h"
 #include "mainLib.h"
+#include "memprofile.h"
+#include "simd.h"
+#include "threads.h"
 
 
 #ifndef INSTRUCTIONS
@@ -76,18 +81,18 @@
 */
 
 
-void nop(Env &env, std::vector<Arg> args) {
+void nop(Env &env, const std::vector<Arg> &) {
 	// Do nothing
 	env.line++;     // Move to next line
 	env.steps++;    // Increment steps
 }
 
-void label(Env &env, std::vector<Arg> args) {
+void label(Env &env, const std::vector<Arg> &) {
 	// Same as nop, but without incrementing steps 
 	env.line++;
 }
 
-void mov(Env &env, std::vector<Arg> args) {
+void mov(Env &env, const std::vector<Arg> &args) {
 
 	int val1 = getDeref(env, args[0]);     // Get the possibly dereferenced value from the first argument
 	setDeref(env, args[1], val1);          // Set the possibly dereferenced value to the referenced value from the first argument
@@ -96,7 +101,7 @@ void mov(Env &env, std::vector<Arg> args) {
 	env.steps++;
 }
 
-void cpf(Env &env, std::vector<Arg> args) {
+void cpf(Env &env, const std::vector<Arg> &args) {
 	env.reg = getDeref(env, args[0]);
 
 	env.line++;
@@ -104,7 +109,7 @@ void cpf(Env &env, std::vector<Arg> args) {
 	//return env;
 }
 
-void cpt(Env &env, std::vector<Arg> args) {
+void cpt(Env &env, const std::vector<Arg> &args) {
 	setDeref(env, args[0], env.reg);  // Set memory block at arg1 to the value in the register
 
 	env.line++;
@@ -112,7 +117,7 @@ void cpt(Env &env, std::vector<Arg> args) {
 	//return env;
 }
 
-void add(Env &env, std::vector<Arg> args) {
+void add(Env &env, const std::vector<Arg> &args) {
 	int val = getDeref(env, args[0]);
 	env.reg += val;                   // Add value in memory to current register
 
@@ -121,7 +126,7 @@ void add(Env &env, std::vector<Arg> args) {
 	//return env;
 }
 
-void sub(Env &env, std::vector<Arg> args) {
+void sub(Env &env, const std::vector<Arg> &args) {
 	int val = getDeref(env, args[0]);
 	env.reg -= val;  // Set reg = reg - val;
 	
@@ -129,25 +134,25 @@ void sub(Env &env, std::vector<Arg> args) {
 	env.steps++;
 }
 
-void inc(Env &env, std::vector<Arg> args) {
+void inc(Env &env, const std::vector<Arg> &args) {
 	int *val = getDerefp(env, args[0]); // Get pointer to value to use ++ operator
 	// Increment the value val is pointing to
-	val++;
+	(*val)++;
 	env.line++;
 	env.steps++;
 	//return env;
 }
 
-void dec(Env &env, std::vector<Arg> args) {
+void dec(Env &env, const std::vector<Arg> &args) {
 	int *val = getDerefp(env, args[0]);
 	
-	val--;
+	(*val)--;
 	env.line++;
 	env.steps++;
 	//return env;
 }
 
-void jmp(Env &env, std::vector<Arg> args) {
+void jmp(Env &env, const std::vector<Arg> &args) {
 	// For jmp, the args will actually be different
 	// The value of the arg will be the line number to jump to
 	// instead of a memory address
@@ -156,7 +161,7 @@ void jmp(Env &env, std::vector<Arg> args) {
 	env.steps++;
 }
 
-void jiz(Env &env, std::vector<Arg> args) {
+void jiz(Env &env, const std::vector<Arg> &args) {
 	if (env.reg == 0) {
 		env.line = args[0].value;
 	} else {
@@ -165,7 +170,7 @@ void jiz(Env &env, std::vector<Arg> args) {
 	env.steps++;
 }
 
-void jlz(Env &env, std::vector<Arg> args) {
+void jlz(Env &env, const std::vector<Arg> &args) {
 	if (env.reg < 0) {
 		env.line = args[0].value;
 	} else {
@@ -174,27 +179,243 @@ void jlz(Env &env, std::vector<Arg> args) {
 	env.steps++;
 }
 
+// The jmp at the end of a loop that loopopt.cpp knows how to speed up. args[1] is which
+// one of the program's loops it is. Jumps like jmp does, then skips whatever whole trips it can
+void jmploop(Env &env, const std::vector<Arg> &args) {
+	env.line = args[0].value;
+	env.steps++;
+	accelerateLoop(env, env.program->loops[args[1].value]);
+}
+
+void addreg(Env &env, const std::vector<Arg> &args) {
+	int val = getDeref(env, args[0]);
+	env.regs[args[1].value] += val;
+	env.line++;
+	env.steps++;
+}
+
+void subreg(Env &env, const std::vector<Arg> &args) {
+	int val = getDeref(env, args[0]);
+	env.regs[args[1].value] -= val;
+	env.line++;
+	env.steps++;
+}
+
+void jizreg(Env &env, const std::vector<Arg> &args) {
+	if (env.regs[args[1].value] == 0) {
+		env.line = args[0].value;
+	} else {
+		env.line++;
+	}
+	env.steps++;
+}
+
+void jlzreg(Env &env, const std::vector<Arg> &args) {
+	if (env.regs[args[1].value] < 0) {
+		env.line = args[0].value;
+	} else {
+		env.line++;
+	}
+	env.steps++;
+}
+
+OpFunc lineFunc(Op op, const std::vector<Arg> &args) {
+	if (args.size() >= 2 && args[1].mode == ArgMode::REGISTER) {
+		switch (op) {
+			case Op::ADD:              return addreg;
+			case Op::SUB:              return subreg;
+			case Op::JUMP_IF_ZERO:     return jizreg;
+			case Op::JUMP_IF_NEGATIVE: return jlzreg;
+			default:                   break;
+		}
+	}
+	OpToFuncmap_t::const_iterator it = optofunc.find(op);
+	return it != optofunc.end() ? it->second : nullptr;
+}
+
 // Sets the current register to the number of input values left
-void gis(Env &env, std::vector<Arg> args) {
+void gis(Env &env, const std::vector<Arg> &) {
 	setReg(env, env.input.size());
 	env.line++;
 	env.steps++;
 }
 
-void inp(Env &env, std::vector<Arg> args) {
+void inp(Env &env, const std::vector<Arg> &) {
+	if (env.input.empty()) {
+		// Nothing to read yet, so stay on this line and let whoever is
+		// running the program push more input and resume it
+		env.status = RunStatus::BLOCKED_INPUT;
+		return;
+	}
 	// Get input value, and set current register to it
-	setReg(env, env.input.front()); env.input.pop();
+	setReg(env, env.input.front()); env.input.pop_front();
+	env.line++;
+	env.steps++;
+}
+
+void out(Env &env, const std::vector<Arg> &) {
+	if (env.outputSink != nullptr) {
+		if (!sinkPut(*env.outputSink, env.reg)) {
+			// Same as inp with no input, stay on this line until there's room
+			env.status = RunStatus::BLOCKED_OUTPUT;
+			return;
+		}
+		getReg(env, true);
+		env.line++;
+		env.steps++;
+		return;
+	}
+	env.output.push_back(getReg(env, true));
+	env.line++;
+	env.steps++;
+}
+
+// The block instructions. See instructionsEnum.h for what each one does.
+// They all work on whole ranges with the kernels in simd.cpp and only count as one step.
+
+// Makes sure a block instruction got all of its arguments, since they'd be read past the end otherwise
+static void needArgs(Env &env, const std::vector<Arg> &args, int count) {
+	if ((int)args.size() < count) {
+		throw CaiError(CaiErrc::BAD_ARGUMENT, "Instruction needs " + std::to_string(count) +
+			" arguments on program line " + std::to_string(env.line), env.line);
+	}
+}
+
+void fill(Env &env, const std::vector<Arg> &args) {
+	needArgs(env, args, 3);
+	int n = getDeref(env, args[1]);
+	int v = getDeref(env, args[2]);
+	int *dst = getRangep(env, args[0], n, MemAccess::WRITE);
+	bulkKernels().fill(dst, n, v);
+	env.line++;
+	env.steps++;
+}
+
+void bcp(Env &env, const std::vector<Arg> &args) {
+	needArgs(env, args, 3);
+	int n = getDeref(env, args[2]);
+	const int *src = getRangep(env, args[0], n, MemAccess::READ);
+	int *dst = getRangep(env, args[1], n, MemAccess::WRITE);
+	// memmove is already as fast as a copy gets, and deals with the ranges overlapping
+	memmove(dst, src, (size_t)n * sizeof(int));
+	env.line++;
+	env.steps++;
+}
+
+void badd(Env &env, const std::vector<Arg> &args) {
+	needArgs(env, args, 3);
+	int n = getDeref(env, args[1]);
+	int v = getDeref(env, args[2]);
+	int *dst = getRangep(env, args[0], n, MemAccess::WRITE);
+	bulkKernels().addScalar(dst, n, v);
+	env.line++;
+	env.steps++;
+}
+
+void bsum(Env &env, const std::vector<Arg> &args) {
+	needArgs(env, args, 2);
+	int n = getDeref(env, args[1]);
+	const int *src = getRangep(env, args[0], n, MemAccess::READ);
+	setReg(env, bulkKernels().sum(src, n));
+	env.line++;
+	env.steps++;
+}
+
+// Works as if all of [a, a+n) was read before anything in [b, b+n) was written
+void vadd(Env &env, const std::vector<Arg> &args) {
+	needArgs(env, args, 3);
+	int n = getDeref(env, args[2]);
+	const int *src = getRangep(env, args[0], n, MemAccess::READ);
+	int *dst = getRangep(env, args[1], n, MemAccess::WRITE);
+	if (dst > src && dst < src + n) {
+		// The kernels go forwards, so this overlap would read values they already wrote
+		std::vector<int> copy(src, src + n);
+		bulkKernels().addRanges(copy.data(), dst, n);
+	} else {
+		bulkKernels().addRanges(src, dst, n);
+	}
+	env.line++;
+	env.steps++;
+}
+
+void bfind(Env &env, const std::vector<Arg> &args) {
+	needArgs(env, args, 3);
+	int n = getDeref(env, args[1]);
+	int v = getDeref(env, args[2]);
+	const int *src = getRangep(env, args[0], n, MemAccess::READ);
+	setReg(env, bulkKernels().find(src, n, v));
 	env.line++;
 	env.steps++;
 }
 
-void out(Env &env, std::vector<Arg> args) {
-	env.output.push(getReg(env, true));
+// The atomic instructions. See threads.h for what the plain ones are allowed to do when
+// threads share memory. All of these are sequentially consistent except ldacq and strel
+
+void fadd(Env &env, const std::vector<Arg> &args) {
+	needArgs(env, args, 1);
+	int *cell = getDerefp(env, args[0]);
+	env.reg = std::atomic_ref<int>(*cell).fetch_add(env.reg);
+	env.line++;
+	env.steps++;
+}
+
+void cas(Env &env, const std::vector<Arg> &args) {
+	needArgs(env, args, 2);
+	int desired = getDeref(env, args[1]);
+	int *cell = getDerefp(env, args[0]);
+	int expected = env.reg;
+	// If it doesn't match, expected gets set to what's there. So acc is unchanged if and only if it worked
+	std::atomic_ref<int>(*cell).compare_exchange_strong(expected, desired);
+	env.reg = expected;
+	env.line++;
+	env.steps++;
+}
+
+void ldacq(Env &env, const std::vector<Arg> &args) {
+	needArgs(env, args, 1);
+	if (args[0].mode == ArgMode::REGISTER) {
+		env.reg = env.regs[args[0].value];  // Registers are the thread's own
+		env.line++;
+		env.steps++;
+		return;
+	}
+	// Like getDeref, so it's a read to the profiler and doesn't mark the page for an EnvPool
+	int addr = checkAddress(env, resolveAddress(env, args[0]));
+	env.reg = std::atomic_ref<int>(env.memory[addr]).load(std::memory_order_acquire);
+	if (env.memProfile != nullptr) {
+		recordMemAccess(*env.memProfile, env.line, addr, args[0].derefLevel, MemAccess::READ);
+	}
+	env.line++;
+	env.steps++;
+}
+
+void strel(Env &env, const std::vector<Arg> &args) {
+	needArgs(env, args, 1);
+	int *cell = getDerefp(env, args[0]);
+	std::atomic_ref<int>(*cell).store(env.reg, std::memory_order_release);
+	env.line++;
+	env.steps++;
+}
+
+void fence(Env &env, const std::vector<Arg> &) {
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	env.line++;
+	env.steps++;
+}
+
+// Without threads there's nobody else to wait for, so it's just a nop
+void barrier(Env &env, const std::vector<Arg> &) {
+	if (env.group != nullptr) {
+		waitAtBarrier(env);
+	}
+	env.line++;
+	env.steps++;
 }
 
-void endprog(Env &env, std::vector<Arg> args) {
+void endprog(Env &env, const std::vector<Arg> &) {
 	// Set endprogram flag to true
 	env.states[IS_END] = true;
+	env.endProgram = true;
 }
 
 #endif
@@ -15,6 +15,7 @@
  *  You should have received a copy of the GNU General Public License
  *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
+#include <set>
 #include <vector>
 
 #include "instructionsEnum.h"
@@ -23,35 +24,58 @@
 #ifndef INSTRUCTIONS_H
 #define INSTRUCTIONS_H
 
-//using OpFunc = std::function<void(Env&,std::vector<Arg>)>;
-using OpFunc = void(*)(Env&,std::vector<Arg>);
+//using OpFunc = std::function<void(Env&,const std::vector<Arg>&)>;
+using OpFunc = void(*)(Env&, const std::vector<Arg>&);
 using OpToFuncmap_t = std::map<Op,OpFunc>;
 using strToOpmap_t = std::map<std::string,Op>;
 
 //OpToFuncmap_t optofunc;
 //strToOpmap_t strtoop;
 
-void nop(Env &env, std::vector<Arg> args);
-void label(Env &env, std::vector<Arg> args);
+void nop(Env &env, const std::vector<Arg> &args);
+void label(Env &env, const std::vector<Arg> &args);
 
-void mov(Env &env, std::vector<Arg> args);
+void mov(Env &env, const std::vector<Arg> &args);
 
-void cpf(Env &env, std::vector<Arg> args);
-void cpt(Env &env, std::vector<Arg> args);
+void cpf(Env &env, const std::vector<Arg> &args);
+void cpt(Env &env, const std::vector<Arg> &args);
 
-void add(Env &env, std::vector<Arg> args);
-void sub(Env &env, std::vector<Arg> args);
+void add(Env &env, const std::vector<Arg> &args);
+void sub(Env &env, const std::vector<Arg> &args);
 
-void inc(Env &env, std::vector<Arg> args);
-void dec(Env &env, std::vector<Arg> args);
-void endprog(Env &env, std::vector<Arg> args);
+void inc(Env &env, const std::vector<Arg> &args);
+void dec(Env &env, const std::vector<Arg> &args);
+void endprog(Env &env, const std::vector<Arg> &args);
 
-void jmp(Env &env, std::vector<Arg> args);
-void jiz(Env &env, std::vector<Arg> args);
-void jlz(Env &env, std::vector<Arg> args);
+void jmp(Env &env, const std::vector<Arg> &args);
+void jiz(Env &env, const std::vector<Arg> &args);
+void jlz(Env &env, const std::vector<Arg> &args);
+void jmploop(Env &env, const std::vector<Arg> &args);
 
-void inp(Env &env, std::vector<Arg> args);
-void out(Env &env, std::vector<Arg> args);
+// The two argument forms that work on a register instead of the acc. "add 5 r1" adds memory[5]
+// to r1, "sub #1 r1" takes 1 from it, and "jiz r1 done"(which has the label first in its args,
+// like every other jump) jumps if r1 is 0. lineFunc picks these for them
+void addreg(Env &env, const std::vector<Arg> &args);
+void subreg(Env &env, const std::vector<Arg> &args);
+void jizreg(Env &env, const std::vector<Arg> &args);
+void jlzreg(Env &env, const std::vector<Arg> &args);
+
+void inp(Env &env, const std::vector<Arg> &args);
+void out(Env &env, const std::vector<Arg> &args);
+
+void fadd(Env &env, const std::vector<Arg> &args);
+void cas(Env &env, const std::vector<Arg> &args);
+void ldacq(Env &env, const std::vector<Arg> &args);
+void strel(Env &env, const std::vector<Arg> &args);
+void fence(Env &env, const std::vector<Arg> &args);
+void barrier(Env &env, const std::vector<Arg> &args);
+
+void fill(Env &env, const std::vector<Arg> &args);
+void bcp(Env &env, const std::vector<Arg> &args);
+void badd(Env &env, const std::vector<Arg> &args);
+void bsum(Env &env, const std::vector<Arg> &args);
+void vadd(Env &env, const std::vector<Arg> &args);
+void bfind(Env &env, const std::vector<Arg> &args);
 
 // Use this to create a map from the OP enum class to the func
 const OpToFuncmap_t optofunc {
@@ -69,9 +93,26 @@ const OpToFuncmap_t optofunc {
 	{Op::JUMP_IF_NEGATIVE, jlz},
 	{Op::INP, inp},
 	{Op::OUT, out},
-	{Op::END, endprog}
+	{Op::END, endprog},
+	{Op::FILL, fill},
+	{Op::BLOCK_COPY, bcp},
+	{Op::BLOCK_ADD, badd},
+	{Op::BLOCK_SUM, bsum},
+	{Op::VECTOR_ADD, vadd},
+	{Op::BLOCK_FIND, bfind},
+	{Op::LOOP_JUMP, jmploop},
+	{Op::FETCH_ADD, fadd},
+	{Op::COMPARE_SWAP, cas},
+	{Op::LOAD_ACQUIRE, ldacq},
+	{Op::STORE_RELEASE, strel},
+	{Op::FENCE, fence},
+	{Op::BARRIER, barrier}
 };
 
+// The func a line of op with these arguments runs. That's the one in optofunc, unless it's
+// one of the register forms above. nullptr if op doesn't have one
+OpFunc lineFunc(Op op, const std::vector<Arg> &args);
+
 // A map from the string of an operation to the enum class OP
 // Note, some of these, namely the label, will need to be treated specially
 const strToOpmap_t strtoop {
@@ -89,12 +130,30 @@ const strToOpmap_t strtoop {
 	{"jlz", Op::JUMP_IF_NEGATIVE},
 	{"inp", Op::INP},
 	{"out", Op::OUT},
-	{"end", Op::END}
+	{"end", Op::END},
+	{"fill", Op::FILL},
+	{"bcp", Op::BLOCK_COPY},
+	{"badd", Op::BLOCK_ADD},
+	{"bsum", Op::BLOCK_SUM},
+	{"vadd", Op::VECTOR_ADD},
+	{"bfind", Op::BLOCK_FIND},
+	{"fadd", Op::FETCH_ADD},
+	{"cas", Op::COMPARE_SWAP},
+	{"ldacq", Op::LOAD_ACQUIRE},
+	{"strel", Op::STORE_RELEASE},
+	{"fence", Op::FENCE},
+	{"barrier", Op::BARRIER}
 };
 
+// Ops that don't always do the same thing given the same memory, register and input(like
+// reading a clock or making random numbers). A program with any of these in it never gets its
+// runs put in the result cache, so add any custom instructions like that here
+const std::set<Op> nondeterministicOps {};
+
 enum State {
 	IS_END,          // For when the program has ended
-	NULL_REGISTER    // Means the register is null. This can't be done normally
+	NULL_REGISTER,   // Means the register is null. This can't be done normally
+	NUM_STATES       // Not a state, just the number of them so Env::states can be sized
 };
 
 #endif
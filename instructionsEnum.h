@@ -18,7 +18,28 @@ enum class Op {
 	INP,                // 12  "inp"      Get one input value and store to acc
 	OUT,                // 13  "out"      Output one value
 	END,                // 14  "end"      for when the program has ended
-	LABEL               // 15  "*:"       For completeness, a label is considered an operation
+	LABEL,              // 15  "*:"       For completeness, a label is considered an operation
+	// Block instructions. a is the first address of a range(so it can be dereferenced like
+	// any other argument), and n and v are read from memory like the argument of "add" is.
+	// Each one is a single step no matter how long the range is.
+	FILL,               // 16  "fill a n v"   Set [a, a+n) to v
+	BLOCK_COPY,         // 17  "bcp a b n"    Copy [a, a+n) to [b, b+n). The ranges can overlap
+	BLOCK_ADD,          // 18  "badd a n v"   Add v to everything in [a, a+n)
+	BLOCK_SUM,          // 19  "bsum a n"     Set acc to the sum of [a, a+n)
+	VECTOR_ADD,         // 20  "vadd a b n"   Add [a, a+n) to [b, b+n) element by element
+	BLOCK_FIND,         // 21  "bfind a n v"  Set acc to the index of the first v in [a, a+n), or -1
+	LOOP_JUMP,          // 22  A "jmp" that closes a loop findCountedLoops can speed up. Not written by hand
+	// Atomic instructions, for programs with "threads=" in the ENVDEF(see threads.h). They work
+	// the same in a program without threads, they're just slower than the plain ones
+	FETCH_ADD,          // 23  "fadd a"     Add acc to a, and set acc to what a was before
+	COMPARE_SWAP,       // 24  "cas a b"    If a == acc then set a to b. Either way acc is set to what a was
+	LOAD_ACQUIRE,       // 25  "ldacq a"    cpf, but nothing after it can happen before it
+	STORE_RELEASE,      // 26  "strel a"    cpt, but nothing before it can happen after it
+	FENCE,              // 27  "fence"      Nothing before it can happen after it and nothing after it can happen before it
+	BARRIER             // 28  "barrier"    Wait until every thread still running gets to a barrier
 };
 
+// Not an Op, just how many there are so things can be indexed by them
+constexpr int NUM_OPS = (int)Op::BARRIER + 1;
+
 #endif
\ No newline at end of file
@@ -0,0 +1,269 @@
+/*
+ *	This file is a part of ConfigurableAssemblyIntepreter.
+ *
+ *	ConfigurableAssemblyIntepreter is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ConfigurableAssemblyIntepreter is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <charconv>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CAI_X86 1
+#endif
+
+#include "lexscan.h"
+#include "simd.h"
+
+#ifndef LEXSCAN_CPP
+#define LEXSCAN_CPP
+
+// Bitmasks for one 64 byte block. Bit i is byte i of the block
+struct BlockMasks {
+	uint64_t nl;     // '\n'
+	uint64_t sep;    // Anything that ends a token: whitespace, '\n', and in array mode ',' '[' ']'
+	uint64_t slash;  // '/', to find "//"
+};
+
+static void classifyScalar(const char *p, bool arrayMode, BlockMasks &m) {
+	m.nl = m.sep = m.slash = 0;
+	for (int i = 0; i < 64; i++) {
+		char c = p[i];
+		uint64_t bit = (uint64_t)1 << i;
+		if (c == '\n') {
+			m.nl |= bit;
+		}
+		if (c == ' ' || c == '\t' || c == '\r' || c == '\n' ||
+			(arrayMode && (c == ',' || c == '[' || c == ']'))) {
+			m.sep |= bit;
+		}
+		if (c == '/') {
+			m.slash |= bit;
+		}
+	}
+}
+
+#ifdef CAI_X86
+
+__attribute__((target("sse2")))
+static void classifySSE2(const char *p, bool arrayMode, BlockMasks &m) {
+	m.nl = m.sep = m.slash = 0;
+	for (int i = 0; i < 4; i++) {
+		__m128i x = _mm_loadu_si128((const __m128i*)(p + i * 16));
+		__m128i nl = _mm_cmpeq_epi8(x, _mm_set1_epi8('\n'));
+		__m128i sep = _mm_or_si128(_mm_or_si128(nl, _mm_cmpeq_epi8(x, _mm_set1_epi8(' '))),
+			_mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('\t')), _mm_cmpeq_epi8(x, _mm_set1_epi8('\r'))));
+		if (arrayMode) {
+			sep = _mm_or_si128(sep, _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(',')),
+				_mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('[')), _mm_cmpeq_epi8(x, _mm_set1_epi8(']')))));
+		}
+		__m128i slash = _mm_cmpeq_epi8(x, _mm_set1_epi8('/'));
+		m.nl    |= (uint64_t)(uint16_t)_mm_movemask_epi8(nl) << (i * 16);
+		m.sep   |= (uint64_t)(uint16_t)_mm_movemask_epi8(sep) << (i * 16);
+		m.slash |= (uint64_t)(uint16_t)_mm_movemask_epi8(slash) << (i * 16);
+	}
+}
+
+__attribute__((target("avx2")))
+static void classifyAVX2(const char *p, bool arrayMode, BlockMasks &m) {
+	m.nl = m.sep = m.slash = 0;
+	for (int i = 0; i < 2; i++) {
+		__m256i x = _mm256_loadu_si256((const __m256i*)(p + i * 32));
+		__m256i nl = _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\n'));
+		__m256i sep = _mm256_or_si256(_mm256_or_si256(nl, _mm256_cmpeq_epi8(x, _mm256_set1_epi8(' '))),
+			_mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('\t')), _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\r'))));
+		if (arrayMode) {
+			sep = _mm256_or_si256(sep, _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(',')),
+				_mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('[')), _mm256_cmpeq_epi8(x, _mm256_set1_epi8(']')))));
+		}
+		__m256i slash = _mm256_cmpeq_epi8(x, _mm256_set1_epi8('/'));
+		m.nl    |= (uint64_t)(uint32_t)_mm256_movemask_epi8(nl) << (i * 32);
+		m.sep   |= (uint64_t)(uint32_t)_mm256_movemask_epi8(sep) << (i * 32);
+		m.slash |= (uint64_t)(uint32_t)_mm256_movemask_epi8(slash) << (i * 32);
+	}
+}
+
+#endif
+
+using ClassifyFunc = void(*)(const char*, bool, BlockMasks&);
+
+static ClassifyFunc classifierFor(LexKernel kernel) {
+	if (kernel == LexKernel::AUTO) {
+		kernel = bestLexKernel();
+	}
+#ifdef CAI_X86
+	if (kernel == LexKernel::AVX2) {
+		return classifyAVX2;
+	}
+	if (kernel == LexKernel::SSE2) {
+		return classifySSE2;
+	}
+#endif
+	return classifyScalar;
+}
+
+// Uses whatever simd.cpp picked for the block instructions, so CAI_SIMD works for both
+LexKernel bestLexKernel() {
+	const char *name = bulkKernels().name;
+	if (strcmp(name, "avx2") == 0) {
+		return LexKernel::AVX2;
+	} else if (strcmp(name, "sse2") == 0) {
+		return LexKernel::SSE2;
+	}
+	return LexKernel::SCALAR;
+}
+
+const char* lexKernelName(LexKernel kernel) {
+	switch (kernel) {
+		case LexKernel::AUTO:   return "auto";
+		case LexKernel::SCALAR: return "scalar";
+		case LexKernel::SSE2:   return "sse2";
+		case LexKernel::AVX2:   return "avx2";
+	}
+	return "unknown";
+}
+
+// The part both lexSource and scanIntArray share. Calls onToken(start, end) for every token and
+// onLine(start, end) for every line, in order. Comments are only looked for if arrayMode is false
+template <class TokenFunc, class LineFunc>
+static void scanBlocks(const char *src, size_t len, bool arrayMode, ClassifyFunc classify,
+                       TokenFunc onToken, LineFunc onLine) {
+	char tail[64];
+	uint64_t prevNonSep = 0;     // 1 if the last byte of the previous block was part of a token
+	bool inComment = false;
+	bool tokenOpen = false;
+	size_t tokenStart = 0;
+	size_t lineStart = 0;
+
+	for (size_t base = 0; base < len; base += 64) {
+		const char *p = src + base;
+		size_t valid = len - base;
+		if (valid < 64) {
+			// Pad the last block with spaces, which are separators, so any open token gets ended
+			memset(tail, ' ', sizeof(tail));
+			memcpy(tail, p, valid);
+			p = tail;
+		}
+		BlockMasks m;
+		classify(p, arrayMode, m);
+
+		uint64_t nonSep = ~m.sep;
+		uint64_t starts = nonSep & ~((nonSep << 1) | prevNonSep);
+		uint64_t ends = m.sep & ((nonSep << 1) | prevNonSep);
+		uint64_t comments = 0;
+		if (!arrayMode && m.slash != 0) {
+			// "//" starts at i if i and i+1 are both '/'. Bit 63 needs the first byte of the next block
+			uint64_t nextSlash = (base + 64 < len && src[base + 64] == '/') ? 1 : 0;
+			comments = m.slash & ((m.slash >> 1) | (nextSlash << 63));
+		}
+		prevNonSep = nonSep >> 63;
+
+		uint64_t events = starts | ends | m.nl | comments;
+		if (valid < 64) {
+			// Nothing past the end counts, except for ending a token right at the end
+			uint64_t keep = ((uint64_t)1 << valid) - 1;
+			events &= keep | ((uint64_t)1 << valid);
+			starts &= keep;
+			m.nl &= keep;
+			comments &= keep;
+		}
+		while (events != 0) {
+			int bit = __builtin_ctzll(events);
+			uint64_t mask = (uint64_t)1 << bit;
+			events &= events - 1;
+			size_t pos = base + bit;
+			if (ends & mask) {
+				if (tokenOpen) {
+					onToken(tokenStart, pos);
+					tokenOpen = false;
+				}
+				if (m.nl & mask) {
+					onLine(lineStart, pos);
+					lineStart = pos + 1;
+					inComment = false;
+				}
+			} else if (m.nl & mask) {
+				onLine(lineStart, pos);
+				lineStart = pos + 1;
+				inComment = false;
+			} else {
+				// A byte that's part of a token. "//" in the middle of a token still starts a comment
+				if (comments & mask) {
+					if (tokenOpen) {
+						onToken(tokenStart, pos);
+						tokenOpen = false;
+					}
+					inComment = true;
+				}
+				if ((starts & mask) && !inComment) {
+					tokenOpen = true;
+					tokenStart = pos;
+				}
+			}
+		}
+	}
+	if (tokenOpen) {
+		onToken(tokenStart, len);
+	}
+	if (lineStart < len) {
+		onLine(lineStart, len);
+	}
+}
+
+void lexSource(const char *src, size_t len, LexIndex &index, LexKernel kernel) {
+	index.lines.clear();
+	index.tokens.clear();
+	// Rough guesses so the vectors don't have to grow much
+	index.lines.reserve(len / 12 + 1);
+	index.tokens.reserve(len / 4 + 1);
+	uint32_t lineFirstToken = 0;
+	scanBlocks(src, len, false, classifierFor(kernel),
+		[&](size_t start, size_t end) {
+			index.tokens.push_back(TokenSpan{ (uint32_t)start, (uint32_t)(end - start) });
+		},
+		[&](size_t start, size_t end) {
+			uint32_t count = (uint32_t)index.tokens.size() - lineFirstToken;
+			index.lines.push_back(LexedLine{ (uint32_t)start, (uint32_t)end, lineFirstToken, count });
+			lineFirstToken = (uint32_t)index.tokens.size();
+		});
+}
+
+std::vector<int> scanIntArray(const char *src, size_t len, LexKernel kernel) {
+	std::vector<int> values;
+	values.reserve(len / 2 + 1);
+	scanBlocks(src, len, true, classifierFor(kernel),
+		[&](size_t start, size_t end) {
+			int v;
+			const char *first = src + start;
+			if (*first == '+') {
+				first++;  // from_chars doesn't take a leading '+', but stoi did
+			}
+			std::from_chars_result res = std::from_chars(first, src + end, v);
+			if (res.ec == std::errc::result_out_of_range) {
+				throw std::out_of_range("Number '" + std::string(src + start, end - start) + "' is too big");
+			}
+			if (res.ec != std::errc() || res.ptr != src + end) {
+				throw std::invalid_argument("'" + std::string(src + start, end - start) + "' isn't a number");
+			}
+			values.push_back(v);
+		},
+		[](size_t, size_t) {});
+	return values;
+}
+
+std::vector<int> scanIntArray(const std::string &str) {
+	return scanIntArray(str.data(), str.size());
+}
+
+#endif
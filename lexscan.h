@@ -0,0 +1,69 @@
+// -*- grammar-ext: .cpp -*-
+/*
+ *	This file is a part of ConfigurableAssemblyIntepreter.
+ *
+ *	ConfigurableAssemblyIntepreter is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ConfigurableAssemblyIntepreter is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#ifndef LEXSCAN_H
+#define LEXSCAN_H
+
+// The scanner the loader uses to find lines and tokens. It works like the first stage of
+// simdjson: 64 bytes at a time get turned into bitmasks(one bit per byte) of newlines,
+// whitespace, separators and "//" comment starts, and then only the set bits get walked
+// to build the index, instead of looking at every byte one at a time.
+
+// One token, as an offset and length into the source
+struct TokenSpan {
+	uint32_t start;
+	uint32_t len;
+};
+
+// One line of the source. Comments aren't tokens, so a comment-only line has no tokens
+struct LexedLine {
+	uint32_t start;       // Offset of the first byte of the line
+	uint32_t end;         // Offset of the '\n'(or the end of the source)
+	uint32_t firstToken;  // Index into LexIndex::tokens
+	uint32_t numTokens;
+};
+
+struct LexIndex {
+	std::vector<LexedLine> lines;
+	std::vector<TokenSpan> tokens;
+};
+
+// Which classifier to use. AUTO picks the best one the CPU has(CAI_SIMD works here too)
+enum class LexKernel {
+	AUTO,
+	SCALAR,
+	SSE2,
+	AVX2
+};
+
+// Splits the source into lines, and the lines into whitespace separated tokens
+void lexSource(const char *src, size_t len, LexIndex &index, LexKernel kernel = LexKernel::AUTO);
+
+// Parses something like "[1, 2,3]" into the numbers in it. Commas, brackets and whitespace are all
+// separators, so it's linear in the length of the string no matter how many numbers there are
+std::vector<int> scanIntArray(const char *src, size_t len, LexKernel kernel = LexKernel::AUTO);
+std::vector<int> scanIntArray(const std::string &str);
+
+const char* lexKernelName(LexKernel kernel);
+LexKernel bestLexKernel();
+
+#endif
@@ -0,0 +1,581 @@
+/*
+ *	This file is a part of ConfigurableAssemblyIntepreter.
+ *
+ *	ConfigurableAssemblyIntepreter is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ConfigurableAssemblyIntepreter is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <mutex>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "instructions.h"
+#include "linker.h"
+#include "mappedfile.h"
+#include "sha256.h"
+
+#ifndef LINKER_CPP
+#define LINKER_CPP
+
+namespace fs = std::filesystem;
+
+static const char objectMagic[4] = { 'C', 'A', 'I', 'O' };
+static const uint64_t objectVersion = 3;  // Change this whenever Line, Arg or Op change
+
+bool isLinkDirective(const char *word, size_t len) {
+	return len == 6 && (memcmp(word, "MODULE", 6) == 0 || memcmp(word, "EXPORT", 6) == 0 ||
+		memcmp(word, "IMPORT", 6) == 0);
+}
+
+static bool tokenIs(const char *src, const TokenSpan &tok, const char *word) {
+	return tok.len == strlen(word) && memcmp(src + tok.start, word, tok.len) == 0;
+}
+
+static bool isJumpOp(Op op) {
+	return op == Op::JUMP || op == Op::JUMP_IF_ZERO || op == Op::JUMP_IF_NEGATIVE;
+}
+
+ObjectModule compileModule(const char *src, const LexIndex &index, int first, LoadTimes *times) {
+	using clock = std::chrono::steady_clock;
+	const clock::time_point start = clock::now();
+	ObjectModule mod;
+	mod.labels = makeLabelMap(src, index, first);
+
+	// Find the directives first, since the imports have to be in the labelmap before the jumps
+	// to them get interpreted
+	for (int i = first; i < (int)index.lines.size(); i++) {
+		const LexedLine &line = index.lines[i];
+		if (line.numTokens == 0) {
+			continue;
+		}
+		const TokenSpan *tokens = index.tokens.data() + line.firstToken;
+		if (line.numTokens == 1 && tokenIs(src, tokens[0], "ENDPROGRAM")) {
+			break;
+		}
+		if (!isLinkDirective(src + tokens[0].start, tokens[0].len)) {
+			continue;
+		}
+		std::string word(src + tokens[0].start, tokens[0].len);
+		if (line.numTokens != 2) {
+			throw CaiError(CaiErrc::BAD_ARGUMENT, word + " needs exactly one argument on line " + std::to_string(i + 1), i + 1);
+		}
+		std::string name(src + tokens[1].start, tokens[1].len);
+		if (word == "MODULE") {
+			mod.modules.push_back(name);
+		} else if (word == "EXPORT") {
+			Labelmap_t::const_iterator it = mod.labels.find(name);
+			if (it == mod.labels.end()) {
+				throw CaiError(CaiErrc::UNKNOWN_LABEL, "Exported label '" + name + "' isn't in this module on line " +
+					std::to_string(i + 1), i + 1);
+			}
+			mod.exports[name] = it->second;
+		} else if (mod.labels.count(name) != 0) {
+			throw CaiError(CaiErrc::BAD_ARGUMENT, "Label '" + name + "' is imported but it's also in this module on line " +
+				std::to_string(i + 1), i + 1);
+		} else if (std::find(mod.imports.begin(), mod.imports.end(), name) == mod.imports.end()) {
+			mod.imports.push_back(name);
+		}
+	}
+
+	const clock::time_point parseStart = clock::now();
+	if (times != nullptr) {
+		times->labelNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(parseStart - start).count();
+	}
+	if (mod.imports.empty()) {
+		mod.lines = interpretLines(src, index, first, mod.labels);
+	} else {
+		// An import's "line" is -1 - which import it is, which no real line is
+		Labelmap_t labelmap = mod.labels;
+		for (int i = 0; i < (int)mod.imports.size(); i++) {
+			labelmap[mod.imports[i]] = -1 - i;
+		}
+		mod.lines = interpretLines(src, index, first, labelmap);
+		for (int i = 0; i < (int)mod.lines.size(); i++) {
+			Line &line = mod.lines[i];
+			if (isJumpOp(line.operation) && line.arguments[0].value < 0) {
+				mod.relocs.push_back(ModuleReloc{ i, -1 - line.arguments[0].value });
+				line.arguments[0].value = 0;
+			}
+		}
+	}
+	if (times != nullptr) {
+		times->parseNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - parseStart).count();
+	}
+	return mod;
+}
+
+// The .caio format. Everything after the magic is a LEB128 varint, with signed numbers
+// zigzagged and strings as their length and then their bytes:
+//   version, source size, source modification time, SHA-256 of the source(32 raw bytes),
+//   modules, imports, exports(name and line), labels(name and line),
+//   lines(op, then each argument's value, derefLevel, mode, index and indexDeref),
+//   relocs(line and import)
+// where each list starts with how many there are.
+struct ObjectStamp {
+	uint64_t size;
+	uint64_t mtime;
+	Digest digest;
+};
+
+static void putVarint(std::vector<unsigned char> &buf, uint64_t v) {
+	while (v >= 0x80) {
+		buf.push_back((unsigned char)(v | 0x80));
+		v >>= 7;
+	}
+	buf.push_back((unsigned char)v);
+}
+
+static void putSigned(std::vector<unsigned char> &buf, int v) {
+	putVarint(buf, ((uint32_t)v << 1) ^ (uint32_t)(v >> 31));
+}
+
+static void putString(std::vector<unsigned char> &buf, const std::string &s) {
+	putVarint(buf, s.size());
+	buf.insert(buf.end(), s.begin(), s.end());
+}
+
+static void putLabels(std::vector<unsigned char> &buf, const Labelmap_t &labels) {
+	putVarint(buf, labels.size());
+	for (const std::pair<const std::string, int> &label : labels) {
+		putString(buf, label.first);
+		putVarint(buf, (uint64_t)label.second);
+	}
+}
+
+static bool getVarint(const std::vector<unsigned char> &buf, size_t &pos, uint64_t &v) {
+	if (pos < buf.size() && buf[pos] < 0x80) {
+		v = buf[pos++];  // Most of them are one byte
+		return true;
+	}
+	v = 0;
+	for (int shift = 0; shift < 64 && pos < buf.size(); shift += 7) {
+		unsigned char b = buf[pos++];
+		v |= (uint64_t)(b & 0x7f) << shift;
+		if (!(b & 0x80)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool getSigned(const std::vector<unsigned char> &buf, size_t &pos, int &v) {
+	uint64_t u;
+	if (!getVarint(buf, pos, u) || u > 0xffffffffull) {
+		return false;
+	}
+	uint32_t z = (uint32_t)u;
+	v = (int)((z >> 1) ^ (0u - (z & 1)));
+	return true;
+}
+
+// A count, that can't be more than what's left of buf since everything takes at least a byte
+static bool getCount(const std::vector<unsigned char> &buf, size_t &pos, uint64_t &n) {
+	return getVarint(buf, pos, n) && n <= buf.size() - pos;
+}
+
+static bool getString(const std::vector<unsigned char> &buf, size_t &pos, std::string &s) {
+	uint64_t len;
+	if (!getCount(buf, pos, len)) {
+		return false;
+	}
+	s.assign((const char*)buf.data() + pos, len);
+	pos += len;
+	return true;
+}
+
+static bool getLabels(const std::vector<unsigned char> &buf, size_t &pos, Labelmap_t &labels, uint64_t numLines) {
+	uint64_t n, line;
+	bool ok = getCount(buf, pos, n);
+	for (uint64_t i = 0; ok && i < n; i++) {
+		std::string name;
+		ok = getString(buf, pos, name) && getVarint(buf, pos, line) && line < numLines;
+		labels.emplace_hint(labels.end(), std::move(name), (int)line);  // They were written in order
+	}
+	return ok;
+}
+
+static std::vector<unsigned char> writeObject(const ObjectModule &mod, const ObjectStamp &stamp) {
+	std::vector<unsigned char> buf(objectMagic, objectMagic + sizeof(objectMagic));
+	buf.reserve(64 + mod.lines.size() * 8);
+	putVarint(buf, objectVersion);
+	putVarint(buf, stamp.size);
+	putVarint(buf, stamp.mtime);
+	buf.insert(buf.end(), stamp.digest.begin(), stamp.digest.end());
+	putVarint(buf, mod.modules.size());
+	for (const std::string &s : mod.modules) {
+		putString(buf, s);
+	}
+	putVarint(buf, mod.imports.size());
+	for (const std::string &s : mod.imports) {
+		putString(buf, s);
+	}
+	putLabels(buf, mod.exports);
+	putLabels(buf, mod.labels);
+	putVarint(buf, mod.lines.size());
+	for (const Line &line : mod.lines) {
+		putVarint(buf, (uint64_t)line.operation);
+		putVarint(buf, line.arguments.size());
+		for (const Arg &arg : line.arguments) {
+			putSigned(buf, arg.value);
+			putVarint(buf, (uint64_t)arg.derefLevel);
+			putVarint(buf, (uint64_t)arg.mode);
+			putSigned(buf, arg.index);
+			putVarint(buf, (uint64_t)arg.indexDeref);
+		}
+	}
+	putVarint(buf, mod.relocs.size());
+	for (const ModuleReloc &r : mod.relocs) {
+		putVarint(buf, (uint64_t)r.line);
+		putVarint(buf, (uint64_t)r.import);
+	}
+	return buf;
+}
+
+// Reads just the stamp, so an up to date .caio can be told apart before reading the rest
+static bool readStamp(const std::vector<unsigned char> &buf, size_t &pos, ObjectStamp &stamp) {
+	uint64_t version;
+	if (buf.size() < sizeof(objectMagic) || memcmp(buf.data(), objectMagic, sizeof(objectMagic)) != 0) {
+		return false;
+	}
+	pos = sizeof(objectMagic);
+	if (!getVarint(buf, pos, version) || version != objectVersion || !getVarint(buf, pos, stamp.size) ||
+		!getVarint(buf, pos, stamp.mtime) || buf.size() - pos < stamp.digest.size()) {
+		return false;
+	}
+	memcpy(stamp.digest.data(), buf.data() + pos, stamp.digest.size());
+	pos += stamp.digest.size();
+	return true;
+}
+
+// Anything that doesn't make sense(like an op this build doesn't have) just means it gets recompiled
+static bool readObject(const std::vector<unsigned char> &buf, size_t pos, ObjectModule &mod) {
+	uint64_t n, v;
+	bool ok = getCount(buf, pos, n);
+	mod.modules.resize(ok ? n : 0);
+	for (std::string &s : mod.modules) {
+		ok = ok && getString(buf, pos, s);
+	}
+	ok = ok && getCount(buf, pos, n);
+	mod.imports.resize(ok ? n : 0);
+	for (std::string &s : mod.imports) {
+		ok = ok && getString(buf, pos, s);
+	}
+	// The labels can't be checked against the number of lines until that's been read, so they're
+	// checked against the most lines there could be here, and then again below
+	Labelmap_t exports, labels;
+	ok = ok && getLabels(buf, pos, exports, INT_MAX) && getLabels(buf, pos, labels, INT_MAX);
+	ok = ok && getCount(buf, pos, n);
+	mod.lines.resize(ok ? n : 0);
+	for (int i = 0; ok && i < (int)mod.lines.size(); i++) {
+		Line &line = mod.lines[i];
+		uint64_t numArgs;
+		ok = getVarint(buf, pos, v) && getCount(buf, pos, numArgs);
+		line.operation = (Op)v;
+		// A label runs as a nop and an empty line runs as a label, like interpretTokens does it
+		Op usual = line.operation == Op::LABEL ? Op::NOP : line.operation == Op::NO_INSTRUCTION ? Op::LABEL : line.operation;
+		OpToFuncmap_t::const_iterator it = optofunc.find(usual);
+		ok = ok && v < (uint64_t)NUM_OPS && line.operation != Op::LOOP_JUMP && it != optofunc.end();
+		if (!ok) {
+			break;
+		}
+		line.lineNum = i;
+		line.numArgs = (int)numArgs;
+		line.arguments.resize(numArgs);
+		for (Arg &arg : line.arguments) {
+			uint64_t deref, mode, indexDeref;
+			ok = ok && getSigned(buf, pos, arg.value) && getVarint(buf, pos, deref) && deref <= INT_MAX &&
+				getVarint(buf, pos, mode) && mode <= (uint64_t)ArgMode::REGISTER && getSigned(buf, pos, arg.index) &&
+				getVarint(buf, pos, indexDeref) && indexDeref <= INT_MAX;
+			arg.derefLevel = (int)deref;
+			arg.mode = (ArgMode)mode;
+			arg.indexDeref = (int)indexDeref;
+		}
+		for (const Arg &arg : line.arguments) {
+			ok = ok && (arg.mode != ArgMode::REGISTER || (arg.value >= 0 && arg.value < MAX_REGISTERS));
+		}
+		if (ok && isJumpOp(line.operation)) {
+			// Only jiz and jlz can have a second one, the register they test
+			ok = (numArgs == 1 || (numArgs == 2 && line.operation != Op::JUMP && line.arguments[1].mode == ArgMode::REGISTER)) &&
+				line.arguments[0].value >= 0 && line.arguments[0].value < (int)mod.lines.size();
+		}
+		// The register forms of add, sub, jiz and jlz have their own funcs
+		line.func = usual == line.operation ? lineFunc(usual, line.arguments) : it->second;
+	}
+	ok = ok && getCount(buf, pos, n);
+	mod.relocs.resize(ok ? n : 0);
+	for (ModuleReloc &r : mod.relocs) {
+		uint64_t line, import;
+		ok = ok && getVarint(buf, pos, line) && line < mod.lines.size() && isJumpOp(mod.lines[line].operation) &&
+			getVarint(buf, pos, import) && import < mod.imports.size();
+		r.line = (int)line;
+		r.import = (int)import;
+	}
+	for (const Labelmap_t *map : { &exports, &labels }) {
+		for (const std::pair<const std::string, int> &label : *map) {
+			ok = ok && label.second < (int)mod.lines.size();
+		}
+	}
+	mod.exports = std::move(exports);
+	mod.labels = std::move(labels);
+	return ok && pos == buf.size();
+}
+
+// Where the compiled version of a module goes, which is the source with its extension swapped
+static std::string objectPath(const std::string &path) {
+	return fs::path(path).replace_extension(".caio").string();
+}
+
+static bool readWholeFile(const std::string &path, std::vector<unsigned char> &buf) {
+	MappedFile file;
+	if (!mapFile(file, path)) {
+		return false;
+	}
+	buf.assign((const unsigned char*)file.data, (const unsigned char*)file.data + file.size);
+	return true;
+}
+
+// Writes it somewhere else first and renames it, so nobody ever reads half of a .caio
+static void saveObject(const std::string &path, const std::vector<unsigned char> &buf) {
+	// mkstemp so two processes(or threads) saving the same module never write to the same file
+	std::string tmp = path + ".tmpXXXXXX";
+	int fd = mkstemp(&tmp[0]);
+	if (fd < 0) {
+		return;  // Like the result cache, this is only an optimization, so a read only directory is fine
+	}
+	fchmod(fd, 0644);
+	FILE *f = fdopen(fd, "wb");
+	std::error_code ec;
+	if (f == nullptr) {
+		close(fd);
+		fs::remove(tmp, ec);
+		return;
+	}
+	bool written = fwrite(buf.data(), 1, buf.size(), f) == buf.size();
+	written = (fclose(f) == 0) && written;
+	if (written) {
+		fs::rename(tmp, path, ec);
+	}
+	if (!written || ec) {
+		fs::remove(tmp, ec);
+	}
+}
+
+// Modules that have already been loaded by this process. Checked the same way as a .caio
+struct LoadedModule {
+	uint64_t size;
+	uint64_t mtime;
+	std::shared_ptr<const ObjectModule> module;
+};
+
+static std::mutex loadedLock;
+static std::map<std::string, LoadedModule> loadedModules;
+static ModuleCacheStats cacheStats;
+
+static std::shared_ptr<ObjectModule> compileModuleFile(const std::string &path, const MappedFile &file) {
+	if (file.size >= UINT32_MAX) {
+		throw CaiError(CaiErrc::FILE_ERROR, "Module '" + path + "' is too big, it has to be under 4GB");
+	}
+	LexIndex index;
+	lexSource(file.data, file.size, index);
+	for (const LexedLine &line : index.lines) {
+		if (line.numTokens == 0) {
+			continue;
+		}
+		if (tokenIs(file.data, index.tokens[line.firstToken], "ENVDEF")) {
+			throw CaiError(CaiErrc::BAD_CONFIG, "Module '" + path + "' can't have an ENVDEF, only the main program can");
+		}
+		break;
+	}
+	std::shared_ptr<ObjectModule> mod;
+	try {
+		mod = std::make_shared<ObjectModule>(compileModule(file.data, index, 0));
+	} catch (const CaiError &e) {
+		throw CaiError(e.code, std::string(e.what()) + " in module '" + path + "'", e.lineNum);
+	}
+	mod->path = path;
+	return mod;
+}
+
+std::shared_ptr<const ObjectModule> loadModule(const std::string &path) {
+	std::error_code ec;
+	ObjectStamp stamp;
+	stamp.size = fs::file_size(path, ec);
+	if (!ec) {
+		stamp.mtime = (uint64_t)fs::last_write_time(path, ec).time_since_epoch().count();
+	}
+	if (ec) {
+		throw CaiError(CaiErrc::FILE_ERROR, "Couldn't open module '" + path + "'");
+	}
+	{
+		std::lock_guard<std::mutex> guard(loadedLock);
+		std::map<std::string, LoadedModule>::const_iterator it = loadedModules.find(path);
+		if (it != loadedModules.end() && it->second.size == stamp.size && it->second.mtime == stamp.mtime) {
+			cacheStats.fromMemory++;
+			return it->second.module;
+		}
+	}
+
+	std::string objPath = objectPath(path);
+	std::vector<unsigned char> buf;
+	ObjectStamp saved;
+	size_t pos = 0;
+	bool haveObject = readWholeFile(objPath, buf) && readStamp(buf, pos, saved);
+	std::shared_ptr<ObjectModule> mod = std::make_shared<ObjectModule>();
+	bool fromObject = false;
+	if (haveObject && saved.size == stamp.size && saved.mtime == stamp.mtime) {
+		fromObject = readObject(buf, pos, *mod);
+	}
+	if (!fromObject) {
+		MappedFile file;
+		if (!mapFile(file, path)) {
+			throw CaiError(CaiErrc::FILE_ERROR, "Couldn't open module '" + path + "'");
+		}
+		stamp.digest = sha256(std::string(file.data, file.size));
+		// Only touched, so the old one still works, but it gets saved again with the new time
+		if (haveObject && saved.digest == stamp.digest) {
+			fromObject = readObject(buf, pos, *mod);
+		}
+		if (!fromObject) {
+			mod = compileModuleFile(path, file);
+		}
+		saveObject(objPath, writeObject(*mod, stamp));
+	}
+	mod->path = path;
+
+	std::lock_guard<std::mutex> guard(loadedLock);
+	(fromObject ? cacheStats.fromObject : cacheStats.parsed)++;
+	loadedModules[path] = LoadedModule{ stamp.size, stamp.mtime, mod };
+	return mod;
+}
+
+ModuleCacheStats moduleCacheStats() {
+	std::lock_guard<std::mutex> guard(loadedLock);
+	return cacheStats;
+}
+
+void forgetLoadedModules() {
+	std::lock_guard<std::mutex> guard(loadedLock);
+	loadedModules.clear();
+}
+
+static std::string moduleName(const ObjectModule &mod) {
+	return mod.path.empty() ? "the main program" : "'" + mod.path + "'";
+}
+
+// Adds mod's exports to exported, which is where each one ended up after linking
+static void addExports(Labelmap_t &exported, std::map<std::string, const ObjectModule*> &exporters,
+	const ObjectModule &mod, int base) {
+	for (const std::pair<const std::string, int> &label : mod.exports) {
+		std::map<std::string, const ObjectModule*>::const_iterator it = exporters.find(label.first);
+		if (it != exporters.end()) {
+			throw CaiError(CaiErrc::BAD_ARGUMENT, "Label '" + label.first + "' is exported by both " +
+				moduleName(*it->second) + " and " + moduleName(mod));
+		}
+		exporters[label.first] = &mod;
+		exported[label.first] = base + label.second;
+	}
+}
+
+static void resolveImports(std::vector<Line> &lines, const Labelmap_t &exported, const ObjectModule &mod, int base) {
+	for (const ModuleReloc &r : mod.relocs) {
+		const std::string &name = mod.imports[r.import];
+		Labelmap_t::const_iterator it = exported.find(name);
+		if (it == exported.end()) {
+			throw CaiError(CaiErrc::UNKNOWN_LABEL, "Label '" + name + "' imported by " + moduleName(mod) +
+				" isn't exported by any module");
+		}
+		lines[base + r.line].arguments[0].value = it->second;
+	}
+}
+
+static Line endLine(int lineNum) {
+	return Line{ Op::END, optofunc.at(Op::END), lineNum, 0, std::vector<Arg>{} };
+}
+
+void linkModules(Program &prog, ObjectModule main, const char *fileDir) {
+	if (!main.modules.empty() && fileDir == nullptr) {
+		throw CaiError(CaiErrc::BAD_CONFIG, "MODULE can only be used in a program loaded from a file");
+	}
+	// Every module that gets linked in, once each however many times it's asked for
+	std::vector<std::shared_ptr<const ObjectModule>> mods;
+	std::map<std::string, int> seen;
+	auto request = [&](const std::string &dir, const std::string &name) {
+		std::string path = (name[0] == '/' || dir.empty()) ? name : dir + "/" + name;
+		std::error_code ec;
+		fs::path canonical = fs::weakly_canonical(path, ec);
+		if (!ec) {
+			path = canonical.string();
+		}
+		if (seen.count(path) == 0) {
+			seen[path] = (int)mods.size();
+			mods.push_back(loadModule(path));
+		}
+	};
+	for (const std::string &name : main.modules) {
+		request(fileDir, name);
+	}
+	for (size_t i = 0; i < mods.size(); i++) {
+		std::string dir = fs::path(mods[i]->path).parent_path().string();
+		for (const std::string &name : mods[i]->modules) {
+			request(dir, name);
+		}
+	}
+
+	Labelmap_t exported;
+	std::map<std::string, const ObjectModule*> exporters;
+	addExports(exported, exporters, main, 0);
+	prog.labels = std::move(main.labels);
+	prog.lines = std::move(main.lines);
+	if (mods.empty()) {
+		resolveImports(prog.lines, exported, main, 0);
+		return;
+	}
+	size_t total = prog.lines.size() + 1;
+	for (const std::shared_ptr<const ObjectModule> &mod : mods) {
+		total += mod->lines.size() + 1;
+	}
+	if (total > INT_MAX) {
+		throw CaiError(CaiErrc::BAD_ARGUMENT, "The linked program is too big");
+	}
+	prog.lines.reserve(total);
+	prog.lines.push_back(endLine((int)prog.lines.size()));
+	std::vector<int> bases;
+	for (const std::shared_ptr<const ObjectModule> &mod : mods) {
+		int base = (int)prog.lines.size();
+		bases.push_back(base);
+		addExports(exported, exporters, *mod, base);
+		for (const Line &line : mod->lines) {
+			prog.lines.push_back(line);
+			Line &copy = prog.lines.back();
+			copy.lineNum += base;
+			if (isJumpOp(copy.operation)) {
+				copy.arguments[0].value += base;
+			}
+		}
+		prog.lines.push_back(endLine((int)prog.lines.size()));
+	}
+	resolveImports(prog.lines, exported, main, 0);
+	for (size_t i = 0; i < mods.size(); i++) {
+		resolveImports(prog.lines, exported, *mods[i], bases[i]);
+	}
+	// The main program's own labels win over an exported label with the same name
+	prog.labels.insert(exported.begin(), exported.end());
+}
+
+#endif
@@ -0,0 +1,88 @@
+// -*- grammar-ext: .cpp -*-
+/*
+ *	This file is a part of ConfigurableAssemblyIntepreter.
+ *
+ *	ConfigurableAssemblyIntepreter is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ConfigurableAssemblyIntepreter is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "mainLib.h"
+
+#ifndef LINKER_H
+#define LINKER_H
+
+// Programs made of more than one file. Any file(the main program too) can have these lines:
+//   MODULE lib/math.asm  Link another file in. The path is relative to the file it's in
+//   EXPORT name          Let other modules jump to the label "name" in this one
+//   IMPORT name          Jumps to "name" in this one go to whichever module exports it
+// Every other label belongs to the module it's in, so two modules can both have a "loop:".
+// A module is just lines, without an ENVDEF. The lines count as NO_INSTRUCTIONs.
+//
+// Each module gets compiled on its own into an ObjectModule, which gets saved next to the
+// source as a ".caio" file(lib/math.asm -> lib/math.caio). Next time the module is needed
+// and the source's size and modification time haven't changed, the .caio gets read instead
+// of lexing and parsing the source again, so after editing one module only that one gets
+// parsed. Linking then just copies the lines of every module after the main program's and
+// fixes up their jumps, which is a lot cheaper than parsing them.
+//
+// The main program comes first and every module gets an "end" after it, so running off the
+// end of one stops the program instead of running into the next one.
+
+// A jump to a label some other module exports
+struct ModuleReloc {
+	int line;    // Which line the jump is on
+	int import;  // Index into ObjectModule::imports
+};
+
+struct ObjectModule {
+	std::string path;                  // The source it came from("" for a main program that isn't from a file)
+	std::vector<std::string> modules;  // What its MODULE lines link in, as written
+	std::vector<std::string> imports;  // Its IMPORT lines
+	Labelmap_t exports;                // Its EXPORT lines, and which of its lines each one is on
+	Labelmap_t labels;                 // All of its labels
+	std::vector<Line> lines;           // Jumps go to its own lines(counting from 0), except for relocs
+	std::vector<ModuleReloc> relocs;
+};
+
+// How many modules were parsed from source, read from a .caio, or were already in memory
+struct ModuleCacheStats {
+	long long parsed{0};
+	long long fromObject{0};
+	long long fromMemory{0};
+};
+
+// True for "MODULE", "EXPORT" and "IMPORT"
+bool isLinkDirective(const char *word, size_t len);
+
+// Compiles lines first until the end(or an ENDPROGRAM) of already lexed source into a module.
+// If times isn't nullptr, the time spent on the labels and on the lines gets added to it
+ObjectModule compileModule(const char *src, const LexIndex &index, int first, LoadTimes *times = nullptr);
+
+// Loads the module at path, from memory or its .caio if they're still up to date, and from the
+// source if not(writing a new .caio while it's at it). Throws a CaiError if it can't be compiled
+std::shared_ptr<const ObjectModule> loadModule(const std::string &path);
+
+// Puts main and every module it links in(and every one they link in) together into
+// prog.lines and prog.labels(main's lines get moved, so pass it with std::move). fileDir is
+// the directory main came from, or nullptr if it didn't come from a file, in which case it
+// can't have any MODULE lines
+void linkModules(Program &prog, ObjectModule main, const char *fileDir);
+
+ModuleCacheStats moduleCacheStats();
+// Forgets the modules this process has loaded, so the next load has to check the .caio files
+void forgetLoadedModules();
+
+#endif
@@ -0,0 +1,734 @@
+/*
+ *	This file is a part of ConfigurableAssemblyIntepreter.
+ *
+ *	ConfigurableAssemblyIntepreter is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ConfigurableAssemblyIntepreter is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <exception>
+
+#include "instructions.h"
+#include "lockstep.h"
+
+#ifndef LOCKSTEP_CPP
+#define LOCKSTEP_CPP
+
+// What a line turns into for the lockstep engine
+enum class LaneKind {
+	SKIP,    // Empty line, doesn't count as a step
+	STEP,    // nop or a label, only counts as a step
+	MOV,
+	CPF,
+	CPT,
+	ADD,
+	SUB,
+	INC,
+	DEC,
+	JMP,
+	JIZ,
+	JLZ,
+	INP,
+	OUT,
+	END,
+	SCALAR   // Can't be done in lockstep, so lanes that get here are finished with runSteps
+};
+
+struct LaneLine {
+	LaneKind kind{LaneKind::SCALAR};
+	Arg a{0, 0};
+	Arg b{0, 0};
+	bool directA{false};  // Not dereferenced and inside memory(or a register), so every lane uses the same cell
+	bool directB{false};
+	int regA{-1};         // Which register a and b are, if they are
+	int regB{-1};
+	int regAcc{-1};       // The register "add a r1", "sub a r1", "jiz r1 x" and "jlz r1 x" use instead of the acc
+	int target{-1};       // Where a jump goes
+	int rpc{0};           // Where the lanes join back up after a branch(its immediate post-dominator)
+};
+
+// Works out what kind of line each line is. This goes by the line's handler and not its Op,
+// so anything with an unusual handler is just left to runSteps
+static std::vector<LaneLine> decodeLanes(const Program &prog, int memSize) {
+	int n = (int)prog.lines.size();
+	std::vector<LaneLine> code(n);
+	for (int i = 0; i < n; i++) {
+		const Line &line = prog.lines[i];
+		LaneLine &ll = code[i];
+		ll.rpc = n;
+		int needs = 0;
+		OpFunc f = line.func;
+		if      (f == label)   { ll.kind = LaneKind::SKIP; }
+		else if (f == nop)     { ll.kind = LaneKind::STEP; }
+		else if (f == mov)     { ll.kind = LaneKind::MOV; needs = 2; }
+		else if (f == cpf)     { ll.kind = LaneKind::CPF; needs = 1; }
+		else if (f == cpt)     { ll.kind = LaneKind::CPT; needs = 1; }
+		else if (f == add)     { ll.kind = LaneKind::ADD; needs = 1; }
+		else if (f == sub)     { ll.kind = LaneKind::SUB; needs = 1; }
+		else if (f == inc)     { ll.kind = LaneKind::INC; needs = 1; }
+		else if (f == dec)     { ll.kind = LaneKind::DEC; needs = 1; }
+		else if (f == jmp || f == jmploop) { ll.kind = LaneKind::JMP; needs = 1; }
+		else if (f == jiz)     { ll.kind = LaneKind::JIZ; needs = 1; }
+		else if (f == jlz)     { ll.kind = LaneKind::JLZ; needs = 1; }
+		else if (f == addreg)  { ll.kind = LaneKind::ADD; needs = 1; }
+		else if (f == subreg)  { ll.kind = LaneKind::SUB; needs = 1; }
+		else if (f == jizreg)  { ll.kind = LaneKind::JIZ; needs = 1; }
+		else if (f == jlzreg)  { ll.kind = LaneKind::JLZ; needs = 1; }
+		else if (f == inp)     { ll.kind = LaneKind::INP; }
+		else if (f == out)     { ll.kind = LaneKind::OUT; }
+		else if (f == endprog) { ll.kind = LaneKind::END; }
+
+		if ((int)line.arguments.size() < needs) {
+			ll.kind = LaneKind::SCALAR;
+			continue;
+		}
+		// Immediates and indexed arguments aren't something laneAddresses knows about
+		bool plain = true;
+		for (int j = 0; j < needs; j++) {
+			plain = plain && (line.arguments[j].mode == ArgMode::ADDRESS || line.arguments[j].mode == ArgMode::REGISTER);
+		}
+		if (!plain) {
+			ll.kind = LaneKind::SCALAR;
+			continue;
+		}
+		if (needs >= 1) {
+			ll.a = line.arguments[0];
+			ll.regA = ll.a.mode == ArgMode::REGISTER ? ll.a.value : -1;
+			ll.directA = ll.regA >= 0 || (ll.a.derefLevel == 0 && ll.a.value >= 0 && ll.a.value < memSize);
+			ll.target = ll.a.value;
+		}
+		if (needs >= 2) {
+			ll.b = line.arguments[1];
+			ll.regB = ll.b.mode == ArgMode::REGISTER ? ll.b.value : -1;
+			ll.directB = ll.regB >= 0 || (ll.b.derefLevel == 0 && ll.b.value >= 0 && ll.b.value < memSize);
+			// The lanes only follow pointers for both sides at once
+			if ((ll.regA >= 0 && !ll.directB) || (ll.regB >= 0 && !ll.directA)) {
+				ll.kind = LaneKind::SCALAR;
+				continue;
+			}
+		}
+		if (f == addreg || f == subreg || f == jizreg || f == jlzreg) {
+			ll.regAcc = line.arguments[1].value;
+		}
+		bool isJump = ll.kind == LaneKind::JMP || ll.kind == LaneKind::JIZ || ll.kind == LaneKind::JLZ;
+		if (isJump && (ll.target < 0 || ll.target >= n)) {
+			// Leave jumps to nowhere to runSteps, so they fail the same way they always do
+			ll.kind = LaneKind::SCALAR;
+		}
+	}
+	return code;
+}
+
+// Fills in the rpc of every line with its immediate post-dominator, using the
+// Cooper-Harvey-Kennedy dominator algorithm on the reversed control flow graph.
+// Node n(one past the last line) is the exit. Lines that can't ever reach the exit
+// don't have one, so they get the exit too, which just means those lanes don't join back up.
+static void findPostDominators(std::vector<LaneLine> &code) {
+	int n = (int)code.size();
+	int exitNode = n;
+
+	// Successors of each line. At most two, and -1 means none
+	std::vector<int> succ((size_t)(n + 1) * 2, -1);
+	for (int i = 0; i < n; i++) {
+		int *s = &succ[(size_t)i * 2];
+		switch (code[i].kind) {
+			case LaneKind::JMP: s[0] = code[i].target; break;
+			case LaneKind::JIZ:
+			case LaneKind::JLZ: s[0] = code[i].target; s[1] = i + 1; break;
+			case LaneKind::END: s[0] = exitNode; break;
+			default:            s[0] = i + 1; break;  // i + 1 == n is the exit
+		}
+	}
+
+	// Predecessors, which are the successors in the reversed graph, as one flat array
+	std::vector<int> predStart(n + 2, 0);
+	for (int i = 0; i < n; i++) {
+		for (int k = 0; k < 2; k++) {
+			if (succ[(size_t)i * 2 + k] >= 0) {
+				predStart[succ[(size_t)i * 2 + k] + 1]++;
+			}
+		}
+	}
+	for (int i = 0; i <= n; i++) {
+		predStart[i + 1] += predStart[i];
+	}
+	std::vector<int> preds(predStart[n + 1]);
+	std::vector<int> fillAt(predStart.begin(), predStart.end() - 1);
+	for (int i = 0; i < n; i++) {
+		for (int k = 0; k < 2; k++) {
+			int s = succ[(size_t)i * 2 + k];
+			if (s >= 0) {
+				preds[fillAt[s]++] = i;
+			}
+		}
+	}
+
+	// Postorder of the reversed graph starting from the exit. No recursion, since programs can be huge
+	std::vector<int> order;
+	order.reserve(n + 1);
+	std::vector<int> postNum(n + 1, -1);
+	std::vector<char> seen(n + 1, 0);
+	std::vector<std::pair<int,int>> stack;
+	stack.push_back({exitNode, predStart[exitNode]});
+	seen[exitNode] = 1;
+	while (!stack.empty()) {
+		std::pair<int,int> &top = stack.back();
+		if (top.second < predStart[top.first + 1]) {
+			int p = preds[top.second++];
+			if (!seen[p]) {
+				seen[p] = 1;
+				stack.push_back({p, predStart[p]});
+			}
+		} else {
+			postNum[top.first] = (int)order.size();
+			order.push_back(top.first);
+			stack.pop_back();
+		}
+	}
+
+	std::vector<int> ipdom(n + 1, -1);
+	ipdom[exitNode] = exitNode;
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		// Reverse postorder, skipping the exit which is last in the postorder
+		for (int k = (int)order.size() - 2; k >= 0; k--) {
+			int node = order[k];
+			int newIdom = -1;
+			for (int j = 0; j < 2; j++) {
+				int s = succ[(size_t)node * 2 + j];
+				if (s < 0 || ipdom[s] < 0) {
+					continue;
+				}
+				if (newIdom < 0) {
+					newIdom = s;
+					continue;
+				}
+				// Walk both up the tree until they meet
+				int x = s, y = newIdom;
+				while (x != y) {
+					while (postNum[x] < postNum[y]) { x = ipdom[x]; }
+					while (postNum[y] < postNum[x]) { y = ipdom[y]; }
+				}
+				newIdom = x;
+			}
+			if (newIdom != ipdom[node]) {
+				ipdom[node] = newIdom;
+				changed = true;
+			}
+		}
+	}
+	for (int i = 0; i < n; i++) {
+		code[i].rpc = (ipdom[i] < 0) ? exitNode : ipdom[i];
+	}
+}
+
+// One entry of the reconvergence stack. The lanes in mask are all at line pc,
+// and once they get to rpc they join back up with the entry below
+struct LaneEntry {
+	int pc;
+	uint64_t mask;
+	int rpc;
+};
+
+template <int K>
+struct LaneGroup {
+	int memSize;
+	std::vector<int> mem;  // Cell a of lane l is mem[a*K + l]
+	int reg[K];
+	int regs[MAX_REGISTERS][K];  // Register r of lane l is regs[r][l]
+	long long steps[K];
+	bool nullReg[K];
+	long long maxSteps[K];   // 0 is no limit, like RunLimits
+	long long maxOutput[K];
+	Env *env[K];
+	uint64_t live{0};        // Lanes still being run in lockstep
+	uint64_t ejected{0};     // Lanes that have to be finished by runSteps
+};
+
+// Puts a lane's state back in its Env
+template <int K>
+static void writeBack(LaneGroup<K> &g, int l, int line) {
+	Env &env = *g.env[l];
+	env.reg = g.reg[l];
+	for (int r = 0; r < MAX_REGISTERS; r++) {
+		env.regs[r] = g.regs[r][l];
+	}
+	env.line = line;
+	env.steps = g.steps[l];
+	env.states[NULL_REGISTER] = g.nullReg[l];
+	for (int a = 0; a < g.memSize; a++) {
+		const int v = g.mem[(size_t)a * K + l];
+		if (env.memory[a] != v) {
+			env.memory[a] = v;
+			env.memory.touch(a);
+		}
+	}
+}
+
+// Takes the lanes in mask out of the group. They're at line pc, and runSteps picks them up from there
+template <int K>
+static void ejectLanes(LaneGroup<K> &g, uint64_t mask, int pc) {
+	for (int l = 0; l < K; l++) {
+		if (mask >> l & 1) {
+			writeBack(g, l, pc);
+		}
+	}
+	g.ejected |= mask;
+	g.live &= ~mask;
+}
+
+// The lanes in mask are done(ran off the end or hit "end")
+template <int K>
+static void finishLanes(LaneGroup<K> &g, uint64_t mask, int pc, bool isEnd) {
+	for (int l = 0; l < K; l++) {
+		if (mask >> l & 1) {
+			writeBack(g, l, pc);
+			Env &env = *g.env[l];
+			if (isEnd) {
+				env.states[IS_END] = true;
+			}
+			env.endProgram = true;
+			env.status = RunStatus::ENDED;
+		}
+	}
+	g.live &= ~mask;
+}
+
+// Works out the address arg ends up at for every lane in mask, following the "*"s separately
+// for each lane. Lanes that would go outside of memory are returned instead
+template <int K>
+static uint64_t laneAddresses(const LaneGroup<K> &g, Arg arg, uint64_t mask, int *addr) {
+	uint64_t bad = 0;
+	for (int l = 0; l < K; l++) {
+		if (!(mask >> l & 1)) {
+			continue;
+		}
+		int a = arg.value;
+		for (int d = arg.derefLevel; d >= 0; d--) {
+			if (a < 0 || a >= g.memSize) {
+				bad |= (uint64_t)1 << l;
+				break;
+			}
+			if (d > 0) {
+				a = g.mem[(size_t)a * K + l];
+			}
+		}
+		addr[l] = a;
+	}
+	return bad;
+}
+
+template <int K>
+static void runGroup(LaneGroup<K> &g, const std::vector<LaneLine> &code, const std::vector<int> &startLines) {
+	const int n = (int)code.size();
+	std::vector<LaneEntry> stack;
+	stack.reserve(64);
+	// Lanes that start on different lines just start as different entries
+	for (int l = 0; l < K; l++) {
+		if (!(g.live >> l & 1)) {
+			continue;
+		}
+		bool found = false;
+		for (LaneEntry &e : stack) {
+			if (e.pc == startLines[l]) {
+				e.mask |= (uint64_t)1 << l;
+				found = true;
+			}
+		}
+		if (!found) {
+			stack.push_back({startLines[l], (uint64_t)1 << l, INT_MAX});
+		}
+	}
+
+	// The step limit is only looked at once this runs out. It's the fewest steps any lane has left,
+	// and every lane takes at most one step per line, so no lane can go over without it running out first
+	auto stepsLeft = [&]() {
+		long long left = LLONG_MAX;
+		for (int l = 0; l < K; l++) {
+			if ((g.live >> l & 1) && g.maxSteps[l] > 0) {
+				left = std::min(left, g.maxSteps[l] - g.steps[l]);
+			}
+		}
+		return left;
+	};
+	long long budget = stepsLeft();
+
+	int sel[K];     // -1 for the lanes in the current mask, 0 for the rest, for branch-free blends
+	int addrA[K], addrB[K];
+	while (!stack.empty()) {
+		LaneEntry &top = stack.back();
+		top.mask &= g.live;
+		if (top.mask == 0 || top.pc == top.rpc) {
+			stack.pop_back();
+			continue;
+		}
+		const int pc = top.pc;
+		const uint64_t mask = top.mask;
+		if (budget <= 0) {
+			// runSteps stops a program as soon as it has used up its steps, unless it's right at its end.
+			// Either way it gets to say which, so the lanes that are out go back to it
+			uint64_t out = 0;
+			for (int l = 0; l < K; l++) {
+				if ((g.live >> l & 1) && g.maxSteps[l] > 0 && g.steps[l] >= g.maxSteps[l]) {
+					out |= (uint64_t)1 << l;
+				}
+			}
+			// Those lanes are ejected wherever they are, which is the highest entry they're in
+			for (int k = (int)stack.size() - 1; k >= 0 && out != 0; k--) {
+				uint64_t here = stack[k].mask & out;
+				if (here != 0) {
+					ejectLanes(g, here, stack[k].pc);
+					out &= ~here;
+				}
+			}
+			budget = stepsLeft();
+			continue;
+		}
+		if (pc >= n || pc < 0) {
+			// Ran off the end, which ends the program the same as iterateOnce does
+			if (pc >= n) {
+				finishLanes(g, mask, pc, false);
+			} else {
+				ejectLanes(g, mask, pc);
+			}
+			continue;
+		}
+		const LaneLine &ll = code[pc];
+		const bool full = mask == (((uint64_t)1 << K) - 1);
+		for (int l = 0; l < K; l++) {
+			sel[l] = -(int)(mask >> l & 1);
+		}
+
+		// Memory operands that need a different address for each lane. If any lane would go
+		// outside of memory it's ejected, so runSteps can throw the same error it always does
+		bool indirect = false;
+		if ((ll.kind >= LaneKind::MOV && ll.kind <= LaneKind::DEC) && (!ll.directA || (ll.kind == LaneKind::MOV && !ll.directB))) {
+			uint64_t bad = laneAddresses(g, ll.a, mask, addrA);
+			if (ll.kind == LaneKind::MOV) {
+				bad |= laneAddresses(g, ll.b, mask, addrB);
+			}
+			if (bad != 0) {
+				ejectLanes(g, bad, pc);
+				continue;
+			}
+			indirect = true;
+		}
+
+		int *cellA = ll.regA >= 0 ? g.regs[ll.regA] : ll.directA ? &g.mem[(size_t)ll.a.value * K] : nullptr;
+		int *cellB = ll.regB >= 0 ? g.regs[ll.regB] : ll.directB ? &g.mem[(size_t)ll.b.value * K] : nullptr;
+		int *acc = ll.regAcc >= 0 ? g.regs[ll.regAcc] : g.reg;
+		bool counts = true;       // Whether this line counts as a step
+		uint64_t ejectAfter = 0;  // Lanes to take out once the line is done
+		switch (ll.kind) {
+			case LaneKind::SKIP:
+				counts = false;
+				top.pc++;
+				break;
+			case LaneKind::STEP:
+				top.pc++;
+				break;
+			case LaneKind::MOV:
+				if (!indirect) {
+					for (int l = 0; l < K; l++) {
+						cellB[l] = (cellA[l] & sel[l]) | (cellB[l] & ~sel[l]);
+					}
+				} else {
+					for (int l = 0; l < K; l++) {
+						if (mask >> l & 1) {
+							g.mem[(size_t)addrB[l] * K + l] = g.mem[(size_t)addrA[l] * K + l];
+						}
+					}
+				}
+				top.pc++;
+				break;
+			case LaneKind::CPF:
+				if (!indirect) {
+					for (int l = 0; l < K; l++) {
+						g.reg[l] = (cellA[l] & sel[l]) | (g.reg[l] & ~sel[l]);
+					}
+				} else {
+					for (int l = 0; l < K; l++) {
+						if (mask >> l & 1) {
+							g.reg[l] = g.mem[(size_t)addrA[l] * K + l];
+						}
+					}
+				}
+				top.pc++;
+				break;
+			case LaneKind::CPT:
+				if (!indirect) {
+					for (int l = 0; l < K; l++) {
+						cellA[l] = (g.reg[l] & sel[l]) | (cellA[l] & ~sel[l]);
+					}
+				} else {
+					for (int l = 0; l < K; l++) {
+						if (mask >> l & 1) {
+							g.mem[(size_t)addrA[l] * K + l] = g.reg[l];
+						}
+					}
+				}
+				top.pc++;
+				break;
+			case LaneKind::ADD:
+			case LaneKind::SUB: {
+				// Unsigned so it wraps instead of being undefined, which is what the scalar version does in practice
+				uint32_t sign = (ll.kind == LaneKind::SUB) ? (uint32_t)-1 : 1;
+				if (!indirect) {
+					for (int l = 0; l < K; l++) {
+						acc[l] = (int)((uint32_t)acc[l] + ((uint32_t)cellA[l] & (uint32_t)sel[l]) * sign);
+					}
+				} else {
+					for (int l = 0; l < K; l++) {
+						if (mask >> l & 1) {
+							acc[l] = (int)((uint32_t)acc[l] + (uint32_t)g.mem[(size_t)addrA[l] * K + l] * sign);
+						}
+					}
+				}
+				top.pc++;
+				break;
+			}
+			case LaneKind::INC:
+			case LaneKind::DEC: {
+				uint32_t delta = (ll.kind == LaneKind::INC) ? 1 : (uint32_t)-1;
+				if (!indirect) {
+					for (int l = 0; l < K; l++) {
+						cellA[l] = (int)((uint32_t)cellA[l] + (delta & (uint32_t)sel[l]));
+					}
+				} else {
+					for (int l = 0; l < K; l++) {
+						if (mask >> l & 1) {
+							int &c = g.mem[(size_t)addrA[l] * K + l];
+							c = (int)((uint32_t)c + delta);
+						}
+					}
+				}
+				top.pc++;
+				break;
+			}
+			case LaneKind::JMP:
+				top.pc = ll.target;
+				break;
+			case LaneKind::JIZ:
+			case LaneKind::JLZ: {
+				uint64_t taken = 0;
+				for (int l = 0; l < K; l++) {
+					bool t = (ll.kind == LaneKind::JIZ) ? (acc[l] == 0) : (acc[l] < 0);
+					taken |= (uint64_t)t << l;
+				}
+				taken &= mask;
+				if (taken == mask) {
+					top.pc = ll.target;
+				} else if (taken == 0) {
+					top.pc++;
+				} else {
+					// The lanes split up. This entry waits at the join point for both sides,
+					// which are run one after the other
+					int rpc = ll.rpc;
+					top.pc = rpc;
+					stack.push_back({pc + 1, mask & ~taken, rpc});
+					stack.push_back({ll.target, taken, rpc});
+				}
+				break;
+			}
+			case LaneKind::INP: {
+				// Lanes with nothing to read get blocked by runSteps, the rest read their next value
+				uint64_t empty = 0;
+				for (int l = 0; l < K; l++) {
+					if ((mask >> l & 1) && g.env[l]->input.empty()) {
+						empty |= (uint64_t)1 << l;
+					}
+				}
+				if (empty != 0) {
+					ejectLanes(g, empty, pc);
+					continue;
+				}
+				for (int l = 0; l < K; l++) {
+					if (mask >> l & 1) {
+						g.reg[l] = g.env[l]->input.front();
+						g.env[l]->input.pop_front();
+						g.nullReg[l] = false;
+					}
+				}
+				stack.back().pc++;
+				break;
+			}
+			case LaneKind::OUT: {
+				uint64_t atLimit = 0;
+				for (int l = 0; l < K; l++) {
+					if (mask >> l & 1) {
+						std::deque<int> &output = g.env[l]->output;
+						output.push_back(g.reg[l]);
+						g.nullReg[l] = true;
+						if (g.maxOutput[l] > 0 && (long long)output.size() >= g.maxOutput[l]) {
+							atLimit |= (uint64_t)1 << l;
+						}
+					}
+				}
+				top.pc++;
+				// These finish the step first, then runSteps stops them with OUTPUT_LIMIT
+				ejectAfter = atLimit;
+				break;
+			}
+			case LaneKind::END:
+				counts = false;
+				finishLanes(g, mask, pc, true);
+				break;
+			case LaneKind::SCALAR:
+				counts = false;
+				ejectLanes(g, mask, pc);
+				break;
+		}
+		if (counts) {
+			if (full) {
+				for (int l = 0; l < K; l++) {
+					g.steps[l]++;
+				}
+			} else {
+				for (int l = 0; l < K; l++) {
+					g.steps[l] += sel[l] & 1;
+				}
+			}
+			budget--;
+		}
+		if (ejectAfter != 0) {
+			ejectLanes(g, ejectAfter, pc + 1);
+		}
+	}
+}
+
+// Runs up to K of the Envs in idx(which all run the same program with the same memory size) in lockstep
+template <int K>
+static void runLanes(std::vector<Env> &envs, const std::vector<int> &idx, size_t first,
+                     const std::vector<LaneLine> &code, std::vector<int> &leftovers) {
+	using clock = std::chrono::steady_clock;
+	const clock::time_point start = clock::now();
+
+	LaneGroup<K> g;
+	g.memSize = envs[idx[first]].memSize;
+	g.mem.assign((size_t)g.memSize * K, 0);
+	std::vector<int> startLines(K, 0);
+	for (int l = 0; l < K; l++) {
+		g.reg[l] = 0;
+		for (int r = 0; r < MAX_REGISTERS; r++) {
+			g.regs[r][l] = 0;
+		}
+		g.steps[l] = 0;
+		g.nullReg[l] = false;
+		g.maxSteps[l] = 0;
+		g.maxOutput[l] = 0;
+		g.env[l] = nullptr;
+		if (first + l >= idx.size()) {
+			continue;
+		}
+		Env &env = envs[idx[first + l]];
+		g.env[l] = &env;
+		g.reg[l] = env.reg;
+		for (int r = 0; r < MAX_REGISTERS; r++) {
+			g.regs[r][l] = env.regs[r];
+		}
+		g.steps[l] = env.steps;
+		g.nullReg[l] = env.states[NULL_REGISTER];
+		g.maxSteps[l] = env.limits.maxSteps;
+		g.maxOutput[l] = env.limits.maxOutput;
+		startLines[l] = env.line;
+		for (int a = 0; a < g.memSize; a++) {
+			g.mem[(size_t)a * K + l] = env.memory[a];
+		}
+		env.status = RunStatus::RUNNING;
+		g.live |= (uint64_t)1 << l;
+	}
+
+	runGroup(g, code, startLines);
+
+	long long nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+	for (int l = 0; l < K; l++) {
+		if (g.env[l] != nullptr) {
+			g.env[l]->runNanos += nanos;
+		}
+		if (g.ejected >> l & 1) {
+			leftovers.push_back(idx[first + l]);
+		}
+	}
+}
+
+template <int K>
+static void runAllLanes(std::vector<Env> &envs, const std::vector<int> &idx,
+                        const std::vector<LaneLine> &code, std::vector<int> &leftovers) {
+	for (size_t first = 0; first < idx.size(); first += K) {
+		runLanes<K>(envs, idx, first, code, leftovers);
+	}
+}
+
+void runLockstep(std::vector<Env> &envs, int lanes) {
+	// Envs that can't go in a group, or that got taken out of one
+	std::vector<int> leftovers;
+	// The ones that can. Only Envs that run the same program as the first one that can go in a group
+	std::vector<int> grouped;
+	const Env *model = nullptr;
+	for (int i = 0; i < (int)envs.size(); i++) {
+		Env &env = envs[i];
+		if (env.status == RunStatus::ENDED) {
+			continue;
+		}
+		if (env.program != nullptr) {
+			env.program = decodedProgram(env.program);  // The lanes are decoded from every line at once
+		}
+		bool fits = env.memProfile == nullptr && env.stats == nullptr && env.breakpoints == nullptr && env.outputSink == nullptr && env.group == nullptr && !env.memory.isShared() &&
+			env.limits.maxMillis <= 0 && env.program != nullptr &&
+			!env.endProgram && (int)env.states.size() >= NUM_STATES && !env.states[IS_END] &&
+			(int)env.memory.size() == env.memSize && env.memSize > 0 &&
+			(env.limits.maxOutput <= 0 || (long long)env.output.size() < env.limits.maxOutput);
+		if (fits && model == nullptr) {
+			model = &env;
+		}
+		if (fits && env.program == model->program && env.memSize == model->memSize) {
+			grouped.push_back(i);
+		} else {
+			leftovers.push_back(i);
+		}
+	}
+
+	if (!grouped.empty()) {
+		std::vector<LaneLine> code = decodeLanes(*model->program, model->memSize);
+		findPostDominators(code);
+		if (lanes <= 4) {
+			runAllLanes<4>(envs, grouped, code, leftovers);
+		} else if (lanes <= 8) {
+			runAllLanes<8>(envs, grouped, code, leftovers);
+		} else if (lanes <= 16) {
+			runAllLanes<16>(envs, grouped, code, leftovers);
+		} else {
+			runAllLanes<32>(envs, grouped, code, leftovers);
+		}
+	}
+
+	std::sort(leftovers.begin(), leftovers.end());
+	std::exception_ptr firstError;
+	for (int i : leftovers) {
+		try {
+			runEnvironment(envs[i]);
+		} catch (...) {
+			if (!firstError) {
+				firstError = std::current_exception();
+			}
+		}
+	}
+	if (firstError) {
+		std::rethrow_exception(firstError);
+	}
+}
+
+#endif
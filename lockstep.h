@@ -0,0 +1,46 @@
+// -*- grammar-ext: .cpp -*-
+/*
+ *	This file is a part of ConfigurableAssemblyIntepreter.
+ *
+ *	ConfigurableAssemblyIntepreter is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ConfigurableAssemblyIntepreter is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <vector>
+
+#include "mainLib.h"
+
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+// Runs lots of instances of one program at once, GPU style. The Envs are split into groups
+// of "lanes"(4, 8, 16 or 32 of them), and every lane in a group runs the same line at the
+// same time. Memory is stored interleaved(cell a of lane l is at a*lanes + l), so when the
+// arguments aren't dereferenced an add or cpt is just one vector operation over all the lanes.
+//
+// When a jiz or jlz goes different ways for different lanes, the group splits: one side runs
+// with the other lanes masked off, then the other side, and they all join back up at the
+// branch's immediate post-dominator(the first line that every path from the branch has to go
+// through). That's tracked with a stack, the same way GPUs do it.
+//
+// Anything that can't be done in lockstep(the block instructions, an "inp" with no input left,
+// a bad address, a limit running out...) takes that lane out of the group and finishes it with
+// runSteps, so every Env ends up exactly the way runEnvironment would have left it, down to
+// the steps and the output. Envs with a time limit, a memory profiler, RunStats, an OutputSink
+// or memory shared with other Envs are just run with runEnvironment, since none of those can be
+// split up between lanes.
+
+// Runs every Env in envs until it stops, like calling runEnvironment on each of them.
+// If one of them throws, the rest still get run and then the first error is rethrown.
+void runLockstep(std::vector<Env> &envs, int lanes = 8);
+
+#endif
@@ -0,0 +1,442 @@
+/*
+ *	This file is a part of ConfigurableAssemblyIntepreter.
+ *
+ *	ConfigurableAssemblyIntepreter is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ConfigurableAssemblyIntepreter is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <array>
+#include <climits>
+
+#include "loopopt.h"
+#include "mainLib.h"
+#include "instructions.h"
+
+#ifndef LOOPOPT_CPP
+#define LOOPOPT_CPP
+
+// More variables than this and it isn't the kind of loop this is for
+static const int MAX_LOOP_VARS = 16;
+// Coefficients bigger than this(from adding the acc to itself over and over) aren't worth it,
+// and keeping them small means the exit test can be worked out exactly in 128 bits
+static const int64_t MAX_LOOP_COEF = (int64_t)1 << 20;
+
+using Wide = __int128;
+
+// Index of the variable for a cell(or a register, see CountedLoop::cells), adding it if it's new.
+// -1 if there are too many
+static int loopVar(std::vector<int> &cells, int addr) {
+	for (int i = 0; i < (int)cells.size(); i++) {
+		if (cells[i] == addr) {
+			return i + 1;
+		}
+	}
+	if ((int)cells.size() + 1 >= MAX_LOOP_VARS) {
+		return -1;
+	}
+	cells.push_back(addr);
+	return (int)cells.size();
+}
+
+static LoopExpr addExprs(const LoopExpr &a, const LoopExpr &b, int64_t sign) {
+	LoopExpr r = a;
+	for (int i = 0; i < (int)r.coef.size(); i++) {
+		r.coef[i] += sign * b.coef[i];
+	}
+	r.konst += sign * b.konst;
+	return r;
+}
+
+static bool exprTooBig(const LoopExpr &e) {
+	for (int64_t c : e.coef) {
+		if (c > MAX_LOOP_COEF || c < -MAX_LOOP_COEF) {
+			return true;
+		}
+	}
+	return e.konst > MAX_LOOP_COEF || e.konst < -MAX_LOOP_COEF;
+}
+
+// What goes in CountedLoop::cells for an argument: a direct, in range address, or -1 - the register
+// for a register. False if it's dereferenced, indexed, an immediate or out of range
+static bool loopCell(const Line &line, int i, int memSize, int &cell) {
+	if ((int)line.arguments.size() <= i) {
+		return false;
+	}
+	const Arg &a = line.arguments[i];
+	if (a.mode == ArgMode::REGISTER) {
+		cell = -1 - a.value;
+		return true;
+	}
+	if (a.mode != ArgMode::ADDRESS || a.derefLevel != 0 || a.value < 0 || a.value >= memSize) {
+		return false;
+	}
+	cell = a.value;
+	return true;
+}
+
+// Whether argument i of a line is an immediate that only gets read, like the "#1" in "add #1"
+static bool readsImmediate(const Line &line, int i) {
+	OpFunc f = line.func;
+	bool reads = f == cpf || f == add || f == sub || f == mov || f == addreg || f == subreg;
+	return reads && i == 0 && (int)line.arguments.size() > i && line.arguments[i].mode == ArgMode::IMMEDIATE;
+}
+
+// Works out what the loop from head to back does in one trip. False if it's not one this can handle
+static bool analyzeLoop(const Program &prog, int head, int back, CountedLoop &loop) {
+	const int memSize = prog.config.memSize;
+	loop.head = head;
+	loop.back = back;
+	loop.exitLine = -1;
+	loop.stepsPerTrip = 1;  // The jmp
+
+	// First pass: check every line and find the variables
+	for (int i = head; i < back; i++) {
+		const Line &line = prog.lines[i];
+		OpFunc f = line.func;
+		if (f == label) {
+			continue;
+		}
+		loop.stepsPerTrip++;
+		if (f == nop) {
+			continue;
+		}
+		if (f == jiz || f == jlz || f == jizreg || f == jlzreg) {
+			int target = line.arguments.empty() ? head : line.arguments[0].value;
+			if (loop.exitLine >= 0 || (target >= head && target <= back)) {
+				return false;  // A second way out, or a jump around inside the loop
+			}
+			int cell;
+			if ((f == jizreg || f == jlzreg) && (!loopCell(line, 1, memSize, cell) || loopVar(loop.cells, cell) < 0)) {
+				return false;
+			}
+			loop.exitLine = i;
+			loop.exitIfNegative = f == jlz || f == jlzreg;
+			continue;
+		}
+		int args;
+		if (f == cpf || f == cpt || f == add || f == sub || f == inc || f == dec) {
+			args = 1;
+		} else if (f == mov || f == addreg || f == subreg) {
+			args = 2;
+		} else {
+			return false;
+		}
+		for (int a = 0; a < args; a++) {
+			if (readsImmediate(line, a)) {
+				continue;
+			}
+			int cell;
+			if (!loopCell(line, a, memSize, cell) || loopVar(loop.cells, cell) < 0) {
+				return false;
+			}
+		}
+	}
+	if (loop.exitLine < 0) {
+		return false;
+	}
+
+	// Second pass: run one trip with expressions instead of numbers
+	const int nv = (int)loop.cells.size() + 1;
+	std::vector<LoopExpr> state(nv);
+	for (int v = 0; v < nv; v++) {
+		state[v].coef.assign(nv, 0);
+		state[v].coef[v] = 1;
+	}
+	for (int i = head; i < back; i++) {
+		const Line &line = prog.lines[i];
+		OpFunc f = line.func;
+		// The variable an argument is. Only called on ones the first pass found
+		auto var = [&](int arg) {
+			int cell = 0;
+			loopCell(line, arg, memSize, cell);
+			return loopVar(loop.cells, cell);
+		};
+		if (f == jiz || f == jlz) {
+			loop.exitTest = state[0];
+			continue;
+		}
+		if (f == jizreg || f == jlzreg) {
+			loop.exitTest = state[var(1)];
+			continue;
+		}
+		if (f == label || f == nop) {
+			continue;
+		}
+		// What the first argument reads as. An immediate is just a constant
+		LoopExpr constant;
+		int a = 0;
+		if (readsImmediate(line, 0)) {
+			constant.coef.assign(nv, 0);
+			constant.konst = line.arguments[0].value;
+		} else {
+			a = var(0);
+		}
+		const LoopExpr &src = a > 0 ? state[a] : constant;
+		int b = (f == mov || f == addreg || f == subreg) ? var(1) : 0;
+		if      (f == cpf)    { state[0] = src; }
+		else if (f == cpt)    { state[a] = state[0]; }
+		else if (f == add)    { state[0] = addExprs(state[0], src, 1); }
+		else if (f == sub)    { state[0] = addExprs(state[0], src, -1); }
+		else if (f == inc)    { state[a].konst++; }
+		else if (f == dec)    { state[a].konst--; }
+		else if (f == mov)    { state[b] = src; }
+		else if (f == addreg) { state[b] = addExprs(state[b], src, 1); }
+		else if (f == subreg) { state[b] = addExprs(state[b], src, -1); }
+		if (exprTooBig(state[0]) || exprTooBig(state[a]) || exprTooBig(state[b]) || exprTooBig(constant)) {
+			return false;
+		}
+	}
+	loop.trip = state;
+
+	// Now sort the variables out by how they change from trip to trip
+	std::vector<int> order(nv, -1);  // 0 for INVARIANT, 1 for STEP1, 2 for STEP2
+	loop.kinds.assign(nv, LoopVarKind::INVARIANT);
+	for (int v = 0; v < nv; v++) {
+		const LoopExpr &e = loop.trip[v];
+		if (e.coef[v] == 0) {
+			loop.kinds[v] = LoopVarKind::OVERWRITTEN;
+		} else if (e.coef[v] != 1) {
+			return false;  // Something like doubling, which isn't a counter
+		} else {
+			bool same = e.konst == 0;
+			for (int u = 0; u < nv; u++) {
+				same = same && (u == v || e.coef[u] == 0);
+			}
+			if (same) {
+				order[v] = 0;
+			}
+		}
+	}
+	// An OVERWRITTEN variable only follows a formula after the first trip, so nothing can read it
+	for (int v = 0; v < nv; v++) {
+		if (loop.kinds[v] != LoopVarKind::OVERWRITTEN) {
+			continue;
+		}
+		if (loop.exitTest.coef[v] != 0) {
+			return false;
+		}
+		for (int w = 0; w < nv; w++) {
+			if (loop.trip[w].coef[v] != 0) {
+				return false;
+			}
+		}
+	}
+	// Counters go up by something made of variables that have already been sorted out
+	for (bool changed = true; changed; ) {
+		changed = false;
+		for (int v = 0; v < nv; v++) {
+			if (order[v] >= 0 || loop.kinds[v] == LoopVarKind::OVERWRITTEN) {
+				continue;
+			}
+			int highest = 0;
+			bool known = true;
+			for (int u = 0; u < nv && known; u++) {
+				if (u != v && loop.trip[v].coef[u] != 0) {
+					known = order[u] >= 0;
+					highest = std::max(highest, order[u]);
+				}
+			}
+			if (known) {
+				order[v] = highest + 1;
+				changed = true;
+			}
+		}
+	}
+	for (int v = 0; v < nv; v++) {
+		if (loop.kinds[v] == LoopVarKind::OVERWRITTEN) {
+			continue;
+		}
+		if (order[v] < 0 || order[v] > 2) {
+			return false;  // Depends on itself in a circle, or it's a series of a series
+		}
+		loop.kinds[v] = order[v] == 0 ? LoopVarKind::INVARIANT : order[v] == 1 ? LoopVarKind::STEP1 : LoopVarKind::STEP2;
+	}
+	// The exit test has to change by the same amount every trip so it can be solved for
+	for (int u = 0; u < nv; u++) {
+		if (loop.exitTest.coef[u] != 0 && order[u] > 1) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void findCountedLoops(Program &prog) {
+	for (int back = 0; back < (int)prog.lines.size(); back++) {
+		Line &line = prog.lines[back];
+		if (line.func != jmp || line.arguments.empty()) {
+			continue;
+		}
+		int head = line.arguments[0].value;
+		if (head < 0 || head >= back) {
+			continue;
+		}
+		CountedLoop loop;
+		if (!analyzeLoop(prog, head, back, loop)) {
+			continue;
+		}
+		line.operation = Op::LOOP_JUMP;
+		line.func = jmploop;
+		line.arguments.resize(1);
+		line.arguments.push_back(Arg{ (int)prog.loops.size(), 0 });
+		line.numArgs = 2;
+		prog.loops.push_back(std::move(loop));
+	}
+}
+
+// vals has a value for each of the loop's variables, which is as many as e has coefs
+static Wide evalWide(const LoopExpr &e, const Wide *vals) {
+	Wide r = e.konst;
+	for (int i = 0; i < (int)e.coef.size(); i++) {
+		r += (Wide)e.coef[i] * vals[i];
+	}
+	return r;
+}
+
+// The same, but wrapping around like the interpreter does
+static uint32_t evalWrap(const LoopExpr &e, const uint32_t *vals) {
+	uint32_t r = (uint32_t)e.konst;
+	for (int i = 0; i < (int)e.coef.size(); i++) {
+		r += (uint32_t)e.coef[i] * vals[i];
+	}
+	return r;
+}
+
+static bool fitsInt(Wide v) {
+	return v >= INT_MIN && v <= INT_MAX;
+}
+
+void accelerateLoop(Env &env, const CountedLoop &loop) {
+	if (env.memProfile != nullptr || env.line != loop.head) {
+		return;  // The profiler wants to see every access
+	}
+	if (env.group != nullptr || env.memory.isShared()) {
+		return;  // Another thread can change the cells it reads, like a spin loop waiting on a flag
+	}
+	// There are never more than MAX_LOOP_VARS variables, so these are arrays and
+	// speeding up a loop doesn't allocate anything
+	const int nv = (int)loop.kinds.size();
+	std::array<Wide, MAX_LOOP_VARS> start;
+	start[0] = env.reg;
+	for (int i = 1; i < nv; i++) {
+		int addr = loop.cells[i - 1];
+		if (addr >= (int)env.memory.size()) {
+			return;  // Let the interpreter give the error
+		}
+		start[i] = addr < 0 ? env.regs[-1 - addr] : env.memory[addr];
+	}
+
+	// How much each STEP1 variable goes up by every trip, and so how much the exit test does
+	std::array<Wide, MAX_LOOP_VARS> delta{};
+	for (int v = 0; v < nv; v++) {
+		if (loop.kinds[v] == LoopVarKind::STEP1) {
+			delta[v] = evalWide(loop.trip[v], start.data()) - start[v];
+		}
+	}
+	Wide test = evalWide(loop.exitTest, start.data());
+	Wide testDelta = 0;
+	for (int u = 0; u < nv; u++) {
+		testDelta += (Wide)loop.exitTest.coef[u] * delta[u];
+	}
+
+	// Solve for the number of whole trips before the one that leaves
+	bool forever = false;
+	Wide trips = 0;
+	if (testDelta == 0) {
+		int now = (int)(uint32_t)test;  // The same every trip, so wrapping doesn't matter
+		if (loop.exitIfNegative ? now < 0 : now == 0) {
+			return;
+		}
+		forever = true;
+	} else {
+		// Since it's a straight line, it can't have wrapped around if both ends fit
+		if (!fitsInt(test)) {
+			return;
+		}
+		if (loop.exitIfNegative) {
+			if (test < 0 || testDelta > 0) {
+				return;
+			}
+			trips = test / -testDelta + 1;
+		} else {
+			if ((-test) % testDelta != 0 || (-test) / testDelta < 0) {
+				return;
+			}
+			trips = (-test) / testDelta;
+		}
+		if (!fitsInt(test + trips * testDelta)) {
+			return;
+		}
+	}
+
+	// Don't go past the limits. Without any, a loop that never ends still stops well short of
+	// LLONG_MAX steps, so the trip it does for real(and everything after) can't overflow them
+	long long room = std::min(env.stepFence, LLONG_MAX / 2) - env.steps;
+	long long n = room / loop.stepsPerTrip;
+	if (!forever && trips < n) {
+		n = (long long)trips;
+	}
+	if (n <= 0) {
+		return;
+	}
+
+	// Everything from here on wraps like the interpreter's ints do, so it's done in uint32_t
+	std::array<uint32_t, MAX_LOOP_VARS> before, after;
+	for (int v = 0; v < nv; v++) {
+		before[v] = (uint32_t)start[v];
+	}
+	const uint32_t n32 = (uint32_t)n;
+	// 0 + 1 + ... + (n - 2), for the series. n can be way past 2^32, so the even one of the two gets
+	// halved first and the product is left to wrap, which is still right in the low 32 bits
+	const uint64_t n1 = (uint64_t)(n - 1), n2 = (uint64_t)std::max(n - 2, 0LL);
+	const uint32_t series = (uint32_t)((n1 % 2 == 0) ? (n1 / 2) * n2 : n1 * (n2 / 2));
+	// Work out everything at the start of the last skipped trip, then do that trip for real
+	std::array<uint32_t, MAX_LOOP_VARS> last;
+	for (int v = 0; v < nv; v++) {
+		uint32_t step = evalWrap(loop.trip[v], before.data()) - before[v];
+		switch (loop.kinds[v]) {
+			case LoopVarKind::INVARIANT:
+			case LoopVarKind::OVERWRITTEN:
+				last[v] = before[v];  // OVERWRITTEN ones don't matter, nothing reads them
+				break;
+			case LoopVarKind::STEP1:
+				last[v] = before[v] + (n32 - 1) * step;
+				break;
+			case LoopVarKind::STEP2: {
+				uint32_t stepDelta = 0;
+				for (int u = 0; u < nv; u++) {
+					if (u != v) {
+						stepDelta += (uint32_t)loop.trip[v].coef[u] * (uint32_t)delta[u];
+					}
+				}
+				last[v] = before[v] + (n32 - 1) * step + stepDelta * series;
+				break;
+			}
+		}
+	}
+	for (int v = 0; v < nv; v++) {
+		after[v] = evalWrap(loop.trip[v], last.data());
+	}
+
+	env.reg = (int)after[0];
+	for (int i = 1; i < nv; i++) {
+		int addr = loop.cells[i - 1];
+		if (addr < 0) {
+			env.regs[-1 - addr] = (int)after[i];
+		} else {
+			env.memory[addr] = (int)after[i];
+			env.memory.touch(addr);
+		}
+	}
+	env.steps += n * loop.stepsPerTrip;
+}
+
+#endif
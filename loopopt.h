@@ -0,0 +1,74 @@
+// -*- grammar-ext: .cpp -*-
+/*
+ *	This file is a part of ConfigurableAssemblyIntepreter.
+ *
+ *	ConfigurableAssemblyIntepreter is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ConfigurableAssemblyIntepreter is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <cstdint>
+#include <vector>
+
+#ifndef LOOPOPT_H
+#define LOOPOPT_H
+
+// Closed form loop acceleration. A loop here is a "jmp" back to an earlier line where every
+// line in between is a cpf, cpt, add, sub, inc, dec, mov(none of them dereferenced or indexed,
+// but immediates like "add #1" and registers like "add 5 r1" are fine), nop or label, plus
+// exactly one jiz or jlz that leaves the loop. No I/O and no pointers means one trip around
+// the loop is just a linear function of the acc and the cells and registers it uses, so that
+// gets worked out once when the program is loaded.
+//
+// When the loop's "jmp" runs, the number of trips left before the exit gets solved for, and
+// all of those trips get done at once: counters go up by a constant each trip, accumulators
+// of counters go up by an arithmetic series, and steps goes up by exactly what running them
+// would have added. The last trip(the one that leaves) is still run normally. Anything it
+// can't be sure about, like the exit test overflowing before it's taken, just runs normally.
+
+struct Env;
+struct Program;
+
+// A linear expression over the loop's variables: konst + sum of coef[i] * var i
+struct LoopExpr {
+	std::vector<int64_t> coef;
+	int64_t konst{0};
+};
+
+// How each variable changes from one trip to the next
+enum class LoopVarKind {
+	INVARIANT,   // Doesn't change
+	STEP1,       // Goes up by the same amount every trip
+	STEP2,       // Goes up by something that's STEP1, so an arithmetic series
+	OVERWRITTEN  // Set from the others every trip without being read first
+};
+
+struct CountedLoop {
+	int head;                       // The line the "jmp" goes back to
+	int back;                       // The line of the "jmp"
+	int exitLine;                   // The line of the jiz/jlz
+	bool exitIfNegative;            // jlz instead of jiz
+	int stepsPerTrip;
+	std::vector<int> cells;         // Variable 0 is the acc, variable i is memory[cells[i - 1]](or register -1 - cells[i - 1] if it's negative)
+	std::vector<LoopExpr> trip;     // Each variable after one trip, in terms of all of them before it
+	std::vector<LoopVarKind> kinds;
+	LoopExpr exitTest;              // The acc when the jiz/jlz gets to it
+};
+
+// Finds the loops in prog that can be sped up and switches their "jmp" lines over to
+// Op::LOOP_JUMP, which is a jmp that calls accelerateLoop after jumping. The loader calls this.
+void findCountedLoops(Program &prog);
+
+// Skips as many whole trips around the loop as it safely can without going past env.stepFence.
+// Does nothing if it can't be sure the skipped trips would have been the same
+void accelerateLoop(Env &env, const CountedLoop &loop);
+
+#endif
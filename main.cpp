@@ -18,10 +18,23 @@
 //#include "instructions.h"
 #include <cassert>
 #include <cstdio>
+#include <cstring>
 
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "breakpoints.h"
+#include "debugger.h"
 #include "instructions.h"
 #include "mainLib.h"
+#include "memprofile.h"
+#include "resultcache.h"
+#include "server.h"
+#include "statedump.h"
 #include "stringops.h"
+#include "threads.h"
 
 void printArray(int arr[], int size) {
 	for (int i = 0; i < size; ++i) {
@@ -45,7 +58,7 @@ void printVector(std::vector<int> vec) {
 
 // Prints the parameters of a given line struct 
 // For debugging purposes
-void printLine(Line line) {
+void printLine(const Line &line) {
 	printf("%i %i [", static_cast<int>(line.operation), line.lineNum);
 	Arg carg;
 	for (int i = 0; i < line.numArgs; ++i) {
@@ -98,7 +111,7 @@ int testInterpreter() {
 	for (int i = 0; i < (int)p1.lines.size(); i++) {
 		printLine(p1.lines[i]);
 	}*/
-	temp = makeLabelMap("tests/jmptest.asm");
+	temp = loadProgramFile("tests/jmptest.asm")->labels;
 	printLabelMap(temp);	
 	
 	Env env = createEnvironmentFromFile("test.asm");
@@ -119,8 +132,9 @@ int testInterpreter() {
 		printState(env);
 		if (i > 10) {
 			printf("Too many iterations, exiting\n");
-			throw 'i';
+			return 1;
 		}
+		i++;
 	}
 	printf("\nStarting jmptest.asm\n");
 	env = runProgram("tests/jmptest.asm");
@@ -151,6 +165,183 @@ int testStringops() {
 	return 0;
 }
 
+// Runs a program with "threads=" in its ENVDEF, with the limits and engine model has
+int runThreads(const Env &model) {
+	std::unique_ptr<ThreadGroup> group;
+	try {
+		group = createThreadGroup(model.program);
+	} catch (const CaiError &e) {
+		fprintf(stderr, "Error: %s\n", e.what());
+		return 1;
+	}
+	for (Env &env : group->threads) {
+		env.limits = model.limits;
+		env.engine = model.engine;
+	}
+	int result = 0;
+	try {
+		runThreadGroup(*group);
+	} catch (const CaiError &e) {
+		fprintf(stderr, "Error: %s\n", e.what());
+		result = 1;
+	}
+	for (int i = 0; i < (int)group->threads.size(); i++) {
+		const Env &env = group->threads[i];
+		printf("Thread %i:\n", i);
+		printState(env);
+		printOutput(env);
+		if (env.status != RunStatus::ENDED) {
+			printf("Thread %i stopped early: %s after %lld steps\n", i, runStatusName(env.status), env.steps);
+			result = (result == 0) ? 2 : result;
+		}
+	}
+	return result;
+}
+
+// The --debug prompt. Reads commands from stdin until "q" or the end of it
+int runDebugger(Env &env) {
+	Debugger dbg;
+	try {
+		setupDebugger(dbg, std::move(env));
+	} catch (const CaiError &e) {
+		fprintf(stderr, "Error: %s\n", e.what());
+		return 1;
+	}
+	printf("Commands: s [n] step, b [n] step back, c continue, g N go to step N, rc A back to the last write of cell A,\n"
+		"          i V give it input V, p print the state, m A print cell A, q quit\n");
+	char buf[256];
+	while (true) {
+		printf("step %lld  line %i  acc %i%s> ", dbg.step, dbg.env.line, dbg.env.reg,
+			(dbg.env.endProgram || dbg.env.states[IS_END]) ? "  ended" : "");
+		fflush(stdout);
+		if (fgets(buf, sizeof(buf), stdin) == nullptr) {
+			printf("\n");
+			break;
+		}
+		char cmd[16] = "";
+		long long n = 1;
+		int args = sscanf(buf, "%15s %lld", cmd, &n);
+		RunStatus status = RunStatus::RUNNING;
+		try {
+			if (args <= 0) {
+				continue;
+			} else if (strcmp(cmd, "q") == 0) {
+				break;
+			} else if (strcmp(cmd, "s") == 0) {
+				status = debugContinue(dbg, n);
+			} else if (strcmp(cmd, "b") == 0) {
+				for (long long i = 0; i < n && debugStepBack(dbg); i++) {}
+			} else if (strcmp(cmd, "c") == 0) {
+				status = debugContinue(dbg);
+			} else if (strcmp(cmd, "g") == 0 && args == 2) {
+				status = debugGoTo(dbg, n);
+			} else if (strcmp(cmd, "rc") == 0 && args == 2) {
+				if (!debugReverseToWrite(dbg, (int)n)) {
+					printf("Nothing wrote to cell %lld\n", n);
+				}
+			} else if (strcmp(cmd, "i") == 0 && args == 2) {
+				debugPushInput(dbg, (int)n);
+			} else if (strcmp(cmd, "p") == 0) {
+				printState(dbg.env);
+				printOutput(dbg.env);
+			} else if (strcmp(cmd, "m") == 0 && args == 2) {
+				if (n >= 0 && n < (long long)dbg.env.memory.size()) {
+					printf("[%lld] = %i\n", n, dbg.env.memory[n]);
+				} else {
+					printf("Cell %lld is outside of memory\n", n);
+				}
+			} else {
+				printf("Unknown command '%s'\n", cmd);
+			}
+		} catch (const CaiError &e) {
+			printf("Error: %s\n", e.what());
+		}
+		if (status == RunStatus::BLOCKED_INPUT) {
+			printf("Waiting for input, give it some with i\n");
+		}
+	}
+	env = std::move(dbg.env);
+	return 0;
+}
+
+// Splits "where if condition" from --break and --watch
+static std::pair<std::string, BreakCondition> parseBreakSpec(const std::string &spec) {
+	size_t at = spec.find(" if ");
+	if (at == std::string::npos) {
+		return { trim(spec), BreakCondition() };
+	}
+	return { trim(spec.substr(0, at)), parseBreakCondition(spec.substr(at + 4)) };
+}
+
+// Adds the --break and --watch ones to bp and arms env with them
+static bool setupBreakpoints(Env &env, Breakpoints &bp, const std::vector<std::string> &breaks, const std::vector<std::string> &watches) {
+	try {
+		for (const std::string &spec : breaks) {
+			std::pair<std::string, BreakCondition> p = parseBreakSpec(spec);
+			addBreakpoint(bp, breakpointLine(*env.program, p.first), p.second);
+		}
+		for (const std::string &spec : watches) {
+			std::pair<std::string, BreakCondition> p = parseBreakSpec(spec);
+			addWatchpoint(bp, std::stoi(p.first), p.second);
+		}
+		armBreakpoints(env, bp);
+	} catch (const CaiError &e) {
+		fprintf(stderr, "Error: %s\n", e.what());
+		return false;
+	} catch (const std::logic_error &e) {
+		fprintf(stderr, "Error: --watch needs a cell number\n");
+		return false;
+	}
+	return true;
+}
+
+// The prompt a run stopped at a breakpoint gets. False if it shouldn't keep going
+static bool runBreakPrompt(Env &env, Breakpoints &bp) {
+	const BreakHit &hit = bp.lastHit;
+	if (hit.watch) {
+		printf("Watchpoint %i: [%i] %i -> %i on line %i\n", hit.id, hit.addr, hit.oldValue, hit.newValue, hit.line);
+	} else {
+		printf("Breakpoint %i on line %i\n", hit.id, hit.line);
+	}
+	printf("Commands: c continue, p print the state, m A print cell A, d N delete breakpoint N, q quit\n");
+	char buf[256];
+	while (true) {
+		printf("step %lld  line %i  acc %i> ", env.steps, env.line, env.reg);
+		fflush(stdout);
+		if (fgets(buf, sizeof(buf), stdin) == nullptr) {
+			printf("\n");
+			return false;
+		}
+		char cmd[16] = "";
+		long long n = 0;
+		int args = sscanf(buf, "%15s %lld", cmd, &n);
+		if (args <= 0) {
+			continue;
+		} else if (strcmp(cmd, "c") == 0) {
+			return true;
+		} else if (strcmp(cmd, "q") == 0) {
+			return false;
+		} else if (strcmp(cmd, "p") == 0) {
+			printState(env);
+			printOutput(env);
+		} else if (strcmp(cmd, "m") == 0 && args == 2) {
+			if (n >= 0 && n < (long long)env.memory.size()) {
+				printf("[%lld] = %i\n", n, env.memory[n]);
+			} else {
+				printf("Cell %lld is outside of memory\n", n);
+			}
+		} else if (strcmp(cmd, "d") == 0 && args == 2) {
+			if (removeBreakpoint(bp, (int)n)) {
+				armBreakpoints(env, bp);
+			} else {
+				printf("There's no breakpoint %lld\n", n);
+			}
+		} else {
+			printf("Unknown command '%s'\n", cmd);
+		}
+	}
+}
+
 // The GNU GPL v3.0 license
 std::string license = 
 R"LICENSE(ConfigurableAssemblyInterpreter is exactly what you'd expect, a configurable assembly intepreter
@@ -170,7 +361,26 @@ You should have received a copy of the GNU General Public License
 along with this program.  If not, see <http://www.gnu.org/licenses/>.
 )LICENSE";
 
-int main(int argc, char const *argv[], char *envp[]) {
+// Reads the number given to a flag into out. If it isn't a whole number from least to most,
+// it says so and returns false, and main gives up
+static bool parseFlagNumber(const char *flag, const char *text, long long least, long long most, long long &out) {
+	if (!parseWholeNumber(text, least, most, out)) {
+		if (most == LLONG_MAX) {
+			fprintf(stderr, "Error: %s needs a whole number that's at least %lld, not '%s'\n", flag, least, text);
+		} else {
+			fprintf(stderr, "Error: %s needs a whole number from %lld to %lld, not '%s'\n", flag, least, most, text);
+		}
+		return false;
+	}
+	return true;
+}
+
+// --serve stops cleanly on ^C or a kill, so the socket file gets cleaned up
+static void onServeSignal(int) {
+	stopServer();
+}
+
+int main(int argc, char const *argv[]) {
 	// Test the tellg function to see if any information can be gained from it 
 	/*
 	std::ifstream ifs;
@@ -185,17 +395,310 @@ int main(int argc, char const *argv[], char *envp[]) {
 	//testStringops();
 	testInterpreter();
 	*/
-	if (argc < 2) {
-		printf("Please input a file name\n");
-	} else {
-		// Print GNU GPL v3.0 license
-		if (argv[1] == "-v") {
+	std::string filename;
+	std::string memProfilePrefix;
+	std::string statsPath;
+	std::string resultCacheDir;
+	uint64_t resultCacheBytes = 64ull << 20;
+	bool trace = false;
+	bool debug = false;
+	std::vector<std::string> breaks, watches;
+	// Where the state goes at the end, see statedump.h. "none" for nowhere
+	std::string dumpPath = "-";
+	DumpFormat dumpFormat = DumpFormat::TEXT;
+	long long dumpFirst = 0, dumpLast = -1, dumpZeros = 0, dumpEvery = 0;
+	bool dumpOptions = false;
+	std::string engine;
+	std::string outputPath;
+	OutputEncoding outputEncoding = OutputEncoding::TEXT;
+	bool flushOnEnd = false;
+	bool serve = false;
+	ServerConfig serverConfig;
+	// Limits given on the command line win over the ones in ENVDEF. -1 means not given
+	long long maxSteps = -1, maxMillis = -1, maxOutput = -1;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-v") == 0) {
+			// Print GNU GPL v3.0 license
 			printf("%s\n", license.c_str());
+		} else if (strcmp(argv[i], "--trace") == 0) {
+			// Print the state after every step, like runProgram used to
+			trace = true;
+		} else if (strcmp(argv[i], "--debug") == 0) {
+			// Step through it forwards and backwards, see debugger.h
+			debug = true;
+		} else if (strcmp(argv[i], "--break") == 0 && i + 1 < argc) {
+			// "line" or "label", with an optional " if condition", see breakpoints.h
+			breaks.push_back(argv[++i]);
+		} else if (strcmp(argv[i], "--watch") == 0 && i + 1 < argc) {
+			// "cell", with an optional " if condition"
+			watches.push_back(argv[++i]);
+		} else if (strcmp(argv[i], "--dump") == 0 && i + 1 < argc) {
+			// Write the state here instead of printing it("-" is stdout, "none" is not at all)
+			dumpPath = argv[++i];
+			dumpOptions = true;
+		} else if (strcmp(argv[i], "--dump-format") == 0 && i + 1 < argc) {
+			if (!parseDumpFormat(argv[++i], dumpFormat)) {
+				fprintf(stderr, "Error: Unknown dump format '%s', the formats are: text, json, csv, binary\n", argv[i]);
+				return 1;
+			}
+			dumpOptions = true;
+		} else if (strcmp(argv[i], "--dump-range") == 0 && i + 1 < argc) {
+			if (!parseDumpRange(argv[++i], dumpFirst, dumpLast)) {
+				fprintf(stderr, "Error: '%s' isn't a range of cells like 100:200\n", argv[i]);
+				return 1;
+			}
+			dumpOptions = true;
+		} else if (strcmp(argv[i], "--dump-zeros") == 0 && i + 1 < argc) {
+			// Runs of at least this many zeros just get their length written
+			if (!parseFlagNumber(argv[i], argv[i + 1], 0, LLONG_MAX, dumpZeros)) {
+				return 1;
+			}
+			i++;
+			dumpOptions = true;
+		} else if (strcmp(argv[i], "--dump-every") == 0 && i + 1 < argc) {
+			// Dump it every this many steps too, not just at the end
+			if (!parseFlagNumber(argv[i], argv[i + 1], 0, LLONG_MAX, dumpEvery)) {
+				return 1;
+			}
+			i++;
+			dumpOptions = true;
+		} else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+			// Run as a server for caiclient instead of running a file
+			serve = true;
+			serverConfig.socketPath = argv[++i];
+		} else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+			long long workers;
+			if (!parseFlagNumber(argv[i], argv[i + 1], 1, 1024, workers)) {
+				return 1;
+			}
+			serverConfig.workers = (int)workers;
+			i++;
+		} else if (strcmp(argv[i], "--cache-size") == 0 && i + 1 < argc) {
+			long long cacheSize;
+			if (!parseFlagNumber(argv[i], argv[i + 1], 1, INT_MAX, cacheSize)) {
+				return 1;
+			}
+			serverConfig.cacheSize = (size_t)cacheSize;
+			i++;
+		} else if (strcmp(argv[i], "--result-cache") == 0 && i + 1 < argc) {
+			// Keep finished runs in this directory, and skip running ones that are already there
+			resultCacheDir = argv[++i];
+		} else if (strcmp(argv[i], "--result-cache-mb") == 0 && i + 1 < argc) {
+			long long mb;
+			if (!parseFlagNumber(argv[i], argv[i + 1], 0, 1ll << 40, mb)) {
+				return 1;
+			}
+			resultCacheBytes = (uint64_t)mb << 20;
+			i++;
+		} else if (strcmp(argv[i], "--engine") == 0 && i + 1 < argc) {
+			// Wins over "engine=" in the ENVDEF
+			engine = argv[++i];
+		} else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+			// Stream "out" to a file("-" for stdout) instead of keeping it all until the end
+			outputPath = argv[++i];
+		} else if (strcmp(argv[i], "--output-format") == 0 && i + 1 < argc) {
+			if (!parseOutputEncoding(argv[++i], outputEncoding)) {
+				fprintf(stderr, "Error: Unknown output format '%s', the formats are: text, binary\n", argv[i]);
+				return 1;
+			}
+		} else if (strcmp(argv[i], "--flush-on-end") == 0) {
+			flushOnEnd = true;
+		} else if (strcmp(argv[i], "--memprofile") == 0 && i + 1 < argc) {
+			memProfilePrefix = argv[++i];
+		} else if (strcmp(argv[i], "--stats") == 0 && i + 1 < argc) {
+			// Count what the run does and write it as JSON("-" for stdout), see stats.h
+			statsPath = argv[++i];
+		} else if (strcmp(argv[i], "--bench") == 0 && i + 1 < argc) {
+			// Everything after the benchmark's name is for the benchmark
+			std::string name = argv[++i];
+			std::vector<std::string> benchArgs(argv + i + 1, argv + argc);
+			return runBench(name, benchArgs);
+		} else if (strcmp(argv[i], "--max-steps") == 0 && i + 1 < argc) {
+			if (!parseFlagNumber(argv[i], argv[i + 1], 0, LLONG_MAX, maxSteps)) {
+				return 1;
+			}
+			i++;
+		} else if (strcmp(argv[i], "--max-time") == 0 && i + 1 < argc) {
+			if (!parseFlagNumber(argv[i], argv[i + 1], 0, LLONG_MAX / 1000000, maxMillis)) {
+				return 1;
+			}
+			i++;
+		} else if (strcmp(argv[i], "--max-output") == 0 && i + 1 < argc) {
+			if (!parseFlagNumber(argv[i], argv[i + 1], 0, LLONG_MAX, maxOutput)) {
+				return 1;
+			}
+			i++;
+		} else {
+			filename = argv[i];
+		}
+	}
+	if (serve) {
+		serverConfig.resultCacheDir = resultCacheDir;
+		serverConfig.resultCacheBytes = resultCacheBytes;
+		// For a server these are the most any request gets(0 for no limit)
+		if (maxSteps  >= 0) { serverConfig.maxSteps  = maxSteps; }
+		if (maxMillis >= 0) { serverConfig.maxMillis = maxMillis; }
+		signal(SIGINT, onServeSignal);
+		signal(SIGTERM, onServeSignal);
+		int err = runServer(serverConfig);
+		if (err != 0) {
+			fprintf(stderr, "Error: Couldn't serve on '%s': %s\n", serverConfig.socketPath.c_str(), strerror(err));
+			return 1;
+		}
+		return 0;
+	}
+	if (filename.empty()) {
+		printf("Please input a file name\n");
+		return 0;
+	}
+	
+	Env env;
+	try {
+		env = createEnvironmentFromFile(filename);
+	} catch (const CaiError &e) {
+		fprintf(stderr, "Error: %s\n", e.what());
+		return 1;
+	}
+	if (maxSteps  >= 0) { env.limits.maxSteps  = maxSteps; }
+	if (maxMillis >= 0) { env.limits.maxMillis = maxMillis; }
+	if (maxOutput >= 0) { env.limits.maxOutput = maxOutput; }
+	if (!engine.empty() && !parseEngine(engine, env.engine)) {
+		fprintf(stderr, "Error: Unknown engine '%s', the engines are: interp, closure\n", engine.c_str());
+		return 1;
+	}
+	
+	if (env.program->config.threads > 1) {
+		if (trace || debug || !memProfilePrefix.empty() || !statsPath.empty() || !outputPath.empty() || !resultCacheDir.empty() ||
+			!breaks.empty() || !watches.empty() || dumpOptions) {
+			fprintf(stderr, "Error: --trace, --debug, --memprofile, --stats, --output, --result-cache, --break, --watch and --dump don't work with threads=\n");
+			return 1;
+		}
+		return runThreads(env);
+	}
+	if (debug) {
+		return runDebugger(env);
+	}
+	Breakpoints breakpoints;
+	if (!breaks.empty() || !watches.empty()) {
+		if (trace || !resultCacheDir.empty()) {
+			fprintf(stderr, "Error: --break and --watch don't work with --trace or --result-cache\n");
+			return 1;
+		}
+		if (!setupBreakpoints(env, breakpoints, breaks, watches)) {
+			return 1;
 		}
-		std::string filename = argv[1];
-		printState(runProgram(filename));
 	}
 	
+	// Attach a profiler to the environment if one was asked for
+	MemProfile profile;
+	if (!memProfilePrefix.empty()) {
+		setupMemProfile(profile, env.memSize);
+		env.memProfile = &profile;
+	}
+	RunStats stats;
+	if (!statsPath.empty()) {
+		env.stats = &stats;
+	}
+	OutputSink sink;
+	if (!outputPath.empty()) {
+		int fd = (outputPath == "-") ? STDOUT_FILENO : open(outputPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0) {
+			fprintf(stderr, "Error: Couldn't open '%s' for the output: %s\n", outputPath.c_str(), strerror(errno));
+			return 1;
+		}
+		fflush(stdout);  // So nothing printf'd so far ends up after it
+		setupOutputSink(sink, fd, outputEncoding);
+		sink.flushOnEnd = flushOnEnd;
+		env.outputSink = &sink;
+	}
+	ResultCache resultCache;
+	if (!resultCacheDir.empty() && !openResultCache(resultCache, resultCacheDir, resultCacheBytes)) {
+		fprintf(stderr, "Error: Couldn't use '%s' as a result cache\n", resultCacheDir.c_str());
+		return 1;
+	}
+	StateDump dump;
+	if (dumpEvery > 0 && (trace || !resultCacheDir.empty() || dumpPath == "none")) {
+		fprintf(stderr, "Error: --dump-every doesn't work with --trace, --result-cache or --dump none\n");
+		return 1;
+	}
+	if (dumpPath != "none") {
+		if (!openStateDump(dump, dumpPath, dumpFormat)) {
+			fprintf(stderr, "Error: Couldn't open '%s' for the state: %s\n", dumpPath.c_str(), strerror(errno));
+			return 1;
+		}
+		dump.first = dumpFirst;
+		dump.last = dumpLast;
+		dump.zeroRun = dumpZeros;
+	}
+	try {
+		if (trace) {
+			while (runSteps(env, 1) == RunStatus::RUNNING) {
+				printState(env);
+			}
+		} else if (!resultCacheDir.empty()) {
+			runCached(resultCache, env);
+		} else {
+			// With --dump-every it gets dumped every time a slice is used up
+			const long long slice = (dumpEvery > 0) ? dumpEvery : -1;
+			runSteps(env, slice);
+			// Blocked output only happens if the fd is non-blocking, like a pipe someone else set up
+			while (env.status == RunStatus::RUNNING || env.status == RunStatus::BLOCKED_OUTPUT ||
+				(env.status == RunStatus::BREAKPOINT && runBreakPrompt(env, breakpoints))) {
+				if (env.status == RunStatus::RUNNING) {
+					writeStateDump(dump, env);
+				} else if (env.status == RunStatus::BLOCKED_OUTPUT) {
+					waitForSink(sink);
+				}
+				runSteps(env, slice);
+			}
+		}
+		if (env.outputSink != nullptr) {
+			waitForSink(sink);
+		}
+	} catch (const CaiError &e) {
+		// Still print where it got to, since that's usually what you want to see
+		fprintf(stderr, "Error: %s\n", e.what());
+		if (dump.file != nullptr) {
+			writeStateDump(dump, env);
+			closeStateDump(dump);
+		}
+		return 1;
+	}
+	env.memProfile = nullptr;
+	env.stats = nullptr;
+	env.outputSink = nullptr;
+	if (!outputPath.empty() && outputPath != "-") {
+		close(sink.fd);
+	}
+	if (dump.file != nullptr) {
+		writeStateDump(dump, env);
+		if (!closeStateDump(dump)) {
+			printf("Error, couldn't write the state to '%s'\n", dumpPath.c_str());
+			return 1;
+		}
+	}
+	printOutput(env);
+	
+	if (!memProfilePrefix.empty() && !writeMemProfile(profile, memProfilePrefix)) {
+		printf("Error, couldn't write memory profile '%s'\n", memProfilePrefix.c_str());
+		return 1;
+	}
+	if (!statsPath.empty()) {
+		std::string json = statsJson(&stats, &env.program->loadTimes);
+		FILE *file = (statsPath == "-") ? stdout : fopen(statsPath.c_str(), "w");
+		if (file == nullptr || fwrite(json.data(), 1, json.size(), file) != json.size()) {
+			printf("Error, couldn't write stats '%s'\n", statsPath.c_str());
+			return 1;
+		}
+		if (file != stdout) {
+			fclose(file);
+		}
+	}
+	if (env.status != RunStatus::ENDED) {
+		// Stopped by the watchdog, env is whatever state it was in at that point
+		printf("Program stopped early: %s after %lld steps\n", runStatusName(env.status), env.steps);
+		return 2;
+	}
 	
 	return 0;
 	
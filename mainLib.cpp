@@ -21,51 +21,125 @@
 #include <vector>
 #include <cmath>
 #include <algorithm>
+#include <chrono>
+#include <climits>
+#include <charconv>
+#include <type_traits>
 
 #include "stringops.h"
 #include "instructions.h"
 #include "mainLib.h"
+#include "memprofile.h"
+#include "lexscan.h"
+#include "closures.h"
+#include "mappedfile.h"
+#include "linker.h"
+#include "statedump.h"
 
 #ifndef MAINLIB_CPP
 #define MAINLIB_CPP
 
+// Makes sure addr is inside the memory, and just gives it back if it is
+int checkAddress(Env &env, int addr) {
+	if (addr < 0 || addr >= (int)env.memory.size()) {
+		throw CaiError(CaiErrc::BAD_ADDRESS, "Address " + std::to_string(addr) + " is outside of memory of size " +
+			std::to_string(env.memory.size()) + " on program line " + std::to_string(env.line), env.line);
+	}
+	return addr;
+}
+
+// Follows a chain of derefLevel "*"s starting at addr and returns the address it ends up at.
+// Every cell that is read as a pointer along the way is reported to the profiler
+static int followDerefs(Env &env, int addr, int derefLevel) {
+	// Repeatedly dereference the address while derefLevel >= 1
+	while (derefLevel >= 1) {
+		int next = env.memory[checkAddress(env, addr)]; // The value at the address addr
+		if (env.memProfile != nullptr) {
+			recordMemAccess(*env.memProfile, env.line, addr, 0, MemAccess::HOP);
+		}
+		addr = next;
+		derefLevel--; // Decrement derefLevel
+	}
+	return addr;
+}
+
+// Returns the address an argument ends up at. An immediate doesn't have one
+int resolveAddress(Env &env, const Arg &arg1) {
+	if (arg1.mode == ArgMode::INDEXED) {
+		int base = followDerefs(env, arg1.value, arg1.derefLevel);
+		int index = followDerefs(env, arg1.index, arg1.indexDeref);
+		return (int)((unsigned)base + (unsigned)index);  // Wraps instead of being undefined
+	}
+	if (arg1.mode == ArgMode::IMMEDIATE) {
+		throw CaiError(CaiErrc::BAD_ARGUMENT, "The immediate #" + std::to_string(arg1.value) +
+			" isn't an address on program line " + std::to_string(env.line), env.line);
+	}
+	if (arg1.mode == ArgMode::REGISTER) {
+		throw CaiError(CaiErrc::BAD_ARGUMENT, "The register r" + std::to_string(arg1.value) +
+			" isn't an address on program line " + std::to_string(env.line), env.line);
+	}
+	return followDerefs(env, arg1.value, arg1.derefLevel);
+}
+
 // Function to handle getting a dereferenced value
-int getDeref(Env &env, Arg arg1) {
-	// Stores the argument's value if derefLevel == 0,
-	// but will store the value found at each dereference level if derefLevel >= 1
-	int lastval = env.memory.at(arg1.derefLevel);
-	
-	// Repeatedly dereference the value lastval while derefLevel >= 1 
-	while (arg1.derefLevel >= 1) {
-		lastval = env.memory.at(lastval); // Set lastval to the value the address lastval
-		arg1.derefLevel--; // Decrement derefLevel
+int getDeref(Env &env, const Arg &arg1) {
+	if (arg1.mode == ArgMode::IMMEDIATE) {
+		return arg1.value;
 	}
-	
-	// lastval is now the n-th dereferenced value.
-	return lastval;
+	if (arg1.mode == ArgMode::REGISTER) {
+		return env.regs[arg1.value];  // The loader made sure it's one of the program's registers
+	}
+	// addr is the address of the n-th dereferenced value
+	int addr = resolveAddress(env, arg1);
+	int val = env.memory[checkAddress(env, addr)];
+	if (env.memProfile != nullptr) {
+		recordMemAccess(*env.memProfile, env.line, addr, arg1.derefLevel, MemAccess::READ);
+	}
+	return val;
 }
 
 // Same as above, but returns a pointer to the value.
-// Used for setting a value with +=, ++ and other operators
-int* getDerefp(Env &env, Arg arg1) {
-	int* lastval = &env.memory.at(arg1.value);
-	
-	// Same as getDeref, but modified since lastval is int* and not int.
-	while (arg1.derefLevel >= 1) {
-		lastval = &env.memory.at(*lastval);
-		arg1.derefLevel--;
+// Used for setting a value with +=, ++ and other operators, so
+// the profiler counts this as a write
+int* getDerefp(Env &env, const Arg &arg1) {
+	if (arg1.mode == ArgMode::REGISTER) {
+		return &env.regs[arg1.value];
+	}
+	int addr = resolveAddress(env, arg1);
+	int* lastval = &env.memory[checkAddress(env, addr)];
+	env.memory.touch(addr);
+	if (env.memProfile != nullptr) {
+		recordMemAccess(*env.memProfile, env.line, addr, arg1.derefLevel, MemAccess::WRITE);
 	}
-	
 	return lastval;
 }
 
+// Gets a pointer to the start of the range [arg1, arg1+len) after making sure all of it is
+// inside the memory. Used by the block instructions. kind is only for the profiler,
+// which counts every cell of the range
+int* getRangep(Env &env, const Arg &arg1, int len, MemAccess kind) {
+	int addr = resolveAddress(env, arg1);
+	if (len < 0 || addr < 0 || (long long)addr + len > (long long)env.memory.size()) {
+		throw CaiError(CaiErrc::BAD_ADDRESS, "Range [" + std::to_string(addr) + ", " + std::to_string((long long)addr + len) +
+			") is outside of memory of size " + std::to_string(env.memory.size()) + " on program line " +
+			std::to_string(env.line), env.line);
+	}
+	if (kind == MemAccess::WRITE) {
+		env.memory.touchRange(addr, len);
+	}
+	if (env.memProfile != nullptr) {
+		for (int i = 0; i < len; i++) {
+			recordMemAccess(*env.memProfile, env.line, addr + i, arg1.derefLevel, kind);
+		}
+	}
+	return env.memory.data() + addr;
+}
+
 // Function to handle setting a dereferenced value
-Env setDeref(Env &env, Arg arg1, int newValue) {
+void setDeref(Env &env, const Arg &arg1, int newValue) {
 	// Use getDerefp to get a pointer to the value
 	int* val = getDerefp(env, arg1);
 	*val = newValue;
-	
-	return env;
 }
 
 // Wrapper to get the value of the register 
@@ -84,16 +158,15 @@ int* getRegp(Env &env) {
 	return &env.reg;
 }
 
+// Puts a value in the register, which also means it isn't null anymore
 void setReg(Env &env, int value) {
-	env.states[NULL_REGISTER] = true;
-	
+	env.reg = value;
+	env.states[NULL_REGISTER] = false;
 }
 
 // Call the instruction func given the line struct and the current environment
-void doInstruction(Line line, Env &env) {
-	Op inst = line.operation;
-	std::vector<Arg> args = line.arguments;
-	
+// The Line and its arguments are only looked at, never copied, so running one doesn't allocate anything
+void doInstruction(const Line &line, Env &env) {
 	(*line.func)(env, line.arguments);
 }
 
@@ -130,17 +203,111 @@ Op getOpFromString(std::string op) {
 		return Op::OUT;
 	} else if (strcmp(cop, "end") == 0) {
 		return Op::END;
-	} else {
-		printf("Error, instruction %s not found\n", op.c_str());
-		throw 'i';
 	}
+	// Anything newer than the ones above only has to be added to strtoop
+	strToOpmap_t::const_iterator it = strtoop.find(op);
+	if (it != strtoop.end() && it->second != Op::LABEL) {
+		return it->second;
+	}
+	throw CaiError(CaiErrc::UNKNOWN_INSTRUCTION, "Instruction '" + op + "' not found");
+}
+
+// Reads a number with an optional sign from str, which has to be all of it.
+// Used for the parts of immediates and indexed arguments
+static bool parseArgNumber(const std::string &str, int &out) {
+	if (str.empty() || (str.size() == 1 && (str[0] == '-' || str[0] == '+'))) {
+		return false;
+	}
+	size_t pos = 0;
+	try {
+		out = std::stoi(str, &pos);
+	} catch (const std::logic_error &e) {
+		return false;
+	}
+	return pos == str.size();
+}
+
+// Splits the "*"s off the front of an address like "**5"
+static bool parseArgAddress(const std::string &str, int &address, int &derefLevel) {
+	size_t stars = 0;
+	while (stars < str.size() && str[stars] == '*') {
+		stars++;
+	}
+	derefLevel = (int)stars;
+	return parseArgNumber(str.substr(stars), address);
+}
+
+// Interprets an immediate("#5") or an indexed argument("[10+3]", "[*10-3]", "[10+*4]")
+static Arg interpretSpecialArg(const std::string &argString) {
+	if (argString[0] == '#') {
+		int value;
+		if (!parseArgNumber(argString.substr(1), value)) {
+			throw CaiError(CaiErrc::BAD_ARGUMENT, "Immediate '" + argString + "' isn't a number");
+		}
+		return Arg{ value, 0, ArgMode::IMMEDIATE };
+	}
+	if (argString.size() < 3 || argString.back() != ']') {
+		throw CaiError(CaiErrc::BAD_ARGUMENT, "Indexed argument '" + argString + "' is missing its ']'");
+	}
+	std::string inside = argString.substr(1, argString.size() - 2);
+	// The first + or - after the base's number splits it from the index
+	size_t split = 0;
+	while (split < inside.size() && inside[split] == '*') {
+		split++;
+	}
+	if (split < inside.size() && (inside[split] == '-' || inside[split] == '+')) {
+		split++;
+	}
+	split = inside.find_first_of("+-", split);
+	int base, baseDeref;
+	if (!parseArgAddress(inside.substr(0, split), base, baseDeref)) {
+		throw CaiError(CaiErrc::BAD_ARGUMENT, "Indexed argument '" + argString + "' has a bad base");
+	}
+	if (split == std::string::npos) {
+		return Arg{ base, baseDeref };  // Just "[5]"
+	}
+	bool negative = inside[split] == '-';
+	std::string term = inside.substr(split + 1);
+	int index, indexDeref;
+	if (!parseArgAddress(term, index, indexDeref) || (indexDeref > 0 && negative)) {
+		throw CaiError(CaiErrc::BAD_ARGUMENT, "Indexed argument '" + argString + "' has a bad offset");
+	}
+	if (indexDeref == 0) {
+		long long offset = negative ? -(long long)index : (long long)index;
+		if (baseDeref == 0) {
+			// Both are constants, so it's just a normal address
+			long long addr = (long long)base + offset;
+			if (addr < INT_MIN || addr > INT_MAX) {
+				throw CaiError(CaiErrc::BAD_ARGUMENT, "Indexed argument '" + argString + "' is out of range");
+			}
+			return Arg{ (int)addr, 0 };
+		}
+		if (offset < INT_MIN || offset > INT_MAX) {
+			throw CaiError(CaiErrc::BAD_ARGUMENT, "Indexed argument '" + argString + "' is out of range");
+		}
+		index = (int)offset;
+	}
+	return Arg{ base, baseDeref, ArgMode::INDEXED, index, indexDeref };
 }
 
 // Interprets a given argument as the default address argument
 // Returns the Arg struct of the argument
-Arg interpretArg(std::string argString) {
+Arg interpretArg(const std::string &argString) {
 	//printf("\nEntering interpretArg\n");
 	assert(argString.size() > 0);
+	if (argString[0] == '#' || argString[0] == '[') {
+		return interpretSpecialArg(argString);
+	}
+	if (argString[0] == 'r') {
+		// A register, "r0" to "r15"
+		int reg;
+		if (!parseArgNumber(argString.substr(1), reg) || argString[1] == '-' || argString[1] == '+' ||
+			reg < 0 || reg >= MAX_REGISTERS) {
+			throw CaiError(CaiErrc::BAD_ARGUMENT, "Register '" + argString + "' isn't one of r0 to r" +
+				std::to_string(MAX_REGISTERS - 1));
+		}
+		return Arg{ reg, 0, ArgMode::REGISTER };
+	}
 	const char *argcstring = argString.c_str();
 	// Count dereference level, using 0 if not dereferencing
 	int count = 0;
@@ -158,7 +325,12 @@ Arg interpretArg(std::string argString) {
 	}
 	//printf("snumber is '%s'\n", snumber.c_str());
 	// Convert snumber to integer
-	int address = std::stoi(snumber);
+	int address;
+	try {
+		address = std::stoi(snumber);
+	} catch (const std::logic_error &e) {
+		throw CaiError(CaiErrc::BAD_ARGUMENT, "Argument '" + argString + "' isn't a number");
+	}
 
 	// Now, create and return the Arg struct
 	Arg retval{
@@ -170,44 +342,52 @@ Arg interpretArg(std::string argString) {
 }
 
 // For processing the operation and returning a Line from it
-Line processOperation(Op operation, int lineNum, std::vector<std::string> stringArgs, Labelmap_t labelmap) {
-	OpFunc opfunc = optofunc.at(operation);
+Line processOperation(Op operation, int lineNum, const std::vector<std::string> &stringArgs, const Labelmap_t &labelmap) {
 	switch (operation) {
 		case Op::JUMP: 
 		case Op::JUMP_IF_ZERO:
 		case Op::JUMP_IF_NEGATIVE: { // Using brackets because Atom doesn't autoindent after case statements
 			// Get the label to jump to 
-			std::string label = stringArgs[0];
+			if (stringArgs.empty()) {
+				throw CaiError(CaiErrc::BAD_ARGUMENT, "Jump without a label");
+			}
+			// "jiz r3 done" tests r3 instead of the acc
+			bool testsRegister = operation != Op::JUMP && stringArgs.size() >= 2;
+			std::string label = stringArgs[testsRegister ? 1 : 0];
 			
 			// Print the labelmap
 			//printLabelMap(labelmap);
 			
 			// Check if label is in labelmap 
 			//printf("Jump op references label '%s'\n", label.c_str());
-			goto SKIP_CHECK;
-			if (labelmap.find(label) == labelmap.end()) {
-				printf("Error, label '%s' not found in labelmap\n", label.c_str());
-				throw '0';
+			Labelmap_t::const_iterator it = labelmap.find(label);
+			if (it == labelmap.end()) {
+				throw CaiError(CaiErrc::UNKNOWN_LABEL, "Label '" + label + "' not found in labelmap");
 			}
-			SKIP_CHECK:
 			// Get the line that label is on 
-			int label_lineNum = labelmap.at(label);
+			int label_lineNum = it->second;
 			Arg arg1 {
 				label_lineNum,
 				0
 			};
+			std::vector<Arg> args{ arg1 };
+			if (testsRegister) {
+				args.push_back(interpretArg(stringArgs[0]));
+				if (args[1].mode != ArgMode::REGISTER) {
+					throw CaiError(CaiErrc::BAD_ARGUMENT, "A jump can only test a register, not '" + stringArgs[0] + "'");
+				}
+			}
 			return Line {
 				operation,
-				opfunc,
+				lineFunc(operation, args),
 				lineNum,
-				1,
-				std::vector<Arg>{ arg1 }
+				static_cast<int>(args.size()),
+				args
 			};
 			
 		} case Op::LABEL: {
 			// This is handled by interpretLine, so this case will never happen
-			printf("Error, Op::LABEL should never be found in processOperation\n");
-			throw 's';
+			throw CaiError(CaiErrc::INTERNAL, "Op::LABEL should never be found in processOperation");
 		}
 		
 		
@@ -222,7 +402,7 @@ Line processOperation(Op operation, int lineNum, std::vector<std::string> string
 			
 			return Line {
 				operation,
-				opfunc,
+				lineFunc(operation, args),
 				lineNum,
 				static_cast<int>(args.size()),
 				args
@@ -231,14 +411,17 @@ Line processOperation(Op operation, int lineNum, std::vector<std::string> string
 	}
 }
 
-// Interpret line of file and return a Line struct
-Line interpretLine(std::string line, int lineNum, Labelmap_t labelmap) {
-	//printf("Entering interpretLine\n");
-	// First, get rid of single line comments, which should start with "//"
-	// This is done first since whitespace may come before a comment, and hence won't be 
-	// removed by stripends
-	if (line.empty()) {
-		// Nothing here, so ignore the instruction
+// Whether a lexed line is a label: one token that ends in a ':'. Comments aren't tokens, so
+// "a: // loop" is still one. The labelmap, the lazy loader and interpretTokens all go by this
+static bool isLabelToken(const char *src, const TokenSpan *tokens, int numTokens) {
+	return numTokens == 1 && tokens[0].len > 0 && src[tokens[0].start + tokens[0].len - 1] == ':';
+}
+
+// Interpret one already lexed line. tokens are the line's tokens(comments are already gone),
+// and each one is an offset into src
+Line interpretTokens(const char *src, const TokenSpan *tokens, int numTokens, int lineNum, const Labelmap_t &labelmap) {
+	if (numTokens == 0) {
+		// Nothing here(or only a comment), so ignore the instruction
 		return Line {
 			Op::NO_INSTRUCTION,
 			optofunc.at(Op::LABEL), // No instruction should act as a label
@@ -247,16 +430,8 @@ Line interpretLine(std::string line, int lineNum, Labelmap_t labelmap) {
 			std::vector<Arg> {}
 		};
 	}
-	// Find the first occurence of "//"
-	size_t ind = line.find("//");
-	if (ind != line.npos) {  // If "//" was found
-		line.erase(ind);     // Erase from "ind" to end, 
-	}
-	line = stripends(line, ' ');
-	line = stripends(line, '\t');
 	
-	// Check if the current line ends in colon, to see if it's a label 
-	if (line.back() == ':') {
+	if (isLabelToken(src, tokens, numTokens)) {
 		// A label should be the same as a nop instruction
 		// Since a label shouldn't do anything.
 		return Line {
@@ -268,220 +443,464 @@ Line interpretLine(std::string line, int lineNum, Labelmap_t labelmap) {
 		};
 	}
 	
-	stringPair_t tempPair;
-	std::string current_arg;
-	Op operation;
-	std::vector<std::string> stringArgs{};
-	stringArgs.reserve(2);
-	int argCount = 0;
-	int i=0;
-	while (!line.empty()) {
-		//printf("current string is '%s'\n", line.c_str());
-		if (i > 10) {
-			printf("interpretLine loop has gone on for more \
-			than 10 iterations, throwing exception and exiting\n");
-			throw 'l';
-		}
-		// Split string into two parts by space
-		tempPair = splitOnFirstChar(line, ' ');
-		
-		//printf("('%s' . '%s')\n", tempPair.first.c_str(), tempPair.second.c_str());
-		// Current argument should be the car of the pair
-		current_arg = stripends(tempPair.first, ' ');
-		
-		// Find out what current_arg should be
-		if (argCount == 0) { // current_arg is the operation
-			operation = getOpFromString(current_arg);
-		} else { // current_arg is an argument to the operation
-			stringArgs.push_back(current_arg);
-		}
-		argCount++;
-		if (tempPair.second.empty()) {
-			break;
-		} 
-		line = stripends(tempPair.second, ' ');
-		
-		i++;
+	// MODULE, EXPORT and IMPORT are for compileModule, and they don't do anything when running
+	if (isLinkDirective(src + tokens[0].start, tokens[0].len)) {
+		return Line {
+			Op::NO_INSTRUCTION,
+			optofunc.at(Op::LABEL),
+			lineNum,
+			0,
+			std::vector<Arg> {}
+		};
+	}
+	
+	// The operation and at most 10 arguments
+	if (numTokens > 11) {
+		throw CaiError(CaiErrc::BAD_ARGUMENT, "Too many arguments");
+	}
+	Op operation = getOpFromString(std::string(src + tokens[0].start, tokens[0].len));
+	std::vector<std::string> stringArgs;
+	stringArgs.reserve(numTokens - 1);
+	for (int i = 1; i < numTokens; i++) {
+		stringArgs.emplace_back(src + tokens[i].start, tokens[i].len);
 	}
-	//printLabelMap(labelmap);
-	//printf("Exiting interpretLine\n");
 	return processOperation(operation, lineNum, stringArgs, labelmap);
 }
 
-void printLabelMap(Labelmap_t labelmap) {
-	for (Labelmap_t::iterator it=labelmap.begin(); it!=labelmap.end(); ++it) {
+// Interpret line of file and return a Line struct
+Line interpretLine(const std::string &line, int lineNum, const Labelmap_t &labelmap) {
+	LexIndex index;
+	lexSource(line.data(), line.size(), index);
+	if (index.lines.empty()) {
+		return interpretTokens(line.data(), nullptr, 0, lineNum, labelmap);
+	}
+	return interpretTokens(line.data(), index.tokens.data(), index.lines[0].numTokens, lineNum, labelmap);
+}
+
+// True if the line is just "ENDPROGRAM"(and maybe a comment)
+static bool isEndProgram(const char *src, const LexIndex &index, const LexedLine &line) {
+	if (line.numTokens != 1) {
+		return false;
+	}
+	const TokenSpan &tok = index.tokens[line.firstToken];
+	return tok.len == 10 && memcmp(src + tok.start, "ENDPROGRAM", 10) == 0;
+}
+
+void printLabelMap(const Labelmap_t &labelmap) {
+	for (Labelmap_t::const_iterator it=labelmap.begin(); it!=labelmap.end(); ++it) {
 		//std::cout << it->first << " => " << it->second << '\n';
 		printf("'%s' => '%i'\n", it->first.c_str(), it->second);
 	}
 }
 
 // Make a labelmap, which has type map<string, int>
-Labelmap_t makeLabelMap(std::string filename) {
-	std::ifstream ifs;
-	ifs.open(filename);
-	std::string line;
-	std::getline(ifs,line);
-	
-	// This section is to skip past the configuration if it exists
-	if (line.compare("ENVDEF") == 0) {
-		while (line.compare("ENDENVDEF") != 0) {
-			std::getline(ifs,line);
-		}
-	}
-	
+// index is the lexed source, and first is the line the program starts on(just after the ENVDEF).
+// The line numbers in the map count from first, the same way interpretLines numbers the Lines
+Labelmap_t makeLabelMap(const char *src, const LexIndex &index, int first) {
 	// Create an empty map 
 	Labelmap_t labelmap;
 	int lineNum = 0;
-	while (static_cast<int>(ifs.tellg()) != -1) {
-		//printf("tellg() = %i, lineNum = %i\n", (int)inputfile.tellg(), lineNum);
-		
-		std::getline(ifs,line);
-		// Strip line of whitespace characters
-		line = stripends(line, ' ');
-		line = stripends(line, '\t');
+	for (int i = first; i < (int)index.lines.size(); i++) {
+		const LexedLine &line = index.lines[i];
+		if (isEndProgram(src, index, line)) {
+			break;
+		}
 		
-		// Check if line is a label 
-		if (line.back() == ':') {
-			//printf("Found label '%s'\n", line.c_str());
-			line.pop_back();           // Get rid of colon at end
-			//printf("Adding label '%s'\n", line.c_str());
-			labelmap[line] = lineNum;  // Add label to map
+		if (isLabelToken(src, index.tokens.data() + line.firstToken, line.numTokens)) {
+			// Add label to map, without the colon at the end
+			const TokenSpan &tok = index.tokens[line.firstToken];
+			labelmap[std::string(src + tok.start, tok.len - 1)] = lineNum;
 		}
 		lineNum++;
 	}
-	ifs.close();
-	//printf("Printing labelmap in makeLabelMap\n");
-	//printLabelMap(labelmap);
 	return labelmap;
 }
 
-// Interprets a given filename as a program, and returns a program struct from it
-// "offset" is so that the environment config can be skipped
-Program interpretFile(std::string filename, std::streampos offset) {
-	printf("Entering interpretFile\n");
-	
-	// First, make a labelmap
-	Labelmap_t labelmap;
-	labelmap = makeLabelMap(filename);
-	// try {
-	// 	Labelmap_t labelmap = makeLabelMap(filename);
-	// } catch (const std::exception& e) {
-	// 	printf("An error has occured in makeLabelMap\n");
-	// 	throw e;
-	// }
-	//printf("printing labelmap in interpretFile\n");
-	//printLabelMap(labelmap);
-	// Open file
-	std::ifstream ifs;
-	ifs.open(filename, std::ifstream::in);
-	
-	ifs.seekg(0, ifs.end);
-	int length = ifs.tellg();
-	ifs.seekg(0, ifs.beg);
-	
-	// Ignore the first offset number of chars	
-	ifs.ignore(offset);
-	
+// interpretTokens for what's on line fileLine(from 0) of the file
+static Line interpretFileLine(const char *src, const TokenSpan *tokens, int numTokens, int fileLine, int lineNum,
+	const Labelmap_t &labelmap) {
+	try {
+		return interpretTokens(src, tokens, numTokens, lineNum, labelmap);
+	} catch (const CaiError &e) {
+		// Say which line of the file it was if the error doesn't already
+		if (e.lineNum == -1) {
+			throw CaiError(e.code, std::string(e.what()) + " on line " + std::to_string(fileLine + 1), fileLine + 1);
+		}
+		throw;
+	}
+}
+
+// Interprets the lines of a program, starting at first and going until the end or an ENDPROGRAM line.
+// Empty lines are kept as NO_INSTRUCTION lines so that Line i is always line first+i of the source,
+// which is what the line numbers in the labelmap count.
+std::vector<Line> interpretLines(const char *src, const LexIndex &index, int first, const Labelmap_t &labelmap) {
 	// Create a vector of Lines to make a Program struct with 
-	std::vector<Line> lines;
-	// Estimate number of lines needed
-	// Code block to keep the variables scope limited
+	std::vector<Line> program;
+	program.reserve(std::max(4, (int)index.lines.size() - first));
+	
+	// Now, for each line, interpret it, and add it to the vector 
+	int lineNum = 0;
+	for (int i = first; i < (int)index.lines.size(); i++) {
+		if (isEndProgram(src, index, index.lines[i])) { // Now at end of the program
+			break;
+		}
+		const LexedLine &line = index.lines[i];
+		program.push_back(interpretFileLine(src, index.tokens.data() + line.firstToken, line.numTokens, i, lineNum, labelmap));
+		lineNum++;
+	}
+	return program;
+}
+
+// Turns the thread_start labels into lines, now that there are labels
+static void resolveThreadStarts(Program &prog) {
+	EnvConfig &config = prog.config;
+	const std::vector<std::string> &starts = config.threadStarts;
+	if (starts.empty()) {
+		return;
+	}
+	if (starts.size() != 1 && (int)starts.size() != config.threads) {
+		throw CaiError(CaiErrc::BAD_CONFIG, "thread_start has " + std::to_string(starts.size()) +
+			" labels but there are " + std::to_string(config.threads) + " threads");
+	}
+	config.threadLines.clear();
+	for (int i = 0; i < config.threads; i++) {
+		const std::string &name = starts[starts.size() == 1 ? 0 : i];
+		const int line = findLabel(prog, name);
+		if (line < 0) {
+			throw CaiError(CaiErrc::UNKNOWN_LABEL, "Label '" + name + "' in thread_start not found in labelmap");
+		}
+		config.threadLines.push_back(line);
+	}
+}
+
+static void checkLineRegisters(const Line &line, int registers) {
+	for (const Arg &arg : line.arguments) {
+		if (arg.mode == ArgMode::REGISTER && arg.value >= registers) {
+			throw CaiError(CaiErrc::BAD_ARGUMENT, "Register r" + std::to_string(arg.value) + " is used on program line " +
+				std::to_string(line.lineNum) + " but the ENVDEF only has registers=" +
+				std::to_string(registers), line.lineNum);
+		}
+	}
+}
+
+// Makes sure every register the lines use is one the ENVDEF asked for. The modules are checked
+// against the main program's ENVDEF too, since that's the one the Env gets made from
+static void checkRegisters(const Program &prog) {
+	for (const Line &line : prog.lines) {
+		checkLineRegisters(line, prog.config.registers);
+	}
+}
+
+// How much of the source is the ENVDEF(up to and including the ENDENVDEF line), which is all that
+// has to be lexed to read it. All of it if there's no ENDENVDEF
+static size_t headerLength(const std::string &source) {
+	size_t pos = 0;
+	while ((pos = source.find("ENDENVDEF", pos)) != std::string::npos) {
+		size_t start = source.rfind('\n', pos);
+		start = (start == std::string::npos) ? 0 : start + 1;
+		size_t end = source.find('\n', pos);
+		end = (end == std::string::npos) ? source.size() : end;
+		if (trim(source.substr(start, end - start)) == "ENDENVDEF") {
+			return std::min(end + 1, source.size());
+		}
+		pos = end;
+	}
+	return source.size();
+}
+
+// Indexes the next line of a lazy program, which lazy.indexLock has to be held for. Only a line
+// that could be a label, ENDPROGRAM or a link directive gets lexed. False if there aren't any more
+static bool indexLazyLine(LazyLines &lazy) {
+	const char *src = lazy.source.data();
+	const size_t len = lazy.source.size();
+	const size_t start = lazy.indexEnd;
+	if (lazy.indexDone || start >= len) {
+		lazy.indexDone = true;
+		return false;
+	}
+	const char *nl = (const char*)memchr(src + start, '\n', len - start);
+	const size_t end = (nl == nullptr) ? len : nl - src;
+	const int i = (int)lazy.lines.size();
+	size_t at = start;
+	while (at < end && (src[at] == ' ' || src[at] == '\t' || src[at] == '\r')) {
+		at++;
+	}
+	// Only a line with a ':' in it can be a label, and only one starting with an E, M or I
+	// can be ENDPROGRAM, MODULE, EXPORT or IMPORT
+	if (at < end && (src[at] == 'E' || src[at] == 'M' || src[at] == 'I' || memchr(src + at, ':', end - at) != nullptr)) {
+		LexIndex one;
+		lexSource(src + start, end - start, one);
+		const int numTokens = one.lines.empty() ? 0 : one.lines[0].numTokens;
+		const char *text = src + start;
+		if (numTokens > 0) {
+			const TokenSpan &tok = one.tokens[0];
+			if (numTokens == 1 && tok.len == 10 && memcmp(text + tok.start, "ENDPROGRAM", 10) == 0) {
+				lazy.indexDone = true;
+				return false;
+			}
+			if (isLinkDirective(text + tok.start, tok.len)) {
+				// Finding out that a program has modules would mean looking through all of it first
+				throw CaiError(CaiErrc::BAD_CONFIG, std::string(text + tok.start, tok.len) +
+					" doesn't work with lazy=yes, on line " + std::to_string(lazy.first + i + 1), lazy.first + i + 1);
+			}
+			if (isLabelToken(text, one.tokens.data(), numTokens)) {
+				// The first one wins, since jumps to it could already have been decoded
+				lazy.labels.emplace(std::string(text + tok.start, tok.len - 1), i);
+			}
+		}
+	}
+	const int mask = (1 << LAZY_CHUNK_SHIFT) - 1;
+	if ((i & mask) == 0) {
+		lazy.decoded[i >> LAZY_CHUNK_SHIFT].reset(new std::atomic<const Line*>[mask + 1]());
+	}
+	lazy.lines.push_back(LexedLine{ (uint32_t)start, (uint32_t)end, 0, 0 });
+	lazy.indexEnd = end + 1;
+	lazy.indexed.store(i + 1, std::memory_order_release);
+	return true;
+}
+
+bool indexLazyLines(const Program &prog, int i) {
+	LazyLines &lazy = *prog.lazy;
+	std::lock_guard<std::mutex> guard(lazy.indexLock);
+	while ((int)lazy.lines.size() <= i && indexLazyLine(lazy)) {
+	}
+	return i < (int)lazy.lines.size();
+}
+
+int findLabel(const Program &prog, const std::string &name) {
+	if (prog.lazy == nullptr) {
+		Labelmap_t::const_iterator it = prog.labels.find(name);
+		return it == prog.labels.end() ? -1 : it->second;
+	}
+	LazyLines &lazy = *prog.lazy;
+	std::lock_guard<std::mutex> guard(lazy.indexLock);
+	Labelmap_t::const_iterator it = lazy.labels.find(name);
+	while (it == lazy.labels.end()) {
+		const size_t before = lazy.labels.size();
+		if (!indexLazyLine(lazy)) {
+			return -1;
+		}
+		if (lazy.labels.size() != before) {
+			it = lazy.labels.find(name);  // Only worth looking again when there's a new one
+		}
+	}
+	return it->second;
+}
+
+// Sets prog up to decode its lines as they get run(lazy=yes), instead of all of them now. The
+// program starts at byte offset in the source, and first is which line of the file that is.
+// Nothing past the ENVDEF gets looked at until something needs it, see LazyLines
+static void loadLazily(Program &prog, std::string source, size_t offset, int first) {
+	std::shared_ptr<LazyLines> lazy = std::make_shared<LazyLines>();
+	// There can't be more lines than bytes, so that's how many chunks there could be
+	const size_t chunks = ((source.size() - offset) >> LAZY_CHUNK_SHIFT) + 1;
+	lazy->decoded.reset(new std::unique_ptr<std::atomic<const Line*>[]>[chunks]);
+	lazy->source = std::move(source);
+	lazy->indexEnd = offset;
+	lazy->first = first;
+	prog.lazy = std::move(lazy);
+}
+
+const Line& decodeLazyLine(const Program &prog, int i) {
+	LazyLines &lazy = *prog.lazy;
+	if (!indexLazyLines(prog, i)) {
+		throw CaiError(CaiErrc::INTERNAL, "Line " + std::to_string(i) + " is past the end of the program");
+	}
+	LexedLine span;
 	{
-		int linesNeeded = ceil(length / 5);
-		if (linesNeeded < 4) { // Guarantee at least 4 lines are reserved
-			linesNeeded = 4;
-		}
-		lines.reserve(linesNeeded);
-	}
-	// Now, for each line in the file, interpret it, and add it to the vector 
-	std::string cline = {""};
-	Labelmap_t prev = labelmap;
-	Line temp;
-	int i = 0;
-	if (static_cast<int>(ifs.tellg()) == -1) {
-		printf("Error, already at end of file in interpretFile, exiting\n");
-		throw 'e';
-	}
-	while (static_cast<int>(ifs.tellg()) < length &&
-		   static_cast<int>(ifs.tellg()) != -1) {
-		if (i > length) {
-			printf("Error, i is larger than the file's size, meaning something is wrong, exiting\n");
-			throw 's';
-		}
-		std::getline(ifs,cline);
-		cline = stripends(cline, ' ');
-		cline = stripends(cline, '\n');
-		if (cline.compare("\n") == 0) {  // Skip over any empty lines
-			continue;
+		std::lock_guard<std::mutex> guard(lazy.indexLock);
+		span = lazy.lines[i];  // lines can move when another thread indexes more
+	}
+	const char *text = lazy.source.data() + span.start;
+	LexIndex index;
+	lexSource(text, span.end - span.start, index);
+	const int numTokens = index.lines.empty() ? 0 : index.lines[0].numTokens;
+	// A jump's label is its last argument(see processOperation), and it's the only label the line needs
+	Labelmap_t labels;
+	const TokenSpan *tokens = index.tokens.data();
+	if (numTokens >= 2 && tokens[0].len == 3 && (memcmp(text + tokens[0].start, "jmp", 3) == 0 ||
+		memcmp(text + tokens[0].start, "jiz", 3) == 0 || memcmp(text + tokens[0].start, "jlz", 3) == 0)) {
+		const bool testsRegister = text[tokens[0].start + 1] != 'm' && numTokens >= 3;
+		const TokenSpan &tok = tokens[testsRegister ? 2 : 1];
+		std::string name(text + tok.start, tok.len);
+		const int at = findLabel(prog, name);
+		if (at >= 0) {
+			labels[name] = at;
 		}
-		if (strcmp(cline.c_str(), "ENDPROGRAM") == 0) { // Now at end of the program
-			//printf("Breaking\n");
-			break;
+	}
+	std::unique_ptr<Line> line = std::make_unique<Line>(
+		interpretFileLine(text, tokens, numTokens, lazy.first + i, i, labels));
+	checkLineRegisters(*line, prog.config.registers);
+	std::atomic<const Line*> &slot = lazy.decoded[i >> LAZY_CHUNK_SHIFT][i & ((1 << LAZY_CHUNK_SHIFT) - 1)];
+	const Line *expected = nullptr;
+	if (slot.compare_exchange_strong(expected, line.get(), std::memory_order_acq_rel, std::memory_order_acquire)) {
+		return *line.release();
+	}
+	return *expected;  // Another thread decoded it first
+}
+
+ProgramRef decodedProgram(const ProgramRef &prog) {
+	if (prog->lazy == nullptr) {
+		return prog;
+	}
+	LazyLines &lazy = *prog->lazy;
+	std::call_once(lazy.fullOnce, [&]() {
+		std::shared_ptr<Program> full = std::make_shared<Program>();
+		const int count = programSize(*prog);
+		full->config = prog->config;
+		{
+			std::lock_guard<std::mutex> guard(lazy.indexLock);
+			full->labels = lazy.labels;
 		}
-		prev = labelmap;
-		temp = interpretLine(cline, i, labelmap);
-		//assert(prev == labelmap);
-		if (temp.operation == Op::NO_INSTRUCTION) {
-			// Ignore the current line
-			i++;
-			continue;
-		} else {
-			lines.push_back(temp);
+		full->loadTimes = prog->loadTimes;
+		full->lines.reserve(count);
+		for (int i = 0; i < count; i++) {
+			full->lines.push_back(fetchLine(*prog, i));
 		}
-		
-		i++;
+		findCountedLoops(*full);
+		lazy.full = std::move(full);
+	});
+	return lazy.full;
+}
+
+// Compiles a whole source file that's already in memory into a Program.
+// This is the one function everything else uses to load a program
+// fileDir is the directory the source came from, if it came from a file
+ProgramRef loadProgramBuffer(std::string source, const char *fileDir) {
+	if (source.size() >= UINT32_MAX) {
+		throw CaiError(CaiErrc::FILE_ERROR, "Source is too big, it has to be under 4GB");
 	}
-	ifs.sync();
-	ifs.close();
-	printf("Exiting interpretFile\n");
-	return Program {
-		lines
+	using clock = std::chrono::steady_clock;
+	auto nanosSince = [](clock::time_point &since) {
+		clock::time_point now = clock::now();
+		long long nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(now - since).count();
+		since = now;
+		return nanos;
 	};
+	clock::time_point start = clock::now();
+	std::shared_ptr<Program> prog = std::make_shared<Program>();
+	LoadTimes &times = prog->loadTimes;
+	
+	// Lex the ENVDEF first, since a lazy program doesn't need the rest of it lexed
+	LexIndex index;
+	const size_t header = headerLength(source);
+	lexSource(source.data(), header, index);
+	times.lexNanos = nanosSince(start);
+	
+	std::pair<EnvConfig,int> tempPair = makeEnvConf(source.data(), index, fileDir);
+	prog->config = std::move(tempPair.first);  // initialMemory can be big if it came from init_file=
+	int first = tempPair.second;
+	times.headerNanos = nanosSince(start);
+	if (prog->config.lazy && first > 0) {
+		loadLazily(*prog, std::move(source), header, first);
+		resolveThreadStarts(*prog);
+		times.labelNanos = nanosSince(start);
+		return prog;
+	}
+	// Then lex the whole thing once, everything after this only looks at the tokens
+	if (header < source.size()) {
+		lexSource(source.data(), source.size(), index);
+		times.lexNanos += nanosSince(start);
+	}
+	// The program is a module too, it's just the one that gets linked first. See linker.h
+	ObjectModule main = compileModule(source.data(), index, first, &times);
+	nanosSince(start);
+	linkModules(*prog, std::move(main), fileDir);
+	resolveThreadStarts(*prog);
+	checkRegisters(*prog);
+	times.linkNanos = nanosSince(start);
+	findCountedLoops(*prog);
+	times.loopNanos = nanosSince(start);
+	return prog;
+}
+
+ProgramRef loadProgramFile(const std::string &filename) {
+	std::ifstream ifs(filename, std::ifstream::in | std::ifstream::binary);
+	if (!ifs.is_open()) {
+		throw CaiError(CaiErrc::FILE_ERROR, "Couldn't open file '" + filename + "'");
+	}
+	std::string source((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+	if (ifs.bad()) {
+		throw CaiError(CaiErrc::FILE_ERROR, "Couldn't read file '" + filename + "'");
+	}
+	// init_file= and input_file= are relative to the directory the program is in
+	size_t slash = filename.rfind('/');
+	std::string dir;
+	if (slash == 0) {
+		dir = "/";
+	} else if (slash != std::string::npos) {
+		dir = filename.substr(0, slash);
+	}
+	return loadProgramBuffer(std::move(source), dir.c_str());
 }
 
 // Setup the environment
-Env setupEnvironment(EnvConfig config, Program prog) {
-	printf("Entering setupEnvironment\n");
-	std::vector<int> mem;
+Env setupEnvironment(const EnvConfig &config, ProgramRef prog) {
 	assert(config.memSize > 0);
-	mem.reserve(config.memSize);
-	// Initialize mem with zeros
-	for (int i = 0; i < config.memSize; i++) {
-		mem.push_back(0);
-	}
-	
-	// Put initial memory in mem
-	for (int i = 0; i < (int)config.initialMemory.size(); ++i) {
-		mem[i] = config.initialMemory[i];
+	Memory mem;
+	if (!config.memFile.empty()) {
+		// The memory is whatever the last run left in the file. Only a new one gets the initial memory
+		std::shared_ptr<MemoryFile> file = mapMemoryFile(config.memFile, config.memSize, config.memSync);
+		if (file->created) {
+			std::copy(config.initialMemory.begin(), config.initialMemory.end(), file->cells);
+		}
+		mem = Memory(std::move(file));
+	} else {
+		// Initialize mem with zeros
+		std::vector<int> cells(config.memSize, 0);
+		
+		// Put initial memory in mem
+		std::copy(config.initialMemory.begin(), config.initialMemory.end(), cells.begin());
+		mem = std::move(cells);
 	}
-	Env env {config.reg, config.line, config.memSize, mem, prog};
+	return setupEnvironment(config, std::move(prog), std::move(mem));
+}
+
+// The same, but around memory that's already been set up(like an EnvPool's, see envpool.h)
+Env setupEnvironment(const EnvConfig &config, ProgramRef prog, Memory mem) {
+	Env env;
+	env.reg = config.reg;
+	env.line = config.line;
+	env.memSize = config.memSize;
+	env.memory = std::move(mem);
+	env.program = std::move(prog);
 	
-	// Reserve 16 flags for the states vector, since it's ultra space efficient
-	// the 16 flags should be nothing
-	env.states.reserve(16);
+	// Size the states vector so every flag in the State enum starts out false.
+	// It used to only be reserved, which meant reading env.states[IS_END] was reading garbage
+	env.states.assign(NUM_STATES, false);
+	env.limits = config.limits;
+	env.input = config.input;
+	env.engine = config.engine;
 	
-	//printf("size of memory is %i\n", mem.size());
-	printf("Exiting setupEnvironment\n");
 	return env;
 }
 
-std::pair<EnvConfig,std::streampos> makeEnvConf(std::string filename) {
-	printf("Entering makeEnvConf\n");
-	std::ifstream ifs;
-	ifs.open(filename, std::ifstream::in);
-	// Get length of file 
-	//ifs.seekg(0, ifs.end);
-	//int length = ifs.tellg();
-	//ifs.seekg(0, ifs.beg);
-	
-	
-	
-	// Check for start of environment definition 
+// Makes a new Env to run a program with. This doesn't copy the program,
+// so it's cheap enough to make one for every run
+Env createInstance(ProgramRef prog) {
+	const EnvConfig &config = prog->config;
+	return setupEnvironment(config, std::move(prog));
+}
+
+// Where init_file= and input_file= look for a file. fileDir is nullptr when the source didn't
+// come from a file(like one sent to the server), and then those aren't allowed at all
+static std::string configFilePath(const std::string &path, const char *fileDir, const std::string &var) {
+	if (fileDir == nullptr) {
+		throw CaiError(CaiErrc::BAD_CONFIG, "Config var '" + var + "' can only be used in a program loaded from a file");
+	}
+	if (path.empty() || path[0] == '/' || fileDir[0] == '\0') {
+		return path;
+	}
+	return std::string(fileDir) + "/" + path;
+}
+
+// Reads the ENVDEF at the top of the source, if there is one.
+// Returns the config and the index of the first line after it, which is where the program starts.
+// Relative paths in it are relative to fileDir
+std::pair<EnvConfig,int> makeEnvConf(const char *src, const LexIndex &index, const char *fileDir) {
 	std::string cline;
-	std::getline(ifs, cline);
 	stringPair_t varValPair;
 	std::string var,val; 
-	bool inDef = false;
 	
 	// Vector of bools to keep track of which values were set by the file
 	std::vector<bool> setVals;
@@ -495,32 +914,38 @@ std::pair<EnvConfig,std::streampos> makeEnvConf(std::string filename) {
 		OUTPUT,
 		END_OF_ENUM
 	};
-	setVals.reserve(END_OF_ENUM);
 	// Initialize values of vector to false
-	for (int i=0; i<END_OF_ENUM; i++) {setVals[i]=false;} 
+	setVals.assign(END_OF_ENUM, false);
 	
-	std::vector<int> memInit;
 	EnvConfig envconf;
 	
-	// Read configuration
-	while (cline.compare("ENDENVDEF") != 0) {
-		cline = stripends(cline, ' ');
-		cline = stripends(cline, '\t');
-		if (cline.compare("ENVDEF") == 0) {
-			inDef = true;
-		} else if (cline.compare("ENDENVDEF") == 0) { // At end of configuration
-			break; 
-		} else if (inDef && !cline.empty()) {
+	// Check for start of environment definition. Without one the program starts on the first line
+	const std::vector<LexedLine> &lines = index.lines;
+	int first = 0;
+	while (first < (int)lines.size() && lines[first].numTokens == 0) {
+		first++;
+	}
+	if (first < (int)lines.size() && lines[first].numTokens == 1 &&
+		index.tokens[lines[first].firstToken].len == 6 &&
+		memcmp(src + index.tokens[lines[first].firstToken].start, "ENVDEF", 6) == 0) {
+		int i = first + 1;
+		// Read configuration. There's only a few lines of it, so these get turned back into strings
+		for (; i < (int)lines.size(); i++) {
+			cline = trim(std::string(src + lines[i].start, lines[i].end - lines[i].start));
+			if (cline.compare("ENDENVDEF") == 0) { // At end of configuration
+				break; 
+			}
 			// Now, search for some var=value pairs
-			if (cline.find('=') != cline.npos) {
-				varValPair = splitOnFirstChar(cline, '=');
-				var = varValPair.first;
-				val = varValPair.second;
-				
-				// Strip whitespace from ends of var and val
-				var = stripends(var, ' ');
-				val = stripends(val, ' ');
-				
+			if (cline.empty() || cline.find('=') == cline.npos) {
+				continue;
+			}
+			varValPair = splitOnFirstChar(cline, '=');
+			
+			// Strip whitespace from ends of var and val
+			var = trim(varValPair.first);
+			val = trim(varValPair.second);
+			
+			try {
 				// Now, "switch" with the var to see what val actually is
 				if (var.compare("msize") == 0 ||
 					var.compare("size") == 0) { // Specifies size of memory
@@ -544,40 +969,127 @@ std::pair<EnvConfig,std::streampos> makeEnvConf(std::string filename) {
 					setVals[STARTREG] = true;
 					
 				} else if (var.compare("init") == 0) { // Specifies starting memory
-					envconf.initialMemory = processArrayString(val);
+					envconf.initialMemory = scanIntArray(val);
+					setVals[INIT_MEM] = true;
+				
+				} else if (var.compare("init_file") == 0) { // The same, but from a file. See loadIntFile
+					envconf.initialMemory = loadIntFile(configFilePath(val, fileDir, var));
 					setVals[INIT_MEM] = true;
 				
 				} else if (var.compare("input") == 0) {
-					printf("Taking input '%s'\n", val.c_str());
-					std::vector<int> temp = processArrayString(val);
-					for (int i : temp) {
-						envconf.input.push(i);
+					std::vector<int> temp = scanIntArray(val);
+					for (int v : temp) {
+						envconf.input.push_back(v);
 					}
 				
+				} else if (var.compare("input_file") == 0) {
+					std::vector<int> temp = loadIntFile(configFilePath(val, fileDir, var));
+					envconf.input = std::deque<int>(temp.begin(), temp.end());
+				
+				} else if (var.compare("maxsteps") == 0) { // Watchdog limits, see RunLimits
+					envconf.limits.maxSteps = stoll(val);
+					
+				} else if (var.compare("maxtime") == 0) {  // In milliseconds
+					envconf.limits.maxMillis = stoll(val);
+					
+				} else if (var.compare("maxoutput") == 0) {
+					envconf.limits.maxOutput = stoll(val);
+					
+				} else if (var.compare("cache") == 0) {  // See resultcache.h
+					if (val == "yes" || val == "true" || val == "1") {
+						envconf.cacheable = true;
+					} else if (val == "no" || val == "false" || val == "0") {
+						envconf.cacheable = false;
+					} else {
+						throw std::invalid_argument(val);
+					}
+					
+				} else if (var.compare("lazy") == 0) {  // See fetchLine
+					if (val == "yes" || val == "true" || val == "1") {
+						envconf.lazy = true;
+					} else if (val == "no" || val == "false" || val == "0") {
+						envconf.lazy = false;
+					} else {
+						throw std::invalid_argument(val);
+					}
+					
+				} else if (var.compare("engine") == 0) {  // "interp" or "closure"
+					if (!parseEngine(val, envconf.engine)) {
+						throw std::invalid_argument(val);
+					}
+					
+				} else if (var.compare("threads") == 0) {  // See threads.h
+					envconf.threads = stoi(val);
+					if (envconf.threads < 1 || envconf.threads > 1024) {
+						throw std::out_of_range(val);
+					}
+					
+				} else if (var.compare("thread_start") == 0) {  // "[a,b,c]", or just "a" for all of them
+					envconf.threadStarts.clear();
+					std::string name;
+					for (char c : val + ",") {
+						if (c == ',' || c == '[' || c == ']' || c == ' ' || c == '\t') {
+							if (!name.empty()) {
+								envconf.threadStarts.push_back(name);
+							}
+							name.clear();
+						} else {
+							name += c;
+						}
+					}
+					if (envconf.threadStarts.empty()) {
+						throw std::invalid_argument(val);
+					}
+					
+				} else if (var.compare("thread_local") == 0) {  // Cells each thread has its own copy of
+					envconf.threadLocal = stoi(val);
+					if (envconf.threadLocal < 0) {
+						throw std::out_of_range(val);
+					}
+					
+				} else if (var.compare("memfile") == 0) {  // See mappedfile.h
+					envconf.memFile = configFilePath(val, fileDir, var);
+					
+				} else if (var.compare("memsync") == 0) {  // "end", "never" or "atomic"
+					if (!parseMemSync(val, envconf.memSync)) {
+						throw std::invalid_argument(val);
+					}
+					
+				} else if (var.compare("registers") == 0) {  // r0 up to r(registers - 1)
+					envconf.registers = stoi(val);
+					if (envconf.registers < 0 || envconf.registers > MAX_REGISTERS) {
+						throw std::out_of_range(val);
+					}
+					
+				} else if (var.compare("checkevery") == 0) {
+					envconf.limits.checkEvery = stoi(val);
+					if (envconf.limits.checkEvery < 1) {
+						envconf.limits.checkEvery = 1;
+					}
+					
 				} else {
-					printf("Error, config var '%s' is not a configuration variable, exiting\n", var.c_str());
-					throw 's';
+					throw CaiError(CaiErrc::BAD_CONFIG, "Config var '" + var + "' is not a configuration variable", i + 1);
 				}
+			} catch (const std::logic_error &e) {
+				// stoi and friends throw invalid_argument or out_of_range for bad numbers
+				throw CaiError(CaiErrc::BAD_CONFIG, "Bad value '" + val + "' for config var '" + var + "'", i + 1);
 			}
 		}
-		
-		// Update current line
-		std::getline(ifs, cline);
-	}
-	assert(strcmp(cline.c_str(),"ENDENVDEF") == 0);
-	assert((int)ifs.tellg() != -1);
-	// Save the offset for later when interpreting the program
-	std::streampos offset = ifs.tellg();
-	ifs.sync();
-	ifs.close(); // Close file since it's no longer needed
+		if (i >= (int)lines.size()) {
+			throw CaiError(CaiErrc::BAD_CONFIG, "ENVDEF without an ENDENVDEF", first + 1);
+		}
+		// The program starts just after the ENDENVDEF
+		first = i + 1;
+	} else {
+		first = 0;
+	}
 	
 	// Figure out what the memory size should be given what values were set
 	if (setVals[MEMSIZE]) {
 		// Memsize was set, so now check if initmem's size is greater than the memsize 
 		if ((int)envconf.initialMemory.size() > envconf.memSize) {
-			printf("Error, initial memory of size %i cannot fit in \
-				memory of size %i, exiting\n", (int)envconf.initialMemory.size(), envconf.memSize);
-			throw 's';
+			throw CaiError(CaiErrc::BAD_CONFIG, "Initial memory of size " + std::to_string(envconf.initialMemory.size()) +
+				" cannot fit in memory of size " + std::to_string(envconf.memSize));
 		}
 	} else if (setVals[INIT_MEM]) {
 		// Memsize was not set, but initmem was. So, set the memory size to be exactly 
@@ -587,7 +1099,13 @@ std::pair<EnvConfig,std::streampos> makeEnvConf(std::string filename) {
 		// None were passed, so set it to a default of 100
 		envconf.memSize = 100;
 	}
-	assert(envconf.memSize > 0);
+	if (envconf.memSize <= 0) {
+		throw CaiError(CaiErrc::BAD_CONFIG, "Memory size has to be more than 0");
+	}
+	if (!envconf.memFile.empty() && envconf.threads > 1) {
+		// The threads share one memory that isn't the file's
+		throw CaiError(CaiErrc::BAD_CONFIG, "memfile= doesn't work with threads=");
+	}
 	
 	// Check if things like reg and line number aren't set. If not, set them 
 	// to the default of 0
@@ -597,81 +1115,435 @@ std::pair<EnvConfig,std::streampos> makeEnvConf(std::string filename) {
 	if (!setVals[STARTREG]) {
 		envconf.reg = 0;
 	}
+	if (envconf.line < 0) {
+		throw CaiError(CaiErrc::BAD_CONFIG, "startline can't be negative");
+	}
 	
-	printf("Exiting makeEnvConf\n");
-	return std::make_pair(envconf, offset);
+	return std::make_pair(std::move(envconf), first);
 }
 
-Env createEnvironmentFromFile(std::string filename) {
-	printf("Entering createEnvironmentFromFile\n");
-	std::pair<EnvConfig,std::streampos> tempPair = makeEnvConf(filename);
-	EnvConfig envconf     = tempPair.first;
-	std::streampos offset = tempPair.second;
-	
-	// Process file into program struct. Pass the offset found earlier so it can skip the environment config
-	//printf("Offset is %i\n", (int)offset);
-	Program prog = interpretFile(filename, offset);
-	//printf("interpretFile returned okay\n");
-	
-	printf("Exiting createEnvironmentFromFile\n");
-	// Finally, setup the environment with the given environment config and program struct
-	return setupEnvironment(envconf, prog);
+Env createEnvironmentFromFile(const std::string &filename) {
+	// Process file into a program struct, then setup the environment with its config
+	return createInstance(loadProgramFile(filename));
 }
 
-Env iterateOnce(Env &env) {
+void iterateOnce(Env &env) {
 	// Get the Line struct representing the current line 
-	Program program = env.program;
-	Line cline;
+	// The program is shared, so this is only a reference to it and not a copy
+	const Program &program = *env.program;
 	//printf("current line is %i and size of program is %i\n", env.line, (int)program.lines.size());
-	if (env.line >= (int)program.lines.size()) {
+	if (env.line < 0) {
+		throw CaiError(CaiErrc::BAD_ADDRESS, "Line " + std::to_string(env.line) + " is before the start of the program", env.line);
+	}
+	if (!hasLine(program, env.line)) {
 		env.endProgram = true;
 		goto RETURN;
 	}
 	//printf("getting current line\n");
-	cline = program.lines.at(env.line);
-	
-	// Execute the correct function given the line
-	//printf("executing instruction %i\n", static_cast<int>(cline.operation));
-	doInstruction(cline, env);
+	{
+		const Line &cline = fetchLine(program, env.line);
+		
+		// Execute the correct function given the line
+		//printf("executing instruction %i\n", static_cast<int>(cline.operation));
+		doInstruction(cline, env);
+	}
 	RETURN:
 	//printf("Exiting iterateOnce\n");
-	return env;
+	return;
 }
 
-// Prints the state of a given environment.
-void printState(Env env) {
-	//printf("Entering printState\n");
-	printf("memorySize is %i\n", (int)env.memory.size());
-	// print the current line num and register value
-	printf("ISEND: %s ACC: %i  LINE: %i - MEM: [", (env.endProgram ? "true" : "false"), env.reg, env.line);
-	
-	// Print the memory
-	for (int i = 0; i < (int)env.memory.size(); ++i) {
-		if ((i+1) == (int)env.memory.size()) {
-			printf("%i]\n", env.memory[i]);
-		} else {
-			printf("%i, ", env.memory[i]);
+// Prints the state of a given environment. It goes through a StateDump(see statedump.h) so
+// it's one big write instead of a printf for every cell
+void printState(const Env &env) {
+	StateDump dump;
+	openStateDump(dump, "-", DumpFormat::TEXT, 1 << 16);
+	writeStateDump(dump, env);
+	closeStateDump(dump);
+}
+
+// Prints whatever is in the output queue, if there is anything. It's all formatted into
+// one string first, since a printf for every value is slow when there's millions of them
+void printOutput(const Env &env) {
+	if (env.output.empty()) {
+		return;
+	}
+	std::string text = "OUTPUT: [";
+	text.reserve(text.size() + env.output.size() * 6);
+	char num[16];
+	for (size_t i = 0; i < env.output.size(); i++) {
+		char *end = std::to_chars(num, num + sizeof(num), env.output[i]).ptr;
+		text.append(num, end);
+		text += (i + 1 == env.output.size()) ? "]\n" : ", ";
+	}
+	fwrite(text.data(), 1, text.size(), stdout);
+}
+
+// How many values the program has output, counting the ones that went to an OutputSink
+long long outputCount(const Env &env) {
+	return (long long)env.output.size() + (env.outputSink != nullptr ? env.outputSink->values : 0);
+}
+
+const char* runStatusName(RunStatus status) {
+	switch (status) {
+		case RunStatus::RUNNING:       return "running";
+		case RunStatus::ENDED:         return "ended";
+		case RunStatus::BLOCKED_INPUT: return "blocked on input";
+		case RunStatus::STEP_LIMIT:    return "step limit reached";
+		case RunStatus::TIME_LIMIT:    return "time limit reached";
+		case RunStatus::OUTPUT_LIMIT:  return "output limit reached";
+		case RunStatus::BLOCKED_OUTPUT: return "blocked on output";
+		case RunStatus::BREAKPOINT:    return "stopped at a breakpoint";
+	}
+	return "unknown";
+}
+
+const char* engineName(Engine engine) {
+	switch (engine) {
+		case Engine::INTERPRETER: return "interp";
+		case Engine::CLOSURE:     return "closure";
+	}
+	return "unknown";
+}
+
+// The other way around. False if it isn't the name of an engine
+bool parseEngine(const std::string &name, Engine &engine) {
+	if (name == "interp") {
+		engine = Engine::INTERPRETER;
+	} else if (name == "closure") {
+		engine = Engine::CLOSURE;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+// True for the statuses that mean one of env.limits ran out
+bool isBudgetExhausted(RunStatus status) {
+	return status == RunStatus::STEP_LIMIT ||
+	       status == RunStatus::TIME_LIMIT ||
+	       status == RunStatus::OUTPUT_LIMIT;
+}
+
+// Works out how many more steps can be done before the limits have to be looked at again.
+// Every step adds at most one output value, so stopping after this many steps can never
+// overshoot the step or output budget(or the slice given to runSteps).
+static long long iterationsUntilCheck(const Env &env, long long sliceEnd) {
+	long long n = env.limits.checkEvery;
+	n = std::min(n, sliceEnd - env.steps);
+	if (env.limits.maxSteps > 0) {
+		n = std::min(n, env.limits.maxSteps - env.steps);
+	}
+	if (env.limits.maxOutput > 0) {
+		n = std::min(n, env.limits.maxOutput - outputCount(env));
+	}
+	return n;
+}
+
+// Whether the next thing the program does is end, by running off the end or at an "end". Neither
+// of those is a step, so a program that's there has nothing left for a limit to stop
+static bool endsNext(const Env &env) {
+	const Program &program = *env.program;
+	if (env.line >= 0 && !hasLine(program, env.line)) {
+		return true;
+	}
+	return env.line >= 0 && fetchLine(program, env.line).operation == Op::END;
+}
+
+// The counting policies runSteps gets built with, see stats.h. before and after get called
+// around every line the interpreter runs, but only if enabled, which is checked with if constexpr.
+// So runStepsWith<NoCounters> doesn't have the calls in it at all, and NoCounters doesn't even
+// have them to call(the static_assert makes sure it doesn't get any state either)
+struct NoCounters {
+	static constexpr bool enabled = false;
+};
+static_assert(std::is_empty_v<NoCounters>, "A run without stats can't carry anything for counting");
+
+// Follows derefLevel "*"s from addr like followDerefs, but never throws or gets profiled.
+// False if it goes outside the memory
+static bool peekDerefs(const Env &env, int &addr, int derefLevel) {
+	for (; derefLevel > 0; derefLevel--) {
+		if (addr < 0 || addr >= (int)env.memory.size()) {
+			return false;
 		}
+		addr = env.memory[addr];
 	}
-	//printf("Exiting printState\n");
+	return true;
 }
 
-Env runProgram(std::string filename) {
-	Env env = createEnvironmentFromFile(filename);
-	printf("createEnvironmentFromFile returned okay\n");
-	int i = 0;
-	while (!env.states[IS_END]) {
-		//printf("Iterating once\n");
-		iterateOnce(env);
-		//if (env.line > 1 && env.program.lines[env.line-1].operation == Op::END) {
-		//	printf("Program should end after this\n");
-		//}
-		printState(env);
-		if (i > 10) {
-			printf("Too many iterations, exiting\n");
+// The address resolveAddress would give for arg, without throwing or being profiled. False if
+// resolveAddress would throw or the address is outside the memory. For looking at a line
+// before it runs, like the counters and the debugger do
+bool peekAddress(const Env &env, const Arg &arg, int &addr) {
+	if (arg.mode == ArgMode::IMMEDIATE || arg.mode == ArgMode::REGISTER) {
+		return false;
+	}
+	addr = arg.value;
+	bool ok = peekDerefs(env, addr, arg.derefLevel);
+	if (arg.mode == ArgMode::INDEXED) {
+		int index = arg.index;
+		ok = ok && peekDerefs(env, index, arg.indexDeref);
+		addr = (int)((unsigned)addr + (unsigned)index);
+	}
+	return ok && addr >= 0 && addr < (int)env.memory.size();
+}
+
+// The same for getDeref. 0 where it would throw
+int peekArg(const Env &env, const Arg &arg) {
+	if (arg.mode == ArgMode::IMMEDIATE) {
+		return arg.value;
+	}
+	if (arg.mode == ArgMode::REGISTER) {
+		return (arg.value >= 0 && arg.value < MAX_REGISTERS) ? env.regs[arg.value] : 0;
+	}
+	int addr;
+	return peekAddress(env, arg, addr) ? env.memory[addr] : 0;
+}
+
+struct Counters {
+	static constexpr bool enabled = true;
+	RunStats &stats;
+	
+	void hops(const Arg &arg) {
+		if (arg.mode != ArgMode::IMMEDIATE && arg.mode != ArgMode::REGISTER) {
+			stats.derefHops += arg.derefLevel + (arg.mode == ArgMode::INDEXED ? arg.indexDeref : 0);
+		}
+	}
+	// An argument that reads and/or writes n cells. Immediates and registers don't touch memory at all
+	void cells(const std::vector<Arg> &args, int i, long long n, bool read, bool write) {
+		if (i >= (int)args.size() || args[i].mode == ArgMode::IMMEDIATE || args[i].mode == ArgMode::REGISTER) {
+			return;
+		}
+		hops(args[i]);
+		stats.memReads += read ? n : 0;
+		stats.memWrites += write ? n : 0;
+	}
+	// What a jiz or jlz is going to look at, the acc or the register after the label
+	int jumpTest(const Env &env, const std::vector<Arg> &args) {
+		return args.size() >= 2 ? peekArg(env, args[1]) : env.reg;
+	}
+	// How long a block instruction's range is going to be
+	long long rangeLength(const Env &env, const std::vector<Arg> &args, int i) {
+		return i < (int)args.size() ? std::max(0, peekArg(env, args[i])) : 0;
+	}
+	
+	// Everything about a line that can be told before it runs. The block instructions have to
+	// be counted now, since they can write over their own n
+	void before(const Env &env) {
+		if (env.line < 0 || !hasLine(*env.program, env.line)) {
+			return;
+		}
+		const Line &line = fetchLine(*env.program, env.line);
+		const std::vector<Arg> &args = line.arguments;
+		stats.dispatches[(int)line.operation]++;
+		long long n = 0;
+		switch (line.operation) {
+			case Op::MOV:
+				cells(args, 0, 1, true, false);
+				cells(args, 1, 1, false, true);
+				break;
+			case Op::COPY_FROM: case Op::ADD: case Op::SUB: case Op::LOAD_ACQUIRE:
+				cells(args, 0, 1, true, false);
+				break;
+			case Op::COPY_TO: case Op::STORE_RELEASE:
+				cells(args, 0, 1, false, true);
+				break;
+			case Op::INC: case Op::DEC: case Op::FETCH_ADD:
+				cells(args, 0, 1, true, true);
+				break;
+			case Op::COMPARE_SWAP:
+				cells(args, 1, 1, true, false);
+				cells(args, 0, 1, true, true);
+				break;
+			case Op::JUMP_IF_ZERO:
+				(jumpTest(env, args) == 0 ? stats.branchesTaken : stats.branchesNotTaken)++;
+				break;
+			case Op::JUMP_IF_NEGATIVE:
+				(jumpTest(env, args) < 0 ? stats.branchesTaken : stats.branchesNotTaken)++;
+				break;
+			case Op::FILL:
+				n = rangeLength(env, args, 1);
+				cells(args, 1, 1, true, false);
+				cells(args, 2, 1, true, false);
+				cells(args, 0, n, false, true);
+				break;
+			case Op::BLOCK_COPY:
+				n = rangeLength(env, args, 2);
+				cells(args, 2, 1, true, false);
+				cells(args, 0, n, true, false);
+				cells(args, 1, n, false, true);
+				break;
+			case Op::BLOCK_ADD:
+				n = rangeLength(env, args, 1);
+				cells(args, 1, 1, true, false);
+				cells(args, 2, 1, true, false);
+				cells(args, 0, n, true, true);
+				break;
+			case Op::BLOCK_SUM:
+				n = rangeLength(env, args, 1);
+				cells(args, 1, 1, true, false);
+				cells(args, 0, n, true, false);
+				break;
+			case Op::VECTOR_ADD:
+				n = rangeLength(env, args, 2);
+				cells(args, 2, 1, true, false);
+				cells(args, 0, n, true, false);
+				cells(args, 1, n, true, true);
+				break;
+			case Op::BLOCK_FIND:
+				n = rangeLength(env, args, 1);
+				cells(args, 1, 1, true, false);
+				cells(args, 2, 1, true, false);
+				cells(args, 0, n, true, false);
+				break;
+			default:
+				break;
+		}
+	}
+	
+	// And the things that can only be told after, like whether inp found anything
+	void after(const Env &env, int lineBefore, long long stepsBefore) {
+		if (lineBefore < 0 || !hasLine(*env.program, lineBefore)) {
+			return;
+		}
+		const long long did = env.steps - stepsBefore;
+		switch (fetchLine(*env.program, lineBefore).operation) {
+			case Op::INP:
+				stats.inputs += did;
+				break;
+			case Op::OUT:
+				stats.outputs += did;
+				break;
+			case Op::LOOP_JUMP:
+				stats.skippedSteps += std::max(0LL, did - 1);
+				break;
+			default:
+				break;
+		}
+	}
+};
+
+// Runs env for at most "steps" more steps(or until something stops it if steps < 0) and says why it stopped.
+//   RUNNING        the slice was used up, call it again to keep going
+//   BLOCKED_INPUT  an "inp" found the input queue empty. Push some input with pushInput and call it again
+//   ENDED          the program is done
+//   *_LIMIT        one of env.limits ran out. Raise the limit and call it again to keep going
+// The time spent in here is added up in env.runNanos, so the time limit is for the time actually
+// spent running and not the time spent waiting for input.
+template <class Counters>
+static RunStatus runStepsWith(Env &env, long long steps, Counters &counters) {
+	using clock = std::chrono::steady_clock;
+	const clock::time_point start = clock::now();
+	const long long sliceEnd = (steps < 0) ? LLONG_MAX : env.steps + steps;
+	
+	if (env.status == RunStatus::ENDED) {
+		return env.status;
+	}
+	// Limits and empty input are looked at again below, so this is how a run gets resumed
+	env.status = RunStatus::RUNNING;
+	// A sped up loop can do lots of steps in one go, but never more than this. Loops have no
+	// I/O, so the output limit can't be overshot by one
+	env.stepFence = sliceEnd;
+	if (env.limits.maxSteps > 0) {
+		env.stepFence = std::min(env.stepFence, env.limits.maxSteps);
+	}
+	const ClosureProgram *closures = nullptr;
+	if (env.engine == Engine::CLOSURE && env.memProfile == nullptr && !Counters::enabled) {
+		if (env.program->lazy != nullptr) {
+			env.program = decodedProgram(env.program);  // The closures are compiled from every line at once
+		}
+		if (env.closuresFor != env.program) {
+			env.closures = compileClosures(env.program);
+			env.closuresFor = env.program;
+		}
+		closures = env.closures.get();
+	}
+	
+	while (env.status == RunStatus::RUNNING) {
+		// Check the limits before doing anything, so a budget that's already used up stops right away.
+		// A program that's about to end anyway just ends, since that doesn't take a step
+		const bool ending = endsNext(env);
+		if (!ending && env.limits.maxSteps > 0 && env.steps >= env.limits.maxSteps) {
+			env.status = RunStatus::STEP_LIMIT;
+			break;
+		}
+		if (!ending && env.limits.maxOutput > 0 && outputCount(env) >= env.limits.maxOutput) {
+			env.status = RunStatus::OUTPUT_LIMIT;
+			break;
+		}
+		if (!ending && env.limits.maxMillis > 0 &&
+			(env.runNanos + std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count())
+				>= env.limits.maxMillis * 1000000) {
+			env.status = RunStatus::TIME_LIMIT;
 			break;
 		}
+		if (!ending && env.steps >= sliceEnd) {
+			break;  // Slice is used up, but the program can keep going
+		}
+		
+		// Now run a batch of steps without looking at the limits. It's counted in steps and not
+		// iterations since a sped up loop does a lot of steps in one iteration
+		const long long batchEnd = env.steps + (ending ? 1 : iterationsUntilCheck(env, sliceEnd));
+		if (closures != nullptr && runClosureBatch(env, *closures, batchEnd)) {
+			continue;
+		}
+		while (env.steps < batchEnd) {
+			[[maybe_unused]] const int lineBefore = env.line;
+			[[maybe_unused]] const long long stepsBefore = env.steps;
+			if constexpr (Counters::enabled) {
+				counters.before(env);
+			}
+			iterateOnce(env);
+			if constexpr (Counters::enabled) {
+				counters.after(env, lineBefore, stepsBefore);
+			}
+			if (env.endProgram || env.states[IS_END]) {
+				env.status = RunStatus::ENDED;
+				break;
+			}
+			if (env.status != RunStatus::RUNNING) {
+				break;  // An instruction stopped the run, like "inp" with no input
+			}
+		}
+	}
+	// Let whoever's reading the output see it, unless it's only supposed to be written at the end.
+	// If the fd is full it stays in the buffer until the next time
+	if (env.outputSink != nullptr && (!env.outputSink->flushOnEnd || env.status == RunStatus::ENDED)) {
+		flushSink(*env.outputSink);
+	}
+	if (env.memory.file != nullptr && env.status == RunStatus::ENDED) {
+		syncMemoryFile(*env.memory.file);
+	}
+	env.runNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+	return env.status;
+}
+
+RunStatus runSteps(Env &env, long long steps) {
+	if (env.stats != nullptr) {
+		Counters counters{*env.stats};
+		return runStepsWith(env, steps, counters);
+	}
+	NoCounters none;
+	return runStepsWith(env, steps, none);
+}
+
+// Gives a (possibly blocked) program one more input value
+void pushInput(Env &env, int value) {
+	env.input.push_back(value);
+	if (env.status == RunStatus::BLOCKED_INPUT) {
+		env.status = RunStatus::RUNNING;
 	}
+}
+
+// Runs an already created environment until it ends, blocks on input or one of env.limits runs out.
+// env.status says which one it was, and env is left as it was at that point
+// so it can still be looked at(or run some more after raising the limit)
+void runEnvironment(Env &env) {
+	runSteps(env, -1);
+}
+
+Env runProgram(const std::string &filename) {
+	Env env = createEnvironmentFromFile(filename);
+	runEnvironment(env);
 	//printf("Exiting runProgram\n");
 	return env;
 }
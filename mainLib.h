@@ -18,14 +18,25 @@
 
 #include <iostream>
 #include <fstream>
+#include <atomic>
+#include <mutex>
 #include <string>
 #include <vector>
 #include <array>
 #include <map>
-#include <queue>
+#include <deque>
+#include <memory>
 #include <functional>
+#include <climits>
+#include <algorithm>
 
+#include "caiError.h"
 #include "instructionsEnum.h"
+#include "lexscan.h"
+#include "loopopt.h"
+#include "mappedfile.h"
+#include "outputsink.h"
+#include "stats.h"
 
 #ifndef MAINLIB_H
 #define MAINLIB_H
@@ -33,26 +44,67 @@
 using Labelmap_t = std::map<std::string, int>;
 
 struct Env;
+struct MemProfile;
+struct ThreadGroup;
+struct Breakpoints;
+struct ClosureProgram;
+enum class MemAccess;
+
+// How an argument gets to its value. See interpretArg for how each one is written
+enum class ArgMode {
+	ADDRESS,    // "5", "*5": the cell at value, after following derefLevel "*"s
+	IMMEDIATE,  // "#5": just value itself. It can be read but not written to
+	INDEXED,    // "[*5+3]", "[5+*4]": the cell at (value after derefLevel "*"s) + (index after indexDeref "*"s)
+	REGISTER    // "r3": Env::regs[value]. Not a cell, so it can't be used as the start of a range
+};
+
+// The most registers(r0 to r15) a program can ask for with "registers=" in its ENVDEF
+const int MAX_REGISTERS = 16;
 
 struct Arg {
 	int value;
 	int derefLevel;
+	ArgMode mode{ArgMode::ADDRESS};
+	int index{0};        // Only for INDEXED
+	int indexDeref{0};
 };
 
 // Struct to store a line of the file
 struct Line {
 	Op operation;
-	void (*func)(struct Env &env, std::vector<Arg> args);
+	void (*func)(struct Env &env, const std::vector<Arg> &args);
 	int lineNum;
 	int numArgs;
 	std::vector<Arg> arguments;
 };
 
-// Struct to store all the lines of a program
-// I know making a struct just to store an array is inefficient, but
-// the point of it is to allow for extensibility in case I add more features
-struct Program {
-	std::vector<Line> lines;
+// Why a run stopped(or that it hasn't yet). Each limit in RunLimits
+// gets its own status so the caller can tell them apart
+enum class RunStatus {
+	RUNNING,        // Hasn't stopped yet
+	ENDED,          // Hit an "end" or ran off the end of the program
+	BLOCKED_INPUT,  // An "inp" found no input. Push some with pushInput to resume
+	STEP_LIMIT,     // Used up RunLimits::maxSteps
+	TIME_LIMIT,     // Ran for longer than RunLimits::maxMillis
+	OUTPUT_LIMIT,   // Produced RunLimits::maxOutput values
+	BLOCKED_OUTPUT, // An "out" found Env::outputSink full. Wait for it with waitForSink and call it again
+	BREAKPOINT      // Stopped at a breakpoint or a watchpoint(see breakpoints.h). Call it again to keep going
+};
+
+// Budgets for a single run. 0 means there's no limit.
+// The time limit is only checked every checkEvery iterations since reading
+// the clock isn't free, but the step and output limits are always exact.
+struct RunLimits {
+	long long maxSteps{ 0 };
+	long long maxMillis{ 0 };
+	long long maxOutput{ 0 };
+	int checkEvery{ 4096 };
+};
+
+// Which engine runSteps uses. They always give the same results, one is just faster
+enum class Engine {
+	INTERPRETER,  // iterateOnce, one Line at a time
+	CLOSURE       // The Lines compiled into a chain of handlers, see closures.h
 };
 
 // For reading and storing the environment configuration
@@ -61,8 +113,224 @@ struct EnvConfig {
 	int line;
 	int memSize;
 	std::vector<int> initialMemory;
-	std::queue<int> input;
-	std::queue<int> output;
+	std::deque<int> input;
+	std::deque<int> output;
+	RunLimits limits;
+	bool cacheable{true};  // "cache=no" in the ENVDEF keeps this program's runs out of the result cache
+	Engine engine{Engine::INTERPRETER};  // "engine=closure" in the ENVDEF
+	int threads{1};                        // "threads=" and "thread_start=", see threads.h
+	std::vector<std::string> threadStarts;
+	std::vector<int> threadLines;          // The thread_start labels, once the labels are known
+	std::string memFile;                   // "memfile=", a file the memory is mapped from(see mappedfile.h)
+	MemSync memSync{MemSync::END};         // "memsync="
+	int threadLocal{0};                    // "thread_local=", how many cells at the start each thread has its own copy of
+	int registers{0};                      // "registers=", how many of r0 to r15 the program can use
+	bool lazy{false};                      // "lazy=yes", decode each line the first time it runs(see fetchLine)
+};
+
+struct LazyLines;
+
+// Struct to store all the lines of a program
+// I know making a struct just to store an array is inefficient, but
+// the point of it is to allow for extensibility in case I add more features
+// (and now it also keeps the ENVDEF and the labels it was made with).
+// Once it's loaded a Program never changes, so one can be shared by any number
+// of Envs on any number of threads through a ProgramRef.
+struct Program {
+	std::vector<Line> lines;
+	EnvConfig config;
+	Labelmap_t labels;               // The main program's labels, and every label a module exports(a lazy one's are in lazy)
+	std::vector<CountedLoop> loops;  // What findCountedLoops found. Op::LOOP_JUMP lines point into this
+	LoadTimes loadTimes;             // How long loading it took
+	std::shared_ptr<LazyLines> lazy; // Only for lazy=yes, and then lines is empty. See fetchLine
+};
+
+using ProgramRef = std::shared_ptr<const Program>;
+
+// decoded is kept in chunks of this many lines(as a shift), each one made when indexing gets to it
+const int LAZY_CHUNK_SHIFT = 12;
+
+// What a program loaded with lazy=yes gets instead of its lines. Loading it doesn't look past
+// the ENVDEF. Lines get indexed(where each one starts and whether it's a label) only as far as
+// something needs: fetching a line, or a jump to a label that hasn't been found yet. Each line
+// is decoded the first time fetchLine is asked for it and kept in decoded, so a huge program
+// where only a few lines ever run starts running right away. Threads running the same program
+// can all be decoding at once: the first one to finish a line wins and the others throw theirs away.
+struct LazyLines {
+	std::string source;
+	int first{0};   // The source line Line 0 is(just after the ENVDEF)
+	std::mutex indexLock;  // For the index, which is everything up to indexed
+	std::vector<LexedLine> lines;  // Where each line indexed so far is in source. Only start and end are set
+	size_t indexEnd{0};    // Where the next line to index starts
+	bool indexDone{false}; // Whether it got to the end or an ENDPROGRAM
+	Labelmap_t labels;     // The labels on the lines indexed so far
+	std::atomic<int> indexed{0};  // lines.size(), for fetchLine to check without the lock
+	std::unique_ptr<std::unique_ptr<std::atomic<const Line*>[]>[]> decoded;
+	std::once_flag fullOnce;  // For decodedProgram
+	ProgramRef full;
+
+	~LazyLines() {
+		const int mask = (1 << LAZY_CHUNK_SHIFT) - 1;
+		for (int i = 0; i < indexed.load(std::memory_order_relaxed); i++) {
+			delete decoded[i >> LAZY_CHUNK_SHIFT][i & mask].load(std::memory_order_relaxed);
+		}
+	}
+};
+
+const Line& decodeLazyLine(const Program &prog, int i);
+bool indexLazyLines(const Program &prog, int i);
+
+// How many lines prog has, whether or not they've been decoded yet. A lazy program has to be
+// indexed all the way to the end for this, so use hasLine when that's all that's needed
+inline int programSize(const Program &prog) {
+	if (prog.lazy == nullptr) {
+		return (int)prog.lines.size();
+	}
+	indexLazyLines(prog, INT_MAX);
+	return prog.lazy->indexed.load(std::memory_order_acquire);
+}
+
+// Whether prog has a line i(which can't be negative). A lazy program only gets indexed up to i
+inline bool hasLine(const Program &prog, int i) {
+	if (prog.lazy == nullptr) {
+		return i < (int)prog.lines.size();
+	}
+	return i < prog.lazy->indexed.load(std::memory_order_acquire) || indexLazyLines(prog, i);
+}
+
+// Line i of prog(which has to be in range), decoding it first if prog is lazy and it hasn't been
+// yet. Throws a CaiError if it's lazy and the line has a mistake in it
+inline const Line& fetchLine(const Program &prog, int i) {
+	if (prog.lazy == nullptr) {
+		return prog.lines[i];
+	}
+	const LazyLines &lazy = *prog.lazy;
+	if (i < lazy.indexed.load(std::memory_order_acquire)) {
+		const Line *line = lazy.decoded[i >> LAZY_CHUNK_SHIFT][i & ((1 << LAZY_CHUNK_SHIFT) - 1)].load(std::memory_order_acquire);
+		if (line != nullptr) {
+			return *line;
+		}
+	}
+	return decodeLazyLine(prog, i);
+}
+
+// The line label name is on, or -1 if there isn't one. A lazy program gets indexed until it's found
+int findLabel(const Program &prog, const std::string &name);
+
+// prog with every line decoded, for things that need the whole program at once(the closure engine,
+// lockstep, breakpoints and the result cache). A program that isn't lazy is just returned, and a
+// lazy one only gets decoded once and then the same one keeps getting returned. Its loops get sped
+// up(see loopopt.h), which a lazy program's can't be
+ProgramRef decodedProgram(const ProgramRef &prog);
+
+// Which pages of a Memory have been written since they were last put back, so an EnvPool(see
+// envpool.h) only has to put those back. A page is 1 << DIRTY_PAGE_SHIFT cells
+const int DIRTY_PAGE_SHIFT = 10;
+
+struct DirtyPages {
+	std::vector<unsigned char> flags;  // One for each page
+	std::vector<int> pages;            // The ones that are set. It has room for all of them, so marking never allocates
+
+	void mark(size_t addr) {
+		const size_t page = addr >> DIRTY_PAGE_SHIFT;
+		if (!flags[page]) {
+			flags[page] = 1;
+			pages.push_back((int)page);
+		}
+	}
+	void markRange(size_t addr, size_t len) {
+		if (len == 0) {
+			return;
+		}
+		for (size_t page = addr >> DIRTY_PAGE_SHIFT; page <= (addr + len - 1) >> DIRTY_PAGE_SHIFT; page++) {
+			mark(page << DIRTY_PAGE_SHIFT);
+		}
+	}
+};
+
+// An Env's memory, which works like the std::vector<int> it used to be. Normally the cells are
+// the Env's own, but they can also be ones it shares with other Envs(like the threads of a
+// ThreadGroup, see threads.h) or a file's(memfile=), and then keep is what keeps them alive.
+// Copying a Memory always copies the cells into a new one of its own, so copying an Env never
+// makes two Envs share memory, and a copy of one with a memfile doesn't write to the file
+// (or one from an EnvPool mark the pool's pages)
+struct Memory {
+	int *cells{nullptr};
+	size_t count{0};
+	std::vector<int> own;
+	std::shared_ptr<void> keep;
+	MemoryFile *file{nullptr};  // The memfile the cells are from, if they are
+	DirtyPages *dirty{nullptr}; // If it's an EnvPool's, where the pages written get marked
+
+	Memory() = default;
+	Memory(std::vector<int> &&v) : own(std::move(v)) {
+		cells = own.data();
+		count = own.size();
+	}
+	explicit Memory(std::shared_ptr<MemoryFile> f) : cells(f->cells), count(f->count), keep(f), file(f.get()) {}
+	Memory(const Memory &o) : own(o.begin(), o.end()) {
+		cells = own.data();
+		count = own.size();
+	}
+	Memory(Memory &&o) noexcept : cells(o.cells), count(o.count), own(std::move(o.own)), keep(std::move(o.keep)), file(o.file), dirty(o.dirty) {
+		o.cells = nullptr;
+		o.count = 0;
+		o.file = nullptr;
+		o.dirty = nullptr;
+	}
+	Memory& operator=(const Memory &o) {
+		if (this != &o) {
+			*this = Memory(o);
+		}
+		return *this;
+	}
+	Memory& operator=(Memory &&o) noexcept {
+		own = std::move(o.own);
+		keep = std::move(o.keep);
+		cells = o.cells;
+		count = o.count;
+		file = o.file;
+		dirty = o.dirty;
+		o.cells = nullptr;
+		o.count = 0;
+		o.file = nullptr;
+		o.dirty = nullptr;
+		return *this;
+	}
+	Memory& operator=(std::vector<int> &&v) {
+		return *this = Memory(std::move(v));
+	}
+
+	int& operator[](size_t i) { return cells[i]; }
+	const int& operator[](size_t i) const { return cells[i]; }
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+	int* data() { return cells; }
+	const int* data() const { return cells; }
+	int* begin() { return cells; }
+	int* end() { return cells + count; }
+	const int* begin() const { return cells; }
+	const int* end() const { return cells + count; }
+	bool isShared() const { return keep != nullptr; }
+	// Anything that writes to the cells without going through getDerefp, getRangep or setDeref
+	// has to say so with these, or an EnvPool won't know to put them back
+	void touch(size_t addr) {
+		if (dirty != nullptr) {
+			dirty->mark(addr);
+		}
+	}
+	void touchRange(size_t addr, size_t len) {
+		if (dirty != nullptr) {
+			dirty->markRange(addr, len);
+		}
+	}
+	// Moves the cells out as a vector(copying them if they're shared), leaving this empty
+	std::vector<int> take() {
+		std::vector<int> v = isShared() ? std::vector<int>(begin(), end()) : std::move(own);
+		*this = Memory();
+		return v;
+	}
+	bool operator==(const Memory &o) const { return std::equal(begin(), end(), o.begin(), o.end()); }
 };
 
 // This is a struct that will contain the current state of the program
@@ -72,38 +340,74 @@ struct Env {
 	int line;         // The line number it's on
 	int memSize;      // This will be to do boundary checks
 	//int *memory;      // This will be a dynamically allocated region of memory for "cpt" and "cpf" operations
-	std::vector<int> memory; // Switching to a vector object
-	Program program;
-	int steps { 0 };           // To keep track of how many steps the program is taking
+	Memory memory;           // Switching to a vector object(and now a Memory, which acts like one)
+	ProgramRef program;      // Shared with every other Env running the same program
+	long long steps { 0 };     // To keep track of how many steps the program is taking
 	std::vector<bool> states;  // This will allow for a general set of states to be set for whatever reason
 	bool endProgram{false};  // The end instruction will make this true
-	std::queue<int> input;
-	std::queue<int> output;
+	std::deque<int> input;   // A deque and not a queue so the debugger can put back what a step took out
+	std::deque<int> output;
+	MemProfile *memProfile{nullptr};  // If set, every memory access gets recorded in it
+	OutputSink *outputSink{nullptr};  // If set, "out" writes to it instead of to output
+	RunLimits limits;
+	RunStatus status{RunStatus::RUNNING};
+	long long runNanos{0};  // Time spent inside runSteps so far, for RunLimits::maxMillis
+	Engine engine{Engine::INTERPRETER};
+	long long stepFence{LLONG_MAX};  // Set by runSteps. Anything that does lots of steps at once(a sped up loop) stops short of this
+	ThreadGroup *group{nullptr};     // The group this is a thread of, if it's one. See threads.h
+	RunStats *stats{nullptr};        // If set, runSteps counts what the run does in it. See stats.h
+	Breakpoints *breakpoints{nullptr};  // Set by armBreakpoints, see breakpoints.h
+	// The closure engine's code and the program it's for, kept so runSteps only has to get it
+	// again when the program changes and not every time it's called(like every step of --trace)
+	std::shared_ptr<const ClosureProgram> closures;
+	ProgramRef closuresFor;
+	std::array<int, MAX_REGISTERS> regs{};  // r0 to r15, for programs with registers= in their ENVDEF. They start at 0
 };
 
-void doInstruction(Line line, Env &env);
+void doInstruction(const Line &line, Env &env);
 
 int  getReg(Env &env, bool remove=false);
 int* getRegp(Env &env);
 void setReg(Env &env, int value);
 
-int  getDeref(Env &env, Arg arg1);
-int* getDerefp(Env &env, Arg arg1);
-Env setDeref(Env &env, Arg arg1, int newValue);
+int  checkAddress(Env &env, int addr);
+int  resolveAddress(Env &env, const Arg &arg1);
+int  getDeref(Env &env, const Arg &arg1);
+int* getDerefp(Env &env, const Arg &arg1);
+int* getRangep(Env &env, const Arg &arg1, int len, MemAccess kind);
+void setDeref(Env &env, const Arg &arg1, int newValue);
+bool peekAddress(const Env &env, const Arg &arg, int &addr);
+int  peekArg(const Env &env, const Arg &arg);
 
 Op getOpFromString(std::string op);
-Line interpretLine(std::string line, int lineNum, Labelmap_t labelmap);
+Arg interpretArg(const std::string &argString);
+Line interpretLine(const std::string &line, int lineNum, const Labelmap_t &labelmap);
+Line interpretTokens(const char *src, const TokenSpan *tokens, int numTokens, int lineNum, const Labelmap_t &labelmap);
+
+void printLabelMap(const Labelmap_t &labelmap);
+std::pair<EnvConfig,int> makeEnvConf(const char *src, const LexIndex &index, const char *fileDir = nullptr);
+Labelmap_t makeLabelMap(const char *src, const LexIndex &index, int first);
+std::vector<Line> interpretLines(const char *src, const LexIndex &index, int first, const Labelmap_t &labelmap);
 
-void printLabelMap(Labelmap_t labelmap);
-Labelmap_t makeLabelMap(std::string filename);
-Program interpretFile(std::string filename, std::streampos offset);
+ProgramRef loadProgramBuffer(std::string source, const char *fileDir = nullptr);
+ProgramRef loadProgramFile(const std::string &filename);
 
-std::pair<EnvConfig,std::streampos> makeEnvConf(std::string filename);
-Env setupEnvironment(int memSize, std::vector<int> init);
-Env createEnvironmentFromFile(std::string filename);
-Env iterateOnce(Env &env);
+Env setupEnvironment(const EnvConfig &config, ProgramRef prog);
+Env setupEnvironment(const EnvConfig &config, ProgramRef prog, Memory mem);
+Env createInstance(ProgramRef prog);
+Env createEnvironmentFromFile(const std::string &filename);
+void iterateOnce(Env &env);
 
-void printState(Env env);
-Env runProgram(std::string filename);
+const char* runStatusName(RunStatus status);
+const char* engineName(Engine engine);
+bool parseEngine(const std::string &name, Engine &engine);
+void printState(const Env &env);
+void printOutput(const Env &env);
+long long outputCount(const Env &env);
+bool isBudgetExhausted(RunStatus status);
+RunStatus runSteps(Env &env, long long steps);
+void pushInput(Env &env, int value);
+void runEnvironment(Env &env);
+Env runProgram(const std::string &filename);
 
 #endif
@@ -0,0 +1,252 @@
+/*
+ *	This file is a part of ConfigurableAssemblyIntepreter.
+ *
+ *	ConfigurableAssemblyIntepreter is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ConfigurableAssemblyIntepreter is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mappedfile.h"
+#include "lexscan.h"
+#include "caiError.h"
+
+#ifndef MAPPEDFILE_CPP
+#define MAPPEDFILE_CPP
+
+MappedFile::~MappedFile() {
+	unmapFile(*this);
+}
+
+bool mapFile(MappedFile &file, const std::string &path) {
+	unmapFile(file);
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+		close(fd);
+		return false;
+	}
+	if (st.st_size > 0) {
+		int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+		flags |= MAP_POPULATE;  // Fault it all in at once instead of a page at a time
+#endif
+		void *p = mmap(nullptr, (size_t)st.st_size, PROT_READ, flags, fd, 0);
+		if (p == MAP_FAILED) {
+			close(fd);
+			return false;
+		}
+		// It's only read front to back once
+		madvise(p, (size_t)st.st_size, MADV_SEQUENTIAL);
+		file.data = (const char*)p;
+		file.size = (size_t)st.st_size;
+	}
+	close(fd);  // The mapping stays after the fd is closed
+	return true;
+}
+
+void unmapFile(MappedFile &file) {
+	if (file.data != nullptr) {
+		munmap((void*)file.data, file.size);
+	}
+	file.data = nullptr;
+	file.size = 0;
+}
+
+static bool endsWith(const std::string &str, const std::string &end) {
+	return str.size() >= end.size() && str.compare(str.size() - end.size(), end.size(), end) == 0;
+}
+
+std::vector<int> loadIntFile(const std::string &path) {
+	MappedFile file;
+	if (!mapFile(file, path)) {
+		throw CaiError(CaiErrc::FILE_ERROR, "Couldn't open file '" + path + "'");
+	}
+	if (endsWith(path, ".bin")) {
+		if (file.size % sizeof(int32_t) != 0) {
+			throw CaiError(CaiErrc::BAD_CONFIG, "'" + path + "' isn't a whole number of 32 bit ints");
+		}
+		// The mapping is page aligned, so it can be read as ints. Building the vector from the
+		// range copies it once, instead of zeroing it and then copying over that
+		const int *first = (const int*)file.data;
+		std::vector<int> values(first, first + file.size / sizeof(int32_t));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		for (int &v : values) {
+			v = (int)__builtin_bswap32((uint32_t)v);
+		}
+#endif
+		return values;
+	}
+	try {
+		return scanIntArray(file.data, file.size);
+	} catch (const std::logic_error &e) {
+		throw CaiError(CaiErrc::BAD_CONFIG, std::string(e.what()) + " in '" + path + "'");
+	}
+}
+
+MemoryFile::~MemoryFile() {
+	if (cells != nullptr) {
+		munmap(cells, count * sizeof(int));
+	}
+}
+
+// Maps bytes of memory for an ATOMIC memfile. The file itself never gets touched before the sync,
+// not even to grow it, so the part it doesn't have yet is anonymous zeros with as much of the
+// file as there is mapped privately over the start of it
+static void* mapPrivateCopy(int fd, size_t fileBytes, size_t bytes) {
+	void *p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (p == MAP_FAILED || fileBytes == 0) {
+		return p;
+	}
+	// Past the end of the file the last page reads as zeros, but a page all the way past it wouldn't
+	// be there at all, so only the pages the file reaches into are mapped from it
+	const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	const size_t fileSpan = std::min(bytes, (fileBytes + page - 1) / page * page);
+	if (mmap(p, fileSpan, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED | MAP_NORESERVE, fd, 0) == MAP_FAILED) {
+		int err = errno;
+		munmap(p, bytes);
+		errno = err;
+		return MAP_FAILED;
+	}
+	return p;
+}
+
+std::shared_ptr<MemoryFile> mapMemoryFile(const std::string &path, size_t count, MemSync sync) {
+	std::shared_ptr<MemoryFile> file = std::make_shared<MemoryFile>();
+	file->path = path;
+	file->sync = sync;
+	const size_t bytes = count * sizeof(int);
+	// An ATOMIC one that isn't there yet only gets made by the sync, so it's opened read only and
+	// a crash before then doesn't leave an empty file behind
+	const bool atomic = sync == MemSync::ATOMIC;
+	int fd = atomic ? open(path.c_str(), O_RDONLY) : open(path.c_str(), O_RDWR | O_CREAT, 0644);
+	if (fd < 0 && !(atomic && errno == ENOENT)) {
+		throw CaiError(CaiErrc::FILE_ERROR, "Couldn't open memfile '" + path + "': " + strerror(errno));
+	}
+	struct stat st{};
+	if (fd >= 0 && (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))) {
+		close(fd);
+		throw CaiError(CaiErrc::FILE_ERROR, "memfile '" + path + "' isn't a file");
+	}
+	if ((size_t)st.st_size > bytes || st.st_size % sizeof(int) != 0) {
+		close(fd);
+		throw CaiError(CaiErrc::BAD_CONFIG, "memfile '" + path + "' has " + std::to_string(st.st_size) +
+			" bytes, which isn't a whole number of cells that fits in memory of size " + std::to_string(count));
+	}
+	file->created = st.st_size == 0;
+	// Growing it makes the new part zeros without writing anything, so nothing has to be zero filled
+	if (!atomic && (size_t)st.st_size < bytes && ftruncate(fd, (off_t)bytes) != 0) {
+		int err = errno;
+		close(fd);
+		throw CaiError(CaiErrc::FILE_ERROR, "Couldn't grow memfile '" + path + "': " + strerror(err));
+	}
+	if (bytes > 0) {
+		// Private for ATOMIC so nothing gets to the file until it's all written at once. Either way
+		// the pages only get read in when they're touched, so it can be bigger than the RAM
+		void *p = atomic ? mapPrivateCopy(fd, (size_t)st.st_size, bytes) :
+			mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (p == MAP_FAILED) {
+			int err = errno;
+			if (fd >= 0) {
+				close(fd);
+			}
+			throw CaiError(CaiErrc::FILE_ERROR, "Couldn't map memfile '" + path + "': " + strerror(err));
+		}
+		file->cells = (int*)p;
+		file->count = count;
+	}
+	if (fd >= 0) {
+		close(fd);
+	}
+	return file;
+}
+
+// fsyncs the directory path is in, so a rename in it is on the disk too
+static bool syncParentDir(const std::string &path) {
+	size_t slash = path.rfind('/');
+	std::string dir = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+	int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+	if (fd < 0) {
+		return false;
+	}
+	bool ok = fsync(fd) == 0;
+	close(fd);
+	return ok;
+}
+
+void syncMemoryFile(MemoryFile &file) {
+	const size_t bytes = file.count * sizeof(int);
+	if (file.sync == MemSync::NEVER || bytes == 0) {
+		return;
+	}
+	if (file.sync == MemSync::END) {
+		if (msync(file.cells, bytes, MS_SYNC) != 0) {
+			throw CaiError(CaiErrc::FILE_ERROR, "Couldn't msync memfile '" + file.path + "': " + strerror(errno));
+		}
+		return;
+	}
+	// ATOMIC. The rename is what makes it all happen at once, so the new image has to be all
+	// the way on the disk before it, and the rename has to be after it. The temp file is a new one
+	// next to it every time, so two runs syncing the same memfile don't write into the same one
+	std::string tmp = file.path + ".XXXXXX";
+	int fd = mkstemp(&tmp[0]);
+	bool ok = fd >= 0 && fchmod(fd, 0644) == 0;
+	const char *data = (const char*)file.cells;
+	for (size_t done = 0; ok && done < bytes; ) {
+		ssize_t n = write(fd, data + done, bytes - done);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		ok = n > 0;
+		done += ok ? (size_t)n : 0;
+	}
+	ok = ok && fsync(fd) == 0;
+	if (fd >= 0) {
+		ok = close(fd) == 0 && ok;
+	}
+	if (!ok || rename(tmp.c_str(), file.path.c_str()) != 0) {
+		int err = errno;
+		if (fd >= 0) {
+			unlink(tmp.c_str());
+		}
+		throw CaiError(CaiErrc::FILE_ERROR, "Couldn't write memfile '" + file.path + "': " + strerror(err));
+	}
+	if (!syncParentDir(file.path)) {
+		throw CaiError(CaiErrc::FILE_ERROR, "Couldn't sync the directory memfile '" + file.path + "' is in: " + strerror(errno));
+	}
+}
+
+bool parseMemSync(const std::string &name, MemSync &sync) {
+	if (name == "end") {
+		sync = MemSync::END;
+	} else if (name == "never") {
+		sync = MemSync::NEVER;
+	} else if (name == "atomic") {
+		sync = MemSync::ATOMIC;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+#endif
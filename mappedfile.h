@@ -0,0 +1,77 @@
+// -*- grammar-ext: .cpp -*-
+/*
+ *	This file is a part of ConfigurableAssemblyIntepreter.
+ *
+ *	ConfigurableAssemblyIntepreter is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ConfigurableAssemblyIntepreter is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+// A whole file mmap'd read only. Unmapped when it goes away
+struct MappedFile {
+	const char *data{nullptr};
+	size_t size{0};
+	MappedFile() = default;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile();
+};
+
+// Maps path into file. An empty file works and just has no data. False if it can't be opened
+bool mapFile(MappedFile &file, const std::string &path);
+void unmapFile(MappedFile &file);
+
+// Reads a file of numbers for init_file= and input_file=. A ".bin" file is raw little endian
+// 32 bit ints, which get copied straight out of the mapping. Anything else is text with the
+// numbers separated by newlines(or spaces or commas), parsed with scanIntArray.
+// Throws a CaiError if the file can't be read or has something that isn't a number in it
+std::vector<int> loadIntFile(const std::string &path);
+
+// How a memfile= gets written back, "memsync=" in the ENVDEF
+enum class MemSync {
+	END,     // The default. Writes go straight to the file, and it gets msync'd when the program ends
+	NEVER,   // The same, but the kernel writes it back whenever it wants to
+	ATOMIC   // Writes stay private until the program ends, and then the whole image replaces the file
+	         // at once(it's written next to it and renamed over it), so a crash leaves the old one
+};
+
+// The cells of an Env's memory, mapped from a file for memfile=. Unmapped when it goes away
+struct MemoryFile {
+	int *cells{nullptr};
+	size_t count{0};
+	std::string path;
+	MemSync sync{MemSync::END};
+	bool created{false};  // The file was new(or empty), so the cells are all 0
+	MemoryFile() = default;
+	MemoryFile(const MemoryFile&) = delete;
+	MemoryFile& operator=(const MemoryFile&) = delete;
+	~MemoryFile();
+};
+
+// Maps count cells of path read/write, making the file(or growing it with zeros) if it has to.
+// For ATOMIC the file isn't made or grown until the sync, the missing cells just start as zeros.
+// The cells are raw 32 bit ints in the machine's byte order. Throws a CaiError if it can't,
+// or if the file is bigger than count cells
+std::shared_ptr<MemoryFile> mapMemoryFile(const std::string &path, size_t count, MemSync sync);
+// Writes the cells back the way file.sync says to. Throws a CaiError if that fails
+void syncMemoryFile(MemoryFile &file);
+// "end", "never" or "atomic". False if it's none of them
+bool parseMemSync(const std::string &name, MemSync &sync);
+
+#endif
@@ -0,0 +1,184 @@
+/*
+ *	This file is a part of ConfigurableAssemblyIntepreter.
+ *
+ *	ConfigurableAssemblyIntepreter is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ConfigurableAssemblyIntepreter is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "memprofile.h"
+
+#ifndef MEMPROFILE_CPP
+#define MEMPROFILE_CPP
+
+void setupMemProfile(MemProfile &profile, int memSize) {
+	profile.memSize = memSize;
+	profile.reads.assign(memSize, 0);
+	profile.writes.assign(memSize, 0);
+	profile.hops.assign(memSize, 0);
+	profile.depth.assign((size_t)memSize * MEMPROFILE_DEPTH_BUCKETS, 0);
+	profile.strides.clear();
+}
+
+void recordMemAccess(MemProfile &profile, int line, int addr, int depth, MemAccess kind) {
+	if (kind == MemAccess::HOP) {
+		// Pointer cells only get counted, they aren't part of any stride stream
+		profile.hops[addr]++;
+		return;
+	}
+	if (kind == MemAccess::READ) {
+		profile.reads[addr]++;
+	} else {
+		profile.writes[addr]++;
+	}
+	if (depth >= MEMPROFILE_DEPTH_BUCKETS) {
+		depth = MEMPROFILE_DEPTH_BUCKETS - 1;
+	}
+	profile.depth[(size_t)addr * MEMPROFILE_DEPTH_BUCKETS + depth]++;
+
+	// Now update the stride stream of this line
+	size_t ind = (size_t)line * 2 + (kind == MemAccess::WRITE ? 1 : 0);
+	if (ind >= profile.strides.size()) {
+		profile.strides.resize(ind + 1);
+	}
+	StrideStream &stream = profile.strides[ind];
+	if (stream.lastAddr != -1) {
+		int stride = addr - stream.lastAddr;
+		if (stream.accesses > 1 && stride == stream.lastStride) {
+			stream.repeats++;
+		}
+		stream.histogram[stride]++;
+		stream.lastStride = stride;
+	}
+	stream.lastAddr = addr;
+	stream.accesses++;
+}
+
+// One row per cell that was touched at all, untouched cells are left out
+// since they'd just be a wall of zeros for big memories
+bool writeHeatmapCSV(const MemProfile &profile, std::string filename) {
+	FILE *f = fopen(filename.c_str(), "w");
+	if (f == nullptr) {
+		return false;
+	}
+	fprintf(f, "address,reads,writes,hops");
+	for (int d = 0; d < MEMPROFILE_DEPTH_BUCKETS; d++) {
+		fprintf(f, (d + 1 == MEMPROFILE_DEPTH_BUCKETS) ? ",depth%i+" : ",depth%i", d);
+	}
+	fprintf(f, "\n");
+	for (int i = 0; i < profile.memSize; i++) {
+		if (profile.reads[i] == 0 && profile.writes[i] == 0 && profile.hops[i] == 0) {
+			continue;
+		}
+		fprintf(f, "%i,%llu,%llu,%llu", i,
+			(unsigned long long)profile.reads[i],
+			(unsigned long long)profile.writes[i],
+			(unsigned long long)profile.hops[i]);
+		for (int d = 0; d < MEMPROFILE_DEPTH_BUCKETS; d++) {
+			fprintf(f, ",%llu", (unsigned long long)profile.depth[(size_t)i * MEMPROFILE_DEPTH_BUCKETS + d]);
+		}
+		fprintf(f, "\n");
+	}
+	return fclose(f) == 0;
+}
+
+// Writes an unsigned LEB128 varint, so small counts only take a byte
+static void putVarint(std::vector<unsigned char> &buf, uint64_t v) {
+	while (v >= 0x80) {
+		buf.push_back((unsigned char)(v | 0x80));
+		v >>= 7;
+	}
+	buf.push_back((unsigned char)v);
+}
+
+// Binary layout (all numbers are LEB128 varints after the magic):
+//   "CAIH" version memSize depthBuckets cellCount
+//   then for each touched cell:
+//   addrDelta reads writes hops depth[0] ... depth[depthBuckets-1]
+// addrDelta is the distance from the previous touched cell (or from 0 for the first one)
+bool writeHeatmapBinary(const MemProfile &profile, std::string filename) {
+	std::vector<unsigned char> buf;
+	buf.reserve(64);
+	std::vector<unsigned char> body;
+	uint64_t count = 0;
+	int prev = 0;
+	for (int i = 0; i < profile.memSize; i++) {
+		if (profile.reads[i] == 0 && profile.writes[i] == 0 && profile.hops[i] == 0) {
+			continue;
+		}
+		putVarint(body, (uint64_t)(i - prev));
+		putVarint(body, profile.reads[i]);
+		putVarint(body, profile.writes[i]);
+		putVarint(body, profile.hops[i]);
+		for (int d = 0; d < MEMPROFILE_DEPTH_BUCKETS; d++) {
+			putVarint(body, profile.depth[(size_t)i * MEMPROFILE_DEPTH_BUCKETS + d]);
+		}
+		prev = i;
+		count++;
+	}
+	buf.insert(buf.end(), {'C', 'A', 'I', 'H'});
+	putVarint(buf, 1);
+	putVarint(buf, (uint64_t)profile.memSize);
+	putVarint(buf, MEMPROFILE_DEPTH_BUCKETS);
+	putVarint(buf, count);
+
+	FILE *f = fopen(filename.c_str(), "wb");
+	if (f == nullptr) {
+		return false;
+	}
+	bool ok = fwrite(buf.data(), 1, buf.size(), f) == buf.size();
+	ok = ok && fwrite(body.data(), 1, body.size(), f) == body.size();
+	return (fclose(f) == 0) && ok;
+}
+
+// One row per line and direction that accessed memory. The dominant stride is the
+// most common distance between two accesses in a row, and "repeats" is how many times
+// the stride stayed the same, which is what tells you if the line is walking an array.
+bool writeStrideCSV(const MemProfile &profile, std::string filename) {
+	FILE *f = fopen(filename.c_str(), "w");
+	if (f == nullptr) {
+		return false;
+	}
+	fprintf(f, "line,kind,accesses,dominant_stride,dominant_count,repeats,distinct_strides\n");
+	for (size_t i = 0; i < profile.strides.size(); i++) {
+		const StrideStream &stream = profile.strides[i];
+		if (stream.accesses == 0) {
+			continue;
+		}
+		int dominant = 0;
+		uint64_t dominantCount = 0;
+		for (const auto &it : stream.histogram) {
+			if (it.second > dominantCount) {
+				dominant = it.first;
+				dominantCount = it.second;
+			}
+		}
+		fprintf(f, "%i,%s,%llu,%i,%llu,%llu,%i\n", (int)(i / 2), (i % 2) ? "write" : "read",
+			(unsigned long long)stream.accesses, dominant,
+			(unsigned long long)dominantCount,
+			(unsigned long long)stream.repeats, (int)stream.histogram.size());
+	}
+	return fclose(f) == 0;
+}
+
+// Writes prefix.heat.csv, prefix.heat.bin and prefix.stride.csv
+bool writeMemProfile(const MemProfile &profile, std::string prefix) {
+	bool ok = writeHeatmapCSV(profile, prefix + ".heat.csv");
+	ok = writeHeatmapBinary(profile, prefix + ".heat.bin") && ok;
+	ok = writeStrideCSV(profile, prefix + ".stride.csv") && ok;
+	return ok;
+}
+
+#endif
@@ -0,0 +1,68 @@
+// -*- grammar-ext: .cpp -*-
+/*
+ *	This file is a part of ConfigurableAssemblyIntepreter.
+ *
+ *	ConfigurableAssemblyIntepreter is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ConfigurableAssemblyIntepreter is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+
+#ifndef MEMPROFILE_H
+#define MEMPROFILE_H
+
+// Dereference depths 0, 1 and 2 get their own bucket, anything deeper
+// goes into the last one
+#define MEMPROFILE_DEPTH_BUCKETS 4
+
+enum class MemAccess {
+	READ,   // The final value of an argument was read
+	WRITE,  // The final value of an argument was written
+	HOP     // The cell was read as a pointer while following a "*" chain
+};
+
+// Keeps track of the stride of one stream of accesses. There is one stream
+// for the reads and one for the writes of every line, since something like
+// "mov *0 *1" would otherwise look like it's jumping back and forth.
+struct StrideStream {
+	int lastAddr{ -1 };
+	int lastStride{ 0 };
+	uint64_t accesses{ 0 };
+	uint64_t repeats{ 0 };                 // How many times the stride was the same as last time
+	std::map<int, uint64_t> histogram;     // stride => count
+};
+
+// Data side profile of a run. One of these can be attached to Env::memProfile,
+// and getDeref/getDerefp will then record every access they make.
+struct MemProfile {
+	int memSize{ 0 };
+	std::vector<uint64_t> reads;
+	std::vector<uint64_t> writes;
+	std::vector<uint64_t> hops;
+	// memSize * MEMPROFILE_DEPTH_BUCKETS counters, the depth of every read/write of a cell
+	std::vector<uint64_t> depth;
+	// Indexed by line*2 for reads and line*2+1 for writes, grown as needed
+	std::vector<StrideStream> strides;
+};
+
+void setupMemProfile(MemProfile &profile, int memSize);
+void recordMemAccess(MemProfile &profile, int line, int addr, int depth, MemAccess kind);
+
+bool writeHeatmapCSV(const MemProfile &profile, std::string filename);
+bool writeHeatmapBinary(const MemProfile &profile, std::string filename);
+bool writeStrideCSV(const MemProfile &profile, std::string filename);
+bool writeMemProfile(const MemProfile &profile, std::string prefix);
+
+#endif
@@ -0,0 +1,125 @@
+/*
+ *	This file is a part of ConfigurableAssemblyIntepreter.
+ *
+ *	ConfigurableAssemblyIntepreter is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ConfigurableAssemblyIntepreter is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+
+#include <poll.h>
+#include <unistd.h>
+
+#include "outputsink.h"
+#include "caiError.h"
+
+#ifndef OUTPUTSINK_CPP
+#define OUTPUTSINK_CPP
+
+// The most one value can take up: "-2147483648\n"
+static const size_t MAX_ENCODED = 12;
+
+void setupOutputSink(OutputSink &sink, int fd, OutputEncoding encoding, size_t bufferBytes) {
+	sink.fd = fd;
+	sink.encoding = encoding;
+	sink.buffer.assign(std::max(bufferBytes, MAX_ENCODED), 0);
+	sink.used = 0;
+	sink.values = 0;
+	sink.bytesWritten = 0;
+}
+
+bool flushSink(OutputSink &sink) {
+	size_t done = 0;
+	while (done < sink.used) {
+		ssize_t n = write(sink.fd, sink.buffer.data() + done, sink.used - done);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				break;
+			}
+			throw CaiError(CaiErrc::FILE_ERROR, std::string("Couldn't write the output: ") + strerror(errno));
+		}
+		done += (size_t)n;
+	}
+	// Keep whatever didn't get written at the front
+	if (done > 0) {
+		memmove(sink.buffer.data(), sink.buffer.data() + done, sink.used - done);
+		sink.used -= done;
+		sink.bytesWritten += (long long)done;
+	}
+	return sink.used == 0;
+}
+
+bool sinkPut(OutputSink &sink, int value) {
+	if (sink.buffer.size() - sink.used < MAX_ENCODED) {
+		flushSink(sink);
+		if (sink.buffer.size() - sink.used < MAX_ENCODED) {
+			return false;
+		}
+	}
+	char *p = sink.buffer.data() + sink.used;
+	if (sink.encoding == OutputEncoding::BINARY) {
+		uint32_t v = (uint32_t)value;
+		p[0] = (char)(v & 0xff);
+		p[1] = (char)((v >> 8) & 0xff);
+		p[2] = (char)((v >> 16) & 0xff);
+		p[3] = (char)(v >> 24);
+		sink.used += 4;
+	} else {
+		char *end = std::to_chars(p, p + MAX_ENCODED - 1, value).ptr;
+		*end++ = '\n';
+		sink.used += (size_t)(end - p);
+	}
+	sink.values++;
+	return true;
+}
+
+bool waitForSink(OutputSink &sink, int timeoutMillis) {
+	while (!flushSink(sink)) {
+		struct pollfd pfd = { sink.fd, POLLOUT, 0 };
+		int r = poll(&pfd, 1, timeoutMillis);
+		if (r < 0 && errno != EINTR) {
+			throw CaiError(CaiErrc::FILE_ERROR, std::string("Couldn't wait for the output: ") + strerror(errno));
+		}
+		if (r == 0) {
+			return false;  // Timed out
+		}
+	}
+	return true;
+}
+
+const char* outputEncodingName(OutputEncoding encoding) {
+	switch (encoding) {
+		case OutputEncoding::TEXT:   return "text";
+		case OutputEncoding::BINARY: return "binary";
+	}
+	return "unknown";
+}
+
+bool parseOutputEncoding(const std::string &name, OutputEncoding &encoding) {
+	if (name == "text") {
+		encoding = OutputEncoding::TEXT;
+	} else if (name == "binary" || name == "bin") {
+		encoding = OutputEncoding::BINARY;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+#endif
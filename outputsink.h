@@ -0,0 +1,62 @@
+// -*- grammar-ext: .cpp -*-
+/*
+ *	This file is a part of ConfigurableAssemblyIntepreter.
+ *
+ *	ConfigurableAssemblyIntepreter is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ConfigurableAssemblyIntepreter is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#ifndef OUTPUTSINK_H
+#define OUTPUTSINK_H
+
+// Somewhere for "out" to write to other than Env::output, which just keeps growing until the
+// program ends. Values get encoded into a fixed size buffer, which gets written to a file
+// descriptor in big writes whenever it fills up. If the fd is non-blocking and can't take any
+// more, "out" doesn't step and runSteps returns RunStatus::BLOCKED_OUTPUT, the same way an
+// "inp" with no input does. Wait for it with waitForSink and call runSteps again to resume.
+// Each Env needs its own sink.
+
+enum class OutputEncoding {
+	TEXT,   // One number per line
+	BINARY  // Little endian 32 bit ints, the same as a .bin for init_file=
+};
+
+struct OutputSink {
+	int fd{ -1 };
+	OutputEncoding encoding{ OutputEncoding::TEXT };
+	bool flushOnEnd{ false };   // Only write when the buffer is full or the program ends, instead of every time runSteps returns
+	std::vector<char> buffer;   // Its size is how much can be buffered
+	size_t used{ 0 };
+	long long values{ 0 };      // How many values have gone into it. These count for RunLimits::maxOutput
+	long long bytesWritten{ 0 };
+};
+
+void setupOutputSink(OutputSink &sink, int fd, OutputEncoding encoding, size_t bufferBytes = 1 << 16);
+
+// Adds a value. False if the buffer is full and the fd can't take any of it right now
+bool sinkPut(OutputSink &sink, int value);
+
+// Writes out as much of the buffer as the fd will take. True if it's all gone, false if the fd
+// would block. Throws a CaiError if the write fails
+bool flushSink(OutputSink &sink);
+
+// Waits until the fd can be written to(up to timeoutMillis, -1 for forever) and flushes
+bool waitForSink(OutputSink &sink, int timeoutMillis = -1);
+
+const char* outputEncodingName(OutputEncoding encoding);
+bool parseOutputEncoding(const std::string &name, OutputEncoding &encoding);
+
+#endif
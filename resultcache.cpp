@@ -0,0 +1,358 @@
+/*
+ *	This file is a part of ConfigurableAssemblyIntepreter.
+ *
+ *	ConfigurableAssemblyIntepreter is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ConfigurableAssemblyIntepreter is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "instructions.h"
+#include "resultcache.h"
+
+#ifndef RESULTCACHE_CPP
+#define RESULTCACHE_CPP
+
+namespace fs = std::filesystem;
+
+static const char resultMagic[4] = { 'C', 'A', 'I', 'R' };
+static const uint64_t resultVersion = 2;
+
+static void putVarint(std::vector<unsigned char> &buf, uint64_t v) {
+	while (v >= 0x80) {
+		buf.push_back((unsigned char)(v | 0x80));
+		v >>= 7;
+	}
+	buf.push_back((unsigned char)v);
+}
+
+// Signed numbers are zigzagged first so small negative ones stay small too
+static void putSigned(std::vector<unsigned char> &buf, int v) {
+	putVarint(buf, ((uint32_t)v << 1) ^ (uint32_t)(v >> 31));
+}
+
+static bool getVarint(const std::vector<unsigned char> &buf, size_t &pos, uint64_t &v) {
+	v = 0;
+	for (int shift = 0; shift < 64 && pos < buf.size(); shift += 7) {
+		unsigned char b = buf[pos++];
+		v |= (uint64_t)(b & 0x7f) << shift;
+		if (!(b & 0x80)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool getSigned(const std::vector<unsigned char> &buf, size_t &pos, int &v) {
+	uint64_t u;
+	if (!getVarint(buf, pos, u) || u > 0xffffffffull) {
+		return false;
+	}
+	uint32_t z = (uint32_t)u;
+	v = (int)((z >> 1) ^ (0u - (z & 1)));
+	return true;
+}
+
+static std::string resultPath(const ResultCache &cache, const Digest &key) {
+	return cache.dir + "/" + digestHex(key) + ".res";
+}
+
+// Deletes the results that were used longest ago until the rest fit in 3/4 of maxBytes.
+// Called with cache.lock held
+static void evictResults(ResultCache &cache) {
+	struct Entry {
+		fs::file_time_type used;
+		uint64_t size;
+		fs::path path;
+	};
+	std::vector<Entry> entries;
+	uint64_t total = 0;
+	std::error_code ec;
+	for (const fs::directory_entry &de : fs::directory_iterator(cache.dir, ec)) {
+		if (de.path().extension() != ".res") {
+			continue;
+		}
+		std::error_code ec2;
+		uint64_t size = de.file_size(ec2);
+		fs::file_time_type used = de.last_write_time(ec2);
+		if (ec2) {
+			continue;  // Another process probably just deleted it
+		}
+		entries.push_back({used, size, de.path()});
+		total += size;
+	}
+	std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) { return a.used < b.used; });
+	uint64_t target = cache.maxBytes / 4 * 3;
+	for (const Entry &e : entries) {
+		if (total <= target) {
+			break;
+		}
+		fs::remove(e.path, ec);
+		total -= e.size;
+	}
+	cache.usedBytes = total;
+}
+
+// Makes the directory if it isn't there, and adds up what's already in it
+bool openResultCache(ResultCache &cache, const std::string &dir, uint64_t maxBytes) {
+	std::error_code ec;
+	fs::create_directories(dir, ec);
+	if (!fs::is_directory(dir, ec)) {
+		return false;
+	}
+	std::lock_guard<std::mutex> guard(cache.lock);
+	cache.dir = dir;
+	cache.maxBytes = maxBytes;
+	evictResults(cache);
+	return true;
+}
+
+// Hashes the program's lines(so comments and spacing don't matter) and checks that it
+// doesn't use anything that could make two identical runs come out different
+static ProgramDigest digestProgram(const ProgramRef &prog) {
+	ProgramDigest pd;
+	pd.program = prog;
+	pd.deterministic = prog->config.cacheable;
+	ProgramRef full = decodedProgram(prog);  // So a lazy program gets the same digest
+	Sha256 ctx;
+	sha256Init(ctx);
+	int32_t count = (int32_t)full->lines.size();
+	sha256Update(ctx, &count, sizeof(count));
+	for (const Line &line : full->lines) {
+		int32_t head[2] = { (int32_t)line.operation, (int32_t)line.arguments.size() };
+		sha256Update(ctx, head, sizeof(head));
+		for (const Arg &arg : line.arguments) {
+			int32_t a[5] = { arg.value, arg.derefLevel, (int32_t)arg.mode, arg.index, arg.indexDeref };
+			sha256Update(ctx, a, sizeof(a));
+		}
+		// A handler that isn't the usual one for its op could do anything
+		Op usual = line.operation;
+		if (usual == Op::NO_INSTRUCTION) {
+			usual = Op::LABEL;
+		} else if (usual == Op::LABEL) {
+			usual = Op::NOP;
+		}
+		OpFunc f = usual == line.operation ? lineFunc(usual, line.arguments) : optofunc.at(usual);
+		if (f == nullptr || f != line.func || nondeterministicOps.count(line.operation) != 0) {
+			pd.deterministic = false;
+		}
+	}
+	pd.digest = sha256Final(ctx);
+	return pd;
+}
+
+static ProgramDigest lookupProgram(ResultCache &cache, const ProgramRef &prog) {
+	std::lock_guard<std::mutex> guard(cache.lock);
+	std::map<const Program*, ProgramDigest>::iterator it = cache.programs.find(prog.get());
+	if (it != cache.programs.end() && it->second.program.lock() == prog) {
+		return it->second;
+	}
+	if (cache.programs.size() >= 256) {
+		// Forget the programs that aren't loaded anymore
+		for (it = cache.programs.begin(); it != cache.programs.end(); ) {
+			it = it->second.program.expired() ? cache.programs.erase(it) : std::next(it);
+		}
+	}
+	ProgramDigest pd = digestProgram(prog);
+	cache.programs[prog.get()] = pd;
+	return pd;
+}
+
+// Only fresh Envs are cached, since that's all the key covers
+bool isCacheable(ResultCache &cache, const Env &env) {
+	if (env.program == nullptr || env.steps != 0 || !env.output.empty() || env.endProgram ||
+		env.status != RunStatus::RUNNING || env.memProfile != nullptr || env.outputSink != nullptr ||
+		env.group != nullptr || env.memory.isShared() || env.stats != nullptr || env.breakpoints != nullptr ||
+		(int)env.states.size() < NUM_STATES || env.states[IS_END]) {
+		return false;
+	}
+	return lookupProgram(cache, env.program).deterministic;
+}
+
+Digest runKey(ResultCache &cache, const Env &env) {
+	Digest progDigest = lookupProgram(cache, env.program).digest;
+	Sha256 ctx;
+	sha256Init(ctx);
+	sha256Update(ctx, "cai-run-2", 9);
+	sha256Update(ctx, progDigest.data(), progDigest.size());
+	int32_t head[4] = { (int32_t)env.memory.size(), env.reg, env.line, (int32_t)env.states[NULL_REGISTER] };
+	sha256Update(ctx, head, sizeof(head));
+	sha256Update(ctx, env.memory.data(), env.memory.size() * sizeof(int));
+	int32_t regCount = (int32_t)env.program->config.registers;
+	sha256Update(ctx, &regCount, sizeof(regCount));
+	sha256Update(ctx, env.regs.data(), regCount * sizeof(int));
+	int32_t inputCount = (int32_t)env.input.size();
+	sha256Update(ctx, &inputCount, sizeof(inputCount));
+	for (int v : env.input) {
+		sha256Update(ctx, &v, sizeof(v));
+	}
+	return sha256Final(ctx);
+}
+
+// File layout: "CAIR", a varint version, the 32 bytes of the key, then varints: steps, reg, line,
+// flags(1 = IS_END, 2 = NULL_REGISTER, 4 = endProgram), input values used, memory size and every
+// cell, how many registers and each one, output count and every output value. reg, cells,
+// registers and outputs are zigzagged
+bool lookupResult(ResultCache &cache, const Digest &key, Env &env) {
+	std::vector<unsigned char> buf;
+	{
+		std::ifstream ifs(resultPath(cache, key), std::ifstream::in | std::ifstream::binary);
+		if (ifs.is_open()) {
+			buf.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+		}
+	}
+	bool ok = buf.size() > sizeof(resultMagic) && memcmp(buf.data(), resultMagic, sizeof(resultMagic)) == 0;
+	size_t pos = sizeof(resultMagic);
+	uint64_t version = 0, steps = 0, line = 0, flags = 0, inputUsed = 0, memSize = 0, regCount = 0, outCount = 0;
+	int reg = 0;
+	ok = ok && getVarint(buf, pos, version) && version == resultVersion;
+	ok = ok && pos + key.size() <= buf.size() && memcmp(buf.data() + pos, key.data(), key.size()) == 0;
+	pos += key.size();
+	ok = ok && getVarint(buf, pos, steps) && getSigned(buf, pos, reg) && getVarint(buf, pos, line) &&
+		getVarint(buf, pos, flags) && getVarint(buf, pos, inputUsed) && getVarint(buf, pos, memSize);
+	ok = ok && memSize == env.memory.size() && inputUsed <= env.input.size();
+	// A run that ran out of a limit before it ended isn't the same run. Using up the last step right
+	// before the end still ends(see runSteps), but the last output could have had more steps after it
+	ok = ok && (env.limits.maxSteps <= 0 || (long long)steps <= env.limits.maxSteps);
+	std::vector<int> memory;
+	if (ok) {
+		memory.resize(memSize);
+		for (uint64_t i = 0; ok && i < memSize; i++) {
+			ok = getSigned(buf, pos, memory[i]);
+		}
+	}
+	std::array<int, MAX_REGISTERS> regs{};
+	ok = ok && getVarint(buf, pos, regCount) && regCount == (uint64_t)env.program->config.registers;
+	for (uint64_t i = 0; ok && i < regCount; i++) {
+		ok = getSigned(buf, pos, regs[i]);
+	}
+	ok = ok && getVarint(buf, pos, outCount) && outCount <= buf.size();
+	ok = ok && (env.limits.maxOutput <= 0 || (long long)outCount < env.limits.maxOutput);
+	std::vector<int> output(ok ? outCount : 0);
+	for (uint64_t i = 0; ok && i < outCount; i++) {
+		ok = getSigned(buf, pos, output[i]);
+	}
+	if (!ok) {
+		std::lock_guard<std::mutex> guard(cache.lock);
+		cache.misses++;
+		return false;
+	}
+
+	env.memory = std::move(memory);
+	env.regs = regs;
+	env.reg = reg;
+	env.line = (int)line;
+	env.steps = (long long)steps;
+	env.states[IS_END] = (flags & 1) != 0;
+	env.states[NULL_REGISTER] = (flags & 2) != 0;
+	env.endProgram = (flags & 4) != 0;
+	for (uint64_t i = 0; i < inputUsed; i++) {
+		env.input.pop_front();
+	}
+	for (int v : output) {
+		env.output.push_back(v);
+	}
+	env.status = RunStatus::ENDED;
+
+	// Mark it as just used, for the eviction
+	std::error_code ec;
+	fs::last_write_time(resultPath(cache, key), fs::file_time_type::clock::now(), ec);
+	std::lock_guard<std::mutex> guard(cache.lock);
+	cache.hits++;
+	return true;
+}
+
+void storeResult(ResultCache &cache, const Digest &key, const Env &env, size_t inputUsed) {
+	std::vector<unsigned char> buf(resultMagic, resultMagic + sizeof(resultMagic));
+	buf.reserve(64 + env.memory.size() * 2 + env.output.size() * 2);
+	putVarint(buf, resultVersion);
+	buf.insert(buf.end(), key.begin(), key.end());
+	putVarint(buf, (uint64_t)env.steps);
+	putSigned(buf, env.reg);
+	putVarint(buf, (uint64_t)env.line);
+	putVarint(buf, (env.states[IS_END] ? 1 : 0) | (env.states[NULL_REGISTER] ? 2 : 0) | (env.endProgram ? 4 : 0));
+	putVarint(buf, inputUsed);
+	putVarint(buf, env.memory.size());
+	for (int v : env.memory) {
+		putSigned(buf, v);
+	}
+	putVarint(buf, env.program->config.registers);
+	for (int i = 0; i < env.program->config.registers; i++) {
+		putSigned(buf, env.regs[i]);
+	}
+	putVarint(buf, env.output.size());
+	for (int v : env.output) {
+		putSigned(buf, v);
+	}
+
+	// Write it somewhere else first so nobody ever reads half of a file
+	std::string path = resultPath(cache, key);
+	// mkstemp so two processes(or threads) storing the same result never write to the same file
+	std::string tmp = path + ".tmpXXXXXX";
+	int fd = mkstemp(&tmp[0]);
+	if (fd < 0) {
+		return;  // The cache is only an optimization, so not being able to write to it is fine
+	}
+	fchmod(fd, 0644);
+	FILE *f = fdopen(fd, "wb");
+	std::error_code ec;
+	if (f == nullptr) {
+		close(fd);
+		fs::remove(tmp, ec);
+		return;
+	}
+	bool written = fwrite(buf.data(), 1, buf.size(), f) == buf.size();
+	written = (fclose(f) == 0) && written;
+	if (!written) {
+		fs::remove(tmp, ec);
+		return;
+	}
+	fs::rename(tmp, path, ec);
+	if (ec) {
+		fs::remove(tmp, ec);
+		return;
+	}
+	std::lock_guard<std::mutex> guard(cache.lock);
+	cache.stores++;
+	cache.usedBytes += buf.size();
+	if (cache.usedBytes > cache.maxBytes) {
+		evictResults(cache);
+	}
+}
+
+bool runCached(ResultCache &cache, Env &env) {
+	if (!isCacheable(cache, env)) {
+		runEnvironment(env);
+		return false;
+	}
+	Digest key = runKey(cache, env);
+	if (lookupResult(cache, key, env)) {
+		return true;
+	}
+	size_t inputBefore = env.input.size();
+	runEnvironment(env);
+	if (env.status == RunStatus::ENDED) {
+		storeResult(cache, key, env, inputBefore - env.input.size());
+	}
+	return false;
+}
+
+#endif
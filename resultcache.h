@@ -0,0 +1,72 @@
+// -*- grammar-ext: .cpp -*-
+/*
+ *	This file is a part of ConfigurableAssemblyIntepreter.
+ *
+ *	ConfigurableAssemblyIntepreter is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ConfigurableAssemblyIntepreter is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "mainLib.h"
+#include "sha256.h"
+
+#ifndef RESULTCACHE_H
+#define RESULTCACHE_H
+
+// A cache of finished runs that's kept on disk, so running the exact same thing again
+// doesn't have to run anything. A run is completely decided by the program, the memory,
+// register and line it starts with(which is what the ENVDEF sets up) and its input, so
+// the key is a SHA-256 of all of those.
+//
+// Each result is its own file in the cache directory, named by the key, holding the final
+// memory, register, line, output and step count as varints. When the files add up to more
+// than maxBytes the ones that were used longest ago get deleted. Several processes can
+// share one directory, since files are only ever replaced with a rename.
+//
+// Only runs that ended are stored. A program is never cached if it has "cache=no" in its
+// ENVDEF, or uses anything in nondeterministicOps(see instructions.h).
+
+// What's remembered about a program, so it only gets hashed once
+struct ProgramDigest {
+	std::weak_ptr<const Program> program;
+	Digest digest;
+	bool deterministic;
+};
+
+struct ResultCache {
+	std::string dir;
+	uint64_t maxBytes{64ull << 20};
+	uint64_t usedBytes{0};
+	long long hits{0};
+	long long misses{0};
+	long long stores{0};
+	std::map<const Program*, ProgramDigest> programs;
+	std::mutex lock;  // Only for the fields above, the files don't need it
+};
+
+bool openResultCache(ResultCache &cache, const std::string &dir, uint64_t maxBytes);
+
+bool isCacheable(ResultCache &cache, const Env &env);
+Digest runKey(ResultCache &cache, const Env &env);
+bool lookupResult(ResultCache &cache, const Digest &key, Env &env);
+void storeResult(ResultCache &cache, const Digest &key, const Env &env, size_t inputUsed);
+
+// Runs env like runEnvironment does, unless the same run is already in the cache, in which
+// case env is just set to how it ended. Returns true if it was a hit
+bool runCached(ResultCache &cache, Env &env);
+
+#endif
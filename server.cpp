@@ -0,0 +1,541 @@
+/*
+ *	This file is a part of ConfigurableAssemblyIntepreter.
+ *
+ *	ConfigurableAssemblyIntepreter is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ConfigurableAssemblyIntepreter is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <charconv>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iterator>
+#include <thread>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "mainLib.h"
+#include "server.h"
+
+#ifndef SERVER_CPP
+#define SERVER_CPP
+
+static std::atomic<bool> serverStopping{ false };
+
+// Small buffered reader so the protocol can be read a line at a time
+struct FdReader {
+	int fd;
+	std::string buf{};
+	size_t pos{ 0 };
+	std::chrono::steady_clock::time_point deadline{ std::chrono::steady_clock::time_point::max() };
+	bool timedOut{ false };
+};
+
+// Reads more from the socket into the buffer, false on EOF or error. It waits in short polls so a
+// client that stops sending can't keep a worker past the deadline, or past the server stopping
+static bool fillReader(FdReader &r) {
+	if (r.pos > 0) {
+		r.buf.erase(0, r.pos);
+		r.pos = 0;
+	}
+	pollfd pfd{ r.fd, POLLIN, 0 };
+	while (true) {
+		if (serverStopping || std::chrono::steady_clock::now() >= r.deadline) {
+			r.timedOut = true;
+			return false;
+		}
+		int ready = poll(&pfd, 1, 200);
+		if (ready > 0) {
+			break;
+		}
+		if (ready < 0 && errno != EINTR) {
+			return false;
+		}
+	}
+	char tmp[65536];
+	ssize_t n;
+	do {
+		n = read(r.fd, tmp, sizeof(tmp));
+	} while (n < 0 && errno == EINTR);
+	if (n <= 0) {
+		return false;
+	}
+	r.buf.append(tmp, n);
+	return true;
+}
+
+// False on EOF or error, or if the line would be longer than maxLen
+static bool readLine(FdReader &r, std::string &line, size_t maxLen = CAI_MAX_REQUEST_LINE) {
+	size_t from = r.pos;
+	while (true) {
+		size_t end = r.buf.find('\n', from);
+		if (end != std::string::npos && end - r.pos <= maxLen) {
+			line.assign(r.buf, r.pos, end - r.pos);
+			r.pos = end + 1;
+			return true;
+		}
+		if (end != std::string::npos || r.buf.size() - r.pos > maxLen) {
+			return false;
+		}
+		from = r.buf.size() - r.pos;  // Where to look from once fillReader has moved it to the front
+		if (!fillReader(r)) {
+			return false;
+		}
+		from += r.pos;
+	}
+}
+
+static bool readBytes(FdReader &r, size_t count, std::string &out) {
+	while (r.buf.size() - r.pos < count) {
+		if (!fillReader(r)) {
+			return false;
+		}
+	}
+	out.assign(r.buf, r.pos, count);
+	r.pos += count;
+	return true;
+}
+
+static bool writeAll(int fd, const std::string &data) {
+	size_t done = 0;
+	while (done < data.size()) {
+		// MSG_NOSIGNAL so the other end going away is an error and not a SIGPIPE
+		ssize_t n = send(fd, data.data() + done, data.size() - done, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return false;
+		}
+		done += n;
+	}
+	return true;
+}
+
+// Appends "<n>\n<v1> <v2> ...\n" to out
+static void appendNumbers(std::string &out, const std::vector<int> &values) {
+	out += std::to_string(values.size());
+	out += '\n';
+	char tmp[16];
+	for (size_t i = 0; i < values.size(); i++) {
+		if (i > 0) {
+			out += ' ';
+		}
+		std::to_chars_result res = std::to_chars(tmp, tmp + sizeof(tmp), values[i]);
+		out.append(tmp, res.ptr);
+	}
+	out += '\n';
+}
+
+// Reads a line of count numbers, the other half of appendNumbers
+static bool readNumbers(FdReader &r, size_t count, std::vector<int> &values) {
+	std::string line;
+	if (!readLine(r, line, count * 12 + 16)) {  // 11 is the longest an int can be, plus a space
+		return false;
+	}
+	values.clear();
+	values.reserve(count);
+	const char *p = line.data();
+	const char *end = line.data() + line.size();
+	while (values.size() < count) {
+		while (p < end && *p == ' ') {
+			p++;
+		}
+		int v;
+		std::from_chars_result res = std::from_chars(p, end, v);
+		if (res.ec != std::errc()) {
+			return false;
+		}
+		values.push_back(v);
+		p = res.ptr;
+	}
+	return true;
+}
+
+// 64 bit FNV-1a, with the length mixed in at the end
+uint64_t hashSource(const std::string &source) {
+	uint64_t h = 14695981039346656037ULL;
+	for (unsigned char c : source) {
+		h ^= c;
+		h *= 1099511628211ULL;
+	}
+	h ^= source.size();
+	h *= 1099511628211ULL;
+	return h;
+}
+
+// Gets the compiled program for source, compiling it if it isn't cached.
+// The lock isn't held while compiling, so a slow compile doesn't hold up other requests
+ProgramRef getCachedProgram(ProgramCache &cache, const std::string &source) {
+	uint64_t key = hashSource(source);
+	{
+		std::lock_guard<std::mutex> guard(cache.lock);
+		auto it = cache.entries.find(key);
+		if (it != cache.entries.end() && it->second->source == source) {
+			cache.order.splice(cache.order.begin(), cache.order, it->second);
+			cache.hits++;
+			return it->second->prog;
+		}
+		cache.misses++;
+	}
+
+	ProgramRef prog = loadProgramBuffer(source);
+
+	std::lock_guard<std::mutex> guard(cache.lock);
+	auto it = cache.entries.find(key);
+	if (it != cache.entries.end()) {
+		if (it->second->source == source) {
+			// Someone else compiled it while we were, so use theirs
+			return it->second->prog;
+		}
+		// A different source with the same hash. Only one of them can be kept, so it's the newest
+		cache.order.erase(it->second);
+		cache.entries.erase(it);
+	}
+	cache.order.push_front(CachedProgram{ key, source, prog });
+	cache.entries[key] = cache.order.begin();
+	while (cache.order.size() > cache.capacity && !cache.order.empty()) {
+		cache.entries.erase(cache.order.back().key);
+		cache.order.pop_back();
+	}
+	return prog;
+}
+
+// limit, but no more than most. 0 is no limit for both of them
+static long long capLimit(long long limit, long long most) {
+	if (most <= 0) {
+		return limit;
+	}
+	return limit <= 0 ? most : std::min(limit, most);
+}
+
+// Does everything for one request except for the socket part
+RunResponse handleRequest(ProgramCache &cache, const RunRequest &request, ResultCache *results, const RunLimits &most) {
+	RunResponse response;
+	try {
+		std::string source;
+		if (!request.path.empty()) {
+			std::ifstream ifs(request.path, std::ifstream::in | std::ifstream::binary);
+			if (!ifs.is_open()) {
+				throw CaiError(CaiErrc::FILE_ERROR, "Couldn't open file '" + request.path + "'");
+			}
+			source.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+		} else {
+			source = request.source;
+		}
+
+		Env env = createInstance(getCachedProgram(cache, source));
+		if (request.hasInput) {
+			env.input.clear();
+			for (int v : request.input) {
+				env.input.push_back(v);
+			}
+		}
+		if (request.maxSteps  >= 0) { env.limits.maxSteps  = request.maxSteps; }
+		if (request.maxMillis >= 0) { env.limits.maxMillis = request.maxMillis; }
+		if (request.maxOutput >= 0) { env.limits.maxOutput = request.maxOutput; }
+		env.limits.maxSteps  = capLimit(env.limits.maxSteps, most.maxSteps);
+		env.limits.maxMillis = capLimit(env.limits.maxMillis, most.maxMillis);
+
+		try {
+			if (results != nullptr) {
+				runCached(*results, env);
+			} else {
+				runEnvironment(env);
+			}
+		} catch (const CaiError &e) {
+			response.error = e.code;
+			response.message = e.what();
+		}
+		// Send the state back even if it failed part way, it's what the caller will want to look at
+		response.status = env.status;
+		response.steps = env.steps;
+		response.reg = env.reg;
+		response.line = env.line;
+		response.endProgram = env.endProgram;
+		response.output.assign(env.output.begin(), env.output.end());
+		response.memory = env.memory.take();
+	} catch (const CaiError &e) {
+		response.error = e.code;
+		response.message = e.what();
+	}
+	return response;
+}
+
+static bool readRequest(FdReader &r, RunRequest &request) {
+	std::string line;
+	if (!readLine(r, line) || line.compare("CAI 1") != 0) {
+		return false;
+	}
+	while (readLine(r, line)) {
+		if (line.compare("RUN") == 0) {
+			return true;
+		} else if (line.compare(0, 5, "PATH ") == 0) {
+			request.path = line.substr(5);
+		} else if (line.compare(0, 7, "SOURCE ") == 0) {
+			size_t count = std::stoull(line.substr(7));
+			if (count > CAI_MAX_REQUEST_SOURCE) {
+				throw CaiError(CaiErrc::BAD_ARGUMENT, "A SOURCE of " + std::to_string(count) +
+					" bytes is more than the " + std::to_string(CAI_MAX_REQUEST_SOURCE) + " a request can send");
+			}
+			if (!readBytes(r, count, request.source)) {
+				return false;
+			}
+		} else if (line.compare(0, 6, "INPUT ") == 0) {
+			request.hasInput = true;
+			size_t count = std::stoull(line.substr(6));
+			if (count > CAI_MAX_REQUEST_INPUT) {
+				throw CaiError(CaiErrc::BAD_ARGUMENT, "An INPUT of " + std::to_string(count) +
+					" numbers is more than the " + std::to_string(CAI_MAX_REQUEST_INPUT) + " a request can send");
+			}
+			if (!readNumbers(r, count, request.input)) {
+				return false;
+			}
+		} else if (line.compare(0, 7, "LIMITS ") == 0) {
+			if (sscanf(line.c_str() + 7, "%lld %lld %lld", &request.maxSteps, &request.maxMillis, &request.maxOutput) != 3) {
+				return false;
+			}
+		} else {
+			return false;
+		}
+	}
+	return false;
+}
+
+static std::string formatResponse(const RunResponse &response) {
+	std::string out;
+	out.reserve(64 + response.memory.size() * 4 + response.output.size() * 4);
+	if (response.error != CaiErrc::OK) {
+		out += "ERROR " + std::to_string((int)response.error) + " " + response.message + "\n";
+	}
+	out += "STATUS " + std::to_string((int)response.status) + "\n";
+	out += "STEPS " + std::to_string(response.steps) + "\n";
+	out += "STATE " + std::to_string(response.reg) + " " + std::to_string(response.line) + " " +
+		(response.endProgram ? "1" : "0") + "\n";
+	out += "OUTPUT ";
+	appendNumbers(out, response.output);
+	out += "MEMORY ";
+	appendNumbers(out, response.memory);
+	out += "END\n";
+	return out;
+}
+
+static void serveConnection(ProgramCache &cache, ResultCache *results, const RunLimits &most, int fd) {
+	// A client gets CAI_REQUEST_TIMEOUT_MS to send the request, and that long again for each
+	// send of the response, so one that stops reading can't hold on to a worker either
+	timeval sendTimeout{ CAI_REQUEST_TIMEOUT_MS / 1000, (CAI_REQUEST_TIMEOUT_MS % 1000) * 1000 };
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &sendTimeout, sizeof(sendTimeout));
+	FdReader r{ fd };
+	r.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(CAI_REQUEST_TIMEOUT_MS);
+	RunRequest request;
+	RunResponse response;
+	bool ok = false;
+	response.message = "Malformed request";
+	try {
+		ok = readRequest(r, request);
+	} catch (const CaiError &e) {
+		response.message = e.what();  // Too big
+	} catch (const std::exception &e) {
+		ok = false;  // stoull on garbage
+	}
+	if (r.timedOut) {
+		ok = false;
+		response.message = serverStopping ? "The server is stopping" : "Timed out waiting for the request";
+	}
+	if (ok) {
+		response = handleRequest(cache, request, results, most);
+	} else {
+		response.error = CaiErrc::BAD_ARGUMENT;
+	}
+	writeAll(fd, formatResponse(response));
+	close(fd);
+}
+
+void stopServer() {
+	serverStopping = true;
+}
+
+// Listens on config.socketPath until stopServer is called(main calls it on SIGINT/SIGTERM).
+// Connections are handed to a pool of config.workers threads. Returns 0 or an errno
+int runServer(const ServerConfig &config) {
+	ResultCache resultCache;
+	ResultCache *results = nullptr;
+	if (!config.resultCacheDir.empty()) {
+		if (!openResultCache(resultCache, config.resultCacheDir, config.resultCacheBytes)) {
+			return ENOTDIR;
+		}
+		results = &resultCache;
+	}
+	
+	int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listenFd < 0) {
+		return errno;
+	}
+	sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (config.socketPath.size() >= sizeof(addr.sun_path)) {
+		close(listenFd);
+		return ENAMETOOLONG;
+	}
+	strcpy(addr.sun_path, config.socketPath.c_str());
+	unlink(config.socketPath.c_str());  // Left over from a server that didn't shut down cleanly
+	if (bind(listenFd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(listenFd, 128) < 0) {
+		int err = errno;
+		close(listenFd);
+		return err;
+	}
+
+	serverStopping = false;
+
+	ProgramCache cache;
+	cache.capacity = config.cacheSize > 0 ? config.cacheSize : 1;
+	RunLimits most;
+	most.maxSteps = config.maxSteps;
+	most.maxMillis = config.maxMillis;
+
+	std::mutex queueLock;
+	std::condition_variable queueReady;
+	std::deque<int> pending;
+	std::vector<std::thread> workers;
+	for (int i = 0; i < std::max(1, config.workers); i++) {
+		workers.emplace_back([&]() {
+			while (true) {
+				int fd;
+				{
+					std::unique_lock<std::mutex> guard(queueLock);
+					queueReady.wait(guard, [&]() { return !pending.empty() || serverStopping; });
+					if (pending.empty()) {
+						return;  // Stopping and nothing left to do
+					}
+					fd = pending.front();
+					pending.pop_front();
+				}
+				serveConnection(cache, results, most, fd);
+			}
+		});
+	}
+
+	// Poll with a timeout so the stop flag gets noticed
+	pollfd pfd{ listenFd, POLLIN, 0 };
+	while (!serverStopping) {
+		int n = poll(&pfd, 1, 200);
+		if (n <= 0) {
+			continue;
+		}
+		int fd = accept(listenFd, nullptr, nullptr);
+		if (fd < 0) {
+			continue;
+		}
+		{
+			std::lock_guard<std::mutex> guard(queueLock);
+			pending.push_back(fd);
+		}
+		queueReady.notify_one();
+	}
+
+	queueReady.notify_all();
+	for (std::thread &t : workers) {
+		t.join();
+	}
+	close(listenFd);
+	unlink(config.socketPath.c_str());
+	return 0;
+}
+
+// The client side. Sends one request to the server at socketPath and reads the response
+CaiErrc requestRun(const std::string &socketPath, const RunRequest &request, RunResponse &response) {
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		response.message = strerror(errno);
+		return response.error = CaiErrc::FILE_ERROR;
+	}
+	sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+	if (connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+		response.message = "Couldn't connect to '" + socketPath + "': " + strerror(errno);
+		close(fd);
+		return response.error = CaiErrc::FILE_ERROR;
+	}
+
+	std::string req = "CAI 1\n";
+	if (!request.path.empty()) {
+		req += "PATH " + request.path + "\n";
+	} else {
+		req += "SOURCE " + std::to_string(request.source.size()) + "\n" + request.source;
+	}
+	if (request.hasInput) {
+		req += "INPUT ";
+		appendNumbers(req, request.input);
+	}
+	req += "LIMITS " + std::to_string(request.maxSteps) + " " + std::to_string(request.maxMillis) + " " +
+		std::to_string(request.maxOutput) + "\n";
+	req += "RUN\n";
+	if (!writeAll(fd, req)) {
+		response.message = "Couldn't send the request";
+		close(fd);
+		return response.error = CaiErrc::FILE_ERROR;
+	}
+
+	FdReader r{ fd };
+	std::string line;
+	bool ok = false;
+	try {
+		while (readLine(r, line, SIZE_MAX)) {  // The server is trusted to send what it said it would
+			if (line.compare("END") == 0) {
+				ok = true;
+				break;
+			} else if (line.compare(0, 6, "ERROR ") == 0) {
+				size_t space = line.find(' ', 6);
+				response.error = (CaiErrc)std::stoi(line.substr(6, space - 6));
+				response.message = (space == std::string::npos) ? "" : line.substr(space + 1);
+			} else if (line.compare(0, 7, "STATUS ") == 0) {
+				response.status = (RunStatus)std::stoi(line.substr(7));
+			} else if (line.compare(0, 6, "STEPS ") == 0) {
+				response.steps = std::stoll(line.substr(6));
+			} else if (line.compare(0, 6, "STATE ") == 0) {
+				int endProgram = 0;
+				sscanf(line.c_str() + 6, "%i %i %i", &response.reg, &response.line, &endProgram);
+				response.endProgram = endProgram != 0;
+			} else if (line.compare(0, 7, "OUTPUT ") == 0) {
+				if (!readNumbers(r, std::stoull(line.substr(7)), response.output)) {
+					break;
+				}
+			} else if (line.compare(0, 7, "MEMORY ") == 0) {
+				if (!readNumbers(r, std::stoull(line.substr(7)), response.memory)) {
+					break;
+				}
+			}
+		}
+	} catch (const std::exception &e) {
+		ok = false;
+	}
+	close(fd);
+	if (!ok) {
+		response.message = "Bad response from the server";
+		return response.error = CaiErrc::INTERNAL;
+	}
+	return response.error;
+}
+
+#endif
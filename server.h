@@ -0,0 +1,123 @@
+// -*- grammar-ext: .cpp -*-
+/*
+ *	This file is a part of ConfigurableAssemblyIntepreter.
+ *
+ *	ConfigurableAssemblyIntepreter is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ConfigurableAssemblyIntepreter is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "caiError.h"
+#include "mainLib.h"
+#include "resultcache.h"
+
+#ifndef SERVER_H
+#define SERVER_H
+
+// Server mode. "./main --serve /tmp/cai.sock" listens on a unix socket and runs programs
+// for clients like caiclient, so the process startup and the parsing only get paid for once.
+//
+// The protocol is line based, with one request per connection. A request is
+//   CAI 1
+//   PATH <path>             (or "SOURCE <n>" followed by exactly n bytes of source, which don't need
+//                            to end in a newline since the next line starts right after them)
+//   INPUT <n>               (optional, followed by a line of n numbers separated by spaces. Replaces input=)
+//   LIMITS <steps> <ms> <output>   (optional, -1 keeps the one from the ENVDEF. The steps and ms can't
+//                            go over the server's, and 0 or -1 doesn't get rid of those either)
+//   RUN
+// where everything between the CAI 1 and the RUN can come in any order. The response is
+//   ERROR <code> <message>  (only if it failed. The rest still gets sent, as far as the run got)
+//   STATUS <RunStatus as a number>
+//   STEPS <n>
+//   STATE <reg> <line> <endProgram>
+//   OUTPUT <n>              followed by a line of n numbers
+//   MEMORY <n>              followed by a line of n numbers
+//   END
+// A request with anything bigger than the limits below gets an ERROR back without the rest of it
+// being read, so a client can't make the server hold on to as much as it wants. The same goes for
+// one that takes longer than CAI_REQUEST_TIMEOUT_MS to send it.
+
+#define CAI_DEFAULT_SOCKET "/tmp/cai.sock"
+#define CAI_MAX_REQUEST_SOURCE ((size_t)64 << 20)  // Bytes of SOURCE
+#define CAI_MAX_REQUEST_INPUT  ((size_t)16 << 20)  // Numbers of INPUT
+#define CAI_MAX_REQUEST_LINE   ((size_t)4096)      // Any other line of a request, like a PATH
+#define CAI_REQUEST_TIMEOUT_MS 10000              // How long a client has to send its request
+
+struct RunRequest {
+	std::string path;           // Either a path for the server to read...
+	std::string source;         // ...or the source itself(used if path is empty)
+	bool hasInput{ false };
+	std::vector<int> input;
+	long long maxSteps{ -1 };   // -1 means keep whatever the ENVDEF says
+	long long maxMillis{ -1 };
+	long long maxOutput{ -1 };
+};
+
+struct RunResponse {
+	CaiErrc error{ CaiErrc::OK };
+	std::string message;
+	RunStatus status{ RunStatus::RUNNING };
+	long long steps{ 0 };
+	int reg{ 0 };
+	int line{ 0 };
+	bool endProgram{ false };
+	std::vector<int> output;
+	std::vector<int> memory;
+};
+
+// A compiled program and the source it came from. The source is kept so a hit can be checked
+// against it, since two sources can have the same hash
+struct CachedProgram {
+	uint64_t key;
+	std::string source;
+	ProgramRef prog;
+};
+
+// LRU cache of compiled programs, keyed by a hash of their source
+struct ProgramCache {
+	size_t capacity{ 64 };
+	std::mutex lock;
+	std::list<CachedProgram> order;  // Most recently used at the front
+	std::unordered_map<uint64_t, std::list<CachedProgram>::iterator> entries;
+	uint64_t hits{ 0 };
+	uint64_t misses{ 0 };
+};
+
+struct ServerConfig {
+	std::string socketPath{ CAI_DEFAULT_SOCKET };
+	int workers{ 4 };
+	size_t cacheSize{ 64 };
+	std::string resultCacheDir;               // If set, runs go through a ResultCache kept here
+	uint64_t resultCacheBytes{ 64ull << 20 };
+	long long maxSteps{ 1000000000 };  // The most steps and milliseconds any request gets. 0 is no limit
+	long long maxMillis{ 10000 };
+};
+
+uint64_t hashSource(const std::string &source);
+ProgramRef getCachedProgram(ProgramCache &cache, const std::string &source);
+
+// most is the most steps and time the run can have, whatever the request and the ENVDEF say
+RunResponse handleRequest(ProgramCache &cache, const RunRequest &request, ResultCache *results = nullptr,
+	const RunLimits &most = RunLimits());
+int runServer(const ServerConfig &config);
+// Makes runServer finish up and return. It only sets a flag, so a signal handler can call it
+void stopServer();
+
+CaiErrc requestRun(const std::string &socketPath, const RunRequest &request, RunResponse &response);
+
+#endif
@@ -0,0 +1,127 @@
+/*
+ *	This file is a part of ConfigurableAssemblyIntepreter.
+ *
+ *	ConfigurableAssemblyIntepreter is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ConfigurableAssemblyIntepreter is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <utility>
+
+#include "mainLib.h"
+#include "session.h"
+
+#ifndef SESSION_CPP
+#define SESSION_CPP
+
+// co_await'ed when the session used up its slice. Puts it at the back of the ready queue
+struct YieldAwaiter {
+	Scheduler &sched;
+	bool await_ready() { return false; }
+	void await_suspend(SessionHandle h) { sched.ready.push_back(h); }
+	void await_resume() {}
+};
+
+// co_await'ed when the program blocked on input. The session isn't in the ready
+// queue at all while it's parked, feedSession puts it back
+struct InputAwaiter {
+	Session &session;
+	bool await_ready() { return !session.env.input.empty(); }
+	void await_suspend(SessionHandle h) { session.waiting = h; }
+	void await_resume() {}
+};
+
+// The body of every session. Runs the program a slice at a time until it's done
+static SessionTask sessionBody(Scheduler &sched, Session &session) {
+	while (true) {
+		RunStatus status = runSteps(session.env, sched.slice);
+		if (status == RunStatus::RUNNING) {
+			co_await YieldAwaiter{ sched };
+		} else if (status == RunStatus::BLOCKED_INPUT) {
+			co_await InputAwaiter{ session };
+		} else if (status == RunStatus::BLOCKED_OUTPUT) {
+			co_await YieldAwaiter{ sched };  // Let the others run while whoever's reading catches up
+		} else {
+			co_return;  // Ended, or one of the limits ran out
+		}
+	}
+}
+
+// Adds a program to the scheduler and returns the id to feed it with
+int addSession(Scheduler &sched, Env env) {
+	int id = sched.nextId++;
+	std::unique_ptr<Session> session = std::make_unique<Session>();
+	session->id = id;
+	session->env = std::move(env);
+	session->task = sessionBody(sched, *session);
+	sched.ready.push_back(session->task.handle);
+	sched.sessions[id] = std::move(session);
+	return id;
+}
+
+// Pushes an input value to a session, waking it up if it was waiting for one
+void feedSession(Scheduler &sched, int id, int value) {
+	Session *session = getSession(sched, id);
+	if (session == nullptr) {
+		return;
+	}
+	pushInput(session->env, value);
+	if (session->waiting) {
+		sched.ready.push_back(session->waiting);
+		session->waiting = nullptr;
+	}
+}
+
+// Runs sessions until none of them can do anything without more input, or one of them throws
+void runScheduler(Scheduler &sched) {
+	while (!sched.ready.empty()) {
+		SessionHandle h = sched.ready.front();
+		sched.ready.pop_front();
+		h.resume();
+		if (h.done() && h.promise().exception) {
+			// Only thrown the once, the session just stays done after this
+			std::rethrow_exception(std::exchange(h.promise().exception, nullptr));
+		}
+	}
+}
+
+Session* getSession(Scheduler &sched, int id) {
+	auto it = sched.sessions.find(id);
+	if (it == sched.sessions.end()) {
+		return nullptr;
+	}
+	return it->second.get();
+}
+
+// A session is done once its program ended, ran out of a budget or threw
+bool sessionDone(const Session &session) {
+	return session.task.handle && session.task.handle.done();
+}
+
+void removeSession(Scheduler &sched, int id) {
+	Session *session = getSession(sched, id);
+	if (session == nullptr) {
+		return;
+	}
+	// Make sure it isn't left in the ready queue
+	for (auto it = sched.ready.begin(); it != sched.ready.end(); ++it) {
+		if (*it == session->task.handle) {
+			sched.ready.erase(it);
+			break;
+		}
+	}
+	sched.sessions.erase(id);
+}
+
+#endif
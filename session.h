@@ -0,0 +1,88 @@
+// -*- grammar-ext: .cpp -*-
+/*
+ *	This file is a part of ConfigurableAssemblyIntepreter.
+ *
+ *	ConfigurableAssemblyIntepreter is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ConfigurableAssemblyIntepreter is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <map>
+#include <memory>
+
+#include "mainLib.h"
+
+#ifndef SESSION_H
+#define SESSION_H
+
+// Coroutine wrapper around runSteps so lots of interactive programs can share one thread.
+// Each program is a Session, and its coroutine suspends whenever the program blocks on
+// input(or used up its slice), so a waiting program costs nothing but its memory.
+//
+//   Scheduler sched;
+//   int id = addSession(sched, createEnvironmentFromFile("prog.asm"));
+//   runScheduler(sched);          // Runs everything until it's all blocked or done
+//   feedSession(sched, id, 5);    // Wakes the session up
+//   runScheduler(sched);
+//
+// If a program throws(a bad address, say), runScheduler rethrows it once that session is done.
+// The rest are left where they were, so calling runScheduler again carries on with them.
+
+struct Scheduler;
+struct Session;
+
+// The coroutine type. Starts suspended and stays suspended at the end so
+// the Session can still be looked at after the program is done
+struct SessionTask {
+	struct promise_type {
+		SessionTask get_return_object() {
+			return SessionTask{ std::coroutine_handle<promise_type>::from_promise(*this) };
+		}
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		std::suspend_always final_suspend() noexcept { return {}; }
+		void return_void() {}
+		void unhandled_exception() { exception = std::current_exception(); }
+		std::exception_ptr exception;
+	};
+	std::coroutine_handle<promise_type> handle;
+};
+using SessionHandle = std::coroutine_handle<SessionTask::promise_type>;
+
+struct Session {
+	int id;
+	Env env;
+	SessionTask task{ nullptr };
+	SessionHandle waiting{ nullptr };           // Set while the session is parked waiting for input
+	~Session() {
+		if (task.handle) {
+			task.handle.destroy();
+		}
+	}
+};
+
+struct Scheduler {
+	long long slice{ 10000 };                       // Steps a session gets before it has to give up the thread
+	int nextId{ 0 };
+	std::map<int, std::unique_ptr<Session>> sessions;
+	std::deque<SessionHandle> ready;                // Sessions that can run right now
+};
+
+int  addSession(Scheduler &sched, Env env);
+void feedSession(Scheduler &sched, int id, int value);
+void runScheduler(Scheduler &sched);
+Session* getSession(Scheduler &sched, int id);
+bool sessionDone(const Session &session);
+void removeSession(Scheduler &sched, int id);
+
+#endif
@@ -0,0 +1,137 @@
+/*
+ *	This file is a part of ConfigurableAssemblyIntepreter.
+ *
+ *	ConfigurableAssemblyIntepreter is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ConfigurableAssemblyIntepreter is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <cstring>
+
+#include "sha256.h"
+
+#ifndef SHA256_CPP
+#define SHA256_CPP
+
+static const uint32_t sha256K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline uint32_t rotr(uint32_t x, int n) {
+	return (x >> n) | (x << (32 - n));
+}
+
+// Mixes one 64 byte block into the state
+static void sha256Block(Sha256 &ctx, const uint8_t *block) {
+	uint32_t w[64];
+	for (int i = 0; i < 16; i++) {
+		w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16 |
+		       (uint32_t)block[i * 4 + 2] << 8 | (uint32_t)block[i * 4 + 3];
+	}
+	for (int i = 16; i < 64; i++) {
+		uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+		uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+	uint32_t a = ctx.h[0], b = ctx.h[1], c = ctx.h[2], d = ctx.h[3];
+	uint32_t e = ctx.h[4], f = ctx.h[5], g = ctx.h[6], h = ctx.h[7];
+	for (int i = 0; i < 64; i++) {
+		uint32_t s1 = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
+		uint32_t ch = (e & f) ^ (~e & g);
+		uint32_t t1 = h + s1 + ch + sha256K[i] + w[i];
+		uint32_t s0 = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
+		uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+		uint32_t t2 = s0 + maj;
+		h = g; g = f; f = e; e = d + t1;
+		d = c; c = b; b = a; a = t1 + t2;
+	}
+	ctx.h[0] += a; ctx.h[1] += b; ctx.h[2] += c; ctx.h[3] += d;
+	ctx.h[4] += e; ctx.h[5] += f; ctx.h[6] += g; ctx.h[7] += h;
+}
+
+void sha256Init(Sha256 &ctx) {
+	static const uint32_t initial[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	};
+	memcpy(ctx.h, initial, sizeof(initial));
+	ctx.bufLen = 0;
+	ctx.totalLen = 0;
+}
+
+void sha256Update(Sha256 &ctx, const void *data, size_t len) {
+	const uint8_t *p = (const uint8_t*)data;
+	ctx.totalLen += len;
+	if (ctx.bufLen > 0) {
+		size_t take = std::min(len, 64 - ctx.bufLen);
+		memcpy(ctx.buf + ctx.bufLen, p, take);
+		ctx.bufLen += take;
+		p += take;
+		len -= take;
+		if (ctx.bufLen < 64) {
+			return;
+		}
+		sha256Block(ctx, ctx.buf);
+		ctx.bufLen = 0;
+	}
+	// Whole blocks straight from the input
+	for (; len >= 64; p += 64, len -= 64) {
+		sha256Block(ctx, p);
+	}
+	memcpy(ctx.buf, p, len);
+	ctx.bufLen = len;
+}
+
+Digest sha256Final(Sha256 &ctx) {
+	uint64_t bits = ctx.totalLen * 8;
+	// A 1 bit, zeros up to 56 mod 64, then the length in bits as a big endian 64 bit number
+	uint8_t pad[72] = { 0x80 };
+	size_t padLen = (ctx.bufLen < 56) ? 56 - ctx.bufLen : 120 - ctx.bufLen;
+	for (int i = 0; i < 8; i++) {
+		pad[padLen + i] = (uint8_t)(bits >> (56 - i * 8));
+	}
+	sha256Update(ctx, pad, padLen + 8);
+	Digest out;
+	for (int i = 0; i < 8; i++) {
+		out[i * 4]     = (uint8_t)(ctx.h[i] >> 24);
+		out[i * 4 + 1] = (uint8_t)(ctx.h[i] >> 16);
+		out[i * 4 + 2] = (uint8_t)(ctx.h[i] >> 8);
+		out[i * 4 + 3] = (uint8_t)ctx.h[i];
+	}
+	return out;
+}
+
+Digest sha256(const std::string &data) {
+	Sha256 ctx;
+	sha256Init(ctx);
+	sha256Update(ctx, data.data(), data.size());
+	return sha256Final(ctx);
+}
+
+std::string digestHex(const Digest &digest) {
+	static const char hex[] = "0123456789abcdef";
+	std::string s;
+	s.reserve(64);
+	for (uint8_t b : digest) {
+		s += hex[b >> 4];
+		s += hex[b & 15];
+	}
+	return s;
+}
+
+#endif
@@ -0,0 +1,45 @@
+// -*- grammar-ext: .cpp -*-
+/*
+ *	This file is a part of ConfigurableAssemblyIntepreter.
+ *
+ *	ConfigurableAssemblyIntepreter is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ConfigurableAssemblyIntepreter is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#ifndef SHA256_H
+#define SHA256_H
+
+// Plain SHA-256(FIPS 180-4), so the result cache has a hash that's strong enough to trust
+// without comparing whole runs. Feed it with sha256Update as many times as needed.
+
+using Digest = std::array<uint8_t, 32>;
+
+struct Sha256 {
+	uint32_t h[8];
+	uint8_t buf[64];
+	size_t bufLen;
+	uint64_t totalLen;
+};
+
+void sha256Init(Sha256 &ctx);
+void sha256Update(Sha256 &ctx, const void *data, size_t len);
+Digest sha256Final(Sha256 &ctx);
+
+Digest sha256(const std::string &data);
+std::string digestHex(const Digest &digest);
+
+#endif
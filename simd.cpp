@@ -0,0 +1,244 @@
+/*
+ *	This file is a part of ConfigurableAssemblyIntepreter.
+ *
+ *	ConfigurableAssemblyIntepreter is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ConfigurableAssemblyIntepreter is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CAI_X86 1
+#endif
+
+#include "simd.h"
+
+#ifndef SIMD_CPP
+#define SIMD_CPP
+
+// Plain C++ versions. These are what everything else falls back to, and what the
+// vector versions use for the last few elements that don't fill a whole vector.
+// The math is done on unsigned ints so overflow wraps instead of being undefined
+
+static void fillScalar(int *dst, int n, int value) {
+	for (int i = 0; i < n; i++) {
+		dst[i] = value;
+	}
+}
+
+static void addScalarScalar(int *dst, int n, int value) {
+	for (int i = 0; i < n; i++) {
+		dst[i] = (int)((uint32_t)dst[i] + (uint32_t)value);
+	}
+}
+
+static int sumScalar(const int *src, int n) {
+	uint32_t total = 0;
+	for (int i = 0; i < n; i++) {
+		total += (uint32_t)src[i];
+	}
+	return (int)total;
+}
+
+static void addRangesScalar(const int *src, int *dst, int n) {
+	for (int i = 0; i < n; i++) {
+		dst[i] = (int)((uint32_t)dst[i] + (uint32_t)src[i]);
+	}
+}
+
+static int findScalar(const int *src, int n, int value) {
+	for (int i = 0; i < n; i++) {
+		if (src[i] == value) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static const BulkKernels scalarKernels {
+	"scalar", fillScalar, addScalarScalar, sumScalar, addRangesScalar, findScalar
+};
+
+#ifdef CAI_X86
+
+// SSE2 versions, 4 ints at a time. Every x86-64 CPU has SSE2
+
+__attribute__((target("sse2")))
+static void fillSSE2(int *dst, int n, int value) {
+	__m128i v = _mm_set1_epi32(value);
+	int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		_mm_storeu_si128((__m128i*)(dst + i), v);
+	}
+	fillScalar(dst + i, n - i, value);
+}
+
+__attribute__((target("sse2")))
+static void addScalarSSE2(int *dst, int n, int value) {
+	__m128i v = _mm_set1_epi32(value);
+	int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128i x = _mm_loadu_si128((const __m128i*)(dst + i));
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_add_epi32(x, v));
+	}
+	addScalarScalar(dst + i, n - i, value);
+}
+
+__attribute__((target("sse2")))
+static int sumSSE2(const int *src, int n) {
+	__m128i acc = _mm_setzero_si128();
+	int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		acc = _mm_add_epi32(acc, _mm_loadu_si128((const __m128i*)(src + i)));
+	}
+	alignas(16) uint32_t lanes[4];
+	_mm_store_si128((__m128i*)lanes, acc);
+	uint32_t total = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	return (int)(total + (uint32_t)sumScalar(src + i, n - i));
+}
+
+__attribute__((target("sse2")))
+static void addRangesSSE2(const int *src, int *dst, int n) {
+	int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128i a = _mm_loadu_si128((const __m128i*)(src + i));
+		__m128i b = _mm_loadu_si128((const __m128i*)(dst + i));
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_add_epi32(a, b));
+	}
+	addRangesScalar(src + i, dst + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static int findSSE2(const int *src, int n, int value) {
+	__m128i v = _mm_set1_epi32(value);
+	int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128i eq = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(src + i)), v);
+		int mask = _mm_movemask_ps(_mm_castsi128_ps(eq));
+		if (mask != 0) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+	int rest = findScalar(src + i, n - i, value);
+	return (rest < 0) ? -1 : i + rest;
+}
+
+static const BulkKernels sse2Kernels {
+	"sse2", fillSSE2, addScalarSSE2, sumSSE2, addRangesSSE2, findSSE2
+};
+
+// AVX2 versions, 8 ints at a time
+
+__attribute__((target("avx2")))
+static void fillAVX2(int *dst, int n, int value) {
+	__m256i v = _mm256_set1_epi32(value);
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		_mm256_storeu_si256((__m256i*)(dst + i), v);
+	}
+	fillScalar(dst + i, n - i, value);
+}
+
+__attribute__((target("avx2")))
+static void addScalarAVX2(int *dst, int n, int value) {
+	__m256i v = _mm256_set1_epi32(value);
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256i x = _mm256_loadu_si256((const __m256i*)(dst + i));
+		_mm256_storeu_si256((__m256i*)(dst + i), _mm256_add_epi32(x, v));
+	}
+	addScalarScalar(dst + i, n - i, value);
+}
+
+__attribute__((target("avx2")))
+static int sumAVX2(const int *src, int n) {
+	// Two accumulators so the adds don't all wait on each other
+	__m256i acc0 = _mm256_setzero_si256();
+	__m256i acc1 = _mm256_setzero_si256();
+	int i = 0;
+	for (; i + 16 <= n; i += 16) {
+		acc0 = _mm256_add_epi32(acc0, _mm256_loadu_si256((const __m256i*)(src + i)));
+		acc1 = _mm256_add_epi32(acc1, _mm256_loadu_si256((const __m256i*)(src + i + 8)));
+	}
+	acc0 = _mm256_add_epi32(acc0, acc1);
+	__m128i half = _mm_add_epi32(_mm256_castsi256_si128(acc0), _mm256_extracti128_si256(acc0, 1));
+	alignas(16) uint32_t lanes[4];
+	_mm_store_si128((__m128i*)lanes, half);
+	uint32_t total = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	return (int)(total + (uint32_t)sumScalar(src + i, n - i));
+}
+
+__attribute__((target("avx2")))
+static void addRangesAVX2(const int *src, int *dst, int n) {
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256i a = _mm256_loadu_si256((const __m256i*)(src + i));
+		__m256i b = _mm256_loadu_si256((const __m256i*)(dst + i));
+		_mm256_storeu_si256((__m256i*)(dst + i), _mm256_add_epi32(a, b));
+	}
+	addRangesScalar(src + i, dst + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static int findAVX2(const int *src, int n, int value) {
+	__m256i v = _mm256_set1_epi32(value);
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256i eq = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i*)(src + i)), v);
+		int mask = _mm256_movemask_ps(_mm256_castsi256_ps(eq));
+		if (mask != 0) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+	int rest = findScalar(src + i, n - i, value);
+	return (rest < 0) ? -1 : i + rest;
+}
+
+static const BulkKernels avx2Kernels {
+	"avx2", fillAVX2, addScalarAVX2, sumAVX2, addRangesAVX2, findAVX2
+};
+
+#endif
+
+static const BulkKernels& pickKernels() {
+	const char *forced = getenv("CAI_SIMD");
+#ifdef CAI_X86
+	__builtin_cpu_init();
+	bool hasAVX2 = __builtin_cpu_supports("avx2");
+	bool hasSSE2 = __builtin_cpu_supports("sse2");
+	if (forced != nullptr) {
+		if (strcmp(forced, "scalar") == 0) {
+			return scalarKernels;
+		} else if (strcmp(forced, "sse2") == 0 && hasSSE2) {
+			return sse2Kernels;
+		}
+	}
+	if (hasAVX2) {
+		return avx2Kernels;
+	}
+	if (hasSSE2) {
+		return sse2Kernels;
+	}
+#endif
+	return scalarKernels;
+}
+
+const BulkKernels& bulkKernels() {
+	// Picked once, the first time a block instruction runs
+	static const BulkKernels &kernels = pickKernels();
+	return kernels;
+}
+
+#endif
@@ -0,0 +1,45 @@
+// -*- grammar-ext: .cpp -*-
+/*
+ *	This file is a part of ConfigurableAssemblyIntepreter.
+ *
+ *	ConfigurableAssemblyIntepreter is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ConfigurableAssemblyIntepreter is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef SIMD_H
+#define SIMD_H
+
+// The kernels behind the block instructions(fill, bcp, badd, bsum, vadd, bfind).
+// On x86 there's an AVX2 set(8 ints at a time), an SSE2 set(4 at a time) and the plain C++
+// set, and bulkKernels() asks the CPU which it can do the first time it's called and uses the
+// best one from then on. The vector sets are built with target attributes, so the rest of the
+// program doesn't need -mavx2 and still runs on a CPU without it. Anywhere else it's just the
+// plain C++ set, which the vector ones also use for the last few ints that don't fill a vector.
+// CAI_SIMD=sse2 or CAI_SIMD=scalar in the environment forces a slower set(sse2 only if the CPU
+// has it), which is handy for benchmarking. Anything else gets the best one.
+//
+// All the arithmetic wraps around like 32 bit ints do on every machine this runs on,
+// so every set gives exactly the same answers.
+struct BulkKernels {
+	const char *name;
+	void (*fill)(int *dst, int n, int value);
+	void (*addScalar)(int *dst, int n, int value);
+	int  (*sum)(const int *src, int n);
+	// dst[i] += src[i]. The ranges can only overlap if dst <= src, see addRanges in simd.cpp
+	void (*addRanges)(const int *src, int *dst, int n);
+	int  (*find)(const int *src, int n, int value);  // Index of the first match, or -1
+};
+
+const BulkKernels& bulkKernels();
+
+#endif
@@ -0,0 +1,390 @@
+/*
+ *	This file is a part of ConfigurableAssemblyIntepreter.
+ *
+ *	ConfigurableAssemblyIntepreter is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ConfigurableAssemblyIntepreter is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+
+#include "instructions.h"
+#include "statedump.h"
+
+#ifndef STATEDUMP_CPP
+#define STATEDUMP_CPP
+
+// Enough room for any number and what goes around it
+static const size_t MAX_ITEM = 48;
+
+// A run of cells that gets written out one by one. Anything between two of them is zeros
+struct DumpSpan {
+	long long first;
+	long long count;
+};
+
+bool openStateDump(StateDump &dump, const std::string &path, DumpFormat format, size_t bufferBytes) {
+	if (path == "-") {
+		dump.file = stdout;
+		dump.ownsFile = false;
+	} else {
+		dump.file = fopen(path.c_str(), "wb");
+		dump.ownsFile = true;
+		if (dump.file == nullptr) {
+			return false;
+		}
+	}
+	dump.format = format;
+	dump.buffer.assign(std::max(bufferBytes, MAX_ITEM * 4), 0);
+	dump.used = 0;
+	dump.dumps = 0;
+	dump.failed = false;
+	return true;
+}
+
+static void flushDump(StateDump &dump) {
+	if (dump.used > 0 && fwrite(dump.buffer.data(), 1, dump.used, dump.file) != dump.used) {
+		dump.failed = true;
+	}
+	dump.used = 0;
+}
+
+// Makes sure there's room for n more bytes
+static char* dumpRoom(StateDump &dump, size_t n) {
+	if (dump.buffer.size() - dump.used < n) {
+		flushDump(dump);
+	}
+	return dump.buffer.data() + dump.used;
+}
+
+static void putText(StateDump &dump, const char *text) {
+	size_t n = strlen(text);
+	memcpy(dumpRoom(dump, n), text, n);
+	dump.used += n;
+}
+
+static void putNum(StateDump &dump, long long value) {
+	char *p = dumpRoom(dump, MAX_ITEM);
+	dump.used += (size_t)(std::to_chars(p, p + MAX_ITEM, value).ptr - p);
+}
+
+static void putInt32(StateDump &dump, uint32_t v) {
+	char *p = dumpRoom(dump, 4);
+	p[0] = (char)(v & 0xff);
+	p[1] = (char)((v >> 8) & 0xff);
+	p[2] = (char)((v >> 16) & 0xff);
+	p[3] = (char)(v >> 24);
+	dump.used += 4;
+}
+
+// Splits [first, last) into the cells that get written, leaving out runs of at least zeroRun zeros
+static std::vector<DumpSpan> findSpans(const int *cells, long long first, long long last, long long zeroRun) {
+	std::vector<DumpSpan> spans;
+	if (zeroRun <= 0) {
+		if (last > first) {
+			spans.push_back(DumpSpan{ first, last - first });
+		}
+		return spans;
+	}
+	long long start = first;  // Where the current span started
+	long long i = first;
+	while (i < last) {
+		if (cells[i] != 0) {
+			i++;
+			continue;
+		}
+		long long end = i;
+		while (end < last && cells[end] == 0) {
+			end++;
+		}
+		if (end - i >= zeroRun) {
+			if (i > start) {
+				spans.push_back(DumpSpan{ start, i - start });
+			}
+			start = end;
+		}
+		i = end;
+	}
+	if (last > start) {
+		spans.push_back(DumpSpan{ start, last - start });
+	}
+	return spans;
+}
+
+// How many registers the program asked for, which is how many get written
+static int dumpRegisters(const Env &env) {
+	return env.program != nullptr ? env.program->config.registers : 0;
+}
+
+// "[1, 2, 3]" or "[1,2,3]"
+static void putRegisters(StateDump &dump, const Env &env, const char *sep) {
+	putText(dump, "[");
+	for (int i = 0; i < dumpRegisters(env); i++) {
+		if (i > 0) {
+			putText(dump, sep);
+		}
+		putNum(dump, env.regs[i]);
+	}
+	putText(dump, "]");
+}
+
+static void writeText(StateDump &dump, const Env &env, const std::vector<DumpSpan> &spans, long long first, long long last) {
+	const int *cells = env.memory.data();
+	putText(dump, "memorySize is ");
+	putNum(dump, (long long)env.memory.size());
+	putText(dump, "\nISEND: ");
+	putText(dump, env.endProgram ? "true" : "false");
+	putText(dump, " ACC: ");
+	putNum(dump, env.reg);
+	putText(dump, "  LINE: ");
+	putNum(dump, env.line);
+	if (dumpRegisters(env) > 0) {
+		putText(dump, " REGS: ");
+		putRegisters(dump, env, ", ");
+	}
+	if (first == 0 && last == (long long)env.memory.size()) {
+		putText(dump, " - MEM: [");
+	} else {
+		putText(dump, " - MEM[");
+		putNum(dump, first);
+		putText(dump, ":");
+		putNum(dump, last);
+		putText(dump, "]: [");
+	}
+	long long at = first;
+	bool any = false;
+	auto zeros = [&](long long n) {
+		putText(dump, any ? ", (" : "(");
+		putNum(dump, n);
+		putText(dump, " zeros)");
+		any = true;
+	};
+	for (const DumpSpan &span : spans) {
+		if (span.first > at) {
+			zeros(span.first - at);
+		}
+		for (long long i = span.first; i < span.first + span.count; i++) {
+			char *p = dumpRoom(dump, MAX_ITEM);
+			char *q = p;
+			if (any) {
+				*q++ = ',';
+				*q++ = ' ';
+			}
+			q = std::to_chars(q, p + MAX_ITEM, cells[i]).ptr;
+			dump.used += (size_t)(q - p);
+			any = true;
+		}
+		at = span.first + span.count;
+	}
+	if (last > at) {
+		zeros(last - at);
+	}
+	putText(dump, "]\n");
+}
+
+static void writeJson(StateDump &dump, const Env &env, const std::vector<DumpSpan> &spans, long long first, long long last) {
+	const int *cells = env.memory.data();
+	putText(dump, "{\"steps\":");
+	putNum(dump, env.steps);
+	putText(dump, ",\"line\":");
+	putNum(dump, env.line);
+	putText(dump, ",\"acc\":");
+	putNum(dump, env.reg);
+	if (dumpRegisters(env) > 0) {
+		putText(dump, ",\"regs\":");
+		putRegisters(dump, env, ",");
+	}
+	putText(dump, ",\"ended\":");
+	putText(dump, (env.endProgram || (!env.states.empty() && env.states[IS_END])) ? "true" : "false");
+	putText(dump, ",\"status\":\"");
+	putText(dump, runStatusName(env.status));
+	putText(dump, "\",\"memSize\":");
+	putNum(dump, (long long)env.memory.size());
+	putText(dump, ",\"first\":");
+	putNum(dump, first);
+	putText(dump, ",\"last\":");
+	putNum(dump, last);
+	putText(dump, ",\"memory\":[");
+	long long at = first;
+	bool any = false;
+	auto zeros = [&](long long n) {
+		putText(dump, any ? ",{\"zeros\":" : "{\"zeros\":");
+		putNum(dump, n);
+		putText(dump, "}");
+		any = true;
+	};
+	for (const DumpSpan &span : spans) {
+		if (span.first > at) {
+			zeros(span.first - at);
+		}
+		for (long long i = span.first; i < span.first + span.count; i++) {
+			char *p = dumpRoom(dump, MAX_ITEM);
+			char *q = p;
+			if (any) {
+				*q++ = ',';
+			}
+			q = std::to_chars(q, p + MAX_ITEM, cells[i]).ptr;
+			dump.used += (size_t)(q - p);
+			any = true;
+		}
+		at = span.first + span.count;
+	}
+	if (last > at) {
+		zeros(last - at);
+	}
+	putText(dump, "]}\n");
+}
+
+static void writeCsv(StateDump &dump, const Env &env, const std::vector<DumpSpan> &spans, long long first, long long last) {
+	const int *cells = env.memory.data();
+	if (dump.dumps == 0) {
+		putText(dump, "steps,addr,value,count\n");
+	}
+	char steps[24];
+	char *stepsEnd = std::to_chars(steps, steps + sizeof(steps), env.steps).ptr;
+	*stepsEnd++ = ',';
+	const size_t stepsLen = (size_t)(stepsEnd - steps);
+	auto row = [&](long long addr, int value, long long count) {
+		char *p = dumpRoom(dump, MAX_ITEM * 2);
+		char *q = p;
+		memcpy(q, steps, stepsLen);
+		q += stepsLen;
+		q = std::to_chars(q, p + MAX_ITEM * 2, addr).ptr;
+		*q++ = ',';
+		q = std::to_chars(q, p + MAX_ITEM * 2, value).ptr;
+		*q++ = ',';
+		q = std::to_chars(q, p + MAX_ITEM * 2, count).ptr;
+		*q++ = '\n';
+		dump.used += (size_t)(q - p);
+	};
+	long long at = first;
+	for (const DumpSpan &span : spans) {
+		if (span.first > at) {
+			row(at, 0, span.first - at);
+		}
+		for (long long i = span.first; i < span.first + span.count; i++) {
+			row(i, cells[i], 1);
+		}
+		at = span.first + span.count;
+	}
+	if (last > at) {
+		row(at, 0, last - at);
+	}
+}
+
+static void writeBinary(StateDump &dump, const Env &env, const std::vector<DumpSpan> &spans, long long first, long long last) {
+	const int *cells = env.memory.data();
+	memcpy(dumpRoom(dump, 4), "CAIS", 4);
+	dump.used += 4;
+	putInt32(dump, 2);
+	putInt32(dump, (uint32_t)env.reg);
+	putInt32(dump, (uint32_t)env.line);
+	putInt32(dump, (uint32_t)((uint64_t)env.steps & 0xffffffff));
+	putInt32(dump, (uint32_t)((uint64_t)env.steps >> 32));
+	putInt32(dump, (env.endProgram || (!env.states.empty() && env.states[IS_END])) ? 1 : 0);
+	putInt32(dump, (uint32_t)env.status);
+	putInt32(dump, (uint32_t)dumpRegisters(env));
+	for (int i = 0; i < dumpRegisters(env); i++) {
+		putInt32(dump, (uint32_t)env.regs[i]);
+	}
+	putInt32(dump, (uint32_t)env.memory.size());
+	putInt32(dump, (uint32_t)first);
+	putInt32(dump, (uint32_t)last);
+	putInt32(dump, (uint32_t)spans.size());
+	for (const DumpSpan &span : spans) {
+		putInt32(dump, (uint32_t)span.first);
+		putInt32(dump, (uint32_t)span.count);
+		for (long long i = span.first; i < span.first + span.count; i++) {
+			putInt32(dump, (uint32_t)cells[i]);
+		}
+	}
+}
+
+bool writeStateDump(StateDump &dump, const Env &env) {
+	const long long size = (long long)env.memory.size();
+	long long first = std::min(std::max(dump.first, 0LL), size);
+	long long last = (dump.last < 0 || dump.last > size) ? size : dump.last;
+	last = std::max(last, first);
+	std::vector<DumpSpan> spans = findSpans(env.memory.data(), first, last, dump.zeroRun);
+	switch (dump.format) {
+		case DumpFormat::TEXT:   writeText(dump, env, spans, first, last);   break;
+		case DumpFormat::JSON:   writeJson(dump, env, spans, first, last);   break;
+		case DumpFormat::CSV:    writeCsv(dump, env, spans, first, last);    break;
+		case DumpFormat::BINARY: writeBinary(dump, env, spans, first, last); break;
+	}
+	// Written out at the end of every one, so it lines up with anything else printed
+	flushDump(dump);
+	dump.dumps++;
+	return !dump.failed;
+}
+
+bool closeStateDump(StateDump &dump) {
+	if (dump.file == nullptr) {
+		return !dump.failed;
+	}
+	flushDump(dump);
+	if (dump.ownsFile) {
+		dump.failed = (fclose(dump.file) != 0) || dump.failed;
+	} else {
+		fflush(dump.file);
+	}
+	dump.file = nullptr;
+	return !dump.failed;
+}
+
+bool parseDumpRange(const std::string &text, long long &first, long long &last) {
+	size_t colon = text.find(':');
+	if (colon == std::string::npos) {
+		return false;
+	}
+	auto number = [](const std::string &s, long long &out, long long empty) {
+		if (s.empty()) {
+			out = empty;
+			return true;
+		}
+		const char *end = s.data() + s.size();
+		std::from_chars_result r = std::from_chars(s.data(), end, out);
+		return r.ec == std::errc() && r.ptr == end && out >= 0;
+	};
+	if (!number(text.substr(0, colon), first, 0) || !number(text.substr(colon + 1), last, -1)) {
+		return false;
+	}
+	return last < 0 || last >= first;
+}
+
+const char* dumpFormatName(DumpFormat format) {
+	switch (format) {
+		case DumpFormat::TEXT:   return "text";
+		case DumpFormat::JSON:   return "json";
+		case DumpFormat::CSV:    return "csv";
+		case DumpFormat::BINARY: return "binary";
+	}
+	return "unknown";
+}
+
+bool parseDumpFormat(const std::string &name, DumpFormat &format) {
+	if (name == "text") {
+		format = DumpFormat::TEXT;
+	} else if (name == "json") {
+		format = DumpFormat::JSON;
+	} else if (name == "csv") {
+		format = DumpFormat::CSV;
+	} else if (name == "binary" || name == "bin") {
+		format = DumpFormat::BINARY;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+#endif
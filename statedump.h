@@ -0,0 +1,77 @@
+// -*- grammar-ext: .cpp -*-
+/*
+ *	This file is a part of ConfigurableAssemblyIntepreter.
+ *
+ *	ConfigurableAssemblyIntepreter is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ConfigurableAssemblyIntepreter is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "mainLib.h"
+
+#ifndef STATEDUMP_H
+#define STATEDUMP_H
+
+// Writing out an Env's state(the acc, line, steps and memory) in one of a few formats, for the
+// end of a run or every so many steps of one. Everything gets formatted with std::to_chars into
+// one big buffer that gets written whenever it fills up, so a memory of millions of cells takes
+// a few milliseconds instead of millions of printfs.
+//
+// Only the cells in [first, last) get written, and runs of at least zeroRun zeros(if it isn't 0)
+// get written as just how long they are, so a big memory that's mostly empty stays small. The
+// registers(if the program has any, see registers= in the ENVDEF) are written with the acc:
+//   TEXT    printState's format. A run of zeros is "(N zeros)"
+//   JSON    One object per line: {"steps":..,"line":..,"acc":..,"regs":[..],"ended":..,"status":"..",
+//           "memSize":..,"first":..,"last":..,"memory":[1,2,{"zeros":1000},3]}
+//   CSV     "steps,addr,value,count" rows, one for every cell or run of zeros(count is how many
+//           cells the row is). Just the memory, the header is only written once
+//   BINARY  Little endian. A header of "CAIS", then int32 version(2), acc, line, int64 steps,
+//           int32 ended, status, the number of registers and each one, memSize, first, last and
+//           the number of spans, then each span as int32 addr, count and its count cells. The
+//           cells between spans are all 0
+
+enum class DumpFormat {
+	TEXT,
+	JSON,
+	CSV,
+	BINARY
+};
+
+struct StateDump {
+	FILE *file{nullptr};
+	bool ownsFile{false};
+	DumpFormat format{DumpFormat::TEXT};
+	long long first{0};
+	long long last{-1};      // -1 for the end of memory
+	long long zeroRun{0};    // 0 to write every zero
+	long long dumps{0};      // How many have been written
+	std::vector<char> buffer;
+	size_t used{0};
+	bool failed{false};      // A write didn't work
+};
+
+// Opens path for writing("-" for stdout). False if it can't be
+bool openStateDump(StateDump &dump, const std::string &path, DumpFormat format, size_t bufferBytes = 1 << 20);
+// Writes env's state. False if the writing failed
+bool writeStateDump(StateDump &dump, const Env &env);
+// Closes the file unless it's stdout. False if anything failed to get written
+bool closeStateDump(StateDump &dump);
+
+// "a:b", "a:" or ":b" for the cells [a, b). False if it isn't one of those
+bool parseDumpRange(const std::string &text, long long &first, long long &last);
+const char* dumpFormatName(DumpFormat format);
+bool parseDumpFormat(const std::string &name, DumpFormat &format);
+
+#endif
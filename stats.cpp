@@ -0,0 +1,86 @@
+/*
+ *	This file is a part of ConfigurableAssemblyIntepreter.
+ *
+ *	ConfigurableAssemblyIntepreter is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ConfigurableAssemblyIntepreter is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <string>
+
+#include "stats.h"
+
+#ifndef STATS_CPP
+#define STATS_CPP
+
+const char* opName(Op op) {
+	static const char *names[NUM_OPS] = {
+		"nop", "none", "mov", "cpf", "cpt", "add", "sub", "inc", "dec", "jmp", "jiz", "jlz",
+		"inp", "out", "end", "label", "fill", "bcp", "badd", "bsum", "vadd", "bfind", "loopjmp",
+		"fadd", "cas", "ldacq", "strel", "fence", "barrier"
+	};
+	int i = (int)op;
+	return (i >= 0 && i < NUM_OPS) ? names[i] : "unknown";
+}
+
+static void appendField(std::string &json, const char *name, long long value, bool comma = true) {
+	json += "    \"";
+	json += name;
+	json += "\": ";
+	json += std::to_string(value);
+	json += comma ? ",\n" : "\n";
+}
+
+std::string statsJson(const RunStats *run, const LoadTimes *load) {
+	std::string json = "{\n";
+	if (run != nullptr) {
+		json += "  \"run\": {\n";
+		json += "    \"dispatches\": {";
+		bool first = true;
+		long long total = 0;
+		// Only the ones that ran, since most programs only use a few of them
+		for (int i = 0; i < NUM_OPS; i++) {
+			if (run->dispatches[i] == 0) {
+				continue;
+			}
+			json += first ? "\"" : ", \"";
+			json += opName((Op)i);
+			json += "\": " + std::to_string(run->dispatches[i]);
+			total += run->dispatches[i];
+			first = false;
+		}
+		json += "},\n";
+		appendField(json, "totalDispatches", total);
+		appendField(json, "memReads", run->memReads);
+		appendField(json, "memWrites", run->memWrites);
+		appendField(json, "derefHops", run->derefHops);
+		appendField(json, "branchesTaken", run->branchesTaken);
+		appendField(json, "branchesNotTaken", run->branchesNotTaken);
+		appendField(json, "inputs", run->inputs);
+		appendField(json, "outputs", run->outputs);
+		appendField(json, "skippedSteps", run->skippedSteps, false);
+		json += load != nullptr ? "  },\n" : "  }\n";
+	}
+	if (load != nullptr) {
+		json += "  \"load\": {\n";
+		appendField(json, "lexNanos", load->lexNanos);
+		appendField(json, "headerNanos", load->headerNanos);
+		appendField(json, "labelNanos", load->labelNanos);
+		appendField(json, "parseNanos", load->parseNanos);
+		appendField(json, "linkNanos", load->linkNanos);
+		appendField(json, "loopNanos", load->loopNanos, false);
+		json += "  }\n";
+	}
+	json += "}\n";
+	return json;
+}
+
+#endif
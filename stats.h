@@ -0,0 +1,61 @@
+// -*- grammar-ext: .cpp -*-
+/*
+ *	This file is a part of ConfigurableAssemblyIntepreter.
+ *
+ *	ConfigurableAssemblyIntepreter is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ConfigurableAssemblyIntepreter is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <array>
+#include <string>
+
+#include "instructionsEnum.h"
+
+#ifndef STATS_H
+#define STATS_H
+
+// Counters for what a run did. Set Env::stats to one of these and runSteps counts into it
+// (it's the interpreter that counts, so a run with stats never uses the closure engine). Which
+// counting runSteps does is picked at compile time by a policy(see the top of mainLib.cpp), so
+// a run without stats goes through a copy of the loop with nothing counted in it at all.
+//
+// A sped up loop(see loopopt.h) does lots of steps without running their lines, so those only
+// show up in skippedSteps and not in the other counters.
+struct RunStats {
+	std::array<long long, NUM_OPS> dispatches{};  // How many times a line with each Op ran
+	long long memReads{0};          // Cells read, not counting "*" hops. A block instruction counts every cell
+	long long memWrites{0};         // Cells written. inc and fadd count as a read and a write
+	long long derefHops{0};         // Cells read as pointers while following "*"s
+	long long branchesTaken{0};     // jiz/jlz that jumped
+	long long branchesNotTaken{0};  // jiz/jlz that didn't
+	long long inputs{0};            // Values inp read
+	long long outputs{0};           // Values out wrote
+	long long skippedSteps{0};
+};
+
+// How long each part of loading a program took, in nanoseconds. Every Program has these
+struct LoadTimes {
+	long long lexNanos{0};     // Finding the lines and tokens
+	long long headerNanos{0};  // The ENVDEF
+	long long labelNanos{0};   // The labelmap
+	long long parseNanos{0};   // Turning lines into Lines
+	long long linkNanos{0};    // Loading and linking modules, see linker.h
+	long long loopNanos{0};    // findCountedLoops
+};
+
+// The name an Op is written with("loopjmp" for LOOP_JUMP, which is never written)
+const char* opName(Op op);
+
+// Both as a JSON object. Either one can be nullptr to leave it out
+std::string statsJson(const RunStats *run, const LoadTimes *load);
+
+#endif
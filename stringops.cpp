@@ -15,9 +15,14 @@
  *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <charconv>
+#include <cstring>
 #include <string>
 #include <vector>
 #include <algorithm>
+
+#include "lexscan.h"
+
 #ifndef STRINGOPS_CPP
 #define STRINGOPS_CPP
 
@@ -64,6 +69,32 @@ std::string stripends(std::string str, char c) {
 	return str;
 }
 
+// Strips all whitespace(spaces, tabs and the '\r' from windows line endings) from both ends.
+// Unlike stripends this doesn't care what order the whitespace is in
+std::string trim(const std::string &str) {
+	std::size_t start = str.find_first_not_of(" \t\r");
+	if (start == std::string::npos) {
+		return std::string{};
+	}
+	std::size_t end = str.find_last_not_of(" \t\r");
+	return str.substr(start, end - start + 1);
+}
+
+// Splits a whole source file into its lines, without the '\n's
+std::vector<std::string> splitLines(const std::string &source) {
+	std::vector<std::string> lines;
+	std::size_t start = 0;
+	while (start < source.size()) {
+		std::size_t end = source.find('\n', start);
+		if (end == std::string::npos) {
+			end = source.size();
+		}
+		lines.emplace_back(source, start, end - start);
+		start = end + 1;
+	}
+	return lines;
+}
+
 // Returns a pair of the string split by the first instance of char in str 
 // For some weird reason, this is vaguely lisp-like in what it does.
 // Probably because it's like it's using a cons object
@@ -80,38 +111,16 @@ stringPair_t splitOnFirstChar(std::string str, char c) {
 
 // Takes a variable str which looks like an array, and returns a vector 
 // representing that array
+// This used to split the string on every comma, which copied the rest of the string each time
+// and was quadratic in the length of the array. scanIntArray does it in one pass
 std::vector<int> processArrayString(std::string str) {
-	std::vector<int> arr;
-	int approxLen = str.length();
-	approxLen = approxLen / 2;
-	arr.reserve(approxLen);
-	str = strip(str, ' '); // Strip spaces from entire string
-	str = strip(str, '['); str = strip(str, ']'); // Strip brackets
-	stringPair_t tempPair;
-	
-	// Count how many commas there are
-	int numCommas = std::count(str.begin(), str.end(), ',');
-	
-	// Continuously split array in two parts by a comma
-	// numCommas+1 is there to make sure that if 0 commas are found,
-	// then the for loop will still run at least once
-	// Then, it makes sure that for each new comma, the for loop is run once more
-	for (int i=0; i < (numCommas+1); i++) {
-		// Just before exiting loop. Means that the current string 
-		// is just a number and can be interpreted directly
-		if (i == numCommas) { 
-			arr.push_back(stoi(str));
-		} else {
-			// Split string in two parts 
-			tempPair = splitOnFirstChar(str, ',');
-			
-			// Push the first value to the vector...
-			arr.push_back(stoi(tempPair.first));
-			
-			// ... and replace the current string with the second half of the string
-			str = tempPair.second;
-		}
-	}
-	return arr;
+	return scanIntArray(str);
+}
+
+// For numbers given on the command line, where stoll would throw for junk and take "12abc" as 12
+bool parseWholeNumber(const char *text, long long least, long long most, long long &out) {
+	const char *end = text + strlen(text);
+	std::from_chars_result res = std::from_chars(text, end, out);
+	return res.ec == std::errc() && res.ptr == end && out >= least && out <= most;
 }
 #endif
@@ -22,6 +22,10 @@ using stringPair_t = std::pair<std::string,std::string>;
 
 std::string strip(std::string str, char c);
 std::string stripends(std::string str, char c);
+std::string trim(const std::string &str);
+std::vector<std::string> splitLines(const std::string &source);
 
 stringPair_t splitOnFirstChar(std::string str, char c);
 std::vector<int> processArrayString(std::string str);
+// Reads all of text as a whole number from least to most into out. False if it isn't one
+bool parseWholeNumber(const char *text, long long least, long long most, long long &out);
@@ -0,0 +1,21 @@
+ENVDEF
+size=64
+init=[0,10,7,3,56,0,0,40]
+ENDENVDEF
+// Like every other instruction the lengths and values are read from memory,
+// so cell 1 is the length(10), cell 2 is 7, cell 3 is 3 and cell 7 points at 40
+// Fill [20, 30) with 7, then copy it to [40, 50) and add 3 to it
+fill 20 1 2
+bcp 20 *7 1
+badd 40 1 3
+// acc = 10*10 = 100
+bsum 40 1
+cpt 5
+// [40, 50) += [20, 30), so it's all 17 now
+vadd 20 40 1
+cpf 44
+cpt 6
+// Look for the first 17 in [8, 64), which is 40, so acc = 32
+bfind 8 4 6
+out
+end
@@ -0,0 +1,17 @@
+ENVDEF
+size=8
+init=[5,0,0,1]
+ENDENVDEF
+// Outputs 2*n+1 for n = 5 down to 0, using the routines in tests/modules
+MODULE modules/math.asm
+IMPORT double
+EXPORT back
+loop:
+	jmp double
+back:
+	out
+	cpf 0
+	jiz done
+	dec 0
+	jmp loop
+done:
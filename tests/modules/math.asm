@@ -0,0 +1,12 @@
+// acc = 2 * cell 0, then addone adds cell 3 to it and goes back
+MODULE util.asm
+EXPORT double
+IMPORT back
+IMPORT addone
+double:
+	cpf 0
+	add 0
+	jmp addone
+// This "loop" is only in here, so it doesn't clash with the one in modtest.asm
+loop:
+	jmp loop
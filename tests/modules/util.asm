@@ -0,0 +1,5 @@
+EXPORT addone
+IMPORT back
+addone:
+	add 3
+	jmp back
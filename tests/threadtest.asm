@@ -0,0 +1,55 @@
+ENVDEF
+size=2048
+threads=4
+thread_local=1024
+ENDENVDEF
+// Four threads add up 0 to 799. Each one's acc starts at its number(0 to 3), and cells
+// 0 to 1023 are each thread's own: cell 0 is i, cell 1 its sum and cell 2 its number.
+// Cell 1024 is the total and the numbers go in 1100 to 1899, which everyone shares
+cpt 2
+cpt 0
+// First every thread fills in every 4th cell starting at its own number...
+fill:
+cpf 0
+sub #800
+jlz store
+jmp filled
+store:
+cpf 0
+cpt [1100+*0]
+add #4
+cpt 0
+jmp fill
+filled:
+// ...and then waits for the others, since it's going to add up cells they filled in
+barrier
+cpf #0
+cpt 1
+cpf 2
+cpt 0
+sum:
+cpf 0
+sub #800
+jlz next
+jmp summed
+next:
+cpf 1
+add [1100+*0]
+cpt 1
+cpf 0
+add #4
+cpt 0
+jmp sum
+summed:
+// Everyone adds their part to the total at once, so it has to be fadd
+cpf 1
+fadd 1024
+barrier
+// Thread 0 says what it came to, 319600
+cpf 2
+jiz report
+end
+report:
+ldacq 1024
+out
+end
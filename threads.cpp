@@ -0,0 +1,185 @@
+/*
+ *	This file is a part of ConfigurableAssemblyIntepreter.
+ *
+ *	ConfigurableAssemblyIntepreter is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ConfigurableAssemblyIntepreter is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <cstring>
+#include <exception>
+#include <thread>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "threads.h"
+
+#ifndef THREADS_CPP
+#define THREADS_CPP
+
+// With thread_local=, a thread's memory is one mapping: pages of its own for the first cells,
+// with the group's shared pages mapped in right after them. So it's still just one array of
+// cells to everything that uses it
+struct ThreadMapping {
+	void *base{nullptr};
+	size_t bytes{0};
+	~ThreadMapping() {
+		if (base != nullptr) {
+			munmap(base, bytes);
+		}
+	}
+};
+
+static size_t roundToPage(size_t bytes, size_t page) {
+	return (bytes + page - 1) / page * page;
+}
+
+// Gives every thread its own copy of the first config.threadLocal cells of cells, sharing the rest
+static void mapThreadLocal(ThreadGroup &group, const EnvConfig &config, const std::vector<int> &cells) {
+	const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	const size_t pageCells = page / sizeof(int);
+	const size_t local = (size_t)config.threadLocal;
+	if (local > cells.size()) {
+		throw CaiError(CaiErrc::BAD_CONFIG, "thread_local=" + std::to_string(local) +
+			" is more than the memory size " + std::to_string(cells.size()));
+	}
+	if (local % pageCells != 0) {
+		throw CaiError(CaiErrc::BAD_CONFIG, "thread_local=" + std::to_string(local) +
+			" has to be a multiple of " + std::to_string(pageCells) + " cells(a page)");
+	}
+	const size_t localBytes = local * sizeof(int);
+	const size_t sharedBytes = roundToPage((cells.size() - local) * sizeof(int), page);
+	int fd = -1;
+	if (sharedBytes > 0) {
+		fd = memfd_create("cai-threads", MFD_CLOEXEC);
+		if (fd < 0 || ftruncate(fd, (off_t)sharedBytes) != 0) {
+			if (fd >= 0) {
+				close(fd);
+			}
+			throw CaiError(CaiErrc::INTERNAL, "Couldn't make the shared memory for thread_local");
+		}
+	}
+	for (size_t t = 0; t < group.threads.size(); t++) {
+		std::shared_ptr<ThreadMapping> map = std::make_shared<ThreadMapping>();
+		void *base = mmap(nullptr, localBytes + sharedBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (base != MAP_FAILED) {
+			map->base = base;
+			map->bytes = localBytes + sharedBytes;
+			if (sharedBytes > 0 && mmap((char*)base + localBytes, sharedBytes, PROT_READ | PROT_WRITE,
+					MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+				base = MAP_FAILED;
+			}
+		}
+		if (base == MAP_FAILED) {
+			if (fd >= 0) {
+				close(fd);
+			}
+			throw CaiError(CaiErrc::INTERNAL, "Couldn't map the memory for thread_local");
+		}
+		// Everyone gets the initial local cells, but the shared ones only have to be written once
+		int *mem = (int*)map->base;
+		std::memcpy(mem, cells.data(), localBytes);
+		if (t == 0) {
+			std::memcpy(mem + local, cells.data() + local, (cells.size() - local) * sizeof(int));
+		}
+		Memory &memory = group.threads[t].memory;
+		memory.cells = mem;
+		memory.count = cells.size();
+		memory.keep = map;
+	}
+	if (fd >= 0) {
+		close(fd);  // The mappings keep it alive
+	}
+}
+
+std::unique_ptr<ThreadGroup> createThreadGroup(ProgramRef prog) {
+	const EnvConfig &config = prog->config;
+	std::unique_ptr<ThreadGroup> group = std::make_unique<ThreadGroup>();
+	const int count = std::max(1, config.threads);
+	// The memory gets taken out first, so copying first for each thread doesn't copy it
+	Env first = createInstance(prog);
+	std::shared_ptr<std::vector<int>> cells = std::make_shared<std::vector<int>>(first.memory.take());
+	first.group = group.get();
+	group->threads.reserve(count);
+	for (int i = 0; i < count; i++) {
+		group->threads.push_back(first);
+		Env &env = group->threads.back();
+		env.memory.cells = cells->data();
+		env.memory.count = cells->size();
+		env.memory.keep = cells;
+		env.reg = config.reg + i;
+		if (i < (int)config.threadLines.size()) {
+			env.line = config.threadLines[i];
+		}
+		if (i > 0) {
+			env.input.clear();
+		}
+	}
+	if (config.threadLocal > 0) {
+		mapThreadLocal(*group, config, *cells);
+	}
+	return group;
+}
+
+// The last thread to get there(counting threads that stop while the rest are waiting) lets them all go
+static void releaseIfAllThere(ThreadGroup &group) {
+	if (group.waiting > 0 && group.waiting >= group.active) {
+		group.waiting = 0;
+		group.generation++;
+		group.wake.notify_all();
+	}
+}
+
+void waitAtBarrier(Env &env) {
+	ThreadGroup &group = *env.group;
+	std::unique_lock<std::mutex> guard(group.lock);
+	long long generation = group.generation;
+	group.waiting++;
+	releaseIfAllThere(group);
+	group.wake.wait(guard, [&]() { return group.generation != generation; });
+}
+
+void runThreadGroup(ThreadGroup &group) {
+	const int count = (int)group.threads.size();
+	std::vector<std::exception_ptr> errors(count);
+	{
+		std::lock_guard<std::mutex> guard(group.lock);
+		group.active = count;
+		group.waiting = 0;
+	}
+	auto run = [&](int i) {
+		try {
+			runEnvironment(group.threads[i]);
+		} catch (...) {
+			errors[i] = std::current_exception();
+		}
+		std::lock_guard<std::mutex> guard(group.lock);
+		group.active--;
+		releaseIfAllThere(group);
+	};
+	std::vector<std::thread> workers;
+	workers.reserve(count - 1);
+	for (int i = 1; i < count; i++) {
+		workers.emplace_back(run, i);
+	}
+	run(0);
+	for (std::thread &t : workers) {
+		t.join();
+	}
+	for (std::exception_ptr &e : errors) {
+		if (e) {
+			std::rethrow_exception(e);
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,78 @@
+// -*- grammar-ext: .cpp -*-
+/*
+ *	This file is a part of ConfigurableAssemblyIntepreter.
+ *
+ *	ConfigurableAssemblyIntepreter is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ConfigurableAssemblyIntepreter is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "mainLib.h"
+
+#ifndef THREADS_H
+#define THREADS_H
+
+// One program running on several threads that all share one memory. "threads=4" in the ENVDEF
+// makes 4 of them, and "thread_start=[producer,consumer,consumer,consumer]" says which label each
+// one starts at(one label means they all start there, and none means they all start at startline).
+// Each thread is an Env of its own with its own line, acc, steps, limits and output, whose
+// memory points at the same cells as all of the others. Thread i's acc starts at startreg + i,
+// so each one can tell which one it is. The input all goes to thread 0.
+//
+// Since the acc is all a thread has of its own, "thread_local=1024" gives each thread its own
+// copy of cells 0 to 1023(the rest are still shared) to keep its counters and such in. It has to
+// be a whole number of pages, and it's done by mapping the shared pages in after each thread's
+// own, so it needs Linux(memfd_create).
+//
+// The memory model. Plain instructions(cpf, cpt, add, mov, inc, the block instructions...) are
+// ordinary C++ reads and writes of the cells, so if one thread writes a cell with them while
+// another reads or writes it with anything, that's a data race and nothing at all is promised
+// about what either of them sees. The only instructions that are safe on a cell another thread
+// is using at the same time are the atomic ones:
+//   strel a + ldacq a  Everything before the strel is seen by whoever ldacq's what it stored
+//   fadd, cas          Atomic read-modify-writes that are sequentially consistent
+// and the ones that order plain accesses, so they can be used on cells that are handed over:
+//   fence              Orders everything before it before everything after it
+//   barrier            Everything before it in every thread happens before anything after it
+// So a flag gets written with strel(or fadd/cas) and read with ldacq, and the data it guards can
+// be plain. Plain accesses to cells only one thread touches between barriers are fine too.
+// Note that "inc a" isn't atomic, two threads inc'ing the same cell can lose one. Use fadd.
+//
+// barrier waits for every thread that's still running, so a thread that ends(or stops for any
+// other reason) doesn't leave the others stuck. Only runThreadGroup runs programs like this.
+// Anything else(the server, sessions, the result cache) just runs them as thread 0 by itself.
+
+struct ThreadGroup {
+	std::vector<Env> threads;
+	std::mutex lock;  // The rest is for barrier
+	std::condition_variable wake;
+	int waiting{0};
+	int active{0};    // Threads that haven't stopped yet
+	long long generation{0};
+};
+
+// Makes a group with one Env per thread, all sharing the memory of the first one.
+// It's a unique_ptr since the Envs point back at it
+std::unique_ptr<ThreadGroup> createThreadGroup(ProgramRef prog);
+
+// Runs every thread on a std::thread of its own until they've all stopped. If any of them threw,
+// the first error gets rethrown once they're all done
+void runThreadGroup(ThreadGroup &group);
+
+// What "barrier" does when env is one of a group's threads
+void waitAtBarrier(Env &env);
+
+#endif